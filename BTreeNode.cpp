@@ -4,7 +4,9 @@
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
 
+#include <algorithm>
 #include <cstring>
+#include <sstream>
 #include "BTreeNode.h"
 
 using namespace std;
@@ -17,7 +19,9 @@ BTreeNode::BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
                                                                                                      file(file),
                                                                                                      id(block_id),
                                                                                                      key_profile(
-                                                                                                             key_profile) {
+                                                                                                             key_profile),
+                                                                                                     int_keys(false) {
+    this->int_keys = has_int_keys(key_profile);
     if (create) {
         this->block = file.get_new();
         this->id = this->block->get_block_id();
@@ -43,45 +47,29 @@ BlockID BTreeNode::get_block_id(RecordID record_id) const {
     return block_id;
 }
 
-// Get the record and turn it into a Handle.
-Handle BTreeNode::get_handle(RecordID record_id) const {
+// Get the record as an encoded posting list.
+PostingBytes BTreeNode::get_postings(RecordID record_id) const {
     Dbt *dbt = this->block->get(record_id);
-    BlockID handle_block_id = *(BlockID *) dbt->get_data();
-    RecordID handle_record_id = *(RecordID *) ((char *) dbt->get_data() + sizeof(BlockID));
+    PostingBytes postings((const char *) dbt->get_data(), dbt->get_size());
     delete dbt;
-    return Handle(handle_block_id, handle_record_id);
+    return postings;
 }
 
-// Get the record and turn it into a KeyValue.
-KeyValue *BTreeNode::get_key(RecordID record_id) const {
+// Get the record as a normalized key.
+KeyBytes BTreeNode::get_key(RecordID record_id) const {
     Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char *) dbt->get_data();
-    KeyValue *key_value = new KeyValue();
-    Value value;
-    uint offset = 0;
-    for (auto const &data_type: this->key_profile) {
-        value.data_type = data_type;
-        if (data_type == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t *) (bytes + offset);
-            offset += sizeof(int32_t);
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            uint16_t size = *(uint16_t *) (bytes + offset);
-            offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t *) (bytes + offset);
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
-        }
-        key_value->push_back(value);
-    }
+    KeyBytes key((const char *) dbt->get_data(), dbt->get_size());
+    delete dbt;
+    return key;
+}
+
+// Compare the normalized key stored in the record against key without copying it out of the block.
+// Returns negative, zero, or positive as the stored key is less than, equal to, or greater than key.
+int BTreeNode::compare_key(RecordID record_id, const char *key, uint key_size) const {
+    Dbt *dbt = this->block->get(record_id);
+    int cmp = NormalizedKey::compare((const char *) dbt->get_data(), dbt->get_size(), key, key_size);
     delete dbt;
-    return key_value;
+    return cmp;
 }
 
 // Convert block_id into bytes.
@@ -92,58 +80,59 @@ Dbt *BTreeNode::marshal_block_id(BlockID block_id) {
     return dbt;
 }
 
-// Convert handle into bytes.
-Dbt *BTreeNode::marshal_handle(Handle handle) {
-    char *bytes = new char[sizeof(BlockID) + sizeof(RecordID)];
-    Dbt *dbt = new Dbt(bytes, sizeof(BlockID) + sizeof(RecordID));
-    *(BlockID *) bytes = handle.first;
-    *(RecordID *) (bytes + sizeof(BlockID)) = handle.second;
-    return dbt;
+// Add key's int32 value to the end of a KEYS record.
+void BTreeNode::append_int_key(string &keys, const KeyBytes &key) {
+    int32_t n = KeySearch::to_int(key);
+    keys.append((const char *) &n, sizeof(int32_t));
 }
 
-// Convert KeyValue into bytes.
-Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const &data_type: this->key_profile) {
-        Value value = (*key)[col_num];
-
-        if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("index key too big to marshal");
-
-            *(int32_t *) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
+// Slot key's int32 value into the KEYS record at index at (the caller has checked there's room).
+void BTreeNode::insert_int_key(RecordID keys_id, uint at, const KeyBytes &key) {
+    string keys = get_key(keys_id), n;
+    append_int_key(n, key);
+    keys.insert(at * sizeof(int32_t), n);
+    Dbt keys_dbt((void *) keys.data(), (u_int32_t) keys.size());
+    this->block->put(keys_id, keys_dbt);
+}
 
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            u_long size = (uint16_t) value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("index key too big to marshal");
+void BTreeNode::remove_int_key(RecordID keys_id, uint at) {
+    string keys = get_key(keys_id);
+    keys.erase(at * sizeof(int32_t), sizeof(int32_t));
+    Dbt keys_dbt((void *) keys.data(), (u_int32_t) keys.size());
+    this->block->put(keys_id, keys_dbt);
+}
 
-            *(uint16_t *) (bytes + offset) = (uint16_t) size;
-            offset += sizeof(uint16_t);
-            memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
+// Check if a block with this many records holding this much data in total would fit.
+// (SlottedPage uses a 4-byte header for the block and another for each record.)
+bool BTreeNode::fits(uint record_count, uint data_size) {
+    return 4 * (record_count + 1) + data_size <= DbBlock::BLOCK_SZ - 1;
+}
 
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("index key too big to marshal");
+// Pick how many of a full node's entries stay put when it splits (the rest go to the new sibling to the right).
+// Normally that's half. But when the new entry went on the end, we're probably seeing a run of increasing keys
+// (auto-increment ids, timestamps) that will keep going to the right, so leaving half of this node empty would be
+// wasted: keep 90% here, or everything but the new entry if this is the rightmost node on its level.
+u_long BTreeNode::split_point(u_long size, bool appending, bool rightmost) {
+    if (!appending)
+        return size / 2;
+    if (rightmost)
+        return size - 1;
+    return max(size * 9 / 10, size / 2);
+}
 
-            *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
-            offset += sizeof(uint8_t);
+// Decode a normalized key's first component for display.
+string BTreeNode::key_string(const KeyBytes &key) const {
+    KeyValue *key_value = NormalizedKey::decode(key.data(), (uint) key.size(), this->key_profile);
+    stringstream out;
+    if (!key_value->empty())
+        out << (*key_value)[0];
+    delete key_value;
+    return out.str();
+}
 
-        } else {
-            throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
-        }
-    }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+// Wrap a normalized key for storing in the block (no copy is made, so key must outlive the returned Dbt).
+Dbt BTreeNode::marshal_key(const KeyBytes &key) {
+    return Dbt((void *) key.data(), (u_int32_t) key.size());
 }
 
 
@@ -156,14 +145,18 @@ BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const Ke
                                                                                                                    key_profile,
                                                                                                                    false),
                                                                                                          root_id(new_root),
-                                                                                                         height(1) {
+                                                                                                         height(1),
+                                                                                                         free_head(0) {
     save();
 }
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile &key_profile) : BTreeNode(file, stat_id,
                                                                                                  key_profile, false),
                                                                                        root_id(get_block_id(ROOT)),
-                                                                                       height(get_block_id(HEIGHT)) {
+                                                                                       height(get_block_id(HEIGHT)),
+                                                                                       free_head(0) {
+    if (this->block->size() >= FREE)  // (an index from before there was a free chain doesn't have it)
+        this->free_head = get_block_id(FREE);
 }
 
 void BTreeStat::save() {
@@ -184,6 +177,14 @@ void BTreeStat::save() {
     delete[] (char *) dbt->get_data();
     delete dbt;
 
+    dbt = marshal_block_id(this->free_head);
+    if (this->block->size() < FREE)
+        this->block->add(dbt);
+    else
+        this->block->put(FREE, *dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+
     BTreeNode::save();
 }
 
@@ -192,68 +193,142 @@ void BTreeStat::save() {
  * BTreeInterior *
  *****************/
 
+// Interior block layout (prefix compressed, B-link):
+//      record 1:       key prefix shared by every boundary in the node
+//      record 2:       high key: every key under this node is less than it (only meaningful if there is a next node)
+//      record 3:       next interior block to the right on the same level (0 if this is the rightmost)
+//      record 4:       message buffer block (0 if none, which is always the case unless the index is buffered)
+//      record 5:       int_keys only: every boundary as an int32 (truncated ones padded, see KeySearch::to_int)
+//      record 6:       first pointer
+//      record 2i+7:    boundary i, less the shared prefix
+//      record 2i+8:    pointer to the right of boundary i
 BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(
-        file, block_id, key_profile, create), first(0), pointers(), boundaries() {
+        file, block_id, key_profile, create), loaded(create), first(0), pointers(), boundaries(), next(0), high_key(),
+                                                                                                    buffer(0) {
     if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == 1) {
-                // first pointer
-                this->first = get_block_id(i);
-            } else if (i % 2 != 0) {
-                // pointer
-                this->pointers.push_back(get_block_id(i));
-            } else {
-                // key
-                KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
-            }
-            i++;
-        }
-        delete record_id_list;
+        this->next = get_block_id(NEXT);
+        this->high_key = get_key(HIGH_KEY);
+        this->buffer = get_block_id(BUFFER);
+    }
+}
+
+// Unmarshal the whole block into first, pointers, and boundaries (only needed for insert and split).
+void BTreeInterior::load() {
+    if (this->loaded)
+        return;
+    KeyBytes prefix = get_key(PREFIX);
+    this->first = get_block_id(FIRST);
+    RecordID n = this->block->size();
+    for (RecordID i = FIRST + 1; i + 1 <= n; i += 2) {
+        // record i: boundary suffix, record i+1: pointer
+        this->boundaries.push_back(prefix + get_key(i));
+        this->pointers.push_back(get_block_id(i + 1));
     }
+    this->loaded = true;
 }
 
 BTreeInterior::~BTreeInterior() {
-    for (auto key_value: this->boundaries)
-        delete key_value;
-    this->boundaries.clear();
 }
 
-// Get next block down in tree where key must be.
-BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
+// Get next block down in tree where key must be (caller has already checked that key isn't past this node).
+// Only the chosen pointer is unmarshaled.
+BlockID BTreeInterior::find(const KeyBytes &key) const {
+    return get_block_id((RecordID) (2 * upper_bound(key) + FIRST));
+}
+
+// Count the boundaries that are less than or equal to key.
+// Binary search directly on the block for the first boundary greater than key. Once the shared prefix is matched,
+// the rest of key is compared against the stored suffixes. With int_keys, a full key is searched for in the KEYS
+// record instead.
+uint BTreeInterior::upper_bound(const KeyBytes &key) const {
+    if (this->int_keys && key.size() == sizeof(int32_t)) {
+        Dbt *keys = this->block->get(KEYS);
+        uint n = KeySearch::upper_bound((const char *) keys->get_data(), keys->get_size() / sizeof(int32_t),
+                                        KeySearch::to_int(key));
+        delete keys;
+        return n;
+    }
+    RecordID low = 0, high = (RecordID) ((this->block->size() - FIRST) / 2);
+    Dbt *prefix = this->block->get(PREFIX);
+    uint prefix_size = prefix->get_size();
+    int cmp = NormalizedKey::compare(key.data(), (uint) min(key.size(), (size_t) prefix_size),
+                                     (const char *) prefix->get_data(), prefix_size);
+    delete prefix;
+    if (cmp < 0) {
+        high = 0;  // key is below every boundary
+    } else if (cmp > 0) {
+        low = high;  // key is above every boundary
+    } else {
+        const char *suffix = key.data() + prefix_size;
+        uint suffix_size = (uint) key.size() - prefix_size;
+        while (low < high) {
+            RecordID mid = (RecordID) ((low + high) / 2);
+            if (compare_key((RecordID) (2 * mid + FIRST + 1), suffix, suffix_size) > 0)
+                high = mid;
             else
-                down = this->first;
-            break;
+                low = (RecordID) (mid + 1);
         }
     }
-    if (depth == 2)
-        return new BTreeLeaf(this->file, down, this->key_profile, false);
-    else
-        return new BTreeInterior(this->file, down, this->key_profile, false);
+    return low;
 }
 
-// Save the pointers and boundaries in the correct order
+// Check if key belongs to a node to the right of this one (it was split after our parent was read).
+bool BTreeInterior::is_past(const KeyBytes &key) const {
+    return this->next != 0 && NormalizedKey::compare(key, this->high_key) >= 0;
+}
+
+// Get the prefix shared by every boundary
+KeyBytes BTreeInterior::shared_prefix() const {
+    if (this->boundaries.empty())
+        return KeyBytes();
+    const KeyBytes &lowest = this->boundaries.front();
+    const KeyBytes &highest = this->boundaries.back();
+    return lowest.substr(0, NormalizedKey::common_prefix_size(lowest, highest));
+}
+
+// Check if the boundaries and pointers will fit into the block once they are prefix compressed
+bool BTreeInterior::fits() const {
+    uint prefix_size = (uint) shared_prefix().size();
+    uint data_size = prefix_size + (uint) this->high_key.size() + 3 * sizeof(BlockID);
+    for (auto const &boundary: this->boundaries)
+        data_size += (uint) (boundary.size() - prefix_size + sizeof(BlockID) +
+                             (this->int_keys ? sizeof(int32_t) : 0));
+    return BTreeNode::fits((uint) (FIRST + 2 * this->boundaries.size()), data_size);
+}
+
+// Save the prefix, high key, right link, buffer, pointers, and boundaries in the correct order
 void BTreeInterior::save() {
     Dbt *dbt;
+    load();
     this->block->clear();
+    KeyBytes prefix = shared_prefix();
+    Dbt prefix_dbt = marshal_key(prefix);
+    this->block->add(&prefix_dbt);
+    Dbt high_key_dbt = marshal_key(this->high_key);
+    this->block->add(&high_key_dbt);
+    dbt = marshal_block_id(this->next);
+    this->block->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    dbt = marshal_block_id(this->buffer);
+    this->block->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    string keys;
+    if (this->int_keys)
+        for (auto const &boundary: this->boundaries)
+            append_int_key(keys, boundary);
+    Dbt keys_dbt((void *) keys.data(), (u_int32_t) keys.size());
+    this->block->add(&keys_dbt);
     dbt = marshal_block_id(this->first);
     this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
     for (uint i = 0; i < this->boundaries.size(); i++) {
-        // key
-        dbt = marshal_key(this->boundaries[i]);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+        // key, less the prefix
+        const KeyBytes &boundary = this->boundaries[i];
+        Dbt key_dbt((void *) (boundary.data() + prefix.size()), (u_int32_t) (boundary.size() - prefix.size()));
+        this->block->add(&key_dbt);
 
         // boundary
         dbt = marshal_block_id(this->pointers[i]);
@@ -265,17 +340,39 @@ void BTreeInterior::save() {
 }
 
 // Insert boundary, block_id pair into block.
-Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
-    // cout << "inserting (" << block_id << ", " << (*boundary)[0] << ") into interior node " << id; // DEBUG
+// Usually the pair just gets slotted into the block in order, without unmarshaling the rest of the node. Only if
+// that won't work (the boundary doesn't share the node's prefix or there's no room) is the whole node unmarshaled
+// to be rewritten or split.
+Insertion BTreeInterior::insert(const KeyBytes &boundary, BlockID block_id, uint max_size) {
+    // cout << "inserting block " << block_id << " into interior node " << id; // DEBUG
     // cout << " (pointers:" << boundaries.size() << ", unused:" << block->unused_bytes() << ") " << endl; // DEBUG
-
-    Dbt *dbt;
+    if (!this->loaded) {
+        KeyBytes prefix = get_key(PREFIX);
+        uint suffix_size = (uint) (boundary.size() - prefix.size());
+        uint int_key_room = this->int_keys ? sizeof(int32_t) + 4 : 0;  // (put wants room for a header, too)
+        if (boundary.compare(0, prefix.size(), prefix) == 0 &&
+            suffix_size + sizeof(BlockID) + int_key_room + 8 <= this->block->unused_bytes() &&
+            (max_size == 0 || (uint) (this->block->size() - FIRST) / 2 < max_size)) {
+            uint index = upper_bound(boundary);
+            RecordID at = (RecordID) (2 * index + FIRST + 1);
+            Dbt key_dbt((void *) (boundary.data() + prefix.size()), (u_int32_t) suffix_size);
+            this->block->insert(at, &key_dbt);
+            Dbt *dbt = marshal_block_id(block_id);
+            this->block->insert((RecordID) (at + 1), dbt);
+            delete[] (char *) dbt->get_data();
+            delete dbt;
+            if (this->int_keys)
+                insert_int_key(KEYS, index, boundary);
+            BTreeNode::save();
+            return BTreeNode::insertion_none();
+        }
+    }
+    load();
 
     bool inserted = false;
     for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
-            this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
+        if (NormalizedKey::compare(this->boundaries[i], boundary) > 0) {
+            this->boundaries.insert(this->boundaries.begin() + i, boundary);
             this->pointers.insert(this->pointers.begin() + i, block_id);
             inserted = true;
             break;
@@ -283,57 +380,51 @@ Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
     }
     if (!inserted) {
         // must go at the end
-        this->boundaries.push_back(new KeyValue(*boundary));
+        this->boundaries.push_back(boundary);
         this->pointers.push_back(block_id);
     }
-    dbt = marshal_block_id(block_id);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(boundary);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
+    if (fits() && (max_size == 0 || this->boundaries.size() <= max_size)) {
+        // no need to split
         save();
         return BTreeNode::insertion_none();
+    }
 
-    } catch (DbBlockNoRoomError &e) {
-        cout << "splitting " << *this << endl; // DEBUG
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // too big, so split
-
-        // create the sister
-        BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
-
-        // only the pointer of the middle entry goes into the sister (as it's first pointer)
-        // the corresponding boundary is moved up to be inserted into the parent node
-        u_long split = this->boundaries.size() / 2;
-        nnode->first = this->pointers[split];
-        KeyValue *nboundary = this->boundaries[split];
-        Insertion ret(nnode->id, *nboundary);
-        delete nboundary;
+    // too big, so split
+    cout << "splitting " << *this << endl; // DEBUG
 
-        // move half of the entries to the sister
-        for (u_long i = split + 1; i < this->boundaries.size(); i++) {
-            nnode->boundaries.push_back(this->boundaries[i]);
-            nnode->pointers.push_back(this->pointers[i]);
-        }
-        this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
-        this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
-        // cout << "after split " << *this << endl; // DEBUG
-        // cout << "new sibling " << *nnode << endl; // DEBUG
+    // create the sister and link her in to my right, taking over my high key
+    BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
+    nnode->next = this->next;
+    nnode->high_key = this->high_key;
+    this->next = nnode->id;
 
-        // save everything
-        nnode->save();
-        this->save();
-        return ret;
+    // only the pointer of the split entry goes into the sister (as it's first pointer)
+    // the corresponding boundary is moved up to be inserted into the parent node and becomes my high key
+    Boundaries all_boundaries = this->boundaries;
+    BlockPointers all_pointers = this->pointers;
+    u_long split = BTreeNode::split_point(all_boundaries.size(), !inserted, nnode->next == 0);
+    while (true) {
+        nnode->first = all_pointers[split];
+        this->high_key = all_boundaries[split];
+        nnode->boundaries.assign(all_boundaries.begin() + split + 1, all_boundaries.end());
+        nnode->pointers.assign(all_pointers.begin() + split + 1, all_pointers.end());
+        this->boundaries.assign(all_boundaries.begin(), all_boundaries.begin() + split);
+        this->pointers.assign(all_pointers.begin(), all_pointers.begin() + split);
+        if (split == all_boundaries.size() / 2 || (fits() && nnode->fits()))
+            break;
+        // lopsided split didn't fit (my new high key can take more room than what moved out), so move another
+        // pointer over, or go back to the middle if it's my sister that's too full
+        split = nnode->fits() ? split - 1 : all_boundaries.size() / 2;
     }
+    Insertion ret(nnode->id, this->high_key);
+    // cout << "after split " << *this << endl; // DEBUG
+    // cout << "new sibling " << *nnode << endl; // DEBUG
+
+    // save everything, sister first so she is there before anyone can follow my link to her
+    nnode->save();
+    this->save();
+    delete nnode;
+    return ret;
 }
 
 
@@ -343,7 +434,7 @@ ostream &operator<<(ostream &out, const BTreeInterior &node) {
         out << " MISMATCH boundaries: " << node.boundaries.size() << ", pointers: " << node.pointers.size();
     } else {
         for (unsigned int i = 0; i < node.boundaries.size(); i++)
-            out << '|' << (*node.boundaries[i])[0] << '|' << node.pointers[i];
+            out << '|' << node.key_string(node.boundaries[i]) << '|' << node.pointers[i];
     }
     return out;
 }
@@ -353,123 +444,670 @@ ostream &operator<<(ostream &out, const BTreeInterior &node) {
  * BTreeLeaf *
  *************/
 
+// Leaf block layout (prefix compressed, B-link):
+//      record 1:       key prefix shared by every key in the leaf
+//      record 2:       high key: every key in the leaf is less than it (only meaningful if there is a next leaf)
+//      record 3:       next leaf block id (0 if this is the rightmost)
+//      record 4:       int_keys only: every key as an int32
+//      record 2i+5:    posting list (handles) of entry i
+//      record 2i+6:    key of entry i, less the shared prefix
 BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(file,
                                                                                                                block_id,
                                                                                                                key_profile,
                                                                                                                create),
+                                                                                                     loaded(create),
                                                                                                      next_leaf(0),
+                                                                                                     high_key(),
                                                                                                      key_map() {
     if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == record_id_list->size()) {
-                // next leaf block
-                this->next_leaf = get_block_id(i);
-            } else if (i % 2 == 0) {
-                // record i-1: handle, record i: key
-                KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i - 1);
-            }
-            i++;
-        }
-        delete record_id_list;
+        this->next_leaf = get_block_id(NEXT);
+        this->high_key = get_key(HIGH_KEY);
     }
 }
 
 BTreeLeaf::~BTreeLeaf() {
 }
 
-// Find the handle for a given key
-Handle BTreeLeaf::find_eq(const KeyValue *key) const {
-    return this->key_map.at(*key);
+// Unmarshal the whole block into key_map (only needed for insert and split).
+void BTreeLeaf::load() {
+    if (this->loaded)
+        return;
+    KeyBytes prefix = get_key(PREFIX);
+    RecordID n = this->block->size();
+    for (RecordID i = KEYS + 1; i + 1 <= n; i += 2) {
+        // record i: posting list, record i+1: key suffix
+        this->key_map[prefix + get_key(i + 1)] = get_postings(i);
+    }
+    this->loaded = true;
+}
+
+// Find the handles for a given key
+Handles *BTreeLeaf::find_eq(const KeyBytes &key) const {
+    Handles *handles = new Handles();
+    bool found;
+    uint entry = lower_bound(key, &found);
+    if (found)
+        get_entry_handles(entry, *handles);
+    return handles;
+}
+
+// Number of entries in the leaf
+uint BTreeLeaf::size() const {
+    if (this->int_keys) {
+        Dbt *keys = this->block->get(KEYS);
+        uint n = keys->get_size() / sizeof(int32_t);
+        delete keys;
+        return n;
+    }
+    return (uint) (this->block->size() - KEYS) / 2;
+}
+
+// Check if key belongs to a leaf to the right of this one (it was split after our parent was read).
+bool BTreeLeaf::is_past(const KeyBytes &key) const {
+    return this->next_leaf != 0 && NormalizedKey::compare(key, this->high_key) >= 0;
 }
 
-// Save the key_map and next_leaf data in the correct order
+// Check if the key of some entry in this leaf starts with prefix.
+bool BTreeLeaf::has_prefix(const KeyBytes &prefix) const {
+    if (this->loaded) {
+        auto entry = this->key_map.lower_bound(prefix);
+        return entry != this->key_map.end() && entry->first.compare(0, prefix.size(), prefix) == 0;
+    }
+    uint entry = lower_bound(prefix);
+    return entry < size() && get_entry_key(entry).compare(0, prefix.size(), prefix) == 0;
+}
+
+// Check if keys starting with prefix can be past this leaf: the high key starts with it, too (any key that doesn't
+// and is greater than prefix is greater than all of them).
+bool BTreeLeaf::continues(const KeyBytes &prefix) const {
+    return this->next_leaf != 0 && this->high_key.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Find the first entry whose key is not less than key (size() if there isn't one), and whether it is equal to key.
+// Binary search directly on the block: once the shared prefix is matched, the rest of key is compared against the
+// stored suffixes. With int_keys, a full key is searched for in the KEYS record instead.
+uint BTreeLeaf::lower_bound(const KeyBytes &key, bool *found) const {
+    if (found != nullptr)
+        *found = false;
+    if (this->int_keys && key.size() == sizeof(int32_t)) {
+        Dbt *keys = this->block->get(KEYS);
+        const char *data = (const char *) keys->get_data();
+        uint n = keys->get_size() / sizeof(int32_t);
+        int32_t target = KeySearch::to_int(key);
+        uint entry = KeySearch::lower_bound(data, n, target);
+        if (found != nullptr)
+            *found = entry < n && memcmp(data + entry * sizeof(int32_t), &target, sizeof(int32_t)) == 0;
+        delete keys;
+        return entry;
+    }
+    uint n = size();
+    Dbt *prefix = this->block->get(PREFIX);
+    uint prefix_size = prefix->get_size();
+    int cmp = memcmp(key.data(), prefix->get_data(), min((uint) key.size(), prefix_size));
+    delete prefix;
+    if (cmp < 0 || (cmp == 0 && key.size() < prefix_size))
+        return 0;  // key is below every entry
+    if (cmp > 0)
+        return n;  // key is above every entry
+    const char *suffix = key.data() + prefix_size;
+    uint suffix_size = (uint) key.size() - prefix_size;
+    uint low = 0, high = n;
+    while (low < high) {
+        uint mid = (low + high) / 2;
+        cmp = compare_key((RecordID) (2 * mid + KEYS + 2), suffix, suffix_size);
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            if (cmp == 0 && found != nullptr)
+                *found = true;
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Get the full key of an entry (the shared prefix plus its stored suffix)
+KeyBytes BTreeLeaf::get_entry_key(uint entry) const {
+    return get_key(PREFIX) + get_key((RecordID) (2 * entry + KEYS + 2));
+}
+
+// Append the handles of an entry's posting list
+void BTreeLeaf::get_entry_handles(uint entry, Handles &handles) const {
+    PostingList(this->file, this->key_profile, get_postings((RecordID) (2 * entry + KEYS + 1))).get(handles);
+}
+
+// Check if an entry's posting list has overflowed into a chain of blocks
+bool BTreeLeaf::is_chained(uint entry) const {
+    return PostingList::is_chain(get_postings((RecordID) (2 * entry + KEYS + 1)));
+}
+
+// Get the prefix shared by every key in the key_map
+KeyBytes BTreeLeaf::shared_prefix() const {
+    if (this->key_map.empty())
+        return KeyBytes();
+    const KeyBytes &lowest = this->key_map.begin()->first;
+    const KeyBytes &highest = this->key_map.rbegin()->first;  // keys are sorted, so this covers all of them
+    return lowest.substr(0, NormalizedKey::common_prefix_size(lowest, highest));
+}
+
+// Check if the key_map will fit into the block once it is prefix compressed
+bool BTreeLeaf::fits() const {
+    uint prefix_size = (uint) shared_prefix().size();
+    uint data_size = prefix_size + (uint) this->high_key.size() + sizeof(BlockID);
+    for (auto const &item: this->key_map)
+        data_size += (uint) (item.second.size() + item.first.size() - prefix_size +
+                             (this->int_keys ? sizeof(int32_t) : 0));
+    return BTreeNode::fits((uint) (KEYS + 2 * this->key_map.size()), data_size);
+}
+
+// Save the prefix, high key, next_leaf, and key_map data in the correct order
 void BTreeLeaf::save() {
     Dbt *dbt;
+    load();
     this->block->clear();
-    for (auto const &item: this->key_map) {
-        // handle
-        dbt = marshal_handle(item.second);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // key
-        dbt = marshal_key(&item.first);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-    }
-    // next leaf pointer is final record
+    KeyBytes prefix = shared_prefix();
+    Dbt prefix_dbt = marshal_key(prefix);
+    this->block->add(&prefix_dbt);
+    Dbt high_key_dbt = marshal_key(this->high_key);
+    this->block->add(&high_key_dbt);
     dbt = marshal_block_id(this->next_leaf);
     this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
+    string keys;
+    if (this->int_keys)
+        for (auto const &item: this->key_map)
+            append_int_key(keys, item.first);
+    Dbt keys_dbt((void *) keys.data(), (u_int32_t) keys.size());
+    this->block->add(&keys_dbt);
+    for (auto const &item: this->key_map) {
+        // posting list
+        Dbt postings_dbt((void *) item.second.data(), (u_int32_t) item.second.size());
+        this->block->add(&postings_dbt);
 
+        // key, less the prefix
+        Dbt key_dbt((void *) (item.first.data() + prefix.size()), (u_int32_t) (item.first.size() - prefix.size()));
+        this->block->add(&key_dbt);
+    }
     BTreeNode::save();
 }
 
-// Insert key, handle pair into block.
-Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
-    // cout << "inserting " << (*key)[0] << " into leaf " << id << endl; // DEBUG
-    // check unique
-    if (this->key_map.find(*key) != this->key_map.end())
+// Insert key, handle pair into block. A key that is already there just gets handle added to its posting list
+// (unless the index is unique: then no key there may start with unique_key).
+// Usually this is done right in the block: a new key's two records are slotted in at its place in order, or just
+// the one posting list record is replaced. Only if that won't work (the key doesn't share the leaf's prefix or
+// there's no room) is the whole leaf unmarshaled to be rewritten or split.
+Insertion BTreeLeaf::insert(const KeyBytes &key, Handle handle, const KeyBytes *unique_key,
+                            OverflowBlocks &overflow_blocks) {
+    // cout << "inserting into leaf " << id << endl; // DEBUG
+    if (unique_key != nullptr && has_prefix(*unique_key))
         throw DbRelationError("Duplicate keys are not allowed in unique index");
+    PostingBytes postings;
+    if (!this->loaded) {
+        bool found;
+        uint entry = lower_bound(key, &found);
+        RecordID postings_id = (RecordID) (2 * entry + KEYS + 1);
+        if (found) {
+            PostingBytes old_postings = get_postings(postings_id);
+            PostingList list(this->file, this->key_profile, old_postings);
+            // this may have changed the overflow chain already, so we have to use postings now
+            list.insert(handle, overflow_blocks);
+            postings = list.get_bytes();
+            if (postings.size() <= old_postings.size() ||
+                postings.size() + 4 <= old_postings.size() + this->block->unused_bytes()) {  // (put wants 4 to spare)
+                Dbt postings_dbt((void *) postings.data(), (u_int32_t) postings.size());
+                this->block->put(postings_id, postings_dbt);
+                BTreeNode::save();
+                return BTreeNode::insertion_none();
+            }
+        } else {
+            postings = PostingList(this->file, this->key_profile, handle).get_bytes();
+            KeyBytes prefix = get_key(PREFIX);
+            uint suffix_size = (uint) (key.size() - prefix.size());
+            uint int_key_room = this->int_keys ? sizeof(int32_t) + 4 : 0;  // (put wants room for a header, too)
+            if (key.compare(0, prefix.size(), prefix) == 0 &&
+                postings.size() + suffix_size + int_key_room + 8 <= this->block->unused_bytes()) {
+                Dbt postings_dbt((void *) postings.data(), (u_int32_t) postings.size());
+                this->block->insert(postings_id, &postings_dbt);
+                Dbt key_dbt((void *) (key.data() + prefix.size()), (u_int32_t) suffix_size);
+                this->block->insert((RecordID) (postings_id + 1), &key_dbt);
+                if (this->int_keys)
+                    insert_int_key(KEYS, entry, key);
+                BTreeNode::save();
+                return BTreeNode::insertion_none();
+            }
+        }
+    }
+    load();
 
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
-        this->key_map[*key] = handle;
+    auto entry = this->key_map.find(key);
+    if (!postings.empty()) {
+        this->key_map[key] = postings;  // worked out above
+    } else if (entry == this->key_map.end()) {
+        this->key_map[key] = PostingList(this->file, this->key_profile, handle).get_bytes();
+    } else {
+        PostingList list(this->file, this->key_profile, entry->second);
+        list.insert(handle, overflow_blocks);
+        entry->second = list.get_bytes();
+    }
+    if (fits()) {
+        // no need to split
         save();
         return BTreeNode::insertion_none();
+    }
 
-    } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // too big, so split
+    // too big, so split
 
-        // create the sister and put her to the right
-        BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
-        nleaf->next_leaf = this->next_leaf;
-        this->next_leaf = nleaf->id;
+    // create the sister and put her to the right, taking over my high key
+    BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
+    nleaf->next_leaf = this->next_leaf;
+    nleaf->high_key = this->high_key;
+    this->next_leaf = nleaf->id;
 
-        // move half of the entries to the sister
-        auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
-        u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
-        this->key_map.clear();               // empty my list
+    // move some of the entries to the sister
+    auto key_list = this->key_map;       // make a copy of my key_map
+    bool appending = key == key_list.rbegin()->first;
+    u_long split = BTreeNode::split_point(key_list.size(), appending, nleaf->next_leaf == 0);  // how many to keep
+    KeyBytes boundary;
+    while (true) {
+        this->key_map.clear();           // empty my list
+        nleaf->key_map.clear();
         u_long i = 0;
-        KeyValue boundary;
         for (auto const &item: key_list) {
             if (i < split) {
                 this->key_map[item.first] = item.second;
-            } else if (i == split) {
-                boundary = item.first;
-                nleaf->key_map[boundary] = item.second;
             } else {
+                if (i == split)  // only push up as much of the first key as it takes to tell it from my last one
+                    boundary = NormalizedKey::shortest_separator(this->key_map.rbegin()->first, item.first);
                 nleaf->key_map[item.first] = item.second;
             }
             i++;
         }
-        cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
-        cout << " starting at value " << boundary[0] << endl; // DEBUG
+        this->high_key = boundary;
+        if (split == key_list.size() / 2 || (fits() && nleaf->fits()))
+            break;
+        // lopsided split didn't fit (my new high key can take more room than what moved out), so move another
+        // entry over, or go back to the middle if it's my sister that's too full
+        split = nleaf->fits() ? split - 1 : key_list.size() / 2;
+    }
+    cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
+    cout << " starting at value " << key_string(boundary) << endl; // DEBUG
+
+    // sister first so she is there before anyone can follow my link to her
+    nleaf->save();
+    this->save();
+    BlockID nleaf_id = nleaf->id;
+    delete nleaf;
+    return Insertion(nleaf_id, boundary);
+}
+
+// Remove handle from key's posting list, and the key too if that was its last handle. Like insert, this is done
+// right in the block: either the posting list record is replaced or the entry's two records are removed. (The list
+// can only grow by moving back inline, which it only does if the block has room.)
+// Leaves are allowed to underflow (even to empty), they are never merged.
+void BTreeLeaf::del(const KeyBytes &key, Handle handle, OverflowBlocks &overflow_blocks) {
+    bool found;
+    uint entry = lower_bound(key, &found);
+    if (!found)
+        throw DbRelationError("key to delete is not in index");
+    RecordID postings_id = (RecordID) (2 * entry + KEYS + 1);
+    PostingBytes old_postings = get_postings(postings_id);
+    PostingList postings(this->file, this->key_profile, old_postings);
+    uint room = (uint) old_postings.size() + this->block->unused_bytes();
+    if (!postings.del(handle, overflow_blocks, room < 4 ? 0 : room - 4))  // (put wants 4 to spare)
+        throw DbRelationError("row to delete is not in index");
+    if (postings.empty()) {
+        this->block->remove((RecordID) (postings_id + 1));
+        this->block->remove(postings_id);
+        if (this->int_keys)
+            remove_int_key(KEYS, entry);
+    } else {
+        Dbt postings_dbt((void *) postings.get_bytes().data(), (u_int32_t) postings.get_bytes().size());
+        this->block->put(postings_id, postings_dbt);
+    }
+    BTreeNode::save();
+}
+
+
+/*****************
+ * BTreeOverflow *
+ *****************/
+
+// Overflow block layout:
+//      record 1:       next overflow block id in the chain (0 at the end)
+//      record 2:       chunk of the posting list
+BTreeOverflow::BTreeOverflow(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create)
+        : BTreeNode(file, block_id, key_profile, create), next(0), chunk() {
+    if (!create) {
+        this->next = get_block_id(NEXT);
+        this->chunk = get_postings(CHUNK);
+    }
+}
+
+void BTreeOverflow::save() {
+    this->block->clear();
+    Dbt *dbt = marshal_block_id(this->next);
+    this->block->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    Dbt chunk_dbt((void *) this->chunk.data(), (u_int32_t) this->chunk.size());
+    this->block->add(&chunk_dbt);
+    BTreeNode::save();
+}
+
+
+/***************
+ * BTreeBuffer *
+ ***************/
+
+// Buffer block layout, one record per message, oldest first:
+//      op (1 byte), handle's block id, handle's record id, entry key
+// The messages are only unmarshaled if someone asks for all of them, since most of the time one is just being added.
+BTreeBuffer::BTreeBuffer(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create)
+        : BTreeNode(file, block_id, key_profile, create), loaded(create), messages() {
+}
+
+void BTreeBuffer::load() {
+    if (this->loaded)
+        return;
+    RecordID n = this->block->size();
+    for (RecordID i = 1; i <= n; i++)
+        this->messages.push_back(get_message(i));
+    this->loaded = true;
+}
+
+BTreeBuffer::Message BTreeBuffer::get_message(RecordID record_id) const {
+    Dbt *dbt = this->block->get(record_id);
+    const char *bytes = (const char *) dbt->get_data();
+    Message message;
+    message.op = (Op) bytes[0];
+    memcpy(&message.handle.first, bytes + 1, sizeof(BlockID));
+    memcpy(&message.handle.second, bytes + 1 + sizeof(BlockID), sizeof(RecordID));
+    message.key.assign(bytes + HEADER_SZ, dbt->get_size() - HEADER_SZ);
+    delete dbt;
+    return message;
+}
+
+// Compare key against each message's key right in the block.
+void BTreeBuffer::find(const KeyBytes &key, Messages &found) const {
+    RecordID n = this->block->size();
+    for (RecordID i = 1; i <= n; i++) {
+        Dbt *dbt = this->block->get(i);
+        bool match = dbt->get_size() - HEADER_SZ == key.size() &&
+                     memcmp((const char *) dbt->get_data() + HEADER_SZ, key.data(), key.size()) == 0;
+        delete dbt;
+        if (match)
+            found.push_back(get_message(i));
+    }
+}
+
+// Convert a message into a record.
+static string marshal_message(const BTreeBuffer::Message &message) {
+    string bytes(BTreeBuffer::HEADER_SZ, '\0');
+    bytes[0] = (char) message.op;
+    memcpy(&bytes[1], &message.handle.first, sizeof(BlockID));
+    memcpy(&bytes[1 + sizeof(BlockID)], &message.handle.second, sizeof(RecordID));
+    return bytes + message.key;
+}
+
+// Append a message to the block, unless it's full.
+bool BTreeBuffer::add(const Message &message) {
+    string bytes = marshal_message(message);
+    if (bytes.size() + 4 > this->block->unused_bytes())
+        return false;
+    Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+    this->block->add(&dbt);
+    if (this->loaded)
+        this->messages.push_back(message);
+    return true;
+}
+
+// Rewrite the block with just these messages.
+void BTreeBuffer::set_messages(const Messages &messages) {
+    this->messages = messages;
+    this->loaded = true;
+    this->block->clear();
+    for (auto const &message: messages) {
+        string bytes = marshal_message(message);
+        Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+        this->block->add(&dbt);
+    }
+}
+
+
+/***************
+ * PostingList *
+ ***************/
+
+// Append n to out as a varint (7 bits per byte, low bits first, high bit set on all but the last byte).
+static void put_varint(string &out, uint64_t n) {
+    while (n >= 0x80) {
+        out.push_back((char) (n | 0x80));
+        n >>= 7;
+    }
+    out.push_back((char) n);
+}
+
+// Read a varint starting at p and move p past it.
+static uint64_t get_varint(const char *&p, const char *end) {
+    uint64_t n = 0;
+    for (uint shift = 0; p < end; shift += 7) {
+        unsigned char byte = (unsigned char) *p++;
+        n |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return n;
+}
+
+PostingList::PostingList(HeapFile &file, const KeyProfile &key_profile, const PostingBytes &bytes) : file(file),
+        key_profile(key_profile), bytes(bytes), count(0), codes(), overflow(false), last(0), head(0), tail(0) {
+    const char *p = bytes.data(), *end = bytes.data() + bytes.size();
+    if (p == end)
+        return;
+    this->count = get_varint(p, end);
+    if (this->count > 0) {
+        uint64_t code = 0;
+        while (p < end) {
+            code += get_varint(p, end);
+            this->codes.push_back(code);
+        }
+    } else {
+        this->overflow = true;
+        this->count = get_varint(p, end);
+        this->last = get_varint(p, end);
+        memcpy(&this->head, p, sizeof(BlockID));
+        memcpy(&this->tail, p + sizeof(BlockID), sizeof(BlockID));
+    }
+}
 
-        nleaf->save();
-        this->save();
-        return Insertion(nleaf->id, boundary);
+PostingList::PostingList(HeapFile &file, const KeyProfile &key_profile, Handle handle) : file(file),
+        key_profile(key_profile), bytes(), count(1), codes(), overflow(false), last(0), head(0), tail(0) {
+    this->codes.push_back(code(handle));
+    encode();
+}
+
+// A list of codes as it's kept inline in the leaf.
+PostingBytes PostingList::encode_inline(const HandleCodes &codes) {
+    PostingBytes bytes;
+    put_varint(bytes, codes.size());
+    uint64_t prev = 0;
+    for (auto const &code: codes) {
+        put_varint(bytes, code - prev);
+        prev = code;
     }
+    return bytes;
 }
 
+// Re-encode the leaf's copy of the list.
+void PostingList::encode() {
+    this->bytes.clear();
+    if (this->count == 0)
+        return;
+    if (!this->overflow) {
+        this->bytes = encode_inline(this->codes);
+    } else {
+        put_varint(this->bytes, 0);
+        put_varint(this->bytes, this->count);
+        put_varint(this->bytes, this->last);
+        this->bytes.append((const char *) &this->head, sizeof(BlockID));
+        this->bytes.append((const char *) &this->tail, sizeof(BlockID));
+    }
+}
+
+// Read every handle in the overflow chain, and the blocks it is stored in.
+void PostingList::read_chain(HandleCodes &all, BlockPointers &blocks) const {
+    for (BlockID block_id = this->head; block_id != 0;) {
+        BTreeOverflow node(this->file, block_id, this->key_profile, false);
+        const string &chunk = node.get_chunk();
+        const char *p = chunk.data(), *end = chunk.data() + chunk.size();
+        uint64_t code = 0;
+        while (p < end) {
+            code += get_varint(p, end);
+            all.push_back(code);
+        }
+        blocks.push_back(block_id);
+        block_id = node.get_next();
+    }
+}
+
+// Rewrite the overflow chain to hold all, reusing its blocks before taking others. Any blocks left over are given
+// back.
+void PostingList::write_chain(const HandleCodes &all, const BlockPointers &blocks, OverflowBlocks &overflow_blocks) {
+    vector<string> chunks(1);
+    uint64_t prev = 0;
+    for (auto const &code: all) {
+        string piece;
+        put_varint(piece, code - prev);
+        if (chunks.back().size() + piece.size() > BTreeOverflow::CHUNK_MAX) {
+            piece.clear();
+            put_varint(piece, code);  // each chunk starts over from zero
+            chunks.push_back(string());
+        }
+        chunks.back() += piece;
+        prev = code;
+    }
+    vector<BTreeOverflow *> nodes;
+    for (uint i = 0; i < chunks.size(); i++) {
+        if (i < blocks.size())
+            nodes.push_back(new BTreeOverflow(this->file, blocks[i], this->key_profile, false));
+        else
+            nodes.push_back(overflow_blocks.take_overflow());
+        nodes.back()->set_chunk(chunks[i]);
+    }
+    for (uint i = 0; i < nodes.size(); i++) {
+        nodes[i]->set_next(i + 1 < nodes.size() ? nodes[i + 1]->get_id() : 0);
+        nodes[i]->save();
+    }
+    for (size_t i = nodes.size(); i < blocks.size(); i++)
+        overflow_blocks.give_overflow(blocks[i]);
+    this->overflow = true;
+    this->count = all.size();
+    this->last = all.back();
+    this->head = nodes.front()->get_id();
+    this->tail = nodes.back()->get_id();
+    this->codes.clear();
+    for (auto const &node: nodes)
+        delete node;
+}
+
+// Add a handle past the end of the overflow chain, only touching the tail block.
+void PostingList::append_to_chain(uint64_t handle_code, OverflowBlocks &overflow_blocks) {
+    BTreeOverflow tail_node(this->file, this->tail, this->key_profile, false);
+    string piece;
+    put_varint(piece, handle_code - this->last);
+    if (tail_node.get_chunk().size() + piece.size() <= BTreeOverflow::CHUNK_MAX) {
+        tail_node.set_chunk(tail_node.get_chunk() + piece);
+        tail_node.save();
+    } else {
+        BTreeOverflow *new_tail = overflow_blocks.take_overflow();
+        piece.clear();
+        put_varint(piece, handle_code);
+        new_tail->set_chunk(piece);
+        new_tail->save();
+        tail_node.set_next(new_tail->get_id());
+        tail_node.save();
+        this->tail = new_tail->get_id();
+        delete new_tail;
+    }
+    this->last = handle_code;
+    this->count++;
+}
+
+// Replace an inline list with all, keeping it inline if it is small enough.
+void PostingList::set_codes(const HandleCodes &all, OverflowBlocks &overflow_blocks) {
+    this->count = all.size();
+    this->codes = all;
+    encode();
+    if (this->bytes.size() > INLINE_MAX)
+        write_chain(all, BlockPointers(), overflow_blocks);
+    encode();
+}
+
+void PostingList::get(Handles &handles) const {
+    if (!this->overflow) {
+        for (auto const &code: this->codes)
+            handles.push_back(handle(code));
+    } else {
+        HandleCodes all;
+        BlockPointers blocks;
+        read_chain(all, blocks);
+        for (auto const &code: all)
+            handles.push_back(handle(code));
+    }
+}
+
+void PostingList::insert(Handle handle, OverflowBlocks &overflow_blocks) {
+    uint64_t handle_code = code(handle);
+    if (!this->overflow) {
+        HandleCodes all = this->codes;
+        auto pos = lower_bound(all.begin(), all.end(), handle_code);
+        if (pos != all.end() && *pos == handle_code)
+            return;
+        all.insert(pos, handle_code);
+        set_codes(all, overflow_blocks);
+    } else if (handle_code > this->last) {
+        append_to_chain(handle_code, overflow_blocks);
+        encode();
+    } else {
+        HandleCodes all;
+        BlockPointers blocks;
+        read_chain(all, blocks);
+        auto pos = lower_bound(all.begin(), all.end(), handle_code);
+        if (pos != all.end() && *pos == handle_code)
+            return;
+        all.insert(pos, handle_code);
+        write_chain(all, blocks, overflow_blocks);
+        encode();
+    }
+}
+
+bool PostingList::del(Handle handle, OverflowBlocks &overflow_blocks, uint room) {
+    uint64_t handle_code = code(handle);
+    HandleCodes all;
+    BlockPointers blocks;
+    if (!this->overflow)
+        all = this->codes;
+    else
+        read_chain(all, blocks);
+    auto pos = lower_bound(all.begin(), all.end(), handle_code);
+    if (pos == all.end() || *pos != handle_code)
+        return false;
+    all.erase(pos);
+    if (!this->overflow) {
+        set_codes(all, overflow_blocks);
+        return true;
+    }
+    // back inline once the list is well under the limit, if the leaf has room for it (otherwise keep the chain)
+    if (all.empty() || (all.size() * sizeof(uint64_t) <= INLINE_MAX / 2 && encode_inline(all).size() <= room)) {
+        for (auto const &block_id: blocks)
+            overflow_blocks.give_overflow(block_id);
+        this->overflow = false;
+        this->count = all.size();
+        this->codes = all;
+    } else {
+        write_chain(all, blocks, overflow_blocks);
+    }
+    encode();
+    return true;
+}
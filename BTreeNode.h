@@ -1,5 +1,6 @@
 /**
- * @file BTreeNode.h - BTreeNode class and its subclasses: BTreeStat, BTreeInterior, BTreeLeaf
+ * @file BTreeNode.h - BTreeNode class and its subclasses: BTreeStat, BTreeInterior, BTreeLeaf, BTreeOverflow,
+ *                      BTreeBuffer and the PostingList kept with each key in a leaf
  *
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2022"
@@ -8,12 +9,13 @@
 
 #include "storage_engine.h"
 #include "heap_storage.h"
+#include "NormalizedKey.h"
+#include "KeySearch.h"
 
-typedef std::vector<ColumnAttribute::DataType> KeyProfile;
-typedef std::vector<Value> KeyValue;
-typedef std::vector<KeyValue *> KeyValues;
+typedef std::vector<KeyBytes> Boundaries;  // boundary keys are kept in their normalized form
 typedef std::vector<BlockID> BlockPointers;
-typedef std::pair<BlockID, KeyValue> Insertion;
+typedef std::pair<BlockID, KeyBytes> Insertion;
+typedef std::string PostingBytes;  // a leaf entry's handles, encoded as described in PostingList
 
 class BTreeNode {
 public:
@@ -23,35 +25,95 @@ public:
 
     static bool insertion_is_none(Insertion insertion) { return insertion.first == 0; }
 
-    static Insertion insertion_none() { return Insertion(0, KeyValue()); }
+    static Insertion insertion_none() { return Insertion(0, KeyBytes()); }
+
+    /**
+     * Interior and leaf nodes of an index whose key is a single INT also keep all their keys in one record, as a
+     * contiguous int32 array, and search that with KeySearch instead of comparing the normalized keys one by one.
+     */
+    static bool has_int_keys(const KeyProfile &key_profile) {
+        return key_profile.size() == 1 && key_profile[0] == ColumnAttribute::INT;
+    }
 
     virtual void save();
 
     BlockID get_id() const { return this->id; }
 
+    uint get_unused_bytes() const { return this->block->unused_bytes(); }
+
+    /**
+     * Right link to the next node on the same level (0 if there isn't one or the node type doesn't have them).
+     */
+    virtual BlockID get_next() const { return 0; }
+
+    /**
+     * Check if key has moved to a node to the right of this one by a split that happened since the pointer to
+     * this node was read. If so, the search has to follow get_next() (the B-link "move right").
+     */
+    virtual bool is_past(const KeyBytes &key) const { return false; }
+
 protected:
     SlottedPage *block;
     HeapFile &file;
     BlockID id;
     const KeyProfile &key_profile;
+    bool int_keys;  // see has_int_keys
 
     static Dbt *marshal_block_id(BlockID block_id);
 
-    static Dbt *marshal_handle(Handle handle);
+    static void append_int_key(std::string &keys, const KeyBytes &key);
+
+    void insert_int_key(RecordID keys_id, uint at, const KeyBytes &key);
+
+    void remove_int_key(RecordID keys_id, uint at);
 
-    virtual Dbt *marshal_key(const KeyValue *key);
+    static Dbt marshal_key(const KeyBytes &key);
+
+    static bool fits(uint record_count, uint data_size);
+
+    static u_long split_point(u_long size, bool appending, bool rightmost);
 
     virtual BlockID get_block_id(RecordID record_id) const;
 
-    virtual Handle get_handle(RecordID record_id) const;
+    virtual PostingBytes get_postings(RecordID record_id) const;
+
+    virtual KeyBytes get_key(RecordID record_id) const;
+
+    virtual int compare_key(RecordID record_id, const char *key, uint key_size) const;
+
+    int compare_key(RecordID record_id, const KeyBytes &key) const {
+        return compare_key(record_id, key.data(), (uint) key.size());
+    }
+
+    std::string key_string(const KeyBytes &key) const;
+};
+
+class BTreeOverflow;
+
+/**
+ * @class OverflowBlocks - where posting lists get the blocks for their overflow chains, and give back the ones they
+ * no longer need, to be used again
+ */
+class OverflowBlocks {
+public:
+    virtual ~OverflowBlocks() {}
 
-    virtual KeyValue *get_key(RecordID record_id) const;
+    /**
+     * An empty block for a chain: one given back earlier, if there is one, or else a new one (freed by caller).
+     */
+    virtual BTreeOverflow *take_overflow() = 0;
+
+    /**
+     * Give back a block that isn't in any chain now.
+     */
+    virtual void give_overflow(BlockID block_id) = 0;
 };
 
 class BTreeStat : public BTreeNode {
 public:
     static const RecordID ROOT = 1;  // where we store the root id in the stat block
     static const RecordID HEIGHT = ROOT + 1;  // where we store the height in the stat block
+    static const RecordID FREE = HEIGHT + 1;  // where we store the first free overflow block (0 for none)
 
     BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile &key_profile);
 
@@ -69,47 +131,291 @@ public:
 
     void set_height(uint height) { this->height = height; }
 
+    BlockID get_free_head() const { return this->free_head; }
+
+    void set_free_head(BlockID free_head) { this->free_head = free_head; }
+
 protected:
     BlockID root_id;
     uint height;
+    BlockID free_head;
 
 };
 
 class BTreeInterior : public BTreeNode {
 public:
+    static const RecordID PREFIX = 1;  // where we store the key prefix shared by all the boundaries
+    static const RecordID HIGH_KEY = PREFIX + 1;  // where we store the upper bound of the keys under this node
+    static const RecordID NEXT = HIGH_KEY + 1;  // where we store the right link
+    static const RecordID BUFFER = NEXT + 1;  // where we store the message buffer's block id
+    static const RecordID KEYS = BUFFER + 1;  // where we store the int32 boundaries (empty unless int_keys)
+    static const RecordID FIRST = KEYS + 1;  // where we store the first pointer
+
     BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
     virtual ~BTreeInterior();
 
-    BTreeNode *find(const KeyValue *key, uint depth) const;
+    BlockID find(const KeyBytes &key) const;
+
+    virtual BlockID get_next() const { return this->next; }
+
+    virtual bool is_past(const KeyBytes &key) const;
 
-    Insertion insert(const KeyValue *boundary, BlockID block_id);
+    /**
+     * Add a pointer, splitting the node if it doesn't fit.
+     * @param max_size  split once there are more than this many boundaries, even if they'd fit (0 for no limit)
+     */
+    Insertion insert(const KeyBytes &boundary, BlockID block_id, uint max_size = 0);
 
     virtual void save();
 
     void set_first(BlockID first) { this->first = first; }
 
+    BlockID get_buffer() const { return this->buffer; }
+
+    void set_buffer(BlockID buffer) { this->buffer = buffer; }
+
     friend std::ostream &operator<<(std::ostream &out, const BTreeInterior &node);
 
 protected:
+    bool loaded;  // true once first, pointers and boundaries have been unmarshaled from the block
     BlockID first;
     BlockPointers pointers;
-    KeyValues boundaries;
+    Boundaries boundaries;
+    BlockID next;
+    KeyBytes high_key;
+    BlockID buffer;
+
+    void load();
+
+    uint upper_bound(const KeyBytes &key) const;
+
+    KeyBytes shared_prefix() const;
+
+    bool fits() const;
 };
 
 class BTreeLeaf : public BTreeNode {
 public:
+    static const RecordID PREFIX = 1;  // where we store the key prefix shared by the whole leaf
+    static const RecordID HIGH_KEY = PREFIX + 1;  // where we store the upper bound of the keys in this leaf
+    static const RecordID NEXT = HIGH_KEY + 1;  // where we store the next leaf's block id
+    static const RecordID KEYS = NEXT + 1;  // where we store the int32 keys (empty unless int_keys)
+
     BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
     virtual ~BTreeLeaf();
 
-    Handle find_eq(const KeyValue *key) const;  // throws if not found
-    Insertion insert(const KeyValue *key, Handle handle);
+    Handles *find_eq(const KeyBytes &key) const;  // (freed by caller) empty if key isn't in the leaf
+    // unique_key, if not null, is the part of key no other entry may start with (all of it unless there are INCLUDE
+    // columns)
+    Insertion insert(const KeyBytes &key, Handle handle, const KeyBytes *unique_key, OverflowBlocks &overflow_blocks);
+
+    void del(const KeyBytes &key, Handle handle, OverflowBlocks &overflow_blocks);
+
+    // for scanning the entries in order, straight from the block
+    uint size() const;
+
+    uint lower_bound(const KeyBytes &key, bool *found = nullptr) const;  // first entry not less than key
+
+    KeyBytes get_entry_key(uint entry) const;
+
+    void get_entry_handles(uint entry, Handles &handles) const;
+
+    bool is_chained(uint entry) const;  // the entry's posting list is in overflow blocks, not the leaf
+
+    BlockID get_next_leaf() const { return this->next_leaf; }
+
+    virtual BlockID get_next() const { return this->next_leaf; }
+
+    virtual bool is_past(const KeyBytes &key) const;
+
+    bool has_prefix(const KeyBytes &prefix) const;  // some entry's key starts with prefix
+
+    bool continues(const KeyBytes &prefix) const;  // keys starting with prefix may be in the next leaf, too
 
     virtual void save();
 
 protected:
+    bool loaded;  // true once key_map has been unmarshaled from the block
     BlockID next_leaf;
-    std::map<KeyValue, Handle> key_map;
+    KeyBytes high_key;
+    std::map<KeyBytes, PostingBytes> key_map;
+
+    void load();
+
+    KeyBytes shared_prefix() const;
+
+    bool fits() const;
+};
+
+class BTreeOverflow : public BTreeNode {
+public:
+    static const RecordID NEXT = 1;  // where we store the next block in the chain (0 at the end)
+    static const RecordID CHUNK = NEXT + 1;  // where we store this block's part of the posting list
+    static const uint CHUNK_MAX = DbBlock::BLOCK_SZ - 1 - 4 * 3 - sizeof(BlockID);
+
+    BTreeOverflow(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
+
+    virtual ~BTreeOverflow() {}
+
+    virtual void save();
+
+    virtual BlockID get_next() const { return this->next; }
+
+    void set_next(BlockID next) { this->next = next; }
+
+    const std::string &get_chunk() const { return this->chunk; }
+
+    void set_chunk(const std::string &chunk) { this->chunk = chunk; }
+
+protected:
+    BlockID next;
+    std::string chunk;
+};
+
+/**
+ * @class BTreeBuffer - the messages waiting under an interior node of a buffered (B-epsilon) index
+ *
+ * Inserts and deletes are queued here instead of going straight to a leaf. When the block fills up, the messages
+ * for the busiest child are moved down a level in one batch (see BTreeIndex).
+ */
+class BTreeBuffer : public BTreeNode {
+public:
+    enum Op {
+        INSERT = 1, DELETE = 2
+    };
+
+    struct Message {
+        Op op;
+        Handle handle;
+        KeyBytes key;  // entry key, as stored in the leaves
+    };
+    typedef std::vector<Message> Messages;
+
+    static const uint HEADER_SZ = 1 + sizeof(BlockID) + sizeof(RecordID);  // bytes in front of each message's key
+
+    BTreeBuffer(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
+
+    virtual ~BTreeBuffer() {}
+
+    const Messages &get_messages() {
+        load();
+        return this->messages;
+    }
+
+    /**
+     * Append the messages for key, oldest first, to found (without unmarshaling the rest).
+     */
+    void find(const KeyBytes &key, Messages &found) const;
+
+    /**
+     * Append a message (the caller still has to save).
+     * @returns  false, without adding it, if the block is full
+     */
+    bool add(const Message &message);
+
+    /**
+     * Replace all the messages (the caller still has to save).
+     */
+    void set_messages(const Messages &messages);
+
+protected:
+    bool loaded;  // true once messages has been unmarshaled from the block
+    Messages messages;
+
+    void load();
+
+    Message get_message(RecordID record_id) const;
+};
+
+/**
+ * @class PostingList - the sorted list of handles kept with one key in a BTreeLeaf
+ *
+ * Handles are ordered by (block, record) and each is stored as a varint of its difference from the one before.
+ * A short list is kept inline in the leaf:
+ *      varint count (> 0), varint handle deltas...
+ * Once that grows past INLINE_MAX bytes the handles move to a chain of BTreeOverflow blocks (each chunk restarts
+ * its deltas) and the leaf just keeps:
+ *      varint 0, varint count, varint last handle, head block id, tail block id
+ * A handle after the last one, which is the usual case since the heap file appends, is added to the tail block
+ * without reading the rest of the chain. Blocks the chain no longer needs go back to the OverflowBlocks.
+ */
+class PostingList {
+public:
+    static const uint INLINE_MAX = DbBlock::BLOCK_SZ / 8;
+
+    /**
+     * Open an existing list.
+     * @param file         where any overflow blocks go (the index file)
+     * @param key_profile  needed to construct the overflow nodes
+     * @param bytes        the list as stored in the leaf
+     */
+    PostingList(HeapFile &file, const KeyProfile &key_profile, const PostingBytes &bytes);
+
+    /**
+     * Start a new list with a single handle.
+     */
+    PostingList(HeapFile &file, const KeyProfile &key_profile, Handle handle);
+
+    /**
+     * The list, encoded for storing in the leaf (empty if there are no handles left).
+     */
+    const PostingBytes &get_bytes() const { return this->bytes; }
+
+    bool empty() const { return this->count == 0; }
+
+    uint64_t size() const { return this->count; }
+
+    /**
+     * Check if a list as stored in the leaf has moved to a chain of overflow blocks.
+     */
+    static bool is_chain(const PostingBytes &bytes) { return !bytes.empty() && bytes[0] == 0; }
+
+    /**
+     * Append every handle in the list, in order, to handles.
+     */
+    void get(Handles &handles) const;
+
+    /**
+     * Add handle to the list (no effect if it is already there).
+     */
+    void insert(Handle handle, OverflowBlocks &overflow_blocks);
+
+    /**
+     * Remove handle from the list.
+     * @param room  most bytes the list may take in the leaf (a short enough overflow list moves back inline, but
+     *              only if that fits)
+     * @returns     false if handle wasn't in the list
+     */
+    bool del(Handle handle, OverflowBlocks &overflow_blocks, uint room);
+
+protected:
+    typedef std::vector<uint64_t> HandleCodes;
+
+    HeapFile &file;
+    const KeyProfile &key_profile;
+    PostingBytes bytes;
+    uint64_t count;
+    HandleCodes codes;  // the whole list if inline, otherwise empty
+    bool overflow;
+    uint64_t last;  // overflow only: last handle in the chain
+    BlockID head, tail;  // overflow only: first and last blocks of the chain
+
+    static uint64_t code(Handle handle) { return ((uint64_t) handle.first << 16) | handle.second; }
+
+    static Handle handle(uint64_t code) { return Handle((BlockID) (code >> 16), (RecordID) (code & 0xFFFF)); }
+
+    void read_chain(HandleCodes &all, BlockPointers &blocks) const;
+
+    void write_chain(const HandleCodes &all, const BlockPointers &blocks, OverflowBlocks &overflow_blocks);
+
+    void append_to_chain(uint64_t handle_code, OverflowBlocks &overflow_blocks);
+
+    void set_codes(const HandleCodes &all, OverflowBlocks &overflow_blocks);
+
+    static PostingBytes encode_inline(const HandleCodes &codes);
+
+    void encode();
 };
 
@@ -0,0 +1,172 @@
+/**
+ * @file ColumnBatch.cpp - implementation of ColumnBatch and its kernels
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <cstring>
+#include "ColumnBatch.h"
+
+using namespace std;
+
+ColumnVector::ColumnVector(ColumnAttribute::DataType data_type) : data_type(data_type), ints(), texts() {
+    if (data_type == ColumnAttribute::TEXT)
+        texts.resize(ColumnBatch::CAPACITY);
+    else
+        ints.resize(ColumnBatch::CAPACITY);
+}
+
+Value ColumnVector::get(uint slot) const {
+    if (data_type == ColumnAttribute::TEXT)
+        return Value(texts[slot]);
+    Value value(ints[slot]);
+    value.data_type = data_type;
+    return value;
+}
+
+void ColumnVector::set(uint slot, const Value &value) {
+    if (data_type == ColumnAttribute::TEXT)
+        texts[slot] = value.s;
+    else
+        ints[slot] = value.n;
+}
+
+ColumnBatch::ColumnBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes)
+        : selection(), handles(CAPACITY), column_names(column_names), columns(), filled(0) {
+    for (auto column_attribute: column_attributes)
+        columns.push_back(ColumnVector(column_attribute.get_data_type()));
+    selection.reserve(CAPACITY);
+}
+
+void ColumnBatch::clear() {
+    this->filled = 0;
+    this->selection.clear();
+}
+
+uint ColumnBatch::grow(uint count) {
+    if (this->filled + count > CAPACITY)
+        throw DbRelationError("column batch is full");
+    uint first = this->filled;
+    this->filled += count;
+    return first;
+}
+
+void ColumnBatch::select_all() {
+    this->selection.resize(this->filled);
+    for (uint slot = 0; slot < this->filled; slot++)
+        this->selection[slot] = (uint16_t) slot;
+}
+
+void ColumnBatch::append(Handle handle, const ValueDict &row) {
+    uint slot = grow(1);
+    for (uint i = 0; i < this->column_names.size(); i++)
+        this->columns[i].set(slot, row.at(this->column_names[i]));
+    this->handles[slot] = handle;
+    this->selection.push_back((uint16_t) slot);
+}
+
+// The project kernel: gather each of our columns, and the handles, from the selected slots of from.
+void ColumnBatch::project(ColumnBatch &from) {
+    clear();
+    uint count = (uint) from.selection.size();
+    const uint16_t *selected = from.selection.data();
+    for (uint i = 0; i < this->column_names.size(); i++) {
+        ColumnVector &source = from.get_column(this->column_names[i]);
+        ColumnVector &target = this->columns[i];
+        if (target.data_type == ColumnAttribute::TEXT) {
+            for (uint j = 0; j < count; j++)
+                target.texts[j].swap(source.texts[selected[j]]);
+        } else {
+            gather(source.ints.data(), from.filled, selected, count, target.ints.data());
+        }
+    }
+    for (uint j = 0; j < count; j++)
+        this->handles[j] = from.handles[selected[j]];
+    this->filled = count;
+    select_all();
+}
+
+ValueDict *ColumnBatch::get_row(uint slot, const ColumnNames *column_names) const {
+    ValueDict *row = new ValueDict();
+    for (uint i = 0; i < this->column_names.size(); i++)
+        if (column_names == nullptr ||
+            find(column_names->begin(), column_names->end(), this->column_names[i]) != column_names->end())
+            (*row)[this->column_names[i]] = this->columns[i].get(slot);
+    return row;
+}
+
+ColumnVector &ColumnBatch::get_column(const Identifier &column_name) {
+    for (uint i = 0; i < this->column_names.size(); i++)
+        if (this->column_names[i] == column_name)
+            return this->columns[i];
+    throw DbRelationError("column batch has no column " + column_name);
+}
+
+// Work out which rows match for the whole batch first (the loop that vectorizes), then shorten the selection to
+// them without a branch per row.
+uint select_equal(const int32_t *values, uint size, int32_t value, uint16_t *selection, uint count) {
+    uint8_t matches[ColumnBatch::CAPACITY];
+    if (count == size) {
+        for (uint i = 0; i < size; i++)
+            matches[i] = values[i] == value;
+    } else {
+        for (uint i = 0; i < count; i++)
+            matches[i] = values[selection[i]] == value;
+    }
+    uint left = 0;
+    for (uint i = 0; i < count; i++) {
+        selection[left] = selection[i];
+        left += matches[i];
+    }
+    return left;
+}
+
+uint select_equal(const string *values, uint size, const string &value, uint16_t *selection, uint count) {
+    uint left = 0;
+    for (uint i = 0; i < count; i++) {
+        selection[left] = selection[i];
+        left += values[selection[i]] == value;
+    }
+    return left;
+}
+
+void gather(const int32_t *values, uint size, const uint16_t *selection, uint count, int32_t *gathered) {
+    if (count == size) {
+        memcpy(gathered, values, count * sizeof(int32_t));
+    } else {
+        for (uint i = 0; i < count; i++)
+            gathered[i] = values[selection[i]];
+    }
+}
+
+int64_t sum(const int32_t *values, uint size, const uint16_t *selection, uint count) {
+    int64_t total = 0;
+    if (count == size) {
+        for (uint i = 0; i < size; i++)
+            total += values[i];
+    } else {
+        for (uint i = 0; i < count; i++)
+            total += values[selection[i]];
+    }
+    return total;
+}
+
+void min_max(const int32_t *values, uint size, const uint16_t *selection, uint count, int32_t &min, int32_t &max) {
+    if (count == 0)
+        return;
+    int32_t lo = min, hi = max;
+    if (count == size) {
+        for (uint i = 0; i < size; i++) {
+            lo = values[i] < lo ? values[i] : lo;
+            hi = values[i] > hi ? values[i] : hi;
+        }
+    } else {
+        for (uint i = 0; i < count; i++) {
+            int32_t v = values[selection[i]];
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+    }
+    min = lo;
+    max = hi;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file ColumnBatch.h - ColumnBatch, a batch of rows stored a column at a time, and the kernels that work on one
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include "storage_engine.h"
+
+/**
+ * @class ColumnVector - the values of one column for every row slot of a ColumnBatch, in an array of their type
+ */
+class ColumnVector {
+public:
+    ColumnAttribute::DataType data_type;
+    std::vector<int32_t> ints;  // INT, and BOOLEAN as 0 or 1
+    std::vector<std::string> texts;  // TEXT
+
+    explicit ColumnVector(ColumnAttribute::DataType data_type);
+
+    Value get(uint slot) const;
+
+    void set(uint slot, const Value &value);
+};
+
+/**
+ * @class ColumnBatch - up to CAPACITY rows of some of a relation's columns, a ColumnVector for each column
+ *
+ * Rows are numbered by slot, 0 up to size. The selection vector holds the slots of the rows that are still in the
+ * batch, in order, so a filter just shortens it instead of moving any values; project then gathers the rows that are
+ * left into another batch with just the columns it wants. Each slot also keeps the handle of its row.
+ *
+ * The vectorized plan operators (see EvalPlan::batch_iterator) pass batches to each other instead of rows, and do
+ * their work with the kernels below, each a loop over the arrays for a whole batch.
+ */
+class ColumnBatch {
+public:
+    static const uint MAX_PAGE_ROWS = DbBlock::BLOCK_SZ / 4;  // every record in a block has a 4-byte header
+    static const uint CAPACITY = 2 * MAX_PAGE_ROWS;  // so a scan can fill at least half of it a page at a time
+
+    ColumnBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual ~ColumnBatch() {}
+
+    ColumnBatch(const ColumnBatch &other) = delete;
+
+    ColumnBatch &operator=(const ColumnBatch &other) = delete;
+
+    /**
+     * Empty the batch (keeping its columns).
+     */
+    void clear();
+
+    /**
+     * Add a row at the next slot and select it.
+     * @param handle  the row's handle
+     * @param row     values for (at least) every column of the batch
+     */
+    void append(Handle handle, const ValueDict &row);
+
+    /**
+     * Fill this batch with the selected rows of another, in this batch's columns, and select them all. TEXT values
+     * are moved rather than copied, so from has to be refilled (or cleared) after.
+     */
+    void project(ColumnBatch &from);
+
+    /**
+     * Get the values of a row.
+     * @param slot          which row
+     * @param column_names  which of its columns (null for all of the batch's)
+     * @returns             the row's values (freed by caller)
+     */
+    ValueDict *get_row(uint slot, const ColumnNames *column_names = nullptr) const;
+
+    /**
+     * The vector for a column of the batch.
+     * @throws DbRelationError if the batch doesn't have it
+     */
+    ColumnVector &get_column(const Identifier &column_name);
+
+    const ColumnNames &get_column_names() const { return this->column_names; }
+
+    /**
+     * Number of row slots filled.
+     */
+    uint size() const { return this->filled; }
+
+    /**
+     * Make room for count more rows, returning the slot of the first one (the caller fills in their values and
+     * handles, then selects them).
+     */
+    uint grow(uint count);
+
+    /**
+     * Select every slot, e.g., after filling them with grow.
+     */
+    void select_all();
+
+    std::vector<uint16_t> selection;  // slots of the selected rows, in order
+    Handles handles;  // handle of each slot's row
+
+protected:
+    ColumnNames column_names;
+    std::vector<ColumnVector> columns;
+    uint filled;
+};
+
+// Kernels: each is a plain loop over a ColumnVector's array, with no calls per row, so the compiler can vectorize
+// it. When count == size (nothing filtered out yet) the selection is 0, 1, ..., and the loops over it read the values
+// straight through instead of through the selection.
+
+/**
+ * Take the rows whose value isn't value out of selection.
+ * @param values     the column's array
+ * @param size       slots in the batch
+ * @param selection  the selected slots, shortened in place
+ * @param count      how many there are
+ * @returns          how many are left
+ */
+uint select_equal(const int32_t *values, uint size, int32_t value, uint16_t *selection, uint count);
+
+uint select_equal(const std::string *values, uint size, const std::string &value, uint16_t *selection, uint count);
+
+/**
+ * Copy the selected values to the front of gathered.
+ */
+void gather(const int32_t *values, uint size, const uint16_t *selection, uint count, int32_t *gathered);
+
+/**
+ * Sum of the selected values.
+ */
+int64_t sum(const int32_t *values, uint size, const uint16_t *selection, uint count);
+
+/**
+ * Fold the selected values into min and max (start them at INT32_MAX and INT32_MIN).
+ */
+void min_max(const int32_t *values, uint size, const uint16_t *selection, uint count, int32_t &min, int32_t &max);
@@ -4,7 +4,20 @@
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
 #include "EvalPlan.h"
+#include "bitmap_index.h"
+#include "joins.h"
+#include "sorts.h"
+#include "aggregates.h"
 
 
 class Dummy : public DbRelation {
@@ -43,28 +56,115 @@ public:
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) { return nullptr; }
 };
 
-EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), projection(nullptr),
-                                                        select_conjunction(nullptr), table(Dummy::one()) {
+EvalPlan::EvalPlan(PlanType type, EvalPlan *relation)
+        : type(type), relation(relation), right(nullptr), join(nullptr), sort(nullptr), aggregate(nullptr),
+          limit(nullptr), projection(nullptr), select_conjunction(nullptr), table(Dummy::one()), index(nullptr),
+          bitmaps(nullptr), max_key(nullptr) {
 }
 
-EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation),
-                                                                  projection(projection), select_conjunction(nullptr),
-                                                                  table(Dummy::one()) {
+EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation)
+        : type(Project), relation(relation), right(nullptr), join(nullptr), sort(nullptr), aggregate(nullptr),
+          limit(nullptr), projection(projection), select_conjunction(nullptr), table(Dummy::one()), index(nullptr),
+          bitmaps(nullptr), max_key(nullptr) {
 }
 
-EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), projection(nullptr),
-                                                                 select_conjunction(conjunction), table(Dummy::one()) {
+EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation)
+        : type(Select), relation(relation), right(nullptr), join(nullptr), sort(nullptr), aggregate(nullptr),
+          limit(nullptr), projection(nullptr), select_conjunction(conjunction), table(Dummy::one()), index(nullptr),
+          bitmaps(nullptr), max_key(nullptr) {
 }
 
-EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), projection(nullptr),
-                                        select_conjunction(nullptr), table(table) {
+EvalPlan::EvalPlan(DbRelation &table)
+        : type(TableScan), relation(nullptr), right(nullptr), join(nullptr), sort(nullptr), aggregate(nullptr),
+          limit(nullptr), projection(nullptr), select_conjunction(nullptr), table(table), index(nullptr),
+          bitmaps(nullptr), max_key(nullptr) {
 }
 
-EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table) {
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *conjunction)
+        : type(IndexOnlyLookup), relation(nullptr), right(nullptr), join(nullptr), sort(nullptr), aggregate(nullptr),
+          limit(nullptr), projection(nullptr), select_conjunction(conjunction), table(Dummy::one()), index(&index),
+          bitmaps(nullptr), max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(std::vector<BitmapIndex *> *bitmaps, ValueDict *conjunction, EvalPlan *relation)
+        : type(BitmapLookup), relation(relation), right(nullptr), join(nullptr), sort(nullptr), aggregate(nullptr),
+          limit(nullptr), projection(nullptr), select_conjunction(conjunction), table(Dummy::one()), index(nullptr),
+          bitmaps(bitmaps), max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *key, EvalPlan *relation)
+        : type(IndexLookup), relation(relation), right(nullptr), join(nullptr), sort(nullptr), aggregate(nullptr),
+          limit(nullptr), projection(nullptr), select_conjunction(key), table(Dummy::one()), index(&index),
+          bitmaps(nullptr), max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *min_key, ValueDict *max_key, EvalPlan *relation)
+        : type(IndexRange), relation(relation), right(nullptr), join(nullptr), sort(nullptr), aggregate(nullptr),
+          limit(nullptr), projection(nullptr), select_conjunction(min_key), table(Dummy::one()), index(&index),
+          bitmaps(nullptr), max_key(max_key) {
+}
+
+EvalPlan::EvalPlan(PlanType type, JoinSpec *join, ValueDict *where, EvalPlan *left, EvalPlan *right)
+        : type(type), relation(left), right(right), join(join), sort(nullptr), aggregate(nullptr), limit(nullptr),
+          projection(nullptr), select_conjunction(where), table(Dummy::one()), index(nullptr), bitmaps(nullptr),
+          max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, JoinSpec *join, ValueDict *where, EvalPlan *left, EvalPlan *right)
+        : type(IndexNestedLoopJoin), relation(left), right(right), join(join), sort(nullptr), aggregate(nullptr),
+          limit(nullptr), projection(nullptr), select_conjunction(where), table(Dummy::one()), index(&index),
+          bitmaps(nullptr), max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(SortSpec *sort, EvalPlan *relation)
+        : type(Sort), relation(relation), right(nullptr), join(nullptr), sort(sort), aggregate(nullptr), limit(nullptr),
+          projection(nullptr), select_conjunction(nullptr), table(Dummy::one()), index(nullptr), bitmaps(nullptr),
+          max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(AggregateSpec *aggregate, EvalPlan *relation)
+        : type(Aggregate), relation(relation), right(nullptr), join(nullptr), sort(nullptr), aggregate(aggregate),
+          limit(nullptr), projection(nullptr), select_conjunction(nullptr), table(Dummy::one()), index(nullptr),
+          bitmaps(nullptr), max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(LimitSpec *limit, EvalPlan *relation)
+        : type(Limit), relation(relation), right(nullptr), join(nullptr), sort(nullptr), aggregate(nullptr),
+          limit(limit), projection(nullptr), select_conjunction(nullptr), table(Dummy::one()), index(nullptr),
+          bitmaps(nullptr), max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(SortSpec *sort, LimitSpec *limit, EvalPlan *relation)
+        : type(TopN), relation(relation), right(nullptr), join(nullptr), sort(sort), aggregate(nullptr), limit(limit),
+          projection(nullptr), select_conjunction(nullptr), table(Dummy::one()), index(nullptr), bitmaps(nullptr),
+          max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table), index(other->index) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
         relation = nullptr;
+    if (other->right != nullptr)
+        right = new EvalPlan(other->right);
+    else
+        right = nullptr;
+    if (other->join != nullptr)
+        join = new JoinSpec(*other->join);
+    else
+        join = nullptr;
+    if (other->sort != nullptr)
+        sort = new SortSpec(*other->sort);
+    else
+        sort = nullptr;
+    if (other->aggregate != nullptr)
+        aggregate = new AggregateSpec(*other->aggregate);
+    else
+        aggregate = nullptr;
+    if (other->limit != nullptr)
+        limit = new LimitSpec(*other->limit);
+    else
+        limit = nullptr;
     if (other->projection != nullptr)
         projection = new ColumnNames(*other->projection);
     else
@@ -73,52 +173,1303 @@ EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->tabl
         select_conjunction = new ValueDict(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    if (other->bitmaps != nullptr)
+        bitmaps = new std::vector<BitmapIndex *>(*other->bitmaps);
+    else
+        bitmaps = nullptr;
+    if (other->max_key != nullptr)
+        max_key = new ValueDict(*other->max_key);
+    else
+        max_key = nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
+    delete right;
+    delete join;
+    delete sort;
+    delete aggregate;
+    delete limit;
     delete projection;
     delete select_conjunction;
+    delete bitmaps;
+    delete max_key;
 }
 
 
-EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+// Check that each value in where is of its column's type in table. One that isn't equals no row's value, but its
+// encoding could still be some other value's, so an index would find rows for it.
+static bool typed_like(const DbRelation &table, const ValueDict *where) {
+    const ColumnNames &column_names = table.get_column_names();
+    ColumnAttributes column_attributes = table.get_column_attributes();
+    for (uint i = 0; i < column_names.size(); i++) {
+        ValueDict::const_iterator value = where->find(column_names[i]);
+        if (value != where->end() && value->second.data_type != column_attributes[i].get_data_type())
+            return false;
+    }
+    return true;
 }
 
-ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
+// So far the rules are for a projection of a select on a table scan, when the select gives the whole key of an index:
+// if the index can tell that no row has that key (a Bloom filter), the answer is empty without looking; if the
+// index also stores every column the query uses (a covering index), answer it from the index alone; and otherwise, if
+// there are bitmap indices, AND their bitmaps to get the rows, leaving a select on just the rest of the columns.
+// Failing all of those, the select under the projection (or a select on its own, as for a delete) is done with
+// whichever index finds its rows best (see optimize_select), which also finds that a select with a value of the
+// wrong type for its column is empty.
+EvalPlan *EvalPlan::optimize(Indices &indices) {
+    if ((this->type == ProjectAll || this->type == Project) && this->relation->type == Select &&
+        this->relation->relation->type == TableScan &&
+        typed_like(this->relation->relation->table, this->relation->select_conjunction)) {
+        DbRelation &scanned = this->relation->relation->table;
+        const ValueDict *where = this->relation->select_conjunction;
+        ColumnNames used = this->type == ProjectAll ? scanned.get_column_names() : *this->projection;
+        for (auto const &column: *where)
+            used.push_back(column.first);
+        for (auto const &index_name: indices.get_index_names(scanned.get_table_name())) {
+            DbIndex &candidate = indices.get_index(scanned.get_table_name(), index_name);
+            bool whole_key = true;
+            for (auto const &column_name: candidate.get_key_columns())
+                if (where->find(column_name) == where->end())
+                    whole_key = false;
+            if (whole_key && !candidate.might_contain(where)) {
+                EvalPlan *nothing = new EvalPlan(Empty, new EvalPlan(scanned));
+                if (this->type == ProjectAll)
+                    return new EvalPlan(ProjectAll, nothing);
+                return new EvalPlan(new ColumnNames(*this->projection), nothing);
+            }
+        }
+        for (auto const &index_name: indices.get_index_names(scanned.get_table_name())) {
+            DbIndex &candidate = indices.get_index(scanned.get_table_name(), index_name);
+            bool whole_key = true;
+            for (auto const &column_name: candidate.get_key_columns())
+                if (where->find(column_name) == where->end())
+                    whole_key = false;
+            if (whole_key && candidate.covers(used)) {
+                EvalPlan *lookup = new EvalPlan(candidate, new ValueDict(*where));
+                if (this->type == ProjectAll)
+                    return new EvalPlan(ProjectAll, lookup);
+                return new EvalPlan(new ColumnNames(*this->projection), lookup);
+            }
+        }
+        std::vector<BitmapIndex *> *bitmaps = new std::vector<BitmapIndex *>();
+        ValueDict *rest = new ValueDict(*where);
+        for (auto const &index_name: indices.get_index_names(scanned.get_table_name())) {
+            BitmapIndex *candidate = dynamic_cast<BitmapIndex *>(&indices.get_index(scanned.get_table_name(),
+                                                                                    index_name));
+            if (candidate == nullptr)
+                continue;
+            bool whole_key = true;
+            for (auto const &column_name: candidate->get_key_columns())
+                if (where->find(column_name) == where->end())
+                    whole_key = false;
+            if (whole_key) {
+                bitmaps->push_back(candidate);
+                for (auto const &column_name: candidate->get_key_columns())
+                    rest->erase(column_name);
+            }
+        }
+        if (!bitmaps->empty()) {
+            EvalPlan *plan = new EvalPlan(bitmaps, new ValueDict(*where), new EvalPlan(scanned));
+            if (!rest->empty())
+                plan = new EvalPlan(rest, plan);
+            else
+                delete rest;
+            if (this->type == ProjectAll)
+                return new EvalPlan(ProjectAll, plan);
+            return new EvalPlan(new ColumnNames(*this->projection), plan);
+        }
+        delete bitmaps;
+        delete rest;
+    }
+    if (this->type == ProjectAll)
+        return new EvalPlan(ProjectAll, this->relation->optimize(indices));
+    if (this->type == Project)
+        return new EvalPlan(new ColumnNames(*this->projection), this->relation->optimize(indices));
+    if (this->type == Select && this->relation->type == TableScan)
+        return optimize_select(indices);
+    if (this->type == HashJoin)
+        return optimize_join(indices);
+    if (this->type == Sort)
+        return new EvalPlan(new SortSpec(*this->sort), this->relation->optimize(indices));
+    if (this->type == Aggregate)
+        return new EvalPlan(new AggregateSpec(*this->aggregate), this->relation->optimize(indices));
+    // a limit of a sort just needs the first limit + offset rows in order, so unless that's a lot of them, a top-n
+    if (this->type == Limit && this->relation->type == Sort && this->limit->limit <= TopNIterator::MAX_ROWS &&
+        this->limit->offset <= TopNIterator::MAX_ROWS - this->limit->limit)
+        return new EvalPlan(new SortSpec(*this->relation->sort), new LimitSpec(*this->limit),
+                            this->relation->relation->optimize(indices));
+    if (this->type == Limit)
+        return new EvalPlan(new LimitSpec(*this->limit), this->relation->optimize(indices));
+    if (this->type == TopN)
+        return new EvalPlan(new SortSpec(*this->sort), new LimitSpec(*this->limit), this->relation->optimize(indices));
+    return new EvalPlan(this);  // otherwise, we don't know how to do anything better
+}
+
+// A hash join reads the whole of its right side. When that's a table (maybe with a select) with an index on some of
+// the join's right keys, and the left side is small next to it, probing the index for each left row reads less. We
+// don't know how many rows either side has, just how many pages their scans read, so we guess that each page of the
+// left side has about PROBES_PER_PAGE rows, each probe costing about one page of the right table. The index with the
+// most key columns wins.
+EvalPlan *EvalPlan::optimize_join(Indices &indices) {
+    static const uint PROBES_PER_PAGE = 64;
+    EvalPlan *left = this->relation->optimize(indices);
+    ValueDict *where = this->select_conjunction == nullptr ? nullptr : new ValueDict(*this->select_conjunction);
+    DbRelation *probed = this->right->projected_table();
+    if (probed != nullptr && (uint64_t) left->scan_pages() * PROBES_PER_PAGE < probed->get_page_count()) {
+        DbIndex *best = nullptr;
+        for (auto const &index_name: indices.get_index_names(probed->get_table_name())) {
+            DbIndex &candidate = indices.get_index(probed->get_table_name(), index_name);
+            if (!candidate.supports_lookup())
+                continue;
+            bool joined = true;
+            for (auto const &column_name: candidate.get_key_columns())
+                if (find(this->join->right_keys.begin(), this->join->right_keys.end(), column_name) ==
+                    this->join->right_keys.end())
+                    joined = false;
+            if (joined && (best == nullptr || candidate.get_key_columns().size() > best->get_key_columns().size()))
+                best = &candidate;
+        }
+        if (best != nullptr)
+            return new EvalPlan(*best, new JoinSpec(*this->join), where, left, new EvalPlan(this->right));
+    }
+    EvalPlan *right = this->right->optimize(indices);
+    if (left->scan_pages() > 0 && right->scan_pages() > 0) {
+        // both sides read all of their tables anyway, so if each has an ordered index on its keys, merge the two
+        DbIndex *left_index = this->relation->ordering_index(indices, this->join->left_keys, true);
+        JoinSpec *merged = new JoinSpec(*this->join);  // the keys in the order of left_index
+        for (uint i = 0; left_index != nullptr && i < merged->left_keys.size(); i++) {
+            const ColumnNames &left_keys = this->join->left_keys;
+            long at = find(left_keys.begin(), left_keys.end(), left_index->get_key_columns()[i]) - left_keys.begin();
+            merged->left_keys[i] = this->join->left_keys[at];
+            merged->right_keys[i] = this->join->right_keys[at];
+        }
+        DbIndex *right_index = left_index == nullptr ? nullptr
+                                                     : this->right->ordering_index(indices, merged->right_keys, false);
+        if (right_index != nullptr) {
+            delete left;
+            delete right;
+            return new EvalPlan(MergeJoin, merged, where, this->relation->ordered_scan(*left_index),
+                                this->right->ordered_scan(*right_index));
+        }
+        delete merged;
+    }
+    return new EvalPlan(HashJoin, new JoinSpec(*this->join), where, left, right);
+}
+
+// The table of a projection of a table scan, with or without a select (otherwise null).
+DbRelation *EvalPlan::projected_table() const {
     if (this->type != ProjectAll && this->type != Project)
-        throw DbRelationError("Invalid evaluation plan--not ending with a projection");
+        return nullptr;
+    const EvalPlan *scan = this->relation->type == Select ? this->relation->relation : this->relation;
+    return scan->type == TableScan ? &scan->table : nullptr;
+}
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
+// An ordered index of projected_table whose leading key columns are keys (in any order, if any_order), so that a
+// range scan over all of it gets the rows in order of keys.
+DbIndex *EvalPlan::ordering_index(Indices &indices, const ColumnNames &keys, bool any_order) const {
+    DbRelation *table = projected_table();
+    if (table == nullptr)
+        return nullptr;
+    for (auto const &index_name: indices.get_index_names(table->get_table_name())) {
+        DbIndex &candidate = indices.get_index(table->get_table_name(), index_name);
+        const ColumnNames &key_columns = candidate.get_key_columns();
+        if (!candidate.supports_range() || key_columns.size() < keys.size())
+            continue;
+        ColumnNames leading(key_columns.begin(), key_columns.begin() + keys.size());
+        if (any_order) {
+            ColumnNames sorted_keys = keys;
+            std::sort(leading.begin(), leading.end());
+            std::sort(sorted_keys.begin(), sorted_keys.end());
+            if (leading == sorted_keys)
+                return &candidate;
+        } else if (leading == keys) {
+            return &candidate;
+        }
+    }
+    return nullptr;
+}
+
+// This projection with its table scan replaced by a range over all of index, to get its rows in the index's order.
+EvalPlan *EvalPlan::ordered_scan(DbIndex &index) const {
+    EvalPlan *plan = new EvalPlan(index, nullptr, nullptr, new EvalPlan(*projected_table()));
+    if (this->relation->type == Select)
+        plan = new EvalPlan(new ValueDict(*this->relation->select_conjunction), plan);
     if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
+        return new EvalPlan(ProjectAll, plan);
+    return new EvalPlan(new ColumnNames(*this->projection), plan);
+}
+
+// About how many pages the plan's table scans read (an index lookup reads none, an index range its whole table).
+uint EvalPlan::scan_pages() const {
+    if (this->type == TableScan)
+        return this->table.get_page_count();
+    if (this->type == IndexOnlyLookup || this->type == Empty || this->type == BitmapLookup ||
+        this->type == IndexLookup)
+        return 0;
+    if (this->type == HashJoin || this->type == MergeJoin)
+        return this->relation->scan_pages() + this->right->scan_pages();
+    return this->relation->scan_pages();  // the rest read what's under them (an index join's probes aren't scans)
+}
+
+// Find the rows of a select on a table scan with an index instead of the scan, leaving a select on whatever columns
+// the index didn't use. The index that uses the most columns of the select wins: an index with its whole key given
+// does a lookup, and an ordered one with just its leading key columns given does a range over them. On a tie, the
+// lookup wins (a hash index beats a B-tree range). If a value isn't of its column's type, no row is selected.
+EvalPlan *EvalPlan::optimize_select(Indices &indices) {
+    DbRelation &scanned = this->relation->table;
+    const ValueDict *where = this->select_conjunction;
+    if (!typed_like(scanned, where))
+        return new EvalPlan(Empty, new EvalPlan(scanned));
+    DbIndex *best = nullptr;
+    uint best_columns = 0;
+    bool best_whole_key = false;
+    for (auto const &index_name: indices.get_index_names(scanned.get_table_name())) {
+        DbIndex &candidate = indices.get_index(scanned.get_table_name(), index_name);
+        if (!candidate.supports_lookup())
+            continue;
+        const ColumnNames &key_columns = candidate.get_key_columns();
+        uint given = 0;
+        while (given < key_columns.size() && where->find(key_columns[given]) != where->end())
+            given++;
+        bool whole_key = given == key_columns.size();
+        if (given == 0 || (!whole_key && !candidate.supports_range()))
+            continue;
+        if (given > best_columns || (given == best_columns && whole_key && !best_whole_key)) {
+            best = &candidate;
+            best_columns = given;
+            best_whole_key = whole_key;
+        }
+    }
+    if (best == nullptr)
+        return new EvalPlan(this);
+
+    ValueDict *key = new ValueDict();
+    ValueDict *rest = new ValueDict(*where);
+    for (uint i = 0; i < best_columns; i++) {
+        const Identifier &column_name = best->get_key_columns()[i];
+        (*key)[column_name] = where->at(column_name);
+        rest->erase(column_name);
+    }
+    EvalPlan *plan;
+    if (best_whole_key)
+        plan = new EvalPlan(*best, key, new EvalPlan(scanned));
+    else
+        plan = new EvalPlan(*best, key, new ValueDict(*key), new EvalPlan(scanned));
+    if (rest->empty()) {
+        delete rest;
+        return plan;
+    }
+    return new EvalPlan(rest, plan);
+}
+
+// A table scan, a page at a time.
+class ScanIterator : public PipelineIterator {
+public:
+    explicit ScanIterator(DbRelation &relation) : relation(relation), page(0), handles(nullptr), at(0) {}
+
+    virtual ~ScanIterator() { close(); }
+
+    virtual void open() {
+        close();
+        this->page = 0;
+    }
+
+    virtual bool next(Handle &handle) {
+        while (this->handles == nullptr || this->at == this->handles->size()) {
+            if (this->page > 0 && this->handles == nullptr)
+                return false;  // already past the end
+            delete this->handles;
+            this->handles = this->relation.select_page(++this->page);
+            this->at = 0;
+            if (this->handles == nullptr)
+                return false;
+        }
+        handle = (*this->handles)[this->at++];
+        return true;
+    }
+
+    virtual void close() {
+        delete this->handles;
+        this->handles = nullptr;
+    }
+
+    virtual DbRelation &get_relation() { return this->relation; }
+
+protected:
+    DbRelation &relation;
+    uint page;
+    Handles *handles;  // the current page's
+    size_t at;
+};
+
+// Handles that an index (or nothing, for Empty) gets all at once, when opened.
+class FoundIterator : public PipelineIterator {
+public:
+    FoundIterator(DbRelation &relation, std::function<Handles *()> find)
+            : relation(relation), find(find), handles(nullptr), at(0) {}
+
+    virtual ~FoundIterator() { close(); }
+
+    virtual void open() {
+        close();
+        this->handles = this->find();
+        this->at = 0;
+    }
+
+    virtual bool next(Handle &handle) {
+        if (this->handles == nullptr || this->at == this->handles->size())
+            return false;
+        handle = (*this->handles)[this->at++];
+        return true;
+    }
+
+    virtual void close() {
+        delete this->handles;
+        this->handles = nullptr;
+    }
+
+    virtual DbRelation &get_relation() { return this->relation; }
+
+protected:
+    DbRelation &relation;
+    std::function<Handles *()> find;
+    Handles *handles;
+    size_t at;
+};
+
+// The rows from another iterator that satisfy a select, checked BATCH_SIZE at a time.
+class SelectIterator : public PipelineIterator {
+public:
+    static const uint BATCH_SIZE = 64;
+
+    SelectIterator(PipelineIterator *input, const ValueDict *where)
+            : input(input), where(where), selected(nullptr), at(0) {}
+
+    virtual ~SelectIterator() {
+        close();
+        delete this->input;
+    }
+
+    virtual void open() {
+        close();
+        this->input->open();
+    }
+
+    virtual bool next(Handle &handle) {
+        while (this->selected == nullptr || this->at == this->selected->size()) {
+            Handles batch;
+            Handle input_handle;
+            while (batch.size() < BATCH_SIZE && this->input->next(input_handle))
+                batch.push_back(input_handle);
+            if (batch.empty())
+                return false;
+            delete this->selected;
+            this->selected = this->input->get_relation().select(&batch, this->where);
+            this->at = 0;
+        }
+        handle = (*this->selected)[this->at++];
+        return true;
+    }
+
+    virtual void close() {
+        this->input->close();
+        delete this->selected;
+        this->selected = nullptr;
+    }
+
+    virtual DbRelation &get_relation() { return this->input->get_relation(); }
+
+protected:
+    PipelineIterator *input;
+    const ValueDict *where;
+    Handles *selected;  // from the current batch
+    size_t at;
+};
+
+// The values of each row from another iterator (all of them if projection is null).
+class ProjectIterator : public EvalIterator {
+public:
+    ProjectIterator(PipelineIterator *input, const ColumnNames *projection) : input(input), projection(projection) {}
+
+    virtual ~ProjectIterator() {
+        close();
+        delete this->input;
+    }
+
+    virtual void open() { this->input->open(); }
+
+    virtual ValueDict *next() {
+        Handle handle;
+        if (!this->input->next(handle))
+            return nullptr;
+        if (this->projection == nullptr)
+            return this->input->get_relation().project(handle);
+        return this->input->get_relation().project(handle, this->projection);
+    }
+
+    virtual void close() { this->input->close(); }
+
+protected:
+    PipelineIterator *input;
+    const ColumnNames *projection;
+};
+
+// Rows an index gets all at once, when opened, narrowed to projection (unless it's null).
+class ValuesIterator : public EvalIterator {
+public:
+    ValuesIterator(std::function<ValueDicts *()> find, const ColumnNames *projection)
+            : find(find), projection(projection), rows(nullptr), at(0) {}
+
+    virtual ~ValuesIterator() { close(); }
+
+    virtual void open() {
+        close();
+        this->rows = this->find();
+        this->at = 0;
+    }
+
+    virtual ValueDict *next() {
+        if (this->rows == nullptr || this->at == this->rows->size())
+            return nullptr;
+        ValueDict *row = (*this->rows)[this->at++];
+        if (this->projection == nullptr)
+            return row;
+        ValueDict *projected = new ValueDict();
+        for (auto const &column_name: *this->projection)
+            (*projected)[column_name] = row->at(column_name);
+        delete row;
+        return projected;
+    }
+
+    virtual void close() {
+        if (this->rows != nullptr) {
+            for (size_t i = this->at; i < this->rows->size(); i++)
+                delete (*this->rows)[i];  // the ones nobody took
+            delete this->rows;
+            this->rows = nullptr;
+        }
+    }
+
+protected:
+    std::function<ValueDicts *()> find;
+    const ColumnNames *projection;
+    ValueDicts *rows;
+    size_t at;
+};
+
+// The rows from another iterator narrowed to projection (unless it's null), leaving out the columns a row doesn't have
+// (its NULLs).
+class NarrowIterator : public EvalIterator {
+public:
+    NarrowIterator(EvalIterator *input, const ColumnNames *projection) : input(input), projection(projection) {}
+
+    virtual ~NarrowIterator() {
+        close();
+        delete this->input;
+    }
+
+    virtual void open() { this->input->open(); }
+
+    virtual ValueDict *next() {
+        ValueDict *row = this->input->next();
+        if (row == nullptr || this->projection == nullptr)
+            return row;
+        ValueDict *narrowed = new ValueDict();
+        for (auto const &column_name: *this->projection) {
+            ValueDict::const_iterator column = row->find(column_name);
+            if (column != row->end())
+                (*narrowed)[column_name] = column->second;
+        }
+        delete row;
+        return narrowed;
+    }
+
+    virtual void close() { this->input->close(); }
+
+protected:
+    EvalIterator *input;
+    const ColumnNames *projection;
+};
+
+static ColumnBatch *new_batch(DbRelation &relation, const ColumnNames &column_names) {
+    ColumnAttributes *column_attributes = relation.get_column_attributes(column_names);
+    ColumnBatch *batch = new ColumnBatch(column_names, *column_attributes);
+    delete column_attributes;
+    return batch;
+}
+
+// A vectorized table scan: whole pages into the batch until it's at least half full. Given a morsel, just its pages.
+class ScanBatchIterator : public BatchIterator {
+public:
+    ScanBatchIterator(DbRelation &relation, const Morsel *morsel)
+            : relation(relation), morsel(morsel), page(0), last_page(0), done(false) {}
+
+    virtual void open() {
+        this->page = this->morsel == nullptr ? 0 : this->morsel->first_page - 1;
+        this->last_page = this->morsel == nullptr ? UINT32_MAX : this->morsel->last_page;
+        this->done = false;
+    }
+
+    virtual bool next(ColumnBatch &batch) {
+        batch.clear();
+        while (!this->done && batch.size() + ColumnBatch::MAX_PAGE_ROWS <= ColumnBatch::CAPACITY)
+            if (this->page == this->last_page || !this->relation.select_page(++this->page, batch))
+                this->done = true;
+        return batch.size() > 0;
+    }
+
+    virtual void close() {}
+
+    virtual DbRelation &get_relation() { return this->relation; }
+
+protected:
+    DbRelation &relation;
+    const Morsel *morsel;
+    uint page, last_page;
+    bool done;
+};
+
+// Batches of rows from a PipelineIterator, projected a row at a time.
+class RowBatchIterator : public BatchIterator {
+public:
+    explicit RowBatchIterator(PipelineIterator *input) : input(input) {}
+
+    virtual ~RowBatchIterator() {
+        close();
+        delete this->input;
+    }
+
+    virtual void open() { this->input->open(); }
+
+    virtual bool next(ColumnBatch &batch) {
+        batch.clear();
+        Handle handle;
+        while (batch.size() < ColumnBatch::CAPACITY && this->input->next(handle)) {
+            ValueDict *row = this->input->get_relation().project(handle, &batch.get_column_names());
+            batch.append(handle, *row);
+            delete row;
+        }
+        return batch.size() > 0;
+    }
+
+    virtual void close() { this->input->close(); }
+
+    virtual DbRelation &get_relation() { return this->input->get_relation(); }
+
+protected:
+    PipelineIterator *input;
+};
+
+// Narrow each batch from another iterator to the rows that satisfy a select, a kernel call per column.
+class SelectBatchIterator : public BatchIterator {
+public:
+    SelectBatchIterator(BatchIterator *input, const ValueDict *where) : input(input), where(where) {}
+
+    virtual ~SelectBatchIterator() {
+        close();
+        delete this->input;
+    }
+
+    virtual void open() { this->input->open(); }
+
+    virtual bool next(ColumnBatch &batch) {
+        while (this->input->next(batch)) {
+            for (auto const &column: *this->where) {
+                ColumnVector &values = batch.get_column(column.first);
+                uint count = (uint) batch.selection.size();
+                if (values.data_type != column.second.data_type)
+                    count = 0;  // no value of one type equals a value of another
+                else if (values.data_type == ColumnAttribute::TEXT)
+                    count = select_equal(values.texts.data(), batch.size(), column.second.s, batch.selection.data(),
+                                         count);
+                else
+                    count = select_equal(values.ints.data(), batch.size(), column.second.n, batch.selection.data(),
+                                         count);
+                batch.selection.resize(count);
+                if (count == 0)
+                    break;
+            }
+            if (!batch.selection.empty())
+                return true;
+        }
+        return false;
+    }
+
+    virtual void close() { this->input->close(); }
+
+    virtual DbRelation &get_relation() { return this->input->get_relation(); }
+
+protected:
+    BatchIterator *input;
+    const ValueDict *where;
+};
+
+// Gather the projected columns of each batch from another iterator (which also has the columns its selects need).
+class ProjectBatchIterator : public BatchIterator {
+public:
+    ProjectBatchIterator(BatchIterator *input, ColumnBatch *input_batch) : input(input), input_batch(input_batch) {}
+
+    virtual ~ProjectBatchIterator() {
+        close();
+        delete this->input;
+        delete this->input_batch;
+    }
+
+    virtual void open() { this->input->open(); }
+
+    virtual bool next(ColumnBatch &batch) {
+        if (!this->input->next(*this->input_batch))
+            return false;
+        batch.project(*this->input_batch);
+        return true;
+    }
+
+    virtual void close() { this->input->close(); }
+
+    virtual DbRelation &get_relation() { return this->input->get_relation(); }
+
+protected:
+    BatchIterator *input;
+    ColumnBatch *input_batch;
+};
+
+// The rows of the batches from a BatchIterator, one at a time.
+class BatchRowIterator : public EvalIterator {
+public:
+    BatchRowIterator(BatchIterator *input, ColumnBatch *batch) : input(input), batch(batch), at(0) {}
+
+    virtual ~BatchRowIterator() {
+        close();
+        delete this->input;
+        delete this->batch;
+    }
+
+    virtual void open() {
+        this->input->open();
+        this->batch->clear();
+        this->at = 0;
+    }
+
+    virtual ValueDict *next() {
+        while (this->at == this->batch->selection.size()) {
+            if (!this->input->next(*this->batch))
+                return nullptr;
+            this->at = 0;
+        }
+        return this->batch->get_row(this->batch->selection[this->at++]);
+    }
+
+    virtual void close() { this->input->close(); }
+
+protected:
+    BatchIterator *input;
+    ColumnBatch *batch;
+    size_t at;
+};
+
+// The rows of a vectorized plan over a table scan, run by a pool of worker threads. The table is cut into morsels of
+// MORSEL_PAGES pages; each worker has its own copy of the pipeline (scan, selects, projection) and runs it on one
+// morsel after another, whichever is next, until there are none left. The rows of each morsel are kept until next
+// gets to them, so they come out in table order, just as from one thread. So that a slow reader doesn't end up with
+// the whole table in memory, the workers stay within WINDOW morsels each of the one being read.
+class MorselRowIterator : public EvalIterator {
+public:
+    static const uint MORSEL_PAGES = 16;
+    static const uint WINDOW = 4;
+
+    // One per worker thread, set up on the caller's thread.
+    struct Worker {
+        Morsel morsel;
+        BatchIterator *batches;
+        ColumnBatch *batch;
+        std::thread thread;
+    };
+
+    MorselRowIterator(EvalPlan *plan, DbRelation &relation, const ColumnNames &column_names, uint worker_count)
+            : relation(relation), workers(), mutex(), ready(), room(), morsel_count(0), page_count(0), claimed(0),
+              reading(0), finished(), rows(nullptr), at(0), error(), stopping(false) {
+        try {
+            for (uint i = 0; i < worker_count; i++) {
+                Worker *worker = new Worker();
+                this->workers.push_back(worker);
+                worker->batches = plan->batch_iterator(&worker->morsel);
+                worker->batch = new_batch(relation, column_names);
+            }
+        } catch (DbRelationError &e) {
+            free_workers();
+            throw;
+        }
+    }
+
+    virtual ~MorselRowIterator() {
+        close();
+        free_workers();
+    }
+
+    virtual void open() {
+        close();
+        this->page_count = this->relation.get_page_count();
+        this->morsel_count = (this->page_count + MORSEL_PAGES - 1) / MORSEL_PAGES;
+        this->claimed = this->reading = 0;
+        this->error = nullptr;
+        this->stopping = false;
+        for (auto worker: this->workers)
+            worker->thread = std::thread(&MorselRowIterator::work, this, worker);
+    }
+
+    virtual ValueDict *next() {
+        while (this->rows == nullptr || this->at == this->rows->size()) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (this->rows != nullptr) {
+                delete this->rows;  // every row in it has been taken
+                this->rows = nullptr;
+                this->reading++;
+                this->room.notify_all();
+            }
+            if (this->reading >= this->morsel_count)
+                return nullptr;
+            this->ready.wait(lock, [this]() {
+                return this->error != nullptr || this->finished.find(this->reading) != this->finished.end();
+            });
+            if (this->error != nullptr)
+                std::rethrow_exception(this->error);
+            this->rows = this->finished[this->reading];
+            this->finished.erase(this->reading);
+            this->at = 0;
+        }
+        return (*this->rows)[this->at++];
+    }
+
+    virtual void close() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->room.notify_all();
+        for (auto worker: this->workers)
+            if (worker->thread.joinable())
+                worker->thread.join();
+        if (this->rows != nullptr) {
+            for (size_t i = this->at; i < this->rows->size(); i++)
+                delete (*this->rows)[i];  // the ones nobody took
+            delete this->rows;
+            this->rows = nullptr;
+        }
+        for (auto const &morsel: this->finished) {
+            for (auto row: *morsel.second)
+                delete row;
+            delete morsel.second;
+        }
+        this->finished.clear();
+    }
+
+protected:
+    DbRelation &relation;
+    std::vector<Worker *> workers;
+    std::mutex mutex;  // guards everything below
+    std::condition_variable ready;  // a morsel is finished, or a worker failed
+    std::condition_variable room;  // next moved on to another morsel, or we're stopping
+    uint morsel_count, page_count;
+    uint claimed;  // morsels handed to workers so far
+    uint reading;  // the morsel next is on
+    std::map<uint, ValueDicts *> finished;  // rows of the morsels done but not read yet
+    ValueDicts *rows;  // the rows of the morsel next is on
+    size_t at;
+    std::exception_ptr error;  // from the first worker that failed
+    bool stopping;
+
+    void work(Worker *worker) {
+        while (true) {
+            uint morsel;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->room.wait(lock, [this]() {
+                    return this->stopping || this->claimed >= this->morsel_count ||
+                           this->claimed < this->reading + WINDOW * this->workers.size();
+                });
+                if (this->stopping || this->claimed >= this->morsel_count)
+                    return;
+                morsel = this->claimed++;
+            }
+            ValueDicts *morsel_rows = new ValueDicts();
+            try {
+                worker->morsel.first_page = morsel * MORSEL_PAGES + 1;
+                worker->morsel.last_page = std::min((morsel + 1) * MORSEL_PAGES, this->page_count);
+                worker->batches->open();
+                while (worker->batches->next(*worker->batch))
+                    for (auto slot: worker->batch->selection)
+                        morsel_rows->push_back(worker->batch->get_row(slot));
+                worker->batches->close();
+            } catch (...) {
+                for (auto row: *morsel_rows)
+                    delete row;
+                delete morsel_rows;
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (this->error == nullptr)
+                    this->error = std::current_exception();
+                this->stopping = true;
+                this->ready.notify_all();
+                this->room.notify_all();
+                return;
+            }
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->finished[morsel] = morsel_rows;
+            this->ready.notify_all();
+        }
+    }
+
+    void free_workers() {
+        for (auto worker: this->workers) {
+            delete worker->batches;
+            delete worker->batch;
+            delete worker;
+        }
+        this->workers.clear();
+    }
+};
+
+ValueDicts *EvalPlan::evaluate() {
+    EvalIterator *rows = iterator();
+    ValueDicts *ret = new ValueDicts();
+    rows->open();
+    for (ValueDict *row = rows->next(); row != nullptr; row = rows->next())
+        ret->push_back(row);
+    rows->close();
+    delete rows;
     return ret;
 }
 
 EvalPipeline EvalPlan::pipeline() {
+    PipelineIterator *rows = pipeline_iterator();
+    Handles *handles = new Handles();
+    rows->open();
+    Handle handle;
+    while (rows->next(handle))
+        handles->push_back(handle);
+    rows->close();
+    EvalPipeline ret(&rows->get_relation(), handles);
+    delete rows;
+    return ret;
+}
+
+EvalIterator *EvalPlan::iterator(bool vectorized) {
+    if (this->type != ProjectAll && this->type != Project)
+        throw DbRelationError("Invalid evaluation plan--not ending with a projection");
+    const ColumnNames *columns = this->type == Project ? this->projection : nullptr;
+    if (this->relation->type == HashJoin || this->relation->type == IndexNestedLoopJoin ||
+        this->relation->type == MergeJoin || this->relation->type == Sort || this->relation->type == Aggregate ||
+        this->relation->type == Limit || this->relation->type == TopN)
+        return new NarrowIterator(this->relation->row_iterator(), columns);
+    if (this->relation->type == IndexOnlyLookup) {
+        EvalPlan *lookup = this->relation;
+        return new ValuesIterator([lookup]() { return lookup->lookup_values(); }, columns);
+    }
+    if (!vectorized)
+        return new ProjectIterator(this->relation->pipeline_iterator(), columns);
+    DbRelation *scanned = morsel_table();
+    if (scanned != nullptr && max_workers > 1) {
+        uint morsels = (scanned->get_page_count() + MorselRowIterator::MORSEL_PAGES - 1) /
+                       MorselRowIterator::MORSEL_PAGES;
+        if (morsels > 1)
+            return new MorselRowIterator(this, *scanned, columns == nullptr ? scanned->get_column_names() : *columns,
+                                         std::min(max_workers, morsels));
+    }
+    BatchIterator *batches = batch_iterator();
+    DbRelation &relation = batches->get_relation();
+    try {
+        return new BatchRowIterator(batches, new_batch(relation, columns == nullptr ? relation.get_column_names()
+                                                                                    : *columns));
+    } catch (DbRelationError &e) {
+        delete batches;
+        throw;
+    }
+}
+
+EvalIterator *EvalPlan::row_iterator() {
+    if (this->type == ProjectAll || this->type == Project)
+        return iterator();
+    if (this->type == HashJoin || this->type == MergeJoin) {
+        EvalIterator *left = this->relation->row_iterator();
+        EvalIterator *right;
+        try {
+            right = this->right->row_iterator();
+        } catch (DbRelationError &e) {
+            delete left;
+            throw;
+        }
+        if (this->type == MergeJoin)
+            return new MergeJoinIterator(left, right, *this->join, this->select_conjunction);
+        return new HashJoinIterator(left, right, *this->join, this->select_conjunction, join_memory);
+    }
+    if (this->type == Sort)
+        return new SortIterator(this->relation->row_iterator(), *this->sort, sort_memory);
+    if (this->type == TopN)
+        return new TopNIterator(this->relation->row_iterator(), *this->sort, *this->limit);
+    if (this->type == Limit)
+        return new LimitIterator(this->relation->row_iterator(), *this->limit);
+    if (this->type == Aggregate) {
+        // a big enough table scan is aggregated a morsel at a time by each of the workers, like in iterator
+        DbRelation *scanned = this->relation->morsel_table();
+        if (scanned != nullptr && max_workers > 1) {
+            uint morsels = (scanned->get_page_count() + HashAggregateIterator::MORSEL_PAGES - 1) /
+                           HashAggregateIterator::MORSEL_PAGES;
+            if (morsels > 1) {
+                EvalPlan *projection = this->relation;
+                ColumnNames column_names = projection->type == Project ? *projection->projection
+                                                                       : scanned->get_column_names();
+                return new HashAggregateIterator(projection, *scanned, column_names, std::min(max_workers, morsels),
+                                                 *this->aggregate, aggregate_memory);
+            }
+        }
+        return new HashAggregateIterator(this->relation->row_iterator(), *this->aggregate, aggregate_memory);
+    }
+    if (this->type == IndexNestedLoopJoin) {
+        // the right side is a projection of the index's table
+        const ValueDict *table_where = this->right->relation->type == Select ? this->right->relation->select_conjunction
+                                                                              : nullptr;
+        return new IndexNestedLoopJoinIterator(this->relation->row_iterator(), *this->right->projected_table(),
+                                               *this->index, table_where, *this->join, this->select_conjunction);
+    }
+    throw DbRelationError("Not implemented: rows of a plan other than a projection, a join, a sort, an aggregate, or "
+                          "a limit");
+}
+
+PipelineIterator *EvalPlan::pipeline_iterator() {
     // base cases
+    if (this->type == Empty)
+        return new FoundIterator(this->relation->table, []() { return new Handles(); });
+    if (this->type == BitmapLookup) {
+        std::vector<BitmapIndex *> *bitmaps = this->bitmaps;
+        ValueDict *where = this->select_conjunction;
+        return new FoundIterator(this->relation->table, [bitmaps, where]() {
+            WahBitmap rows = (*bitmaps)[0]->get_bitmap(where);
+            for (size_t i = 1; i < bitmaps->size() && !rows.empty(); i++)
+                rows = rows & (*bitmaps)[i]->get_bitmap(where);
+            return BitmapIndex::get_handles(rows);
+        });
+    }
+    if (this->type == IndexLookup) {
+        DbIndex *found_by = this->index;
+        ValueDict *key = this->select_conjunction;
+        return new FoundIterator(this->relation->table, [found_by, key]() { return found_by->lookup(key); });
+    }
+    if (this->type == IndexRange) {
+        DbIndex *found_by = this->index;
+        ValueDict *min_key = this->select_conjunction, *max_key = this->max_key;
+        return new FoundIterator(this->relation->table,
+                                 [found_by, min_key, max_key]() { return found_by->range(min_key, max_key); });
+    }
     if (this->type == TableScan)
-        return EvalPipeline(&this->table, this->table.select());
-    if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
+        return new ScanIterator(this->table);
 
     // recursive case
-    if (this->type == Select) {
-        EvalPipeline pipeline = this->relation->pipeline();
-        DbRelation *temp_table = pipeline.first;
-        Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
-        delete handles;
-        return ret;
-    }
+    if (this->type == Select)
+        return new SelectIterator(this->relation->pipeline_iterator(), this->select_conjunction);
 
     throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
 }
 
+// The batches are in the columns of the projection on top, and each operator under it works on batches with all the
+// columns it and the operators under it need (which the projection works out, the selects being all under it).
+BatchIterator *EvalPlan::batch_iterator(const Morsel *morsel) {
+    if (this->type == ProjectAll)
+        return this->relation->batch_iterator(morsel);
+    if (this->type == Project) {
+        BatchIterator *input = this->relation->batch_iterator(morsel);
+        ColumnNames input_columns = *this->projection;
+        for (EvalPlan *plan = this->relation; plan != nullptr; plan = plan->relation)
+            if (plan->type == Select)
+                for (auto const &column: *plan->select_conjunction)
+                    if (find(input_columns.begin(), input_columns.end(), column.first) == input_columns.end())
+                        input_columns.push_back(column.first);
+        try {
+            return new ProjectBatchIterator(input, new_batch(input->get_relation(), input_columns));
+        } catch (DbRelationError &e) {
+            delete input;
+            throw;
+        }
+    }
+    if (this->type == TableScan)
+        return new ScanBatchIterator(this->table, morsel);
+    if (this->type == Select)
+        return new SelectBatchIterator(this->relation->batch_iterator(morsel), this->select_conjunction);
+    if (morsel != nullptr)
+        throw DbRelationError("Not implemented: morsels of a plan other than selects on a table scan");
+    return new RowBatchIterator(pipeline_iterator());  // index lookups and ranges, bitmaps, and Empty
+}
+
+// The table a projection scans, if all it does is selects on a table scan (what can be split into morsels).
+DbRelation *EvalPlan::morsel_table() {
+    EvalPlan *plan = this->relation;
+    while (plan->type == Select)
+        plan = plan->relation;
+    return plan->type == TableScan ? &plan->table : nullptr;
+}
+
+uint EvalPlan::max_workers = std::max(1U, std::thread::hardware_concurrency());
+size_t EvalPlan::join_memory = 64 << 20;
+size_t EvalPlan::sort_memory = 64 << 20;
+size_t EvalPlan::aggregate_memory = 64 << 20;
+
+void EvalPlan::set_max_workers(uint max_workers) {
+    EvalPlan::max_workers = std::max(1U, max_workers);
+}
+
+// Get the rows for an IndexOnlyLookup straight from the index, leaving out any that fail the rest of the select.
+ValueDicts *EvalPlan::lookup_values() {
+    ValueDicts *rows = this->index->lookup_values(this->select_conjunction);
+    ValueDicts *ret = new ValueDicts();
+    for (auto const &row: *rows) {
+        bool selected = true;
+        for (auto const &column: *this->select_conjunction)
+            if (row->at(column.first) != column.second)
+                selected = false;
+        if (selected)
+            ret->push_back(row);
+        else
+            delete row;
+    }
+    delete rows;
+    return ret;
+}
+
+static ValueDicts *test_evaluate(EvalPlan &plan, bool vectorized) {
+    EvalIterator *rows = plan.iterator(vectorized);
+    ValueDicts *ret = new ValueDicts();
+    rows->open();
+    for (ValueDict *row = rows->next(); row != nullptr; row = rows->next())
+        ret->push_back(row);
+    rows->close();
+    delete rows;
+    return ret;
+}
+
+static void test_free(ValueDicts *rows) {
+    for (auto row: *rows)
+        delete row;
+    delete rows;
+}
+
+// Run plan a row at a time, vectorized, and vectorized on several threads, and check they all get the same rows,
+// expected_count of them.
+static bool test_both_ways(EvalPlan &plan, size_t expected_count, const std::string &name) {
+    uint max_workers = EvalPlan::get_max_workers();
+    ValueDicts *by_row = test_evaluate(plan, false);
+    EvalPlan::set_max_workers(1);
+    ValueDicts *by_batch = test_evaluate(plan, true);
+    EvalPlan::set_max_workers(4);
+    ValueDicts *by_morsel = test_evaluate(plan, true);
+    EvalPlan::set_max_workers(max_workers);
+    bool same = by_row->size() == expected_count && by_batch->size() == expected_count &&
+                by_morsel->size() == expected_count;
+    for (size_t i = 0; same && i < expected_count; i++)
+        same = *(*by_row)[i] == *(*by_batch)[i] && *(*by_row)[i] == *(*by_morsel)[i];
+    size_t row_count = by_row->size(), batch_count = by_batch->size(), morsel_count = by_morsel->size();
+    test_free(by_row);
+    test_free(by_batch);
+    test_free(by_morsel);
+    if (!same)
+        return assertion_failure("eval plan " + name, (double) row_count,
+                                 (double) (batch_count == expected_count ? morsel_count : batch_count));
+    return true;
+}
+
+static EvalPlan *test_select(ValueDict where, EvalPlan *relation) {
+    return new EvalPlan(new ValueDict(where), relation);
+}
+
+// The kernels, and then plans evaluated a row at a time and vectorized, which have to agree.
+bool test_eval_plan() {
+    int32_t ints[] = {5, 7, 5, 1, 5, 9, 2, 5};
+    uint16_t selection[] = {0, 1, 2, 3, 4, 5, 6, 7};
+    uint count = select_equal(ints, 8, 5, selection, 8);
+    if (count != 4 || selection[0] != 0 || selection[1] != 2 || selection[2] != 4 || selection[3] != 7)
+        return assertion_failure("select_equal dense", count);
+    selection[1] = 4;
+    selection[2] = 6;
+    count = select_equal(ints, 8, 5, selection, 3);  // 0, 4, 6
+    if (count != 2 || selection[0] != 0 || selection[1] != 4)
+        return assertion_failure("select_equal sparse", count);
+    int32_t gathered[8];
+    uint16_t some[] = {1, 5, 6};
+    gather(ints, 8, some, 3, gathered);
+    if (gathered[0] != 7 || gathered[1] != 9 || gathered[2] != 2)
+        return assertion_failure("gather");
+    if (sum(ints, 8, selection, 8) != 39 || sum(ints, 8, some, 3) != 18)
+        return assertion_failure("sum", (double) sum(ints, 8, some, 3));
+    int32_t lo = INT32_MAX, hi = INT32_MIN;
+    min_max(ints, 8, some, 3, lo, hi);
+    if (lo != 2 || hi != 9)
+        return assertion_failure("min_max", lo, hi);
+
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    column_names.push_back("d");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_eval_plan", column_names, column_attributes);
+    table.create();
+    const int n = 20 * 1000;
+    Handles handles;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i % 10);
+        row["b"] = Value("b" + std::to_string(i % 3));
+        row["c"] = Value(i % 2 == 0);
+        row["c"].data_type = ColumnAttribute::BOOLEAN;
+        row["d"] = Value(i);
+        handles.push_back(table.insert(&row));
+    }
+    size_t expected_a3 = 0, expected_b1_c = 0;
+    int64_t expected_sum = 0;
+    for (int i = 0; i < n; i++) {
+        if (i % 7 == 0) {
+            table.del(handles[i]);  // leave some holes in the blocks
+            continue;
+        }
+        if (i % 10 == 3) {
+            expected_a3++;
+            expected_sum += i;
+        }
+        if (i % 3 == 1 && i % 2 == 0)
+            expected_b1_c++;
+    }
+
+    ValueDict where_a3, where_b1, where_c, where_mismatch;
+    where_a3["a"] = Value(3);
+    where_b1["b"] = Value("b1");
+    where_c["c"] = Value(true);
+    where_c["c"].data_type = ColumnAttribute::BOOLEAN;
+    where_mismatch["a"] = Value("3");
+    ColumnNames *db = new ColumnNames();
+    db->push_back("d");
+    db->push_back("b");
+    EvalPlan all(EvalPlan::ProjectAll, new EvalPlan(table));
+    EvalPlan a3(db, test_select(where_a3, new EvalPlan(table)));
+    EvalPlan b1_c(new ColumnNames(1, "d"), test_select(where_b1, test_select(where_c, new EvalPlan(table))));
+    EvalPlan mismatch(new ColumnNames(1, "d"), test_select(where_mismatch, new EvalPlan(table)));
+    EvalPlan empty(EvalPlan::ProjectAll, new EvalPlan(EvalPlan::Empty, new EvalPlan(table)));
+    bool ok = test_both_ways(all, n - (n + 6) / 7, "all") && test_both_ways(a3, expected_a3, "a = 3") &&
+              test_both_ways(b1_c, expected_b1_c, "b = 'b1' and c") && test_both_ways(mismatch, 0, "a = '3'") &&
+              test_both_ways(empty, 0, "empty");
+
+    if (ok) {  // stop reading part way through, with the workers still going
+        uint max_workers = EvalPlan::get_max_workers();
+        EvalPlan::set_max_workers(4);
+        EvalIterator *rows = all.iterator();
+        rows->open();
+        for (int i = 0; i < 10; i++)
+            delete rows->next();
+        rows->close();
+        delete rows;
+        EvalPlan::set_max_workers(max_workers);
+    }
+    if (ok) {  // an aggregate kernel straight on the batches
+        BatchIterator *batches = a3.batch_iterator();
+        ColumnBatch batch(ColumnNames(1, "d"), ColumnAttributes(1, ColumnAttribute(ColumnAttribute::INT)));
+        int64_t total = 0;
+        batches->open();
+        while (batches->next(batch))
+            total += sum(batch.get_column("d").ints.data(), batch.size(), batch.selection.data(),
+                         (uint) batch.selection.size());
+        batches->close();
+        delete batches;
+        if (total != expected_sum)
+            ok = assertion_failure("sum kernel on batches", (double) total, (double) expected_sum);
+    }
+    table.drop();
+    return ok;
+}
+
+// Scan-filter-project (and a sum) evaluated a row at a time and vectorized.
+void benchmark_eval_plan() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("d");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__benchmark_eval_plan", column_names, column_attributes);
+    table.create();
+    const int n = 200 * 1000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i % 100);
+        row["b"] = Value("row " + std::to_string(i));
+        row["d"] = Value(i);
+        table.insert(&row);
+    }
+    ValueDict where;
+    where["a"] = Value(42);
+    ColumnNames *db = new ColumnNames();
+    db->push_back("d");
+    db->push_back("b");
+    EvalPlan plan(db, test_select(where, new EvalPlan(table)));
+
+    uint max_workers = EvalPlan::get_max_workers();
+    EvalPlan::set_max_workers(1);
+    double seconds[2];
+    size_t rows[2];
+    for (int vectorized = 0; vectorized < 2; vectorized++) {
+        auto start = std::chrono::steady_clock::now();
+        ValueDicts *result = test_evaluate(plan, vectorized == 1);
+        seconds[vectorized] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        rows[vectorized] = result->size();
+        test_free(result);
+    }
+
+    // SELECT SUM(d) ... WHERE a = 42: adding up ValueDicts from the row-at-a-time path, or the sum kernel
+    double sum_seconds[2];
+    int64_t totals[2] = {0, 0};
+    auto start = std::chrono::steady_clock::now();
+    EvalIterator *by_row = plan.iterator(false);
+    by_row->open();
+    for (ValueDict *row = by_row->next(); row != nullptr; row = by_row->next()) {
+        totals[0] += row->at("d").n;
+        delete row;
+    }
+    by_row->close();
+    delete by_row;
+    sum_seconds[0] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    BatchIterator *batches = plan.batch_iterator();
+    ColumnBatch batch(ColumnNames(1, "d"), ColumnAttributes(1, ColumnAttribute(ColumnAttribute::INT)));
+    batches->open();
+    while (batches->next(batch))
+        totals[1] += sum(batch.get_column("d").ints.data(), batch.size(), batch.selection.data(),
+                         (uint) batch.selection.size());
+    batches->close();
+    delete batches;
+    sum_seconds[1] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "scan-filter-project of " << n << " rows (" << rows[1] << " selected): row at a time "
+              << (long) (n / seconds[0]) << " rows/sec, vectorized " << (long) (n / seconds[1]) << " rows/sec"
+              << (rows[0] == rows[1] ? "" : " (DIFFERENT ROWS!)") << "; sum: row at a time "
+              << (long) (n / sum_seconds[0]) << " rows/sec, vectorized " << (long) (n / sum_seconds[1])
+              << " rows/sec" << (totals[0] == totals[1] ? "" : " (DIFFERENT SUMS!)") << std::endl;
+
+    // the same scan-filter-project split into morsels, on more and more worker threads
+    std::cout << "vectorized on worker threads:";
+    for (uint workers = 1; workers <= max_workers; workers *= 2) {
+        if (workers * 2 > max_workers)
+            workers = max_workers;  // and then the most we can have
+        EvalPlan::set_max_workers(workers);
+        auto start = std::chrono::steady_clock::now();
+        ValueDicts *result = test_evaluate(plan, true);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << " " << workers << ": " << (long) (n / elapsed) << " rows/sec"
+                  << (result->size() == rows[1] ? "" : " (DIFFERENT ROWS!)");
+        test_free(result);
+    }
+    std::cout << std::endl;
+    EvalPlan::set_max_workers(max_workers);
+    table.drop();
+}
@@ -7,37 +7,257 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "schema_tables.h"
+#include "ColumnBatch.h"
 
+class BitmapIndex;
 
 typedef std::pair<DbRelation *, Handles *> EvalPipeline;
 
+/**
+ * @struct Morsel - a range of a table's pages, the unit of work a parallel scan hands out to its worker threads
+ */
+struct Morsel {
+    uint first_page, last_page;  // inclusive
+};
+
+/**
+ * @struct JoinSpec - how a join plan matches up the rows of its two sides, and what it calls their columns
+ *
+ * A left row and a right row match when left_keys[i] of the one equals right_keys[i] of the other for every i (a key
+ * column a row doesn't have, i.e., a NULL, matches nothing). The joined row has the columns of both, each under its
+ * name in the side's renames if it's there (so that two columns with the same name, one from each side, can both be
+ * kept, e.g., as "a.id" and "b.id").
+ */
+struct JoinSpec {
+    bool left_outer;  // also keep the left rows that match nothing, with none of the right side's columns (all NULL)
+    ColumnNames left_keys, right_keys;  // as each side's rows name them
+    std::map<Identifier, Identifier> left_renames, right_renames;
+};
+
+/**
+ * @struct SortSpec - the order a sort plan puts its rows in: by columns[0] (descending if descending[0]), then by
+ * columns[1], and so on, with a NULL before any value (after, when descending)
+ */
+struct SortSpec {
+    ColumnNames columns;
+    std::vector<bool> descending;
+};
+
+/**
+ * @struct LimitSpec - which of its rows a limit or top-N plan keeps: limit of them, after skipping the first offset
+ */
+struct LimitSpec {
+    size_t limit;
+    size_t offset;
+};
+
+/**
+ * @struct AggregateSpec - what an aggregate plan gets from its rows: a row for each group of them with the same values
+ * of the group_by columns (a NULL counting as a value of its own here), with those values and the aggregates of the
+ * group's rows, each under its name. With no group_by columns all the rows are one group, which is there even if
+ * there are no rows.
+ *
+ * COUNT of a column counts the rows that have it, and COUNT of no column (COUNT(*)) counts them all. SUM, MIN, MAX,
+ * and AVG are of the rows that have the column, or NULL if none do. SUM and AVG are of INT columns and are INTs, so
+ * AVG is rounded toward zero.
+ */
+struct AggregateSpec {
+    enum Function {
+        Count, Sum, Min, Max, Avg
+    };
+    struct Aggregate {
+        Function function;
+        Identifier column;  // empty for COUNT(*)
+        Identifier name;
+    };
+    ColumnNames group_by;
+    std::vector<Aggregate> aggregates;
+};
+
+/**
+ * @class PipelineIterator - pulls the handles of the rows a plan selects, one at a time (open, next, ..., close)
+ *
+ * Each kind of plan under a projection has one, and each one pulls from the iterator of the plan under it, so rows
+ * flow from the scan up to the output without every step holding all of them (the "Volcano" model). A table scan
+ * reads one page at a time (see DbRelation::select_page) and a select checks its rows a small batch at a time;
+ * an index lookup or range hands out the handles the index found.
+ */
+class PipelineIterator {
+public:
+    virtual ~PipelineIterator() {}
+
+    virtual void open() = 0;
+
+    /**
+     * Get the next row.
+     * @param handle  set to the row's handle
+     * @returns       false if there are no more rows
+     */
+    virtual bool next(Handle &handle) = 0;
+
+    virtual void close() = 0;
+
+    /**
+     * The relation the handles are for.
+     */
+    virtual DbRelation &get_relation() = 0;
+};
+
+/**
+ * @class BatchIterator - pulls the rows a plan selects a ColumnBatch at a time (open, next, ..., close)
+ *
+ * The vectorized version of PipelineIterator: a table scan decodes whole pages straight into the batch's column
+ * vectors, a select narrows the batch's selection vector with a kernel per column, and a projection gathers what's
+ * left to the front. Any other plan is read a row at a time into batches.
+ */
+class BatchIterator {
+public:
+    virtual ~BatchIterator() {}
+
+    virtual void open() = 0;
+
+    /**
+     * Get the next batch of rows.
+     * @param batch  cleared and filled with them (at least one is selected)
+     * @returns      false if there are no more rows
+     */
+    virtual bool next(ColumnBatch &batch) = 0;
+
+    virtual void close() = 0;
+
+    /**
+     * The relation the rows are from.
+     */
+    virtual DbRelation &get_relation() = 0;
+};
+
+/**
+ * @class EvalIterator - pulls the rows of a projection plan, one at a time (open, next, ..., close)
+ */
+class EvalIterator {
+public:
+    virtual ~EvalIterator() {}
+
+    virtual void open() = 0;
+
+    /**
+     * Get the next row.
+     * @returns  the row's values (freed by caller), or nullptr if there are no more rows
+     */
+    virtual ValueDict *next() = 0;
+
+    virtual void close() = 0;
+};
+
 class EvalPlan {
 public:
     enum PlanType {
-        ProjectAll, Project, Select, TableScan
+        ProjectAll, Project, Select, TableScan, IndexOnlyLookup, Empty, BitmapLookup, IndexLookup, IndexRange,
+        HashJoin, IndexNestedLoopJoin, MergeJoin, Sort, Aggregate, Limit, TopN
     };
 
-    EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
+    EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll and Empty, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
     EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(DbIndex &index, ValueDict *conjunction);  // use for IndexOnlyLookup
+    EvalPlan(std::vector<BitmapIndex *> *bitmaps, ValueDict *conjunction, EvalPlan *relation);  // use for BitmapLookup
+    EvalPlan(DbIndex &index, ValueDict *key, EvalPlan *relation);  // use for IndexLookup
+    EvalPlan(DbIndex &index, ValueDict *min_key, ValueDict *max_key, EvalPlan *relation);  // use for IndexRange
+    EvalPlan(DbIndex &index, JoinSpec *join, ValueDict *where, EvalPlan *left, EvalPlan *right);  // use for index joins
+    EvalPlan(SortSpec *sort, EvalPlan *relation);  // use for Sort (of a projection or a join)
+    EvalPlan(AggregateSpec *aggregate, EvalPlan *relation);  // use for Aggregate (of a projection)
+    EvalPlan(LimitSpec *limit, EvalPlan *relation);  // use for Limit (of a projection, join, sort, or aggregate)
+    EvalPlan(SortSpec *sort, LimitSpec *limit, EvalPlan *relation);  // use for TopN (a Limit of a Sort)
+    EvalPlan(PlanType type, JoinSpec *join, ValueDict *where, EvalPlan *left, EvalPlan *right);  // use for other joins
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
-    // Attempt to get the best equivalent evaluation plan
-    EvalPlan *optimize();
+    // Attempt to get the best equivalent evaluation plan, using whichever of the tables' indices help
+    EvalPlan *optimize(Indices &indices);
 
     // Evaluate the plan: evaluate gets values, pipeline gets handles
     ValueDicts *evaluate();
 
     EvalPipeline pipeline();
 
+    // Or evaluate it a row at a time: iterator for a projection, pipeline_iterator for the plans under one (the plan
+    // has to outlive the iterator, which is freed by caller). The vectorized iterator gets its rows from
+    // batch_iterator instead of pulling them through the plan one at a time and, for a big enough table scan, runs
+    // it on up to get_max_workers() threads, each taking a morsel of the table at a time. A batch_iterator given a
+    // morsel scans just that morsel's pages (whatever they are when it's opened).
+    EvalIterator *iterator(bool vectorized = true);
+
+    PipelineIterator *pipeline_iterator();
+
+    BatchIterator *batch_iterator(const Morsel *morsel = nullptr);
+
+    // The rows a join, sort, aggregate, or limit plan gets, or a projection plan under one, with all of their columns
+    // (freed by caller)
+    EvalIterator *row_iterator();
+
+    // Most threads one query is run on at once (1 runs every query on the caller's thread); starts out as the
+    // number of cores
+    static uint get_max_workers() { return max_workers; }
+
+    static void set_max_workers(uint max_workers);
+
+    // About how many bytes of rows a join may hold in memory before it spills them to disk (see HashJoinIterator)
+    static size_t get_join_memory() { return join_memory; }
+
+    static void set_join_memory(size_t join_memory) { EvalPlan::join_memory = join_memory; }
+
+    // About how many bytes of rows a sort may hold in memory before it spills them to disk (see SortIterator)
+    static size_t get_sort_memory() { return sort_memory; }
+
+    static void set_sort_memory(size_t sort_memory) { EvalPlan::sort_memory = sort_memory; }
+
+    // About how many bytes of groups an aggregate may hold in memory before it spills them to disk (see
+    // HashAggregateIterator)
+    static size_t get_aggregate_memory() { return aggregate_memory; }
+
+    static void set_aggregate_memory(size_t aggregate_memory) { EvalPlan::aggregate_memory = aggregate_memory; }
+
 protected:
 
     PlanType type;
-    EvalPlan *relation;  // for everything except TableScan
+    EvalPlan *relation;  // for everything except TableScan (the left side of a join)
+    EvalPlan *right;  // for joins
+    JoinSpec *join;  // for joins
+    SortSpec *sort;  // for Sort and TopN
+    AggregateSpec *aggregate;  // for Aggregate
+    LimitSpec *limit;  // for Limit and TopN
     ColumnNames *projection;  // for Project
-    ValueDict *select_conjunction;  // for Select
+    ValueDict *select_conjunction;  // for Select, IndexOnlyLookup, BitmapLookup, IndexLookup, and IndexRange (min),
+                                    // and for a join, a select on the joined rows (or null)
     DbRelation &table;  // for TableScan
+    DbIndex *index;  // for IndexOnlyLookup, IndexLookup, IndexRange, and IndexNestedLoopJoin (of the right side's
+                     // table, which is a projection of a table scan, maybe with a select)
+    std::vector<BitmapIndex *> *bitmaps;  // for BitmapLookup
+    ValueDict *max_key;  // for IndexRange
+    static uint max_workers;
+    static size_t join_memory;
+    static size_t sort_memory;
+    static size_t aggregate_memory;
+
+    ValueDicts *lookup_values();
+
+    EvalPlan *optimize_select(Indices &indices);
+
+    EvalPlan *optimize_join(Indices &indices);
+
+    uint scan_pages() const;
+
+    DbRelation *projected_table() const;
+
+    DbIndex *ordering_index(Indices &indices, const ColumnNames &keys, bool any_order) const;
+
+    EvalPlan *ordered_scan(DbIndex &index) const;
+
+    DbRelation *morsel_table();
 };
 
+bool test_eval_plan();
+
+void benchmark_eval_plan();
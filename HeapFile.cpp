@@ -10,6 +10,18 @@
 using namespace std;
 typedef uint16_t u16;
 
+/**
+ * A SlottedPage in its own copy of the block (rather than in memory Berkeley DB reuses on the next call).
+ */
+class PrivateSlottedPage : public SlottedPage {
+public:
+    PrivateSlottedPage(Dbt &block, BlockID block_id, bool is_new = false) : SlottedPage(block, block_id, is_new) {}
+
+    virtual ~PrivateSlottedPage() {
+        delete[] (char *) this->block.get_data();
+    }
+};
+
 /**
  * Constructor
  * @param name
@@ -56,19 +68,17 @@ void HeapFile::close(void) {
  * @return the new empty DbBlock that is managing the records in this block and its block id.
  */
 SlottedPage *HeapFile::get_new(void) {
-    char block[DbBlock::BLOCK_SZ];
-    memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
+    char *block = new char[DbBlock::BLOCK_SZ];
+    memset(block, 0, DbBlock::BLOCK_SZ);
+    Dbt data(block, DbBlock::BLOCK_SZ);
 
     int block_id = ++this->last;
     Dbt key(&block_id, sizeof(block_id));
 
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage *page = new SlottedPage(data, this->last, true);
+    // write out an empty block (the page keeps our copy of it)
+    SlottedPage *page = new PrivateSlottedPage(data, (BlockID) block_id, true);
     this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
-    delete page;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, this->last);
+    return page;
 }
 
 /**
@@ -78,9 +88,11 @@ SlottedPage *HeapFile::get_new(void) {
  */
 SlottedPage *HeapFile::get(BlockID block_id) {
     Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
+    Dbt data(new char[DbBlock::BLOCK_SZ], DbBlock::BLOCK_SZ);
+    data.set_ulen(DbBlock::BLOCK_SZ);
+    data.set_flags(DB_DBT_USERMEM);  // copy into our memory
     this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, block_id, false);
+    return new PrivateSlottedPage(data, block_id, false);
 }
 
 /**
@@ -124,7 +136,7 @@ void HeapFile::db_open(uint flags) {
     if (!this->closed)
         return;
     this->db.set_re_len(DbBlock::BLOCK_SZ); // record length - will be ignored if file already exists
-    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0644);
+    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags | DB_THREAD, 0644);
 
     this->last = flags ? 0 : get_block_count();
     this->closed = false;
@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include <atomic>
 #include "db_cxx.h"
 #include "SlottedPage.h"
 
@@ -18,6 +19,9 @@
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
         for buffer management and file management.
         Uses SlottedPage for storing records within blocks.
+
+        Each block we hand out is a private copy, so any number of them can be in use at once and get, get_new,
+        and put can all be called from several threads (the Berkeley DB handle is opened DB_THREAD).
  */
 class HeapFile : public DbFile {
 public:
@@ -57,7 +61,7 @@ public:
 
 protected:
     std::string dbfilename;
-    uint32_t last;
+    std::atomic<uint32_t> last;
     bool closed;
     Db db;
 
@@ -3,8 +3,10 @@
  * @author K Lundeen
  * @see Seattle University, CPSC5300
  */
+#include <algorithm>
 #include <cstring>
 #include "HeapTable.h"
+#include "ColumnBatch.h"
 
 using namespace std;
 typedef uint16_t u16;
@@ -147,6 +149,87 @@ Handles *HeapTable::select(Handles *current_selection, const ValueDict *where) {
     return handles;
 }
 
+/**
+ * Select the rows in one block
+ * @param page  block id
+ * @return      list of the handles of the block's rows, or nullptr past the last block
+ */
+Handles *HeapTable::select_page(uint page) {
+    open();
+    if (page > file.get_last_block_id())
+        return nullptr;
+    Handles *handles = new Handles();
+    SlottedPage *block = file.get(page);
+    RecordIDs *record_ids = block->ids();
+    for (auto const &record_id: *record_ids)
+        handles->push_back(Handle(page, record_id));
+    delete record_ids;
+    delete block;
+    return handles;
+}
+
+/**
+ * Unmarshal the rows in one block straight into a batch's column vectors
+ * @param page   block id
+ * @param batch  where to add the rows (just its columns)
+ * @return       false past the last block
+ */
+bool HeapTable::select_page(uint page, ColumnBatch &batch) {
+    open();
+    if (page > file.get_last_block_id())
+        return false;
+    vector<ColumnVector *> targets;  // where each of our columns goes in the batch (null if it doesn't)
+    const ColumnNames &wanted = batch.get_column_names();
+    for (auto const &column_name: this->column_names) {
+        bool is_wanted = find(wanted.begin(), wanted.end(), column_name) != wanted.end();
+        targets.push_back(is_wanted ? &batch.get_column(column_name) : nullptr);
+    }
+    SlottedPage *block = file.get(page);
+    RecordIDs *record_ids = block->ids();
+    uint slot = batch.grow((uint) record_ids->size());
+    for (auto const &record_id: *record_ids) {
+        Dbt *data = block->get(record_id);
+        const char *bytes = (const char *) data->get_data();
+        uint offset = 0;
+        for (uint col_num = 0; col_num < targets.size(); col_num++) {
+            ColumnVector *target = targets[col_num];
+            ColumnAttribute::DataType data_type = this->column_attributes[col_num].get_data_type();
+            if (data_type == ColumnAttribute::DataType::INT) {
+                if (target != nullptr)
+                    target->ints[slot] = *(int32_t *) (bytes + offset);
+                offset += sizeof(int32_t);
+            } else if (data_type == ColumnAttribute::DataType::TEXT) {
+                u16 size = *(u16 *) (bytes + offset);
+                offset += sizeof(u16);
+                if (target != nullptr)
+                    target->texts[slot].assign(bytes + offset, size);
+                offset += size;
+            } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+                if (target != nullptr)
+                    target->ints[slot] = *(uint8_t *) (bytes + offset);
+                offset += sizeof(uint8_t);
+            } else {
+                throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+            }
+        }
+        delete data;
+        batch.handles[slot] = Handle(page, record_id);
+        batch.selection.push_back((uint16_t) slot++);
+    }
+    delete record_ids;
+    delete block;
+    return true;
+}
+
+/**
+ * Number of blocks in the table's file
+ * @return  the last block id
+ */
+uint HeapTable::get_page_count() {
+    open();
+    return file.get_last_block_id();
+}
+
 /**
  * Project all columns from a given row.
  * @param handle row to be projected
@@ -51,6 +51,12 @@ public:
 
     virtual Handles* select(Handles *current_selection, const ValueDict* where);
 
+    virtual Handles *select_page(uint page);
+
+    virtual bool select_page(uint page, ColumnBatch &batch);
+
+    virtual uint get_page_count();
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
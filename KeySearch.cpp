@@ -0,0 +1,176 @@
+/**
+ * @file KeySearch.cpp - implementation of the int32 key search kernels
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "SlottedPage.h"
+#include "KeySearch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEY_SEARCH_X86
+#endif
+
+using namespace std;
+
+static const uint LINEAR_MAX = 32;  // binary search until there are no more than this many keys left to scan
+
+const KeySearch::Kernel KeySearch::kernel = KeySearch::pick_kernel();
+
+// Use the widest kernel this CPU can run.
+KeySearch::Kernel KeySearch::pick_kernel() {
+#ifdef KEY_SEARCH_X86
+    __builtin_cpu_init();  // we run before main, maybe before the runtime has looked at the CPU
+    if (__builtin_cpu_supports("avx2"))
+        return lower_bound_avx2;
+    return lower_bound_sse2;  // every x86-64 has SSE2
+#else
+    return lower_bound_scalar;
+#endif
+}
+
+const char *KeySearch::kernel_name() {
+    if (kernel == lower_bound_avx2)
+        return "avx2";
+    if (kernel == lower_bound_sse2)
+        return "sse2";
+    return "scalar";
+}
+
+// Pad with zero bytes, then undo the sign flip (see NormalizedKey::encode).
+int32_t KeySearch::to_int(const char *bytes, uint size) {
+    uint32_t n = 0;
+    for (uint i = 0; i < 4; i++)
+        n = (n << 8) | (i < size ? (unsigned char) bytes[i] : 0U);
+    return (int32_t) (n ^ 0x80000000U);
+}
+
+static int32_t key_at(const char *keys, uint i) {
+    int32_t key;
+    memcpy(&key, keys + i * sizeof(int32_t), sizeof(int32_t));
+    return key;
+}
+
+// Binary search keys[low..high) for key until no more than LINEAR_MAX are left.
+static void narrow(const char *keys, uint &low, uint &high, int32_t key) {
+    while (high - low > LINEAR_MAX) {
+        uint mid = (low + high) / 2;
+        if (key_at(keys, mid) < key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+}
+
+uint KeySearch::lower_bound_scalar(const char *keys, uint n, int32_t key) {
+    uint low = 0, high = n;
+    narrow(keys, low, high, key);
+    while (low < high && key_at(keys, low) < key)
+        low++;
+    return low;
+}
+
+#ifdef KEY_SEARCH_X86
+
+// Compare four keys at a time. Since they're sorted, the ones less than key are the leading lanes, so the first
+// group that isn't all less has the answer in it.
+uint KeySearch::lower_bound_sse2(const char *keys, uint n, int32_t key) {
+    uint low = 0, high = n;
+    narrow(keys, low, high, key);
+    __m128i target = _mm_set1_epi32(key);
+    for (; low + 4 <= high; low += 4) {
+        __m128i group = _mm_loadu_si128((const __m128i *) (keys + low * sizeof(int32_t)));
+        int less = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(group, target)));
+        if (less != 0xF)
+            return low + __builtin_popcount(less);
+    }
+    while (low < high && key_at(keys, low) < key)
+        low++;
+    return low;
+}
+
+// Same thing, eight keys at a time.
+__attribute__((target("avx2")))
+uint KeySearch::lower_bound_avx2(const char *keys, uint n, int32_t key) {
+    uint low = 0, high = n;
+    narrow(keys, low, high, key);
+    __m256i target = _mm256_set1_epi32(key);
+    for (; low + 8 <= high; low += 8) {
+        __m256i group = _mm256_loadu_si256((const __m256i *) (keys + low * sizeof(int32_t)));
+        int less = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(target, group)));
+        if (less != 0xFF)
+            return low + __builtin_popcount(less);
+    }
+    while (low < high && key_at(keys, low) < key)
+        low++;
+    return low;
+}
+
+#else
+
+uint KeySearch::lower_bound_sse2(const char *keys, uint n, int32_t key) {
+    return lower_bound_scalar(keys, n, key);
+}
+
+uint KeySearch::lower_bound_avx2(const char *keys, uint n, int32_t key) {
+    return lower_bound_scalar(keys, n, key);
+}
+
+#endif
+
+/**
+ * Testing function for KeySearch: every kernel against std::lower_bound, and to_int against the key order.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_key_search() {
+    mt19937 rng(5300);
+    vector<KeySearch::Kernel> kernels;
+    kernels.push_back(KeySearch::lower_bound_scalar);
+    kernels.push_back(KeySearch::lower_bound_sse2);
+#ifdef KEY_SEARCH_X86
+    if (__builtin_cpu_supports("avx2"))
+#endif
+        kernels.push_back(KeySearch::lower_bound_avx2);
+    for (uint n = 0; n < 300; n += 1 + n / 8) {
+        vector<int32_t> keys;
+        for (uint i = 0; i < n; i++)
+            keys.push_back(i % 5 == 0 ? (int32_t) rng() : (int32_t) (rng() % 100) - 50);  // some duplicates
+        if (n > 2) {
+            keys[0] = INT32_MIN;
+            keys[1] = INT32_MAX;
+        }
+        sort(keys.begin(), keys.end());
+        const char *bytes = (const char *) keys.data();
+        for (int probe = 0; probe < 200; probe++) {
+            int32_t key = probe < 100 ? (int32_t) (probe - 50) : (int32_t) rng();
+            if (probe == 0)
+                key = INT32_MIN;
+            if (probe == 1)
+                key = INT32_MAX;
+            uint expected = (uint) (std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+            for (auto const &kernel: kernels)
+                if (kernel(bytes, n, key) != expected)
+                    return assertion_failure("key search lower bound", n, key);
+            expected = (uint) (std::upper_bound(keys.begin(), keys.end(), key) - keys.begin());
+            if (KeySearch::upper_bound(bytes, n, key) != expected)
+                return assertion_failure("key search upper bound", n, key);
+        }
+    }
+
+    KeyProfile key_profile(1, ColumnAttribute::INT);
+    int32_t ints[] = {INT32_MIN, -70000, -256, -1, 0, 1, 255, 256, 70000, INT32_MAX};
+    for (auto const &n: ints) {
+        KeyValue key(1, Value(n));
+        KeyBytes bytes = NormalizedKey::encode(&key, key_profile);
+        if (KeySearch::to_int(bytes) != n)
+            return assertion_failure("key search to_int", n);
+        for (uint size = 1; size < 4; size++)  // a separator cut off here has to stay on the same side of n
+            if (KeySearch::to_int(bytes.data(), size) > n)
+                return assertion_failure("key search truncated to_int", n, size);
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file KeySearch.h - search kernels for the int32 key arrays kept in B-tree nodes with a single INT key
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "NormalizedKey.h"
+
+/**
+ * @class KeySearch - lower/upper bound on a sorted array of int32 keys
+ *
+ * A node whose KeyProfile is a single INT keeps all its keys in one record as a contiguous array of int32 (see
+ * BTreeNode::has_int_keys), so it can be searched without touching the per-entry records. The search narrows the
+ * range with a binary search and then finishes with a vector compare across the last few keys: AVX2 (8 keys at a
+ * time) if the CPU has it, otherwise SSE2 (4 at a time), otherwise a plain loop. The array is read straight out of
+ * the block, so it need not be aligned.
+ */
+class KeySearch {
+public:
+    /**
+     * Index of the first key not less than key (n if there isn't one).
+     */
+    static uint lower_bound(const char *keys, uint n, int32_t key) { return kernel(keys, n, key); }
+
+    /**
+     * Index of the first key greater than key (n if there isn't one).
+     */
+    static uint upper_bound(const char *keys, uint n, int32_t key) {
+        return key == INT32_MAX ? n : kernel(keys, n, key + 1);
+    }
+
+    /**
+     * The int32 value of a normalized INT key. A truncated key (a separator, see NormalizedKey::shortest_separator)
+     * is padded with zero bytes, which keeps it in the same place relative to every full key.
+     */
+    static int32_t to_int(const char *bytes, uint size);
+
+    static int32_t to_int(const KeyBytes &key) { return to_int(key.data(), (uint) key.size()); }
+
+    /**
+     * Which kernel is in use: "avx2", "sse2", or "scalar".
+     */
+    static const char *kernel_name();
+
+    // the kernels themselves, all with the same results (lower_bound uses the best one this CPU can run)
+    typedef uint (*Kernel)(const char *keys, uint n, int32_t key);
+
+    static uint lower_bound_scalar(const char *keys, uint n, int32_t key);
+
+    static uint lower_bound_sse2(const char *keys, uint n, int32_t key);
+
+    static uint lower_bound_avx2(const char *keys, uint n, int32_t key);
+
+protected:
+    static const Kernel kernel;
+
+    static Kernel pick_kernel();
+};
+
+bool test_key_search();
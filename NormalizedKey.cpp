@@ -0,0 +1,153 @@
+/**
+ * @file NormalizedKey.cpp - implementation of the order-preserving key encoding
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include "SlottedPage.h"
+#include "NormalizedKey.h"
+
+using namespace std;
+
+static const uint32_t SIGN_FLIP = 0x80000000U;
+static const char TEXT_ESCAPE = '\x00';
+static const char TEXT_ESCAPED_NUL = '\xFF';
+static const char TEXT_TERMINATOR = '\x00';
+
+// Convert KeyValue into normalized bytes.
+KeyBytes NormalizedKey::encode(const KeyValue *key, const KeyProfile &key_profile) {
+    KeyBytes bytes;
+    uint col_num = 0;
+    for (auto const &data_type: key_profile) {
+        if (col_num == key->size())
+            break;  // just the leading columns, so a prefix of the full key
+        const Value &value = (*key)[col_num++];
+        if (value.data_type != data_type)
+            throw DbRelationError("index key value isn't of its column's type");
+
+        if (data_type == ColumnAttribute::DataType::INT) {
+            uint32_t n = (uint32_t) value.n ^ SIGN_FLIP;
+            bytes.push_back((char) (n >> 24));
+            bytes.push_back((char) (n >> 16));
+            bytes.push_back((char) (n >> 8));
+            bytes.push_back((char) n);
+
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            for (auto const &c: value.s) {
+                bytes.push_back(c);
+                if (c == TEXT_ESCAPE)
+                    bytes.push_back(TEXT_ESCAPED_NUL);
+            }
+            bytes.push_back(TEXT_ESCAPE);
+            bytes.push_back(TEXT_TERMINATOR);
+
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            bytes.push_back((char) (value.n != 0 ? 1 : 0));
+
+        } else {
+            throw DbRelationError("only know how to encode INT, TEXT, or BOOLEAN for an index key");
+        }
+        if (bytes.size() > DbBlock::BLOCK_SZ / 4)
+            throw DbRelationError("index key too big to marshal");
+    }
+    return bytes;
+}
+
+// Convert normalized bytes back into a KeyValue.
+KeyValue *NormalizedKey::decode(const char *bytes, uint size, const KeyProfile &key_profile) {
+    KeyValue *key_value = new KeyValue();
+    Value value;
+    uint offset = 0;
+    for (auto const &data_type: key_profile) {
+        if (offset >= size)
+            break;  // truncated key
+        value.data_type = data_type;
+        if (data_type == ColumnAttribute::DataType::INT) {
+            uint32_t n = 0;
+            for (uint i = 0; i < 4; i++)
+                n = (n << 8) | (offset + i < size ? (unsigned char) bytes[offset + i] : 0U);
+            value.n = (int32_t) (n ^ SIGN_FLIP);
+            offset += 4;
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            value.s.clear();
+            while (offset + 1 < size && !(bytes[offset] == TEXT_ESCAPE && bytes[offset + 1] == TEXT_TERMINATOR)) {
+                value.s.push_back(bytes[offset]);
+                offset += bytes[offset] == TEXT_ESCAPE ? 2 : 1;
+            }
+            offset += 2;
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            value.n = bytes[offset];
+            offset += 1;
+        } else {
+            delete key_value;
+            throw DbRelationError("only know how to decode INT, TEXT, or BOOLEAN for an index key");
+        }
+        key_value->push_back(value);
+    }
+    return key_value;
+}
+
+// Count the leading bytes in common.
+uint NormalizedKey::common_prefix_size(const KeyBytes &a, const KeyBytes &b) {
+    uint n = (uint) (a.size() < b.size() ? a.size() : b.size());
+    uint i = 0;
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
+
+// Keep just enough of right to be greater than left.
+KeyBytes NormalizedKey::shortest_separator(const KeyBytes &left, const KeyBytes &right) {
+    // right and left agree up to the common prefix and then right is either greater at the next byte or
+    // left has run out, so one more byte of right is enough either way
+    return right.substr(0, common_prefix_size(left, right) + 1);
+}
+
+/**
+ * Testing function for NormalizedKey: checks that the byte order agrees with the KeyValue order.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_normalized_key() {
+    KeyProfile key_profile;
+    key_profile.push_back(ColumnAttribute::INT);
+    key_profile.push_back(ColumnAttribute::TEXT);
+
+    int32_t ints[] = {INT32_MIN, -70000, -1, 0, 1, 255, 256, 70000, INT32_MAX};
+    string texts[] = {"", string(1, '\0'), string("a\0b", 3), "a", "ab", "b", "\xff"};
+    vector<KeyValue> keys;
+    for (auto const &n: ints)
+        for (auto const &s: texts) {
+            KeyValue key;
+            key.push_back(Value(n));
+            key.push_back(Value(s));
+            keys.push_back(key);
+        }
+    for (auto const &a: keys) {
+        KeyBytes a_bytes = NormalizedKey::encode(&a, key_profile);
+        KeyValue *decoded = NormalizedKey::decode(a_bytes.data(), (uint) a_bytes.size(), key_profile);
+        bool round_trip = *decoded == a;
+        delete decoded;
+        if (!round_trip)
+            return assertion_failure("normalized key round trip", a[0].n);
+        for (auto const &b: keys) {
+            KeyBytes b_bytes = NormalizedKey::encode(&b, key_profile);
+            int cmp = NormalizedKey::compare(a_bytes, b_bytes);
+            bool unsigned_text_less = a[0].n < b[0].n || (a[0].n == b[0].n && a[1].s < b[1].s);
+            if ((cmp < 0) != unsigned_text_less || (cmp == 0) != (a == b))
+                return assertion_failure("normalized key order", a[0].n, b[0].n);
+            if (cmp < 0) {
+                KeyBytes separator = NormalizedKey::shortest_separator(a_bytes, b_bytes);
+                if (NormalizedKey::compare(a_bytes, separator) >= 0 || NormalizedKey::compare(separator, b_bytes) > 0)
+                    return assertion_failure("normalized key separator", a[0].n, b[0].n);
+            }
+        }
+    }
+
+    KeyValue mismatch;
+    mismatch.push_back(Value("1"));
+    try {
+        NormalizedKey::encode(&mismatch, key_profile);
+        return assertion_failure("normalized key of the wrong type");
+    } catch (DbRelationError &e) {
+    }
+    return true;
+}
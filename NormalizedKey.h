@@ -0,0 +1,81 @@
+/**
+ * @file NormalizedKey.h - order-preserving binary encoding for (composite) search keys
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <cstring>
+#include <string>
+#include "storage_engine.h"
+
+typedef std::vector<ColumnAttribute::DataType> KeyProfile;
+typedef std::vector<Value> KeyValue;
+typedef std::string KeyBytes;  // normalized key: byte-wise (memcmp) order is the same as KeyValue order
+
+/**
+ * @class NormalizedKey - encodes a KeyValue into bytes whose memcmp order matches the order of the values
+ *
+ * Each component is encoded according to its data type in the KeyProfile and the components are concatenated:
+ *      INT:     4 bytes, big-endian, with the sign bit flipped (so negatives sort before positives)
+ *      TEXT:    the characters, with any 0x00 escaped as 0x00 0xFF, followed by the terminator 0x00 0x00
+ *               (so a string sorts before any longer string it is a prefix of)
+ *      BOOLEAN: 1 byte, 0x00 for false, 0x01 for true
+ *
+ * Since the encoding is order-preserving, node search, splits, and sorting can all be done on the raw bytes
+ * with the single comparison primitive, NormalizedKey::compare.
+ */
+class NormalizedKey {
+public:
+    /**
+     * Encode a key. If key has fewer values than key_profile, the result is the prefix of the encoding of any full
+     * key that starts with those values.
+     * @param key          values of the key, in key_profile order
+     * @param key_profile  data types of the key components
+     * @returns            the normalized bytes
+     * @throws             DbRelationError if the key is too big, of an unknown type, or not of key_profile's types
+     */
+    static KeyBytes encode(const KeyValue *key, const KeyProfile &key_profile);
+
+    /**
+     * Decode a key previously created by encode. A truncated key (see shortest_separator) decodes into
+     * just the components (or partial components) it has bytes for.
+     * @param bytes        normalized bytes
+     * @param size         number of bytes
+     * @param key_profile  data types of the key components
+     * @returns            the key values (freed by caller)
+     */
+    static KeyValue *decode(const char *bytes, uint size, const KeyProfile &key_profile);
+
+    /**
+     * Compare two normalized keys.
+     * @returns  negative, zero, or positive as a is less than, equal to, or greater than b
+     */
+    static int compare(const char *a, uint a_size, const char *b, uint b_size) {
+        int cmp = memcmp(a, b, a_size < b_size ? a_size : b_size);
+        if (cmp != 0)
+            return cmp;
+        return a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+    }
+
+    static int compare(const KeyBytes &a, const KeyBytes &b) {
+        return compare(a.data(), (uint) a.size(), b.data(), (uint) b.size());
+    }
+
+    /**
+     * Number of leading bytes a and b have in common.
+     */
+    static uint common_prefix_size(const KeyBytes &a, const KeyBytes &b);
+
+    /**
+     * Get the shortest separator, s, such that left < s <= right (suffix truncation of right).
+     * Note that the separator is generally not a full key, so it only makes sense for comparisons.
+     * @param left   a key
+     * @param right  a key greater than left
+     * @returns      the shortest prefix of right that is still greater than left
+     */
+    static KeyBytes shortest_separator(const KeyBytes &left, const KeyBytes &right);
+};
+
+bool test_normalized_key();
@@ -5,8 +5,13 @@
  * @author Erika Skornia-Olsen
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
 #include "SQLExec.h"
 #include "EvalPlan.h"
+#include "bloom_index.h"
 
 using namespace std;
 using namespace hsql;
@@ -16,6 +21,32 @@ Tables *SQLExec::tables = nullptr;
 Indices *SQLExec::indices = nullptr;
 
 // make query result be printable
+static void print_row(ostream &out, const ColumnNames &column_names, const ValueDict *row) {
+    for (auto const &column_name: column_names) {
+        ValueDict::const_iterator column = row->find(column_name);
+        if (column == row->end()) {
+            out << "NULL ";  // e.g., the right side's columns of a left outer join's row that matched nothing
+            continue;
+        }
+        Value value = column->second;
+        switch (value.data_type) {
+            case ColumnAttribute::INT:
+                out << value.n;
+                break;
+            case ColumnAttribute::TEXT:
+                out << "\"" << value.s << "\"";
+                break;
+            case ColumnAttribute::BOOLEAN:
+                out << (value.n == 0 ? "false" : "true");
+                break;
+            default:
+                out << "???";
+        }
+        out << " ";
+    }
+    out << endl;
+}
+
 ostream &operator<<(ostream &out, const QueryResult &qres) {
     if (qres.column_names != nullptr) {
         for (auto const &column_name: *qres.column_names)
@@ -24,25 +55,22 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
         for (unsigned int i = 0; i < qres.column_names->size(); i++)
             out << "----------+";
         out << endl;
-        for (auto const &row: *qres.rows) {
-            for (auto const &column_name: *qres.column_names) {
-                Value value = row->at(column_name);
-                switch (value.data_type) {
-                    case ColumnAttribute::INT:
-                        out << value.n;
-                        break;
-                    case ColumnAttribute::TEXT:
-                        out << "\"" << value.s << "\"";
-                        break;
-                    case ColumnAttribute::BOOLEAN:
-                        out << (value.n == 0 ? "false" : "true");
-                        break;
-                    default:
-                        out << "???";
-                }
-                out << " ";
+        if (qres.plan != nullptr) {
+            // pull the rows through the plan as we go
+            EvalIterator *rows = qres.plan->iterator();
+            size_t count = 0;
+            rows->open();
+            for (ValueDict *row = rows->next(); row != nullptr; row = rows->next()) {
+                print_row(out, *qres.column_names, row);
+                delete row;
+                count++;
             }
-            out << endl;
+            rows->close();
+            delete rows;
+            out << "successfully return " << count << " rows";
+        } else {
+            for (auto const &row: *qres.rows)
+                print_row(out, *qres.column_names, row);
         }
     }
     out << qres.message;
@@ -59,10 +87,11 @@ QueryResult::~QueryResult() {
             delete row;
         delete rows;
     }
+    delete plan;
 }
 
 
-QueryResult *SQLExec::execute(const SQLStatement *statement) {
+QueryResult *SQLExec::execute(const SQLStatement *statement, const ColumnNames *include) {
     // initialize _tables table, if not yet present
     if (SQLExec::tables == nullptr) {
         SQLExec::tables = new Tables();
@@ -72,7 +101,7 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) {
     try {
         switch (statement->type()) {
             case kStmtCreate:
-                return create((const CreateStatement *) statement);
+                return create((const CreateStatement *) statement, include);
             case kStmtDrop:
                 return drop((const DropStatement *) statement);
             case kStmtShow:
@@ -91,6 +120,84 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) {
     }
 }
 
+static const char *const BLANKS = " \t\n";
+
+// Check if word is at pos in upper, as a whole word.
+static bool word_at(const string &upper, size_t pos, const string &word) {
+    size_t after = pos + word.size();
+    return pos < upper.size() && upper.compare(pos, word.size(), word) == 0 &&
+           (after == upper.size() || (!isalnum((unsigned char) upper[after]) && upper[after] != '_'));
+}
+
+// Where the statement starting at begin ends: its semicolon (not one in a quoted string), or the end of query.
+static size_t statement_end(const string &query, size_t begin) {
+    char quote = '\0';
+    for (size_t i = begin; i < query.size(); i++) {
+        if (quote != '\0') {
+            if (query[i] == quote)
+                quote = '\0';
+        } else if (query[i] == '\'' || query[i] == '"') {
+            quote = query[i];
+        } else if (query[i] == ';') {
+            return i;
+        }
+    }
+    return query.size();
+}
+
+// Pull out "INCLUDE (column, ...)" from the statement from begin to end of query, if it is a CREATE INDEX with
+// one right after its index column list. Moves end back by however much was taken out.
+static ColumnNames *extract_statement_include(string &query, size_t begin, size_t &end) {
+    string upper = query.substr(begin, end - begin);
+    for (auto &c: upper)
+        c = (char) toupper(c);
+    size_t create = upper.find_first_not_of(BLANKS);
+    if (!word_at(upper, create, "CREATE") || !word_at(upper, upper.find_first_not_of(BLANKS, create + 6), "INDEX"))
+        return nullptr;
+    size_t key_columns = upper.find('(');
+    size_t key_columns_end = key_columns == string::npos ? string::npos : upper.find(')', key_columns);
+    if (key_columns_end == string::npos)
+        return nullptr;
+    size_t at = upper.find_first_not_of(BLANKS, key_columns_end + 1);
+    if (at == string::npos || !word_at(upper, at, "INCLUDE"))
+        return nullptr;
+    size_t open = upper.find_first_not_of(BLANKS, at + 7);
+    size_t close = upper.find(')', open);
+    if (open == string::npos || upper[open] != '(' || close == string::npos)
+        return nullptr;  // leave it for the parser to complain about
+
+    ColumnNames *include = new ColumnNames();
+    string column_list = query.substr(begin + open + 1, close - open - 1);
+    size_t pos = 0;
+    while (pos <= column_list.size()) {
+        size_t comma = column_list.find(',', pos);
+        if (comma == string::npos)
+            comma = column_list.size();
+        string column_name = column_list.substr(pos, comma - pos);
+        size_t first = column_name.find_first_not_of(BLANKS);
+        if (first != string::npos)
+            include->push_back(column_name.substr(first, column_name.find_last_not_of(BLANKS) - first + 1));
+        pos = comma + 1;
+    }
+    query.erase(begin + at, close + 1 - at);
+    end -= close + 1 - at;
+    return include;
+}
+
+// Pull out "INCLUDE (column, ...)" from each CREATE INDEX statement of a query, keeping track of which statement
+// each belongs to.
+vector<ColumnNames *> SQLExec::extract_include(string &query) {
+    vector<ColumnNames *> includes;
+    size_t begin = 0;
+    while (begin < query.size()) {
+        size_t end = statement_end(query, begin);
+        if (query.find_first_not_of(BLANKS, begin) < end)  // (just blanks after the last semicolon aren't one)
+            includes.push_back(extract_statement_include(query, begin, end));
+        begin = end + 1;
+    }
+    return includes;
+}
+
 ColumnAttribute get_column_type(string column, ColumnNames columns, ColumnAttributes column_types) {
     for(uint i = 0; i < columns.size(); i++) {
         if(columns[i] == column) {
@@ -134,7 +241,7 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
     // for each index name in that table, get the index and insert the row handle
     for(auto const& index_name : index_names) {
         DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
-        index.insert(insert_handle);
+        index.insert(insert_handle, &row);
     }
     string suffix = "";
     if(index_names.size() > 0) {
@@ -196,7 +303,7 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
     EvalPlan *plan = new EvalPlan(table);
     if (statement->expr != nullptr)
         plan = new EvalPlan(get_where_conjunction(statement->expr), plan);
-    EvalPlan *optimized = plan->optimize();
+    EvalPlan *optimized = plan->optimize(*SQLExec::indices);
     EvalPipeline pipeline = optimized->pipeline();
 
     // delete all the handles
@@ -216,7 +323,31 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
     return new QueryResult("successfully deleted " + to_string(rows) + " rows from " + tableName + " " + to_string(indices) + " indices");
 }
 
+// Whether a select list has any aggregates.
+static bool has_aggregates(const vector<Expr *> &select_list) {
+    for (auto const &expr: select_list)
+        if (expr->type == kExprFunctionRef)
+            return true;
+    return false;
+}
+
+// The rows a select's LIMIT and OFFSET keep (null if it has neither).
+static LimitSpec *limit_spec(const SelectStatement *statement) {
+    const LimitDescription *limit = statement->limit;
+    if (limit == nullptr || (limit->limit < 0 && limit->offset <= 0))
+        return nullptr;
+    LimitSpec *spec = new LimitSpec();
+    spec->limit = limit->limit < 0 ? SIZE_MAX : (size_t) limit->limit;
+    spec->offset = limit->offset < 0 ? 0 : (size_t) limit->offset;
+    return spec;
+}
+
 QueryResult *SQLExec::select(const SelectStatement *statement) {
+    if (statement->groupBy != nullptr || has_aggregates(*statement->selectList))
+        return select_aggregate(statement);
+    if (statement->fromTable->type == kTableJoin)
+        return select_join(statement);
+
     // SELECT should translate into an evaluation plan with a project plan on a select plan.
     // The enclosed select plan should be annotated with a table scan.
     // get table name
@@ -225,6 +356,23 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
     // get table
     DbRelation &table = SQLExec::tables->get_table(tableName);
 
+    // the order to sort the rows in, if there's an ORDER BY
+    SortSpec *sort = nullptr;
+    if (statement->order != nullptr) {
+        ColumnNames table_names = table.get_column_names();
+        sort = new SortSpec();
+        for (auto const &order: *statement->order) {
+            const Expr *expr = order->expr;
+            if (expr->type != kExprColumnRef ||
+                find(table_names.begin(), table_names.end(), expr->name) == table_names.end()) {
+                delete sort;
+                throw SQLExecError("can only ORDER BY columns of " + tableName);
+            }
+            sort->columns.push_back(expr->name);
+            sort->descending.push_back(order->type == kOrderDesc);
+        }
+    }
+
     // start base of plan at tablescan
     EvalPlan *plan = new EvalPlan(table);
 
@@ -250,13 +398,391 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
             column_names->push_back(stmt->name);
         }
     }
+
+    // sort under the projection, which gets the columns it sorts by as well (then leaves them out)
+    if (sort != nullptr) {
+        ColumnNames *sorted_names = new ColumnNames(*column_names);
+        for (auto const &column_name: sort->columns)
+            if (find(sorted_names->begin(), sorted_names->end(), column_name) == sorted_names->end())
+                sorted_names->push_back(column_name);
+        plan = new EvalPlan(sort, new EvalPlan(sorted_names, plan));
+    }
+
+    // and limit under it too, of the sort or of a projection just like it
+    LimitSpec *limit = limit_spec(statement);
+    if (limit != nullptr) {
+        if (sort == nullptr)
+            plan = new EvalPlan(new ColumnNames(*column_names), plan);
+        plan = new EvalPlan(limit, plan);
+    }
+    plan = new EvalPlan(column_names, plan);
+
+    // optimize plan and leave the optimized plan to be evaluated as the result is printed
+    EvalPlan *optimized = plan->optimize(*SQLExec::indices);
+    ColumnNames *result_column_names = new ColumnNames(*column_names);  // column_names belongs to plan
+    delete plan;
+
+    return new QueryResult(result_column_names, column_attributes, optimized);
+}
+
+// One of the tables of a join, what the query calls it, and what the joined rows call its columns.
+struct JoinedTable {
+    Identifier name;  // its alias, if it has one
+    DbRelation *relation;
+    map<Identifier, Identifier> renames;  // its columns that another of the tables also has, to "name.column"
+    ValueDict where;  // the WHERE clause's values for its columns
+};
+
+// Find the tables of a FROM clause of joins, left to right.
+static void find_joined_tables(const TableRef *from, Tables &tables, vector<JoinedTable> &joined) {
+    if (from->type == kTableJoin) {
+        find_joined_tables(from->join->left, tables, joined);
+        find_joined_tables(from->join->right, tables, joined);
+        return;
+    }
+    if (from->type != kTableName)
+        throw SQLExecError("only joins of tables are implemented");
+    JoinedTable table;
+    table.name = from->getName();
+    for (auto const &other: joined)
+        if (other.name == table.name)
+            throw SQLExecError("table " + table.name + " is in the join twice (give one of them an alias)");
+    table.relation = &tables.get_table(from->name);
+    joined.push_back(table);
+}
+
+// Which of the joined tables a column is from (the one named, if it says), and its name in the joined rows.
+static uint joined_column(const Expr *expr, const vector<JoinedTable> &joined, Identifier &joined_name) {
+    if (expr->type != kExprColumnRef)
+        throw SQLExecError("expected a column");
+    string given = expr->table == nullptr ? string(expr->name) : string(expr->table) + "." + expr->name;
+    int found = -1;
+    for (uint i = 0; i < joined.size(); i++) {
+        if (expr->table != nullptr && joined[i].name != expr->table)
+            continue;
+        ColumnNames column_names = joined[i].relation->get_column_names();
+        if (find(column_names.begin(), column_names.end(), expr->name) == column_names.end())
+            continue;
+        if (found >= 0)
+            throw SQLExecError("column " + given + " is in more than one of the tables");
+        found = (int) i;
+    }
+    if (found < 0)
+        throw SQLExecError("unknown column " + given);
+    auto renamed = joined[found].renames.find(expr->name);
+    joined_name = renamed == joined[found].renames.end() ? expr->name : renamed->second;
+    return (uint) found;
+}
+
+// Sort the equality predicates of a join's WHERE clause out by table (like get_where_conjunction for one table).
+static void join_where(const Expr *expr, vector<JoinedTable> &joined) {
+    if (expr->type != kExprOperator)
+        throw DbRelationError("Invalid statement");
+    if (expr->opType == Expr::AND) {
+        join_where(expr->expr, joined);
+        join_where(expr->expr2, joined);
+    } else if (expr->opChar == '=') {
+        Identifier joined_name;
+        uint which = joined_column(expr->expr, joined, joined_name);
+        if (expr->expr2->type == kExprLiteralInt)
+            joined[which].where[expr->expr->name] = Value(int32_t(expr->expr2->ival));
+        else if (expr->expr2->type == kExprLiteralString)
+            joined[which].where[expr->expr->name] = Value(expr->expr2->name);
+        else
+            throw DbRelationError("Don't know how to handle " + to_string(expr->expr2->type));
+    }
+}
+
+// Add the column = column predicates of a join's ON clause to its keys, each column on its own side: the left side
+// has tables first up to middle, the right side the ones from middle up to end.
+static void join_on(const Expr *expr, const vector<JoinedTable> &joined, uint first, uint middle, uint end,
+                    bool left_is_table, bool right_is_table, JoinSpec &join) {
+    if (expr == nullptr)
+        throw SQLExecError("a join needs ON with column = column");
+    if (expr->type == kExprOperator && expr->opType == Expr::AND) {
+        join_on(expr->expr, joined, first, middle, end, left_is_table, right_is_table, join);
+        join_on(expr->expr2, joined, first, middle, end, left_is_table, right_is_table, join);
+        return;
+    }
+    if (expr->type != kExprOperator || expr->opChar != '=' || expr->expr->type != kExprColumnRef ||
+        expr->expr2->type != kExprColumnRef)
+        throw SQLExecError("ON can only have column = column, joined by AND");
+    const Expr *left = expr->expr, *right = expr->expr2;
+    Identifier left_name, right_name;
+    uint left_table = joined_column(left, joined, left_name), right_table = joined_column(right, joined, right_name);
+    if (left_table >= middle) {
+        swap(left, right);
+        swap(left_name, right_name);
+        swap(left_table, right_table);
+    }
+    if (left_table < first || left_table >= middle || right_table < middle || right_table >= end)
+        throw SQLExecError("ON has to compare a column from each side of the join");
+    join.left_keys.push_back(left_is_table ? left->name : left_name);  // a table's rows don't have the joined names
+    join.right_keys.push_back(right_is_table ? right->name : right_name);
+}
+
+// The plan for (part of) a FROM clause of joins, whose tables are joined[next], joined[next + 1], .... A table's
+// WHERE values go in a select on its scan, unless a left outer join can leave its columns NULL, in which case they go
+// in after, to be checked on the rows the top join gets.
+static EvalPlan *join_plan(const TableRef *from, vector<JoinedTable> &joined, uint &next, bool nullable,
+                           ValueDict &after, bool top) {
+    if (from->type != kTableJoin) {
+        JoinedTable &table = joined[next++];
+        EvalPlan *plan = new EvalPlan(*table.relation);
+        if (!table.where.empty() && !nullable) {
+            plan = new EvalPlan(new ValueDict(table.where), plan);
+        } else if (!table.where.empty()) {
+            for (auto const &column: table.where) {
+                auto renamed = table.renames.find(column.first);
+                after[renamed == table.renames.end() ? column.first : renamed->second] = column.second;
+            }
+        }
+        return new EvalPlan(EvalPlan::ProjectAll, plan);
+    }
+    const JoinDefinition *definition = from->join;
+    bool left_outer;
+    switch (definition->type) {
+        case kJoinInner:
+            left_outer = false;
+            break;
+        case kJoinLeft:
+        case kJoinLeftOuter:
+            left_outer = true;
+            break;
+        default:
+            throw SQLExecError("only inner and left outer joins are implemented");
+    }
+    uint first = next;
+    EvalPlan *left = join_plan(definition->left, joined, next, nullable, after, false);
+    uint middle = next;
+    EvalPlan *right;
+    try {
+        right = join_plan(definition->right, joined, next, nullable || left_outer, after, false);
+    } catch (SQLExecError &e) {
+        delete left;
+        throw;
+    }
+    bool left_is_table = definition->left->type != kTableJoin, right_is_table = definition->right->type != kTableJoin;
+    JoinSpec *join = new JoinSpec();
+    join->left_outer = left_outer;
+    if (left_is_table)
+        join->left_renames = joined[first].renames;
+    if (right_is_table)
+        join->right_renames = joined[middle].renames;
+    try {
+        join_on(definition->condition, joined, first, middle, next, left_is_table, right_is_table, *join);
+    } catch (SQLExecError &e) {
+        delete left;
+        delete right;
+        delete join;
+        throw;
+    }
+    ValueDict *where = top && !after.empty() ? new ValueDict(after) : nullptr;
+    return new EvalPlan(EvalPlan::HashJoin, join, where, left, right);
+}
+
+QueryResult *SQLExec::select_join(const SelectStatement *statement) {
+    vector<JoinedTable> joined;
+    find_joined_tables(statement->fromTable, *SQLExec::tables, joined);
+    for (auto &table: joined) {
+        for (auto const &column_name: table.relation->get_column_names())
+            for (auto const &other: joined) {
+                ColumnNames other_names = other.relation->get_column_names();
+                if (&other != &table && find(other_names.begin(), other_names.end(), column_name) != other_names.end())
+                    table.renames[column_name] = table.name + "." + column_name;
+            }
+    }
+    if (statement->whereClause != nullptr)
+        join_where(statement->whereClause, joined);
+
+    // column names and attributes to return at end
+    ColumnNames *column_names = new ColumnNames;
+    ColumnAttributes *column_attributes = new ColumnAttributes;
+    ValueDict after;
+    uint next = 0;
+    EvalPlan *plan;
+    SortSpec *sort = nullptr;
+    try {
+        for (auto const &expr: *statement->selectList) {
+            if (expr->type == kExprStar) {
+                for (auto const &table: joined) {
+                    ColumnNames table_names = table.relation->get_column_names();
+                    ColumnAttributes *table_attributes = table.relation->get_column_attributes(table_names);
+                    for (auto const &column_name: table_names) {
+                        auto renamed = table.renames.find(column_name);
+                        column_names->push_back(renamed == table.renames.end() ? column_name : renamed->second);
+                    }
+                    column_attributes->insert(column_attributes->end(), table_attributes->begin(),
+                                              table_attributes->end());
+                    delete table_attributes;
+                }
+            } else {
+                Identifier joined_name;
+                uint which = joined_column(expr, joined, joined_name);
+                ColumnAttributes *attributes = joined[which].relation->get_column_attributes(
+                        ColumnNames(1, expr->name));
+                column_names->push_back(joined_name);
+                column_attributes->push_back(attributes->at(0));
+                delete attributes;
+            }
+        }
+        if (statement->order != nullptr) {
+            sort = new SortSpec();
+            for (auto const &order: *statement->order) {
+                Identifier joined_name;
+                joined_column(order->expr, joined, joined_name);
+                sort->columns.push_back(joined_name);
+                sort->descending.push_back(order->type == kOrderDesc);
+            }
+        }
+        plan = join_plan(statement->fromTable, joined, next, false, after, true);
+    } catch (SQLExecError &e) {
+        delete column_names;
+        delete column_attributes;
+        delete sort;
+        throw;
+    }
+    if (sort != nullptr)
+        plan = new EvalPlan(sort, plan);  // the joined rows have all the columns
+    LimitSpec *limit = limit_spec(statement);
+    if (limit != nullptr)
+        plan = new EvalPlan(limit, plan);
     plan = new EvalPlan(column_names, plan);
 
-    // optimize plan and evaluate optimized plan
-    EvalPlan *optimized = plan->optimize();
-    ValueDicts *rows = optimized->evaluate();
+    // optimize plan and leave the optimized plan to be evaluated as the result is printed
+    EvalPlan *optimized = plan->optimize(*SQLExec::indices);
+    ColumnNames *result_column_names = new ColumnNames(*column_names);  // column_names belongs to plan
+    delete plan;
+    return new QueryResult(result_column_names, column_attributes, optimized);
+}
 
-    return new QueryResult(column_names, column_attributes, rows, "successfully return " + to_string(rows->size()) + " rows");
+// Add the aggregate a function call in a select list or ORDER BY stands for to aggregate (unless it's there already),
+// and return it. Its column has to be one of the table's.
+static AggregateSpec::Aggregate add_aggregate(const Expr *expr, const ColumnNames &table_names,
+                                              AggregateSpec &aggregate) {
+    string function_name = expr->name;
+    transform(function_name.begin(), function_name.end(), function_name.begin(), ::toupper);
+    AggregateSpec::Function function;
+    if (function_name == "COUNT")
+        function = AggregateSpec::Count;
+    else if (function_name == "SUM")
+        function = AggregateSpec::Sum;
+    else if (function_name == "MIN")
+        function = AggregateSpec::Min;
+    else if (function_name == "MAX")
+        function = AggregateSpec::Max;
+    else if (function_name == "AVG")
+        function = AggregateSpec::Avg;
+    else
+        throw SQLExecError("unknown function " + function_name);
+    if (expr->distinct)
+        throw SQLExecError(function_name + "(DISTINCT ...) isn't implemented");
+    const Expr *argument = expr->expr;
+    Identifier column_name;
+    if (argument != nullptr && argument->type == kExprStar && function == AggregateSpec::Count)
+        column_name = "";
+    else if (argument != nullptr && argument->type == kExprColumnRef &&
+             find(table_names.begin(), table_names.end(), argument->name) != table_names.end())
+        column_name = argument->name;
+    else
+        throw SQLExecError(function_name + " has to be of a column of the table" +
+                           (function == AggregateSpec::Count ? string(" or *") : string("")));
+    AggregateSpec::Aggregate added = {function, column_name,
+                                      function_name + "(" + (column_name.empty() ? "*" : column_name) + ")"};
+    for (auto const &other: aggregate.aggregates)
+        if (other.name == added.name)
+            return added;
+    aggregate.aggregates.push_back(added);
+    return added;
+}
+
+QueryResult *SQLExec::select_aggregate(const SelectStatement *statement) {
+    if (statement->fromTable->type != kTableName)
+        throw SQLExecError("GROUP BY and aggregates are only implemented for a single table");
+    Identifier table_name = statement->fromTable->getName();
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    ColumnNames table_names = table.get_column_names();
+    ColumnAttributes *table_attributes = table.get_column_attributes(table_names);
+    map<Identifier, ColumnAttribute> attributes;
+    for (size_t i = 0; i < table_names.size(); i++)
+        attributes.insert(make_pair(table_names[i], table_attributes->at(i)));
+    delete table_attributes;
+
+    // work out the aggregation, the result's columns, and the order (all before any plan, in case they throw)
+    AggregateSpec aggregate;
+    if (statement->groupBy != nullptr) {
+        if (statement->groupBy->having != nullptr)
+            throw SQLExecError("HAVING isn't implemented");
+        for (auto const &expr: *statement->groupBy->columns) {
+            if (expr->type != kExprColumnRef || attributes.find(expr->name) == attributes.end())
+                throw SQLExecError("can only GROUP BY columns of " + table_name);
+            aggregate.group_by.push_back(expr->name);
+        }
+    }
+    ColumnNames result_names;
+    ColumnAttributes result_attributes;
+    for (auto const &expr: *statement->selectList) {
+        if (expr->type == kExprColumnRef) {
+            if (find(aggregate.group_by.begin(), aggregate.group_by.end(), expr->name) == aggregate.group_by.end())
+                throw SQLExecError(string("column ") + expr->name + " has to be in the GROUP BY or an aggregate");
+            result_names.push_back(expr->name);
+            result_attributes.push_back(attributes.at(expr->name));
+        } else if (expr->type == kExprFunctionRef) {
+            AggregateSpec::Aggregate added = add_aggregate(expr, table_names, aggregate);
+            result_names.push_back(added.name);
+            if ((added.function == AggregateSpec::Sum || added.function == AggregateSpec::Avg) &&
+                attributes.at(added.column).get_data_type() != ColumnAttribute::INT)
+                throw SQLExecError("can only SUM or AVG an INT column");
+            if (added.function == AggregateSpec::Min || added.function == AggregateSpec::Max)
+                result_attributes.push_back(attributes.at(added.column));
+            else
+                result_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+        } else {
+            throw SQLExecError("can only select GROUP BY columns and aggregates of groups");
+        }
+    }
+    SortSpec sort;
+    if (statement->order != nullptr) {
+        for (auto const &order: *statement->order) {
+            const Expr *expr = order->expr;
+            if (expr->type == kExprFunctionRef)
+                sort.columns.push_back(add_aggregate(expr, table_names, aggregate).name);
+            else if (expr->type == kExprColumnRef &&
+                     find(aggregate.group_by.begin(), aggregate.group_by.end(), expr->name) != aggregate.group_by.end())
+                sort.columns.push_back(expr->name);
+            else
+                throw SQLExecError("can only ORDER BY GROUP BY columns and aggregates of groups");
+            sort.descending.push_back(order->type == kOrderDesc);
+        }
+    }
+
+    // the aggregation reads just the columns it needs (all of them if it needs none, i.e., just COUNT(*))
+    ValueDict *where = statement->whereClause != nullptr ? get_where_conjunction(statement->whereClause) : nullptr;
+    EvalPlan *plan = new EvalPlan(table);
+    if (where != nullptr)
+        plan = new EvalPlan(where, plan);
+    ColumnNames *read_names = new ColumnNames(aggregate.group_by);
+    for (auto const &a: aggregate.aggregates)
+        if (!a.column.empty() && find(read_names->begin(), read_names->end(), a.column) == read_names->end())
+            read_names->push_back(a.column);
+    if (read_names->empty()) {
+        delete read_names;
+        plan = new EvalPlan(EvalPlan::ProjectAll, plan);
+    } else {
+        plan = new EvalPlan(read_names, plan);
+    }
+    plan = new EvalPlan(new AggregateSpec(aggregate), plan);
+    if (!sort.columns.empty())
+        plan = new EvalPlan(new SortSpec(sort), plan);
+    LimitSpec *limit = limit_spec(statement);
+    if (limit != nullptr)
+        plan = new EvalPlan(limit, plan);
+    plan = new EvalPlan(new ColumnNames(result_names), plan);
+
+    // optimize plan and leave the optimized plan to be evaluated as the result is printed
+    EvalPlan *optimized = plan->optimize(*SQLExec::indices);
+    delete plan;
+    return new QueryResult(new ColumnNames(result_names), new ColumnAttributes(result_attributes), optimized);
 }
 
 void
@@ -276,12 +802,14 @@ SQLExec::column_definition(const ColumnDefinition *col, Identifier &column_name,
 }
 
 // CREATE ...
-QueryResult *SQLExec::create(const CreateStatement *statement) {
+QueryResult *SQLExec::create(const CreateStatement *statement, const ColumnNames *include) {
+    if (include != nullptr && statement->type != CreateStatement::kIndex)
+        throw SQLExecError("INCLUDE is only for CREATE INDEX");
     switch (statement->type) {
         case CreateStatement::kTable:
             return create_table(statement);
         case CreateStatement::kIndex:
-            return create_index(statement);
+            return create_index(statement, include);
         default:
             return new QueryResult("Only CREATE TABLE and CREATE INDEX are implemented");
     }
@@ -339,7 +867,7 @@ QueryResult *SQLExec::create_table(const CreateStatement *statement) {
     return new QueryResult("created " + table_name);
 }
 
-QueryResult *SQLExec::create_index(const CreateStatement *statement) {
+QueryResult *SQLExec::create_index(const CreateStatement *statement, const ColumnNames *include) {
     Identifier index_name = statement->indexName;
     Identifier table_name = statement->tableName;
 
@@ -352,12 +880,28 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
         if (find(table_columns.begin(), table_columns.end(), col_name) == table_columns.end())
             throw SQLExecError(string("Column '") + col_name + "' does not exist in " + table_name);
 
+    // and that any included columns exist but aren't already in the key
+    ColumnNames include_columns;
+    if (include != nullptr) {
+        if (string(statement->indexType) != "BTREE" && string(statement->indexType) != "BETREE")
+            throw SQLExecError("INCLUDE is only supported for BTREE and BETREE indices");
+        for (auto const &col_name: *include) {
+            if (find(table_columns.begin(), table_columns.end(), col_name) == table_columns.end())
+                throw SQLExecError(string("Column '") + col_name + "' does not exist in " + table_name);
+            for (auto const &key_col_name: *statement->indexColumns)
+                if (col_name == key_col_name)
+                    throw SQLExecError(string("Column '") + col_name + "' is already in the index key");
+            include_columns.push_back(col_name);
+        }
+    }
+
     // insert a row for every column in index into _indices
     ValueDict row;
     row["table_name"] = Value(table_name);
     row["index_name"] = Value(index_name);
     row["index_type"] = Value(statement->indexType);
     row["is_unique"] = Value(string(statement->indexType) == "BTREE"); // assume HASH is non-unique --
+    string suffix = "";
     int seq = 0;
     Handles i_handles;
     try {
@@ -366,9 +910,21 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
             row["column_name"] = Value(col_name);
             i_handles.push_back(SQLExec::indices->insert(&row));
         }
+        seq = 0;
+        for (auto const &col_name: include_columns) {
+            row["seq_in_index"] = Value(--seq);  // included columns count down from -1
+            row["column_name"] = Value(col_name);
+            i_handles.push_back(SQLExec::indices->insert(&row));
+        }
 
         DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
         index.create();
+        BloomIndex *bloom = dynamic_cast<BloomIndex *>(&index);
+        if (bloom != nullptr) {
+            stringstream rate;
+            rate << fixed << setprecision(3) << bloom->false_positive_rate() * 100;
+            suffix = " (false positive rate " + rate.str() + "%)";
+        }
 
     } catch (...) {
         // attempt to remove from _indices
@@ -378,7 +934,7 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
         } catch (...) {}
         throw;  // re-throw the original exception (which should give the client some clue as to why it did
     }
-    return new QueryResult("created index " + index_name);
+    return new QueryResult("created index " + index_name + suffix);
 }
 
 // DROP ...
@@ -12,6 +12,8 @@
 #include "SQLParser.h"
 #include "schema_tables.h"
 
+class EvalPlan;
+
 /**
  * @class SQLExecError - exception for SQLExec methods
  */
@@ -23,16 +25,28 @@ public:
 
 /**
  * @class QueryResult - data structure to hold all the returned data for a query execution
+ *
+ * The rows of a select can instead be left in the (optimized) evaluation plan that gets them, so they are read as
+ * they are printed, one at a time, without ever all being in memory (get_rows is then null).
  */
 class QueryResult {
 public:
-    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message("") {}
+    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), plan(nullptr), message("") {}
 
     QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
-                                       message(message) {}
+                                       plan(nullptr), message(message) {}
 
     QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message)
-            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
+            : column_names(column_names), column_attributes(column_attributes), rows(rows), plan(nullptr),
+              message(message) {}
+
+    /**
+     * A result whose rows come from plan when printed, followed by a message with how many there were.
+     * @param plan  a plan ending in a projection (freed by the result)
+     */
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, EvalPlan *plan)
+            : column_names(column_names), column_attributes(column_attributes), rows(nullptr), plan(plan),
+              message("") {}
 
     virtual ~QueryResult();
 
@@ -50,6 +64,7 @@ protected:
     ColumnNames *column_names;
     ColumnAttributes *column_attributes;
     ValueDicts *rows;
+    EvalPlan *plan;
     std::string message;
 };
 
@@ -62,9 +77,19 @@ public:
     /**
      * Execute the given SQL statement.
      * @param statement   the Hyrise AST of the SQL statement to execute
+     * @param include     columns from the statement's INCLUDE clause, if any (see extract_include)
      * @returns           the query result (freed by caller)
      */
-    static QueryResult *execute(const hsql::SQLStatement *statement);
+    static QueryResult *execute(const hsql::SQLStatement *statement, const ColumnNames *include = nullptr);
+
+    /**
+     * Pull our CREATE INDEX ... (column, ...) INCLUDE (column, ...) extension out of the SQL before it goes to the
+     * parser, which doesn't know it.
+     * @param query  the SQL, returned by reference without the INCLUDE clauses
+     * @returns      for each statement of the query in turn, its included column names (freed by caller), or
+     *               nullptr if it has no INCLUDE clause
+     */
+    static std::vector<ColumnNames *> extract_include(std::string &query);
 
 protected:
     // the one place in the system that holds the _tables table and _indices table
@@ -78,7 +103,7 @@ protected:
      * @param statement to create table or index
      * @return QueryResult* result summary of appropriate create funtion
      */
-    static QueryResult *create(const hsql::CreateStatement *statement);
+    static QueryResult *create(const hsql::CreateStatement *statement, const ColumnNames *include);
 
     /**
      * @brief creates a table and add it to the relational manager
@@ -92,9 +117,10 @@ protected:
      * @brief creates an index for a specific table
      * 
      * @param statement with parts of SQL query
+     * @param include non-key columns to also store in the index (may be nullptr)
      * @return QueryResult* result summary of creating an index
      */
-    static QueryResult *create_index(const hsql::CreateStatement *statement);
+    static QueryResult *create_index(const hsql::CreateStatement *statement, const ColumnNames *include);
 
     /**
      * @brief calls appropriate drop function to either drop a table or an index
@@ -169,12 +195,36 @@ protected:
 
     /**
      * @brief selects rows from a table
+     * ORDER BY can give columns of the table (each ASC or DESC), whether they're selected or not. LIMIT and OFFSET
+     * (here and in the other selects) give just some of the rows: the first few in order, with ORDER BY.
      * 
      * @param statement with parts of SQL query
      * @return QueryResult* list of rows from table
      */
     static QueryResult *select(const hsql::SelectStatement *statement);
 
+    /**
+     * Select rows from a join of tables: FROM a [LEFT [OUTER]] JOIN b ON a.x = b.y [AND ...] [[LEFT] JOIN c ON ...]
+     * A column that more than one of the tables has goes by "table.column" in the joined rows, and so in the
+     * result, and has to be given that way (or just as "column" if the table is given) in the select list, WHERE,
+     * and ORDER BY.
+     *
+     * @param statement with parts of SQL query
+     * @return QueryResult* list of joined rows
+     */
+    static QueryResult *select_join(const hsql::SelectStatement *statement);
+
+    /**
+     * Select groups of rows from a table: SELECT g, ..., COUNT(*), SUM(c), ... FROM t [WHERE ...] [GROUP BY g, ...]
+     * The select list has columns of the GROUP BY and aggregates (COUNT, SUM, MIN, MAX, or AVG of a column, or
+     * COUNT(*)), each called by how it's written (e.g., "SUM(c)"). Without GROUP BY, all the rows are one group.
+     * ORDER BY can give GROUP BY columns and aggregates.
+     *
+     * @param statement with parts of SQL query
+     * @return QueryResult* list of groups
+     */
+    static QueryResult *select_aggregate(const hsql::SelectStatement *statement);
+
     /**
      * Pull out column name and attributes from AST's column definition clause
      * @param col                AST column definition
@@ -70,6 +70,16 @@ void SlottedPage::put(RecordID record_id, const Dbt &data) {
         u16 extra = new_size - size;
         if (!has_room(extra))
             throw DbBlockNoRoomError("not enough room for enlarged record");
+        if (size == 0) {
+            // an empty record takes no space, so it can have the same location as the record next to it (and
+            // sliding would move that one's header without its data): start it over in the free space, like insert
+            this->end_free -= new_size;
+            loc = this->end_free + 1U;
+            put_header();
+            put_header(record_id, new_size, loc);
+            memcpy(this->address(loc), data.get_data(), new_size);
+            return;
+        }
         slide(loc, loc - extra);
         memcpy(this->address(loc - extra), data.get_data(), new_size);
     } else {
@@ -95,6 +105,40 @@ void SlottedPage::del(RecordID record_id) {
     slide(loc, loc + size);
 }
 
+/**
+ * Insert a new record in front of record_id: the new record gets record_id and the ids of the ones from there on
+ * go up by one. Only the headers are shifted, the new record's data goes in the free space like with add().
+ * @param record_id  id for the new record, from 1 up to one past the last record (which is the same as add)
+ * @param data       contents of the new record
+ * @throws DbBlockNoRoomError if it won't fit
+ */
+void SlottedPage::insert(RecordID record_id, const Dbt *data) {
+    u16 size = (u16) data->get_size();
+    if (!has_room(size))
+        throw DbBlockNoRoomError("not enough room for new record");
+    memmove(this->address((u16) (4 * (record_id + 1))), this->address((u16) (4 * record_id)),
+            (size_t) 4 * (this->num_records + 1 - record_id));
+    this->num_records++;
+    this->end_free -= size;
+    u16 loc = this->end_free + 1U;
+    put_header();
+    put_header(record_id, size, loc);
+    memcpy(this->address(loc), data->get_data(), size);
+}
+
+/**
+ * Remove a record from the page and close up the gap in the ids: the records after it each go down by one.
+ * (Unlike del, which leaves a tombstone so nobody's id changes.)
+ * @param record_id  record to remove
+ */
+void SlottedPage::remove(RecordID record_id) {
+    del(record_id);
+    memmove(this->address((u16) (4 * record_id)), this->address((u16) (4 * (record_id + 1))),
+            (size_t) 4 * (this->num_records - record_id));
+    this->num_records--;
+    put_header();
+}
+
 /**
  * Sequence of all non-deleted record IDs.
  * @return  sequence of IDs (freed by caller)
@@ -208,17 +252,15 @@ void SlottedPage::slide(u_int16_t start, u_int16_t end) {
     int bytes = start - (this->end_free + 1U);
     memmove(to, from, bytes);
 
-    // fix up headers to the right
-    RecordIDs *record_ids = ids();
-    for (auto const &record_id : *record_ids) {
+    // fix up headers to the right (skipping tombstones)
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
         u16 size, loc;
         get_header(size, loc, record_id);
-        if (loc <= start) {
+        if (loc != 0 && loc <= start) {
             loc += shift;
             put_header(record_id, size, loc);
         }
     }
-    delete record_ids;
     this->end_free += shift;
     put_header();
 }
@@ -352,6 +394,43 @@ bool test_slotted_page() {
     if (get_dbt != nullptr)
         return assertion_failure("get of deleted record was not null");
 
+    // test insert and remove (ids shift, data stays put)
+    char rec3[] = "in between";
+    Dbt rec3_dbt(rec3, sizeof(rec3));
+    slot.insert(2, &rec3_dbt);
+    get_dbt = slot.get(3);
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (actual != string(rec2, sizeof(rec2)) || slot.size() != 2)
+        return assertion_failure("get 3 back after insert at 2 " + actual);
+    get_dbt = slot.get(2);
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (actual != string(rec3, sizeof(rec3)))
+        return assertion_failure("get 2 back after insert at 2 " + actual);
+    slot.remove(2);
+    get_dbt = slot.get(2);
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (actual != string(rec2, sizeof(rec2)) || slot.size() != 1)
+        return assertion_failure("get 2 back after remove of 2 " + actual);
+
+    // an empty record shares its location with its neighbor, so growing it mustn't disturb the neighbor
+    Dbt empty_dbt(nullptr, 0);
+    slot.add(&empty_dbt);
+    slot.put(3, rec3_dbt);
+    get_dbt = slot.get(2);
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (actual != string(rec2, sizeof(rec2)))
+        return assertion_failure("neighbor changed by put of empty record " + actual);
+    get_dbt = slot.get(3);
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (actual != string(rec3, sizeof(rec3)))
+        return assertion_failure("get back put of empty record " + actual);
+    slot.remove(3);
+
     // try adding something too big
     rec2_dbt = Dbt(nullptr, DbBlock::BLOCK_SZ - 10); // too big, but only because we have a record in there
     try {
@@ -18,6 +18,8 @@
         Modeled after slotted-page from Database Systems Concepts, 6ed, Figure 10-9.
 
         Record id are handed out sequentially starting with 1 as records are added with add().
+        (Sorted structures can also use insert() and remove(), which renumber the records after the one
+        inserted or removed, so the ids stay in order without moving any record data.)
         Each record has a header which is a fixed offset from the beginning of the block:
             Bytes 0x00 - Ox01: number of records
             Bytes 0x02 - 0x03: offset to end of free space
@@ -41,6 +43,10 @@ public:
 
     virtual void del(RecordID record_id);
 
+    virtual void insert(RecordID record_id, const Dbt *data);
+
+    virtual void remove(RecordID record_id);
+
     virtual RecordIDs *ids(void) const;
 
     virtual void clear();
@@ -0,0 +1,149 @@
+/**
+ * @file SpillFile.cpp - implementation of SpillFile
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+#include "SpillFile.h"
+
+using namespace std;
+typedef uint16_t u16;
+
+// Every SpillFile gets a file of its own, even when several operators are spilling at once, or several processes
+// share the database environment. A file by that name can only be left over from an earlier process with our pid
+// that didn't get to drop it, so it's dropped now.
+string SpillFile::unique_name() {
+    static atomic<uint> spill_count(0);
+    string name = "__spill_" + to_string(getpid()) + "_" + to_string(spill_count++);
+    try {
+        HeapFile(name).drop();
+    } catch (DbException &e) {
+        // there wasn't one
+    }
+    return name;
+}
+
+SpillFile::SpillFile() : file(unique_name()), block(nullptr), record_ids(nullptr), at(0), next_block(1),
+                         row_count(0), reading(false) {
+    this->file.create();
+    this->block = this->file.get(this->file.get_last_block_id());
+}
+
+SpillFile::~SpillFile() {
+    delete this->block;
+    delete this->record_ids;
+    this->file.drop();
+}
+
+void SpillFile::append(const ValueDict &row) {
+    if (this->reading)
+        throw DbRelationError("can't append to a spill file once it's being read");
+    string bytes;
+    u16 count = (u16) row.size();
+    bytes.append((const char *) &count, sizeof(u16));
+    for (auto const &column: row) {
+        u16 size = (u16) column.first.size();
+        bytes.append((const char *) &size, sizeof(u16));
+        bytes.append(column.first);
+        bytes.push_back((char) column.second.data_type);
+        if (column.second.data_type == ColumnAttribute::TEXT) {
+            if (column.second.s.size() > UINT16_MAX)
+                throw DbRelationError("text field too long to spill");
+            size = (u16) column.second.s.size();
+            bytes.append((const char *) &size, sizeof(u16));
+            bytes.append(column.second.s);
+        } else {
+            bytes.append((const char *) &column.second.n, sizeof(int32_t));
+        }
+    }
+    if (bytes.size() > DbBlock::BLOCK_SZ - 8)  // block header plus the record's
+        throw DbRelationError("row too big to spill");
+    Dbt data((void *) bytes.data(), (u_int32_t) bytes.size());
+    try {
+        this->block->add(&data);
+    } catch (DbBlockNoRoomError &e) {
+        this->file.put(this->block);
+        delete this->block;
+        this->block = this->file.get_new();
+        this->block->add(&data);
+    }
+    this->row_count++;
+}
+
+ValueDict *SpillFile::next() {
+    if (!this->reading) {
+        this->file.put(this->block);
+        delete this->block;
+        this->block = nullptr;
+        this->reading = true;
+    }
+    while (this->record_ids == nullptr || this->at == this->record_ids->size()) {
+        if (this->next_block > this->file.get_last_block_id())
+            return nullptr;
+        delete this->block;
+        delete this->record_ids;
+        this->block = this->file.get(this->next_block++);
+        this->record_ids = this->block->ids();
+        this->at = 0;
+    }
+    Dbt *data = this->block->get((*this->record_ids)[this->at++]);
+    const char *bytes = (const char *) data->get_data();
+    uint offset = 0;
+    ValueDict *row = new ValueDict();
+    u16 count = *(u16 *) bytes;
+    offset += sizeof(u16);
+    for (u16 i = 0; i < count; i++) {
+        u16 size = *(u16 *) (bytes + offset);
+        offset += sizeof(u16);
+        Identifier column_name(bytes + offset, size);
+        offset += size;
+        Value value;
+        value.data_type = (ColumnAttribute::DataType) bytes[offset++];
+        if (value.data_type == ColumnAttribute::TEXT) {
+            size = *(u16 *) (bytes + offset);
+            offset += sizeof(u16);
+            value.s.assign(bytes + offset, size);
+            offset += size;
+        } else {
+            memcpy(&value.n, bytes + offset, sizeof(int32_t));
+            offset += sizeof(int32_t);
+        }
+        (*row)[column_name] = value;
+    }
+    delete data;
+    return row;
+}
+
+// Rows of all three types, and with columns missing, across several blocks and back.
+bool test_spill_file() {
+    SpillFile spill;
+    const int n = 2000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        if (i % 5 != 0)
+            row["b"] = Value("row " + to_string(i));
+        row["c"] = Value(i % 2);
+        row["c"].data_type = ColumnAttribute::BOOLEAN;
+        spill.append(row);
+    }
+    if (spill.size() != n)
+        return assertion_failure("spill size", (double) spill.size(), n);
+    int i = 0;
+    for (ValueDict *row = spill.next(); row != nullptr; row = spill.next(), i++) {
+        bool ok = row->at("a") == Value(i) && row->at("c").data_type == ColumnAttribute::BOOLEAN &&
+                  row->at("c").n == i % 2;
+        if (i % 5 == 0)
+            ok = ok && row->size() == 2;
+        else
+            ok = ok && row->at("b") == Value("row " + to_string(i));
+        delete row;
+        if (!ok)
+            return assertion_failure("spilled row", i);
+    }
+    if (i != n)
+        return assertion_failure("spilled rows read back", i, n);
+    return true;
+}
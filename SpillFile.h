@@ -0,0 +1,62 @@
+/**
+ * @file SpillFile.h - SpillFile, a temporary file of rows for operators that run out of memory
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include "heap_storage.h"
+
+/**
+ * @class SpillFile - rows written out to a temporary HeapFile and then read back, in the same order
+ *
+ * For when an operator (a hash join's partitions, say) has more rows than it should hold in memory. A row is any
+ * ValueDict: each record holds the row's column names along with their values, so rows don't need a schema, and a
+ * column a row doesn't have (a NULL) just isn't in its record. Rows are appended until the first call to next, and
+ * then read back from the start; the file is dropped when the SpillFile is deleted.
+ *
+ * Record layout:
+ *      u16 number of columns, and then for each: u16 name length, name, u8 data type, and the value
+ *      (INT and BOOLEAN: int32; TEXT: u16 length and the characters)
+ */
+class SpillFile {
+public:
+    SpillFile();
+
+    virtual ~SpillFile();
+
+    SpillFile(const SpillFile &other) = delete;
+
+    SpillFile &operator=(const SpillFile &other) = delete;
+
+    /**
+     * Add a row to the end of the file.
+     * @throws DbRelationError if the row doesn't fit in a block
+     */
+    void append(const ValueDict &row);
+
+    /**
+     * Read the next row (after the last one appended, appending is over).
+     * @returns  the row (freed by caller), or nullptr after the last one (from then on)
+     */
+    ValueDict *next();
+
+    /**
+     * Number of rows appended.
+     */
+    uint64_t size() const { return this->row_count; }
+
+protected:
+    HeapFile file;
+    SlottedPage *block;  // being written, or being read
+    RecordIDs *record_ids;  // of the block being read
+    size_t at;
+    BlockID next_block;  // to read
+    uint64_t row_count;
+    bool reading;
+
+    static std::string unique_name();
+};
+
+bool test_spill_file();
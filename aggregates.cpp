@@ -0,0 +1,788 @@
+/**
+ * @file aggregates.cpp - implementation of the hash aggregation
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include "aggregates.h"
+
+using namespace std;
+
+// The name of aggregate i's state column part in a state row.
+static Identifier state_column(uint i, const string &part) {
+    return "#" + to_string(i) + "." + part;
+}
+
+// An int64_t in a state row, as two INTs (a missing one being 0).
+static void put_state_int64(ValueDict &state, const Identifier &column_name, int64_t n) {
+    state[column_name] = Value((int32_t) (uint32_t) n);
+    state[column_name + "_high"] = Value((int32_t) (n >> 32));
+}
+
+static int64_t get_state_int64(const ValueDict &state, const Identifier &column_name) {
+    ValueDict::const_iterator low = state.find(column_name), high = state.find(column_name + "_high");
+    if (low == state.end() || high == state.end())
+        return 0;
+    return (int64_t) ((uint64_t) (uint32_t) high->second.n << 32 | (uint32_t) low->second.n);
+}
+
+GroupTable::GroupTable(const AggregateSpec &aggregate)
+        : aggregate(aggregate), key_order(), groups(), slots(64, 0), bytes(0), values(), key() {
+    this->key_order.columns = aggregate.group_by;
+    this->key_order.descending.assign(aggregate.group_by.size(), false);
+}
+
+GroupTable::~GroupTable() {
+    clear();
+}
+
+void GroupTable::add_row(const ValueDict &row) {
+    Group &group = find(row);
+    for (size_t i = 0; i < this->aggregate.aggregates.size(); i++) {
+        const AggregateSpec::Aggregate &aggregate = this->aggregate.aggregates[i];
+        if (aggregate.column.empty()) {
+            group.accumulators[i].count++;
+            continue;
+        }
+        ValueDict::const_iterator column = row.find(aggregate.column);
+        if (column != row.end())
+            accumulate(aggregate, group.accumulators[i], column->second);
+    }
+}
+
+// With no group_by columns, the batch is all one group, and the kernels do the INT columns' sums, mins, and maxes. A
+// table's rows have every column, so every selected row counts.
+void GroupTable::add_batch(ColumnBatch &batch) {
+    uint count = (uint) batch.selection.size();
+    if (count == 0)
+        return;
+    vector<const ColumnVector *> group_columns, columns;
+    for (auto const &column_name: this->aggregate.group_by)
+        group_columns.push_back(&batch.get_column(column_name));
+    for (auto const &aggregate: this->aggregate.aggregates)
+        columns.push_back(aggregate.column.empty() ? nullptr : &batch.get_column(aggregate.column));
+
+    if (group_columns.empty()) {
+        Group &group = find(this->values);
+        for (size_t i = 0; i < columns.size(); i++) {
+            const AggregateSpec::Aggregate &aggregate = this->aggregate.aggregates[i];
+            Accumulator &accumulator = group.accumulators[i];
+            if (columns[i] == nullptr || aggregate.function == AggregateSpec::Count) {
+                accumulator.count += count;
+            } else if (columns[i]->data_type == ColumnAttribute::INT) {
+                Accumulator batch_accumulator;
+                batch_accumulator.count = count;
+                batch_accumulator.sum = 0;
+                if (aggregate.function == AggregateSpec::Sum || aggregate.function == AggregateSpec::Avg) {
+                    batch_accumulator.sum = sum(columns[i]->ints.data(), batch.size(), batch.selection.data(), count);
+                } else {
+                    int32_t min = INT32_MAX, max = INT32_MIN;
+                    min_max(columns[i]->ints.data(), batch.size(), batch.selection.data(), count, min, max);
+                    batch_accumulator.min = Value(min);
+                    batch_accumulator.max = Value(max);
+                }
+                merge(aggregate, accumulator, batch_accumulator);
+            } else {
+                for (auto slot: batch.selection)
+                    accumulate(aggregate, accumulator, columns[i]->get(slot));
+            }
+        }
+        return;
+    }
+
+    for (auto slot: batch.selection) {
+        for (size_t j = 0; j < group_columns.size(); j++)
+            this->values[this->aggregate.group_by[j]] = group_columns[j]->get(slot);
+        Group &group = find(this->values);
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i] == nullptr)
+                group.accumulators[i].count++;
+            else
+                accumulate(this->aggregate.aggregates[i], group.accumulators[i], columns[i]->get(slot));
+        }
+    }
+}
+
+void GroupTable::add_state(const ValueDict &state) {
+    Group &group = find(state);
+    for (uint i = 0; i < (uint) this->aggregate.aggregates.size(); i++) {
+        Accumulator from;
+        from.count = get_state_int64(state, state_column(i, "count"));
+        from.sum = get_state_int64(state, state_column(i, "sum"));
+        ValueDict::const_iterator min = state.find(state_column(i, "min")), max = state.find(state_column(i, "max"));
+        if (min != state.end())
+            from.min = min->second;
+        if (max != state.end())
+            from.max = max->second;
+        merge(this->aggregate.aggregates[i], group.accumulators[i], from);
+    }
+}
+
+void GroupTable::add_table(const GroupTable &other) {
+    for (auto const &other_group: other.groups) {
+        Group &group = find(other_group->values);
+        for (size_t i = 0; i < this->aggregate.aggregates.size(); i++)
+            merge(this->aggregate.aggregates[i], group.accumulators[i], other_group->accumulators[i]);
+    }
+}
+
+ValueDict *GroupTable::get_state(uint i) const {
+    const Group &group = *this->groups[i];
+    ValueDict *state = new ValueDict(group.values);
+    for (uint j = 0; j < (uint) this->aggregate.aggregates.size(); j++) {
+        const Accumulator &accumulator = group.accumulators[j];
+        if (accumulator.count == 0)
+            continue;
+        put_state_int64(*state, state_column(j, "count"), accumulator.count);
+        switch (this->aggregate.aggregates[j].function) {
+            case AggregateSpec::Sum:
+            case AggregateSpec::Avg:
+                put_state_int64(*state, state_column(j, "sum"), accumulator.sum);
+                break;
+            case AggregateSpec::Min:
+                (*state)[state_column(j, "min")] = accumulator.min;
+                break;
+            case AggregateSpec::Max:
+                (*state)[state_column(j, "max")] = accumulator.max;
+                break;
+            default:
+                break;
+        }
+    }
+    return state;
+}
+
+ValueDict *GroupTable::get_result(uint i) const {
+    const Group &group = *this->groups[i];
+    ValueDict *row = new ValueDict(group.values);
+    for (size_t j = 0; j < this->aggregate.aggregates.size(); j++) {
+        const AggregateSpec::Aggregate &aggregate = this->aggregate.aggregates[j];
+        const Accumulator &accumulator = group.accumulators[j];
+        if (aggregate.function == AggregateSpec::Count) {
+            (*row)[aggregate.name] = Value((int32_t) min(accumulator.count, (int64_t) INT32_MAX));
+            continue;
+        }
+        if (accumulator.count == 0)
+            continue;  // NULL
+        switch (aggregate.function) {
+            case AggregateSpec::Sum:
+                if (accumulator.sum < INT32_MIN || accumulator.sum > INT32_MAX) {
+                    delete row;
+                    throw DbRelationError(aggregate.name + " is too big for an INT");
+                }
+                (*row)[aggregate.name] = Value((int32_t) accumulator.sum);
+                break;
+            case AggregateSpec::Avg:
+                (*row)[aggregate.name] = Value((int32_t) (accumulator.sum / accumulator.count));
+                break;
+            case AggregateSpec::Min:
+                (*row)[aggregate.name] = accumulator.min;
+                break;
+            case AggregateSpec::Max:
+                (*row)[aggregate.name] = accumulator.max;
+                break;
+            default:
+                break;
+        }
+    }
+    return row;
+}
+
+void GroupTable::clear() {
+    for (auto group: this->groups)
+        delete group;
+    this->groups.clear();
+    this->slots.assign(64, 0);
+    this->bytes = 0;
+}
+
+// Linear probing from the slot the low bits of the hash pick, adding the row's group if it's not there.
+GroupTable::Group &GroupTable::find(const ValueDict &row) {
+    sort_key(row, this->key_order, this->key);
+    size_t hash = std::hash<KeyBytes>()(this->key);
+    size_t mask = this->slots.size() - 1;
+    size_t slot = hash & mask;
+    while (this->slots[slot] != 0) {
+        Group *group = this->groups[this->slots[slot] - 1];
+        if (group->hash == hash && group->key == this->key)
+            return *group;
+        slot = (slot + 1) & mask;
+    }
+    Group *group = new Group();
+    group->key = this->key;
+    group->hash = hash;
+    for (auto const &column_name: this->aggregate.group_by) {
+        ValueDict::const_iterator column = row.find(column_name);
+        if (column != row.end())
+            group->values[column_name] = column->second;
+    }
+    Accumulator empty;
+    empty.count = empty.sum = 0;
+    group->accumulators.assign(this->aggregate.aggregates.size(), empty);
+    this->groups.push_back(group);
+    this->slots[slot] = (uint32_t) this->groups.size();
+    this->bytes += sizeof(Group) + sizeof(Group *) + 2 * sizeof(uint32_t) + group->key.size() +
+                   row_bytes(group->values) + group->accumulators.size() * sizeof(Accumulator);
+    if (2 * this->groups.size() > this->slots.size())
+        grow();
+    return *group;
+}
+
+void GroupTable::accumulate(const AggregateSpec::Aggregate &aggregate, Accumulator &accumulator, const Value &value) {
+    switch (aggregate.function) {
+        case AggregateSpec::Sum:
+        case AggregateSpec::Avg:
+            if (value.data_type != ColumnAttribute::INT)
+                throw DbRelationError("can only SUM or AVG an INT column, not " + aggregate.column);
+            accumulator.sum += value.n;
+            break;
+        case AggregateSpec::Min:
+            if (accumulator.count == 0 || value < accumulator.min)
+                accumulator.min = value;
+            break;
+        case AggregateSpec::Max:
+            if (accumulator.count == 0 || accumulator.max < value)
+                accumulator.max = value;
+            break;
+        default:
+            break;
+    }
+    accumulator.count++;
+}
+
+void GroupTable::merge(const AggregateSpec::Aggregate &aggregate, Accumulator &into, const Accumulator &from) {
+    if (from.count == 0)
+        return;
+    switch (aggregate.function) {
+        case AggregateSpec::Sum:
+        case AggregateSpec::Avg:
+            into.sum += from.sum;
+            break;
+        case AggregateSpec::Min:
+            if (into.count == 0 || from.min < into.min)
+                into.min = from.min;
+            break;
+        case AggregateSpec::Max:
+            if (into.count == 0 || into.max < from.max)
+                into.max = from.max;
+            break;
+        default:
+            break;
+    }
+    into.count += from.count;
+}
+
+// Twice the slots, each group put back where its hash says.
+void GroupTable::grow() {
+    this->slots.assign(2 * this->slots.size(), 0);
+    size_t mask = this->slots.size() - 1;
+    for (uint32_t i = 0; i < (uint32_t) this->groups.size(); i++) {
+        size_t slot = this->groups[i]->hash & mask;
+        while (this->slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        this->slots[slot] = i + 1;
+    }
+    this->bytes += this->slots.size() / 2 * sizeof(uint32_t);
+}
+
+HashAggregateIterator::HashAggregateIterator(EvalIterator *input, const AggregateSpec &aggregate,
+                                             size_t memory_budget)
+        : input(input), relation(nullptr), workers(), aggregate(aggregate), memory_budget(memory_budget),
+          table(aggregate), at(0), files(), partitions(), partition_count(0), mutex(), morsel_count(0), page_count(0),
+          claimed(0), error() {
+}
+
+HashAggregateIterator::HashAggregateIterator(EvalPlan *plan, DbRelation &relation, const ColumnNames &column_names,
+                                             uint worker_count, const AggregateSpec &aggregate, size_t memory_budget)
+        : input(nullptr), relation(&relation), workers(), aggregate(aggregate), memory_budget(memory_budget),
+          table(aggregate), at(0), files(), partitions(), partition_count(0), mutex(), morsel_count(0), page_count(0),
+          claimed(0), error() {
+    try {
+        for (uint i = 0; i < worker_count; i++) {
+            Worker *worker = new Worker();
+            worker->batches = nullptr;
+            worker->batch = nullptr;
+            worker->table = nullptr;
+            this->workers.push_back(worker);
+            worker->batches = plan->batch_iterator(&worker->morsel);
+            ColumnAttributes *column_attributes = relation.get_column_attributes(column_names);
+            worker->batch = new ColumnBatch(column_names, *column_attributes);
+            delete column_attributes;
+            worker->table = new GroupTable(aggregate);
+        }
+    } catch (DbRelationError &e) {
+        free_workers();
+        throw;
+    }
+}
+
+HashAggregateIterator::~HashAggregateIterator() {
+    close();
+    free_workers();
+    delete this->input;
+}
+
+void HashAggregateIterator::open() {
+    close();
+    this->partition_count = 0;
+    if (this->input != nullptr)
+        aggregate_rows();
+    else
+        aggregate_morsels();
+    if (this->aggregate.group_by.empty() && this->table.size() == 0 && this->partitions.empty())
+        this->table.add_state(ValueDict());  // the one group, with no rows
+}
+
+ValueDict *HashAggregateIterator::next() {
+    while (this->at == this->table.size()) {
+        if (this->partitions.empty())
+            return nullptr;
+        aggregate_partition();
+    }
+    return this->table.get_result(this->at++);
+}
+
+void HashAggregateIterator::close() {
+    if (this->input != nullptr)
+        this->input->close();
+    this->table.clear();
+    this->at = 0;
+    for (auto worker: this->workers)
+        worker->table->clear();
+    clear_partitions();
+}
+
+void HashAggregateIterator::aggregate_rows() {
+    this->input->open();
+    for (ValueDict *row = this->input->next(); row != nullptr; row = this->input->next()) {
+        try {
+            this->table.add_row(*row);
+        } catch (DbRelationError &e) {
+            delete row;
+            throw;
+        }
+        delete row;
+        if (this->table.get_bytes() > this->memory_budget)
+            spill(this->table, this->files, 0);
+    }
+    this->input->close();
+    if (!this->files.empty()) {
+        spill(this->table, this->files, 0);
+        add_partitions(0);
+    }
+}
+
+// Each worker aggregates the morsels it takes into its own table. Then, unless any of them spilled, their tables are
+// merged into ours (spilling it if it gets too big); otherwise they're all spilled, to be merged a partition at a time.
+void HashAggregateIterator::aggregate_morsels() {
+    this->page_count = this->relation->get_page_count();
+    this->morsel_count = (this->page_count + MORSEL_PAGES - 1) / MORSEL_PAGES;
+    this->claimed = 0;
+    this->error = nullptr;
+    for (auto worker: this->workers)
+        worker->thread = thread(&HashAggregateIterator::work, this, worker);
+    for (auto worker: this->workers)
+        worker->thread.join();
+    if (this->error != nullptr)
+        rethrow_exception(this->error);
+
+    bool spilled = false;
+    for (auto worker: this->workers)
+        if (!worker->files.empty())
+            spilled = true;
+    for (auto worker: this->workers) {
+        if (spilled) {
+            spill(*worker->table, worker->files, 0);
+        } else {
+            this->table.add_table(*worker->table);
+            worker->table->clear();
+            if (this->table.get_bytes() > this->memory_budget) {
+                spill(this->table, this->files, 0);
+                spilled = true;
+            }
+        }
+    }
+    if (spilled) {
+        spill(this->table, this->files, 0);
+        add_partitions(0);
+    }
+}
+
+void HashAggregateIterator::work(Worker *worker) {
+    try {
+        while (true) {
+            uint morsel;
+            {
+                lock_guard<std::mutex> lock(this->mutex);
+                if (this->error != nullptr || this->claimed >= this->morsel_count)
+                    return;
+                morsel = this->claimed++;
+            }
+            worker->morsel.first_page = morsel * MORSEL_PAGES + 1;
+            worker->morsel.last_page = min((morsel + 1) * MORSEL_PAGES, this->page_count);
+            worker->batches->open();
+            while (worker->batches->next(*worker->batch)) {
+                worker->table->add_batch(*worker->batch);
+                if (worker->table->get_bytes() > this->memory_budget / this->workers.size()) {
+                    lock_guard<std::mutex> lock(this->mutex);  // spill files are made one at a time
+                    spill(*worker->table, worker->files, 0);
+                }
+            }
+            worker->batches->close();
+        }
+    } catch (...) {
+        lock_guard<std::mutex> lock(this->mutex);
+        if (this->error == nullptr)
+            this->error = current_exception();
+    }
+}
+
+// Merge the states of the last partition into the table (spilling them a level deeper if they don't fit).
+void HashAggregateIterator::aggregate_partition() {
+    this->table.clear();
+    this->at = 0;
+    Partition &partition = this->partitions.back();
+    uint depth = partition.depth;
+    for (auto file: partition.files) {
+        for (ValueDict *state = file->next(); state != nullptr; state = file->next()) {
+            this->table.add_state(*state);
+            delete state;
+            if (this->table.get_bytes() > this->memory_budget && depth + 1 < MAX_DEPTH)
+                spill(this->table, this->files, depth + 1);
+        }
+    }
+    for (auto file: partition.files)
+        delete file;
+    this->partitions.pop_back();
+    if (!this->files.empty()) {
+        spill(this->table, this->files, depth + 1);
+        add_partitions(depth + 1);
+    }
+}
+
+// Write each of the table's groups' states to the file for its partition at depth, and empty the table.
+void HashAggregateIterator::spill(GroupTable &table, vector<SpillFile *> &files, uint depth) {
+    if (files.empty())
+        files.assign(FANOUT, nullptr);
+    for (uint i = 0; i < table.size(); i++) {
+        uint partition = partition_of(table.get_hash(i), depth);
+        if (files[partition] == nullptr)
+            files[partition] = new SpillFile();
+        ValueDict *state = table.get_state(i);
+        try {
+            files[partition]->append(*state);
+        } catch (DbRelationError &e) {
+            delete state;
+            throw;
+        }
+        delete state;
+    }
+    table.clear();
+}
+
+// Gather what we and the workers have spilled into partitions.
+void HashAggregateIterator::add_partitions(uint depth) {
+    vector<vector<SpillFile *> *> spilled;
+    spilled.push_back(&this->files);
+    for (auto worker: this->workers)
+        spilled.push_back(&worker->files);
+    for (uint i = 0; i < FANOUT; i++) {
+        Partition partition;
+        partition.depth = depth;
+        for (auto files: spilled)
+            if (!files->empty() && (*files)[i] != nullptr)
+                partition.files.push_back((*files)[i]);
+        if (!partition.files.empty()) {
+            this->partitions.push_back(partition);
+            this->partition_count++;
+        }
+    }
+    for (auto files: spilled)
+        files->clear();
+}
+
+void HashAggregateIterator::clear_partitions() {
+    for (auto const &partition: this->partitions)
+        for (auto file: partition.files)
+            delete file;
+    this->partitions.clear();
+    for (auto file: this->files)
+        delete file;
+    this->files.clear();
+    for (auto worker: this->workers) {
+        for (auto file: worker->files)
+            delete file;
+        worker->files.clear();
+    }
+}
+
+void HashAggregateIterator::free_workers() {
+    for (auto worker: this->workers) {
+        delete worker->batches;
+        delete worker->batch;
+        delete worker->table;
+        for (auto file: worker->files)
+            delete file;
+        delete worker;
+    }
+    this->workers.clear();
+}
+
+// The table's slots go by the low bits of the hash, so partitions go by the high ones, log2(FANOUT) of them a level.
+uint HashAggregateIterator::partition_of(size_t hash, uint depth) {
+    return (uint) (hash >> (sizeof(size_t) * 8 - 5 * (depth + 1))) % FANOUT;
+}
+
+// What an aggregation of rows should get, worked out the slow way, in order.
+static vector<ValueDict> test_expected(const vector<ValueDict> &rows, const AggregateSpec &aggregate) {
+    SortSpec key_order;
+    key_order.columns = aggregate.group_by;
+    key_order.descending.assign(aggregate.group_by.size(), false);
+    map<KeyBytes, vector<const ValueDict *>> groups;
+    KeyBytes key;
+    for (auto const &row: rows) {
+        sort_key(row, key_order, key);
+        groups[key].push_back(&row);
+    }
+    if (groups.empty() && aggregate.group_by.empty())
+        groups[key];
+    vector<ValueDict> expected;
+    for (auto const &group: groups) {
+        ValueDict result;
+        for (auto const &column_name: aggregate.group_by)
+            if (!group.second.empty() && group.second[0]->find(column_name) != group.second[0]->end())
+                result[column_name] = group.second[0]->at(column_name);
+        for (auto const &a: aggregate.aggregates) {
+            vector<Value> values;
+            for (auto row: group.second)
+                if (a.column.empty() || row->find(a.column) != row->end())
+                    values.push_back(a.column.empty() ? Value() : row->at(a.column));
+            int64_t sum = 0;
+            for (auto const &value: values)
+                sum += value.n;
+            if (a.function == AggregateSpec::Count)
+                result[a.name] = Value((int32_t) values.size());
+            else if (values.empty())
+                continue;
+            else if (a.function == AggregateSpec::Sum)
+                result[a.name] = Value((int32_t) sum);
+            else if (a.function == AggregateSpec::Avg)
+                result[a.name] = Value((int32_t) (sum / (int64_t) values.size()));
+            else if (a.function == AggregateSpec::Min)
+                result[a.name] = *min_element(values.begin(), values.end());
+            else
+                result[a.name] = *max_element(values.begin(), values.end());
+        }
+        expected.push_back(result);
+    }
+    sort(expected.begin(), expected.end());
+    return expected;
+}
+
+// Evaluate plan with memory_budget on workers threads and check it gets expected (in any order), and whether it
+// spilled.
+static bool test_aggregate(EvalPlan &plan, size_t memory_budget, uint workers, const vector<ValueDict> &expected,
+                           bool spills, const string &name) {
+    size_t saved = EvalPlan::get_aggregate_memory();
+    uint saved_workers = EvalPlan::get_max_workers();
+    EvalPlan::set_aggregate_memory(memory_budget);
+    EvalPlan::set_max_workers(workers);
+    EvalIterator *rows = plan.row_iterator();
+    EvalPlan::set_aggregate_memory(saved);
+    EvalPlan::set_max_workers(saved_workers);
+    vector<ValueDict> got;
+    for (int pass = 0; pass < 2; pass++) {  // again, to see it can be reopened
+        got.clear();
+        rows->open();
+        for (ValueDict *row = rows->next(); row != nullptr; row = rows->next()) {
+            got.push_back(*row);
+            delete row;
+        }
+        if (rows->next() != nullptr)
+            return assertion_failure("aggregate " + name + " past the end");
+    }
+    bool spilled = dynamic_cast<HashAggregateIterator *>(rows)->get_partition_count() > 0;
+    rows->close();
+    delete rows;
+    sort(got.begin(), got.end());
+    if (got.size() != expected.size())
+        return assertion_failure("aggregate " + name + " rows", (double) got.size(), (double) expected.size());
+    if (got != expected)
+        return assertion_failure("aggregate " + name + " values");
+    if (spilled != spills)
+        return assertion_failure("aggregate " + name + " spilled", spilled, spills);
+    return true;
+}
+
+// Aggregates with and without GROUP BY, in memory and spilled (some partitions more than once), on one thread and on
+// several, of no rows, and of rows with NULLs (from a left outer join), checked against working them out the slow way.
+bool test_aggregates() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_aggregate", column_names, column_attributes);
+    table.create();
+    const int n = 20 * 1000;
+    vector<ValueDict> rows;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i % 1000);
+        row["b"] = Value("b" + to_string(i % 7));
+        row["c"] = Value((i * 7919) % 10007 - 5000);
+        table.insert(&row);
+        rows.push_back(row);
+    }
+
+    AggregateSpec totals, by_a_b;
+    const AggregateSpec::Function functions[] = {AggregateSpec::Count, AggregateSpec::Sum, AggregateSpec::Min,
+                                                 AggregateSpec::Max, AggregateSpec::Avg};
+    const char *function_names[] = {"COUNT", "SUM", "MIN", "MAX", "AVG"};
+    for (uint i = 0; i < 5; i++)
+        totals.aggregates.push_back({functions[i], "c", string(function_names[i]) + "(c)"});
+    totals.aggregates.push_back({AggregateSpec::Count, "", "COUNT(*)"});
+    totals.aggregates.push_back({AggregateSpec::Min, "b", "MIN(b)"});
+    totals.aggregates.push_back({AggregateSpec::Max, "b", "MAX(b)"});
+    by_a_b = totals;
+    by_a_b.group_by.push_back("a");
+    by_a_b.group_by.push_back("b");
+
+    bool ok = true;
+    {
+        EvalPlan plan(new AggregateSpec(totals), new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table)));
+        vector<ValueDict> expected = test_expected(rows, totals);
+        ok = test_aggregate(plan, 64 << 20, 1, expected, false, "totals") &&
+             test_aggregate(plan, 64 << 20, 4, expected, false, "totals on 4 threads");
+    }
+    if (ok) {
+        EvalPlan plan(new AggregateSpec(by_a_b), new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table)));
+        vector<ValueDict> expected = test_expected(rows, by_a_b);  // 7000 groups
+        ok = test_aggregate(plan, 64 << 20, 1, expected, false, "by a, b") &&
+             test_aggregate(plan, 64 << 20, 4, expected, false, "by a, b on 4 threads") &&
+             test_aggregate(plan, 64 << 10, 1, expected, true, "by a, b spilled") &&
+             test_aggregate(plan, 64 << 10, 4, expected, true, "by a, b spilled on 4 threads") &&
+             test_aggregate(plan, 4 << 10, 1, expected, true, "by a, b spilled deeper");
+    }
+    if (ok) {
+        ValueDict *none = new ValueDict();
+        (*none)["a"] = Value(-1);
+        EvalPlan plan(new AggregateSpec(totals),
+                      new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(none, new EvalPlan(table))));
+        ok = test_aggregate(plan, 64 << 20, 1, test_expected(vector<ValueDict>(), totals), false, "of no rows");
+    }
+
+    // NULLs: group by, and aggregate, a column that half the rows of a left outer join don't have
+    ColumnNames other_names;
+    other_names.push_back("id");
+    other_names.push_back("w");
+    ColumnAttributes other_attributes;
+    other_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    other_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable other("__test_aggregate_other", other_names, other_attributes);
+    other.create();
+    vector<ValueDict> joined;
+    for (auto const &row: rows) {
+        joined.push_back(row);
+        if (row.at("a").n < 500)
+            joined.back()["w"] = Value(row.at("a").n % 3);
+    }
+    for (int i = 0; i < 500; i++) {
+        ValueDict row;
+        row["id"] = Value(i);
+        row["w"] = Value(i % 3);
+        other.insert(&row);
+    }
+    if (ok) {
+        AggregateSpec by_w;
+        by_w.group_by.push_back("w");
+        by_w.aggregates.push_back({AggregateSpec::Count, "", "COUNT(*)"});
+        by_w.aggregates.push_back({AggregateSpec::Sum, "c", "SUM(c)"});
+        AggregateSpec of_w;
+        of_w.aggregates.push_back({AggregateSpec::Count, "w", "COUNT(w)"});
+        of_w.aggregates.push_back({AggregateSpec::Sum, "w", "SUM(w)"});
+        of_w.aggregates.push_back({AggregateSpec::Max, "w", "MAX(w)"});
+        for (auto const &aggregate: {by_w, of_w}) {
+            JoinSpec join;
+            join.left_outer = true;
+            join.left_keys.push_back("a");
+            join.right_keys.push_back("id");
+            EvalPlan plan(new AggregateSpec(aggregate),
+                          new EvalPlan(EvalPlan::HashJoin, new JoinSpec(join), nullptr,
+                                       new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table)),
+                                       new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(other))));
+            ok = ok && test_aggregate(plan, 64 << 20, 1, test_expected(joined, aggregate), false, "with NULLs");
+        }
+    }
+    other.drop();
+    table.drop();
+    return ok;
+}
+
+// Aggregating 500k rows by a column with 100k values: on one thread, on all the workers, and spilled.
+void benchmark_aggregates() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("g");
+    column_names.push_back("v");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__benchmark_aggregate", column_names, column_attributes);
+    table.create();
+    const int n = 500 * 1000, groups = 100 * 1000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["id"] = Value(i);
+        row["g"] = Value((int32_t) ((i * 7919L) % groups));
+        row["v"] = Value(i % 1000);
+        table.insert(&row);
+    }
+    AggregateSpec aggregate;
+    aggregate.group_by.push_back("g");
+    aggregate.aggregates.push_back({AggregateSpec::Count, "", "COUNT(*)"});
+    aggregate.aggregates.push_back({AggregateSpec::Sum, "v", "SUM(v)"});
+    aggregate.aggregates.push_back({AggregateSpec::Max, "v", "MAX(v)"});
+    ColumnNames *projection = new ColumnNames();
+    projection->push_back("g");
+    projection->push_back("v");
+    EvalPlan plan(new AggregateSpec(aggregate), new EvalPlan(projection, new EvalPlan(table)));
+
+    size_t saved = EvalPlan::get_aggregate_memory();
+    uint saved_workers = EvalPlan::get_max_workers();
+    struct {
+        uint workers;
+        size_t budget;
+    } runs[] = {{1, saved}, {saved_workers, saved}, {1, 1 << 20}};
+    cout << "aggregate of " << n << " rows into " << groups << " groups:";
+    for (auto const &run: runs) {
+        EvalPlan::set_max_workers(run.workers);
+        EvalPlan::set_aggregate_memory(run.budget);
+        auto start = chrono::steady_clock::now();
+        EvalIterator *rows = plan.row_iterator();
+        size_t count = 0;
+        rows->open();
+        for (ValueDict *row = rows->next(); row != nullptr; row = rows->next(), count++)
+            delete row;
+        uint partitions = dynamic_cast<HashAggregateIterator *>(rows)->get_partition_count();
+        rows->close();
+        delete rows;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << " " << EvalPlan::get_max_workers() << " workers, budget " << run.budget / 1024 << "KB: " << count
+             << " groups in " << seconds << "s ("
+             << (partitions == 0 ? string("in memory") : to_string(partitions) + " partitions") << ");";
+    }
+    cout << endl;
+    EvalPlan::set_aggregate_memory(saved);
+    EvalPlan::set_max_workers(saved_workers);
+    table.drop();
+}
@@ -0,0 +1,221 @@
+/**
+ * @file aggregates.h - the iterator that evaluates aggregate plans (a hash aggregation), and the pieces it uses
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <exception>
+#include <mutex>
+#include <thread>
+#include "sorts.h"
+
+/**
+ * @class GroupTable - the groups an aggregation has found so far, each with the running state of its aggregates, in
+ * an open-addressing hash table on their group_by values (as a sort_key)
+ *
+ * Rows are added one at a time or a ColumnBatch at a time. A group can also be written out as a state row, with its
+ * group_by values and its aggregates' states (in columns such as "#0.count", which no table's column can be called),
+ * and later added back into another table. So a table can be a partial aggregation of some of the rows, to be merged
+ * with the others': one per worker thread, say, or some of the groups spilled to disk.
+ */
+class GroupTable {
+public:
+    explicit GroupTable(const AggregateSpec &aggregate);
+
+    virtual ~GroupTable();
+
+    GroupTable(const GroupTable &other) = delete;
+
+    GroupTable &operator=(const GroupTable &other) = delete;
+
+    /**
+     * Add a row to its group's aggregates.
+     */
+    void add_row(const ValueDict &row);
+
+    /**
+     * Add the selected rows of a batch (which has every column the aggregation reads).
+     */
+    void add_batch(ColumnBatch &batch);
+
+    /**
+     * Merge a group's state (from get_state of this or another table) into the group here.
+     */
+    void add_state(const ValueDict &state);
+
+    /**
+     * Merge all of another table's groups into this one's.
+     */
+    void add_table(const GroupTable &other);
+
+    /**
+     * Number of groups.
+     */
+    uint size() const { return (uint) this->groups.size(); }
+
+    /**
+     * About how many bytes of memory the groups take.
+     */
+    size_t get_bytes() const { return this->bytes; }
+
+    /**
+     * A hash of group i's group_by values, the same in any table.
+     */
+    size_t get_hash(uint i) const { return this->groups[i]->hash; }
+
+    /**
+     * Group i's state row (freed by caller).
+     */
+    ValueDict *get_state(uint i) const;
+
+    /**
+     * Group i's result row: its group_by values and each aggregate by its name (freed by caller).
+     */
+    ValueDict *get_result(uint i) const;
+
+    /**
+     * Empty the table.
+     */
+    void clear();
+
+protected:
+    // The state of one aggregate of a group (so far). Only Sum and Avg use the sum, and only Min and Max the min and
+    // max, which are set once count is more than 0.
+    struct Accumulator {
+        int64_t count;
+        int64_t sum;
+        Value min, max;
+    };
+
+    struct Group {
+        KeyBytes key;
+        size_t hash;
+        ValueDict values;  // of the group_by columns
+        std::vector<Accumulator> accumulators;
+    };
+
+    const AggregateSpec &aggregate;
+    SortSpec key_order;  // the group_by columns, to get a group's sort_key
+    std::vector<Group *> groups;
+    std::vector<uint32_t> slots;  // a power of 2 of them, each 1 + the number of its group, or 0 if empty
+    size_t bytes;
+    ValueDict values;  // reused by add_batch for each row's group_by values
+    KeyBytes key;  // and its key
+
+    Group &find(const ValueDict &row);
+
+    static void accumulate(const AggregateSpec::Aggregate &aggregate, Accumulator &accumulator, const Value &value);
+
+    static void merge(const AggregateSpec::Aggregate &aggregate, Accumulator &into, const Accumulator &from);
+
+    void grow();
+};
+
+/**
+ * @class HashAggregateIterator - a hash aggregation: the groups of all of its input's rows, with their aggregates
+ *
+ * The groups are collected in a GroupTable. If there get to be more of them than fit in the memory budget, the table
+ * is spilled: each group's state goes to one of FANOUT SpillFiles (by a hash of its group_by values), and the table
+ * starts over empty. Once the input is done, if anything was spilled, what's left is spilled too, and each partition's
+ * states are aggregated in turn (spilling into partitions of its own, by other bits of the hash, if it's still too
+ * big, down to MAX_DEPTH, after which it is held in memory however big it is).
+ *
+ * Given a projection of selects on a table scan instead of rows, the table is split into morsels which worker threads
+ * each take a batch at a time into a GroupTable of their own (with their share of the memory budget, spilling on
+ * their own if they have to), and these partial aggregations are merged at the end.
+ */
+class HashAggregateIterator : public EvalIterator {
+public:
+    static const uint FANOUT = 32;
+    static const uint MAX_DEPTH = 3;
+    static const uint MORSEL_PAGES = 16;
+
+    /**
+     * @param input          the rows to aggregate (freed by this iterator)
+     * @param aggregate      how to (has to outlive the iterator)
+     * @param memory_budget  about how many bytes of groups to hold in memory
+     */
+    HashAggregateIterator(EvalIterator *input, const AggregateSpec &aggregate, size_t memory_budget);
+
+    /**
+     * @param plan           a projection of selects on a table scan (has to outlive the iterator)
+     * @param relation       the table it scans
+     * @param column_names   the projection's columns
+     * @param worker_count   how many threads to aggregate it on
+     * @param aggregate      how to (has to outlive the iterator)
+     * @param memory_budget  about how many bytes of groups to hold in memory (in all)
+     */
+    HashAggregateIterator(EvalPlan *plan, DbRelation &relation, const ColumnNames &column_names, uint worker_count,
+                          const AggregateSpec &aggregate, size_t memory_budget);
+
+    virtual ~HashAggregateIterator();
+
+    /**
+     * Reads and aggregates all of the input's rows (except those of any spilled partitions, which next aggregates
+     * one partition at a time).
+     */
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    /**
+     * Number of partitions spilled to disk (0 if the groups all fit in memory).
+     */
+    uint get_partition_count() const { return this->partition_count; }
+
+protected:
+    struct Partition {
+        std::vector<SpillFile *> files;  // its states
+        uint depth;
+    };
+
+    // One per worker thread.
+    struct Worker {
+        Morsel morsel;
+        BatchIterator *batches;
+        ColumnBatch *batch;
+        GroupTable *table;
+        std::vector<SpillFile *> files;  // a partition of what it's spilled, FANOUT of them (or empty)
+        std::thread thread;
+    };
+
+    EvalIterator *input;  // null when the workers scan relation instead
+    DbRelation *relation;
+    std::vector<Worker *> workers;
+    const AggregateSpec &aggregate;
+    size_t memory_budget;
+    GroupTable table;  // the groups being given out
+    uint at;  // the next one
+    std::vector<SpillFile *> files;  // a partition of what the table has spilled, FANOUT of them (or empty)
+    std::vector<Partition> partitions;  // spilled and still to be aggregated
+    uint partition_count;
+    std::mutex mutex;  // guards the rest (for the workers)
+    uint morsel_count, page_count, claimed;
+    std::exception_ptr error;  // from the first worker that failed
+
+    void aggregate_rows();
+
+    void aggregate_morsels();
+
+    void work(Worker *worker);
+
+    void aggregate_partition();
+
+    void spill(GroupTable &table, std::vector<SpillFile *> &files, uint depth);
+
+    void add_partitions(uint depth);
+
+    void clear_partitions();
+
+    void free_workers();
+
+    static uint partition_of(size_t hash, uint depth);
+};
+
+bool test_aggregates();
+
+void benchmark_aggregates();
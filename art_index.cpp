@@ -0,0 +1,1233 @@
+/**
+ * @file art_index.cpp - implementation of ArtTree and ArtIndex
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include "art_index.h"
+#include "btree.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ART_SSE2
+#endif
+
+using namespace std;
+
+/***********
+ * ArtTree *
+ ***********/
+
+const uint ArtTree::MAX_PREFIX;
+
+enum ArtNodeType : uint8_t {
+    NODE4, NODE16, NODE48, NODE256, LEAF
+};
+
+struct ArtNode {
+    uint8_t type;
+    uint16_t count;  // number of children
+    uint32_t prefix_len;  // length of the compressed path in front of the children's bytes
+    uint8_t prefix[ArtTree::MAX_PREFIX];  // the first MAX_PREFIX bytes of it
+
+    explicit ArtNode(uint8_t type) : type(type), count(0), prefix_len(0) {}
+};
+
+struct ArtNode4 : ArtNode {
+    uint8_t keys[4];
+    ArtNode *children[4];
+
+    ArtNode4() : ArtNode(NODE4) {}
+};
+
+struct ArtNode16 : ArtNode {
+    uint8_t keys[16];
+    ArtNode *children[16];
+
+    ArtNode16() : ArtNode(NODE16) {}
+};
+
+struct ArtNode48 : ArtNode {
+    uint8_t slots[256];  // for each byte, 1 + where its child is in children (0 for none)
+    ArtNode *children[48];
+
+    ArtNode48() : ArtNode(NODE48) {
+        memset(slots, 0, sizeof(slots));
+        memset(children, 0, sizeof(children));
+    }
+};
+
+struct ArtNode256 : ArtNode {
+    ArtNode *children[256];
+
+    ArtNode256() : ArtNode(NODE256) {
+        memset(children, 0, sizeof(children));
+    }
+};
+
+struct ArtLeaf : ArtNode {
+    KeyBytes key;
+    Handles handles;
+
+    explicit ArtLeaf(const KeyBytes &key) : ArtNode(LEAF), key(key) {}
+};
+
+static uint8_t byte_at(const KeyBytes &key, size_t depth) {
+    return (uint8_t) key[depth];
+}
+
+// The pointer to the child for byte (null if there isn't one).
+static ArtNode **find_child(ArtNode *node, uint8_t byte) {
+    switch (node->type) {
+        case NODE4: {
+            ArtNode4 *n = static_cast<ArtNode4 *>(node);
+            for (uint i = 0; i < n->count; i++)
+                if (n->keys[i] == byte)
+                    return &n->children[i];
+            return nullptr;
+        }
+        case NODE16: {
+            ArtNode16 *n = static_cast<ArtNode16 *>(node);
+#ifdef ART_SSE2
+            __m128i matches = _mm_cmpeq_epi8(_mm_set1_epi8((char) byte), _mm_loadu_si128((const __m128i *) n->keys));
+            int mask = _mm_movemask_epi8(matches) & ((1 << n->count) - 1);
+            return mask == 0 ? nullptr : &n->children[__builtin_ctz(mask)];
+#else
+            for (uint i = 0; i < n->count; i++)
+                if (n->keys[i] == byte)
+                    return &n->children[i];
+            return nullptr;
+#endif
+        }
+        case NODE48: {
+            ArtNode48 *n = static_cast<ArtNode48 *>(node);
+            return n->slots[byte] == 0 ? nullptr : &n->children[n->slots[byte] - 1];
+        }
+        case NODE256: {
+            ArtNode256 *n = static_cast<ArtNode256 *>(node);
+            return n->children[byte] == nullptr ? nullptr : &n->children[byte];
+        }
+        default:
+            return nullptr;
+    }
+}
+
+// Call visit(byte, child) for each child, in byte order.
+static void for_each_child(const ArtNode *node, const function<void(uint8_t, const ArtNode *)> &visit) {
+    switch (node->type) {
+        case NODE4: {
+            const ArtNode4 *n = static_cast<const ArtNode4 *>(node);
+            for (uint i = 0; i < n->count; i++)
+                visit(n->keys[i], n->children[i]);
+            break;
+        }
+        case NODE16: {
+            const ArtNode16 *n = static_cast<const ArtNode16 *>(node);
+            for (uint i = 0; i < n->count; i++)
+                visit(n->keys[i], n->children[i]);
+            break;
+        }
+        case NODE48: {
+            const ArtNode48 *n = static_cast<const ArtNode48 *>(node);
+            for (uint b = 0; b < 256; b++)
+                if (n->slots[b] != 0)
+                    visit((uint8_t) b, n->children[n->slots[b] - 1]);
+            break;
+        }
+        case NODE256: {
+            const ArtNode256 *n = static_cast<const ArtNode256 *>(node);
+            for (uint b = 0; b < 256; b++)
+                if (n->children[b] != nullptr)
+                    visit((uint8_t) b, n->children[b]);
+            break;
+        }
+    }
+}
+
+// The leaf with the smallest key under node.
+static const ArtLeaf *minimum(const ArtNode *node) {
+    while (node->type != LEAF) {
+        switch (node->type) {
+            case NODE4:
+                node = static_cast<const ArtNode4 *>(node)->children[0];
+                break;
+            case NODE16:
+                node = static_cast<const ArtNode16 *>(node)->children[0];
+                break;
+            case NODE48: {
+                const ArtNode48 *n = static_cast<const ArtNode48 *>(node);
+                uint b = 0;
+                while (n->slots[b] == 0)
+                    b++;
+                node = n->children[n->slots[b] - 1];
+                break;
+            }
+            case NODE256: {
+                const ArtNode256 *n = static_cast<const ArtNode256 *>(node);
+                uint b = 0;
+                while (n->children[b] == nullptr)
+                    b++;
+                node = n->children[b];
+                break;
+            }
+        }
+    }
+    return static_cast<const ArtLeaf *>(node);
+}
+
+// The whole compressed path of node, which sits at depth (from a leaf under it if it's longer than the node keeps).
+static KeyBytes full_prefix(const ArtNode *node, size_t depth) {
+    if (node->prefix_len <= ArtTree::MAX_PREFIX)
+        return KeyBytes((const char *) node->prefix, node->prefix_len);
+    return minimum(node)->key.substr(depth, node->prefix_len);
+}
+
+// How many bytes of node's compressed path key matches, starting at depth.
+static uint prefix_mismatch(const ArtNode *node, const KeyBytes &key, size_t depth) {
+    size_t kept = min((size_t) min(node->prefix_len, ArtTree::MAX_PREFIX), key.size() - depth);
+    uint i = 0;
+    for (; i < kept; i++)
+        if (node->prefix[i] != byte_at(key, depth + i))
+            return i;
+    if (node->prefix_len > ArtTree::MAX_PREFIX) {
+        const KeyBytes &other = minimum(node)->key;
+        size_t size = min(min(other.size(), key.size()) - depth, (size_t) node->prefix_len);
+        for (; i < size; i++)
+            if (other[depth + i] != key[depth + i])
+                return i;
+    }
+    return i;
+}
+
+static void copy_header(ArtNode *to, const ArtNode *from) {
+    to->count = from->count;
+    to->prefix_len = from->prefix_len;
+    memcpy(to->prefix, from->prefix, min(from->prefix_len, ArtTree::MAX_PREFIX));
+}
+
+// Add a child to the node in ref, moving it to the next bigger kind of node first if it's full.
+static void add_child(ArtNode *&ref, uint8_t byte, ArtNode *child) {
+    ArtNode *node = ref;
+    switch (node->type) {
+        case NODE4: {
+            ArtNode4 *n = static_cast<ArtNode4 *>(node);
+            if (n->count < 4) {
+                uint i = 0;
+                while (i < n->count && n->keys[i] < byte)
+                    i++;
+                memmove(n->keys + i + 1, n->keys + i, n->count - i);
+                memmove(n->children + i + 1, n->children + i, (n->count - i) * sizeof(ArtNode *));
+                n->keys[i] = byte;
+                n->children[i] = child;
+                n->count++;
+                return;
+            }
+            ArtNode16 *bigger = new ArtNode16();
+            copy_header(bigger, n);
+            memcpy(bigger->keys, n->keys, sizeof(n->keys));
+            memcpy(bigger->children, n->children, sizeof(n->children));
+            ref = bigger;
+            delete n;
+            break;
+        }
+        case NODE16: {
+            ArtNode16 *n = static_cast<ArtNode16 *>(node);
+            if (n->count < 16) {
+                uint i = 0;
+                while (i < n->count && n->keys[i] < byte)
+                    i++;
+                memmove(n->keys + i + 1, n->keys + i, n->count - i);
+                memmove(n->children + i + 1, n->children + i, (n->count - i) * sizeof(ArtNode *));
+                n->keys[i] = byte;
+                n->children[i] = child;
+                n->count++;
+                return;
+            }
+            ArtNode48 *bigger = new ArtNode48();
+            copy_header(bigger, n);
+            for (uint i = 0; i < 16; i++) {
+                bigger->slots[n->keys[i]] = (uint8_t) (i + 1);
+                bigger->children[i] = n->children[i];
+            }
+            ref = bigger;
+            delete n;
+            break;
+        }
+        case NODE48: {
+            ArtNode48 *n = static_cast<ArtNode48 *>(node);
+            if (n->count < 48) {
+                uint i = 0;
+                while (n->children[i] != nullptr)
+                    i++;
+                n->children[i] = child;
+                n->slots[byte] = (uint8_t) (i + 1);
+                n->count++;
+                return;
+            }
+            ArtNode256 *bigger = new ArtNode256();
+            copy_header(bigger, n);
+            for (uint b = 0; b < 256; b++)
+                if (n->slots[b] != 0)
+                    bigger->children[b] = n->children[n->slots[b] - 1];
+            ref = bigger;
+            delete n;
+            break;
+        }
+        case NODE256: {
+            ArtNode256 *n = static_cast<ArtNode256 *>(node);
+            n->children[byte] = child;
+            n->count++;
+            return;
+        }
+    }
+    add_child(ref, byte, child);  // now that there's room
+}
+
+// Take the (already emptied) child for byte out of the node in ref, moving it to the next smaller kind of node once
+// it's down to a few children (with some slack, so a node at the boundary doesn't flip back and forth). A Node4 left
+// with one child is replaced by that child, with the two compressed paths joined.
+static void remove_child(ArtNode *&ref, uint8_t byte) {
+    ArtNode *node = ref;
+    switch (node->type) {
+        case NODE4: {
+            ArtNode4 *n = static_cast<ArtNode4 *>(node);
+            uint i = 0;
+            while (n->keys[i] != byte)
+                i++;
+            memmove(n->keys + i, n->keys + i + 1, n->count - i - 1);
+            memmove(n->children + i, n->children + i + 1, (n->count - i - 1) * sizeof(ArtNode *));
+            n->count--;
+            if (n->count == 1) {
+                ArtNode *child = n->children[0];
+                if (child->type != LEAF) {
+                    uint8_t joined[ArtTree::MAX_PREFIX];
+                    uint size = min(n->prefix_len, ArtTree::MAX_PREFIX);
+                    memcpy(joined, n->prefix, size);
+                    if (size < ArtTree::MAX_PREFIX)
+                        joined[size++] = n->keys[0];
+                    uint more = min(child->prefix_len, ArtTree::MAX_PREFIX - size);
+                    memcpy(joined + size, child->prefix, more);
+                    size += more;
+                    memcpy(child->prefix, joined, size);
+                    child->prefix_len += n->prefix_len + 1;
+                }
+                ref = child;
+                delete n;
+            }
+            return;
+        }
+        case NODE16: {
+            ArtNode16 *n = static_cast<ArtNode16 *>(node);
+            uint i = 0;
+            while (n->keys[i] != byte)
+                i++;
+            memmove(n->keys + i, n->keys + i + 1, n->count - i - 1);
+            memmove(n->children + i, n->children + i + 1, (n->count - i - 1) * sizeof(ArtNode *));
+            n->count--;
+            if (n->count == 3) {
+                ArtNode4 *smaller = new ArtNode4();
+                copy_header(smaller, n);
+                memcpy(smaller->keys, n->keys, 3);
+                memcpy(smaller->children, n->children, 3 * sizeof(ArtNode *));
+                ref = smaller;
+                delete n;
+            }
+            return;
+        }
+        case NODE48: {
+            ArtNode48 *n = static_cast<ArtNode48 *>(node);
+            n->children[n->slots[byte] - 1] = nullptr;
+            n->slots[byte] = 0;
+            n->count--;
+            if (n->count == 12) {
+                ArtNode16 *smaller = new ArtNode16();
+                copy_header(smaller, n);
+                uint i = 0;
+                for (uint b = 0; b < 256; b++) {
+                    if (n->slots[b] != 0) {
+                        smaller->keys[i] = (uint8_t) b;
+                        smaller->children[i++] = n->children[n->slots[b] - 1];
+                    }
+                }
+                ref = smaller;
+                delete n;
+            }
+            return;
+        }
+        case NODE256: {
+            ArtNode256 *n = static_cast<ArtNode256 *>(node);
+            n->children[byte] = nullptr;
+            n->count--;
+            if (n->count == 37) {
+                ArtNode48 *smaller = new ArtNode48();
+                copy_header(smaller, n);
+                uint i = 0;
+                for (uint b = 0; b < 256; b++) {
+                    if (n->children[b] != nullptr) {
+                        smaller->slots[b] = (uint8_t) (i + 1);
+                        smaller->children[i++] = n->children[b];
+                    }
+                }
+                ref = smaller;
+                delete n;
+            }
+            return;
+        }
+    }
+}
+
+static void free_node(ArtNode *node) {
+    if (node == nullptr)
+        return;
+    if (node->type == LEAF) {
+        delete static_cast<ArtLeaf *>(node);
+        return;
+    }
+    for_each_child(node, [](uint8_t byte, const ArtNode *child) { free_node(const_cast<ArtNode *>(child)); });
+    switch (node->type) {
+        case NODE4:
+            delete static_cast<ArtNode4 *>(node);
+            break;
+        case NODE16:
+            delete static_cast<ArtNode16 *>(node);
+            break;
+        case NODE48:
+            delete static_cast<ArtNode48 *>(node);
+            break;
+        default:
+            delete static_cast<ArtNode256 *>(node);
+    }
+}
+
+static void insert_node(ArtNode *&ref, const KeyBytes &key, size_t depth, Handle handle) {
+    ArtNode *node = ref;
+    if (node == nullptr) {
+        ArtLeaf *leaf = new ArtLeaf(key);
+        leaf->handles.push_back(handle);
+        ref = leaf;
+        return;
+    }
+
+    if (node->type == LEAF) {
+        ArtLeaf *leaf = static_cast<ArtLeaf *>(node);
+        if (leaf->key == key) {
+            leaf->handles.push_back(handle);
+            return;
+        }
+        // split the leaf: a Node4 with the path the two keys have in common and each of them under it
+        size_t common = depth;
+        while (common < key.size() && common < leaf->key.size() && key[common] == leaf->key[common])
+            common++;
+        if (common == key.size() || common == leaf->key.size())
+            throw DbRelationError("adaptive radix tree keys can't be prefixes of each other");
+        ArtNode4 *split = new ArtNode4();
+        split->prefix_len = (uint32_t) (common - depth);
+        memcpy(split->prefix, key.data() + depth, min(split->prefix_len, ArtTree::MAX_PREFIX));
+        ArtLeaf *new_leaf = new ArtLeaf(key);
+        new_leaf->handles.push_back(handle);
+        ArtNode *split_ref = split;
+        add_child(split_ref, byte_at(leaf->key, common), leaf);
+        add_child(split_ref, byte_at(key, common), new_leaf);
+        ref = split_ref;
+        return;
+    }
+
+    if (node->prefix_len > 0) {
+        uint matched = prefix_mismatch(node, key, depth);
+        if (matched < node->prefix_len) {
+            // key leaves the compressed path part way along: split it with a Node4 where they part
+            if (depth + matched >= key.size())
+                throw DbRelationError("adaptive radix tree keys can't be prefixes of each other");
+            ArtNode4 *split = new ArtNode4();
+            split->prefix_len = matched;
+            memcpy(split->prefix, node->prefix, min(matched, ArtTree::MAX_PREFIX));
+            ArtNode *split_ref = split;
+            if (node->prefix_len <= ArtTree::MAX_PREFIX) {
+                add_child(split_ref, node->prefix[matched], node);
+                node->prefix_len -= matched + 1;
+                memmove(node->prefix, node->prefix + matched + 1, min(node->prefix_len, ArtTree::MAX_PREFIX));
+            } else {
+                const KeyBytes &other = minimum(node)->key;
+                add_child(split_ref, byte_at(other, depth + matched), node);
+                node->prefix_len -= matched + 1;
+                memcpy(node->prefix, other.data() + depth + matched + 1, min(node->prefix_len, ArtTree::MAX_PREFIX));
+            }
+            ArtLeaf *new_leaf = new ArtLeaf(key);
+            new_leaf->handles.push_back(handle);
+            add_child(split_ref, byte_at(key, depth + matched), new_leaf);
+            ref = split_ref;
+            return;
+        }
+        depth += node->prefix_len;
+    }
+
+    if (depth >= key.size())
+        throw DbRelationError("adaptive radix tree keys can't be prefixes of each other");
+    ArtNode **child = find_child(node, byte_at(key, depth));
+    if (child != nullptr) {
+        insert_node(*child, key, depth + 1, handle);
+        return;
+    }
+    ArtLeaf *new_leaf = new ArtLeaf(key);
+    new_leaf->handles.push_back(handle);
+    add_child(ref, byte_at(key, depth), new_leaf);
+}
+
+static bool del_node(ArtNode *&ref, const KeyBytes &key, size_t depth, Handle handle) {
+    ArtNode *node = ref;
+    if (node == nullptr)
+        return false;
+    if (node->type == LEAF) {
+        ArtLeaf *leaf = static_cast<ArtLeaf *>(node);
+        if (leaf->key != key)
+            return false;
+        auto found = find(leaf->handles.begin(), leaf->handles.end(), handle);
+        if (found == leaf->handles.end())
+            return false;
+        leaf->handles.erase(found);
+        if (leaf->handles.empty()) {
+            delete leaf;
+            ref = nullptr;
+        }
+        return true;
+    }
+    if (node->prefix_len > 0) {
+        if (prefix_mismatch(node, key, depth) < min(node->prefix_len, ArtTree::MAX_PREFIX))
+            return false;
+        depth += node->prefix_len;  // the rest of the path gets checked against the leaf's key
+    }
+    if (depth >= key.size())
+        return false;
+    uint8_t byte = byte_at(key, depth);
+    ArtNode **child = find_child(node, byte);
+    if (child == nullptr || !del_node(*child, key, depth + 1, handle))
+        return false;
+    if (*child == nullptr)
+        remove_child(ref, byte);
+    return true;
+}
+
+// Compare path, the first bytes of every key under some node, with a bound. Sets check to false if every key under
+// the node is on the right side of the bound, and returns false if every one is on the wrong side of it.
+static bool within(const KeyBytes &path, const KeyBytes &bound, bool is_max, bool &check) {
+    size_t n = min(path.size(), bound.size());
+    int cmp = memcmp(path.data(), bound.data(), n);
+    if (cmp != 0) {
+        check = false;
+        return is_max ? cmp < 0 : cmp > 0;
+    }
+    if (path.size() >= bound.size())
+        check = false;  // they all start with bound: that's >= a min, and counts as <= a max
+    return true;
+}
+
+static void scan_node(const ArtNode *node, size_t depth, KeyBytes &path, const KeyBytes &min_key,
+                      const KeyBytes *max_key, bool check_min, bool check_max, Handles &handles) {
+    if (node->type == LEAF) {
+        const ArtLeaf *leaf = static_cast<const ArtLeaf *>(node);
+        if (check_min && !(within(leaf->key, min_key, false, check_min) && !check_min))
+            return;  // less than min_key (or a prefix of it, which is less too)
+        if (check_max && !within(leaf->key, *max_key, true, check_max))
+            return;
+        handles.insert(handles.end(), leaf->handles.begin(), leaf->handles.end());
+        return;
+    }
+    size_t size = path.size();
+    path += full_prefix(node, depth);
+    if ((!check_min || within(path, min_key, false, check_min)) &&
+        (!check_max || within(path, *max_key, true, check_max))) {
+        for_each_child(node, [&](uint8_t byte, const ArtNode *child) {
+            path.push_back((char) byte);
+            scan_node(child, depth + node->prefix_len + 1, path, min_key, max_key, check_min, check_max, handles);
+            path.pop_back();
+        });
+    }
+    path.resize(size);
+}
+
+static void visit_leaves(const ArtNode *node, const function<void(const KeyBytes &, const Handles &)> &visit) {
+    if (node->type == LEAF) {
+        const ArtLeaf *leaf = static_cast<const ArtLeaf *>(node);
+        visit(leaf->key, leaf->handles);
+        return;
+    }
+    for_each_child(node, [&](uint8_t byte, const ArtNode *child) { visit_leaves(child, visit); });
+}
+
+static void count_nodes(const ArtNode *node, uint counts[5]) {
+    counts[node->type]++;
+    if (node->type != LEAF)
+        for_each_child(node, [&](uint8_t byte, const ArtNode *child) { count_nodes(child, counts); });
+}
+
+ArtTree::~ArtTree() {
+    free_node(this->root);
+}
+
+// Down a level for each byte of key, skipping over compressed paths, then check the whole key at the leaf.
+const Handles *ArtTree::find(const KeyBytes &key) const {
+    const ArtNode *node = this->root;
+    size_t depth = 0;
+    while (node != nullptr) {
+        if (node->type == LEAF) {
+            const ArtLeaf *leaf = static_cast<const ArtLeaf *>(node);
+            return leaf->key == key ? &leaf->handles : nullptr;
+        }
+        if (node->prefix_len > 0) {
+            size_t kept = min(node->prefix_len, MAX_PREFIX);
+            if (depth + kept > key.size() || memcmp(node->prefix, key.data() + depth, kept) != 0)
+                return nullptr;
+            depth += node->prefix_len;
+        }
+        if (depth >= key.size())
+            return nullptr;
+        ArtNode **child = find_child(const_cast<ArtNode *>(node), byte_at(key, depth));
+        node = child == nullptr ? nullptr : *child;
+        depth++;
+    }
+    return nullptr;
+}
+
+void ArtTree::insert(const KeyBytes &key, Handle handle) {
+    insert_node(this->root, key, 0, handle);
+    this->handle_count++;
+}
+
+bool ArtTree::del(const KeyBytes &key, Handle handle) {
+    if (!del_node(this->root, key, 0, handle))
+        return false;
+    this->handle_count--;
+    return true;
+}
+
+void ArtTree::scan(const KeyBytes &min_key, const KeyBytes *max_key, Handles &handles) const {
+    if (this->root == nullptr)
+        return;
+    KeyBytes path;
+    scan_node(this->root, 0, path, min_key, max_key, !min_key.empty(), max_key != nullptr, handles);
+}
+
+void ArtTree::for_each(const function<void(const KeyBytes &, const Handles &)> &visit) const {
+    if (this->root != nullptr)
+        visit_leaves(this->root, visit);
+}
+
+void ArtTree::clear() {
+    free_node(this->root);
+    this->root = nullptr;
+    this->handle_count = 0;
+}
+
+void ArtTree::node_counts(uint counts[5]) const {
+    for (uint i = 0; i < 5; i++)
+        counts[i] = 0;
+    if (this->root != nullptr)
+        count_nodes(this->root, counts);
+}
+
+
+/************
+ * ArtIndex *
+ ************/
+
+ArtIndex::ArtIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique),
+          closed(true),
+          file(relation.get_table_name() + "-" + name),
+          key_profile(),
+          tree(),
+          checkpoint_head(0),
+          log_head(0),
+          log_tail(0),
+          free_head(0),
+          log_count(0),
+          mutex() {
+    std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+// Create the index from the rows already in the table and write the first checkpoint.
+void ArtIndex::create() {
+    std::lock_guard<std::mutex> guard(mutex);
+    file.create();
+    closed = false;
+    SlottedPage *header = file.get(HEADER);
+    BlockID none = 0;
+    Dbt dbt(&none, sizeof(BlockID));
+    for (RecordID record_id = CHECKPOINT; record_id <= FREE; record_id++)
+        header->add(&dbt);
+    file.put(header);
+    delete header;
+    std::unique_ptr<Handles> table_rows(relation.select());
+    for (auto const &handle: *table_rows) {
+        ValueDict *row = relation.project(handle, &key_columns);
+        KeyBytes key = normalized_key(row);
+        delete row;
+        if (unique && tree.find(key) != nullptr)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        tree.insert(key, handle);
+    }
+    write_checkpoint();
+}
+
+// Drop the index.
+void ArtIndex::drop() {
+    std::lock_guard<std::mutex> guard(mutex);
+    file.drop();
+    tree.clear();
+    closed = true;
+}
+
+// Open existing index: load the checkpoint and replay the log. Enables: lookup, range, prefix, insert, delete.
+void ArtIndex::open() {
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+}
+
+// Open the index unless it already is (mutex held), as the first lookup or change does.
+void ArtIndex::open_locked() {
+    if (!closed)
+        return;
+    file.open();
+    SlottedPage *header = file.get(HEADER);
+    BlockID heads[FREE];
+    for (RecordID record_id = CHECKPOINT; record_id <= FREE; record_id++) {
+        Dbt *dbt = header->get(record_id);
+        heads[record_id - CHECKPOINT] = *(BlockID *) dbt->get_data();
+        delete dbt;
+    }
+    delete header;
+    checkpoint_head = heads[CHECKPOINT - 1];
+    log_head = heads[LOG - 1];
+    log_tail = heads[TAIL - 1];
+    free_head = heads[FREE - 1];
+    log_count = 0;
+    for (int is_log = 0; is_log < 2; is_log++) {
+        for (BlockID block_id = is_log ? log_head : checkpoint_head; block_id != 0;) {
+            SlottedPage *block = file.get(block_id);
+            RecordIDs *record_ids = block->ids();
+            for (auto const &record_id: *record_ids) {
+                Dbt *dbt = block->get(record_id);
+                const char *data = (const char *) dbt->get_data();
+                if (record_id == NEXT) {
+                    block_id = *(BlockID *) data;
+                } else {
+                    char op = is_log ? *data++ : '+';
+                    Handle handle(*(BlockID *) data, *(RecordID *) (data + sizeof(BlockID)));
+                    KeyBytes key(data + ENTRY_HEADER_SZ, dbt->get_size() - ENTRY_HEADER_SZ - (is_log ? 1 : 0));
+                    if (op == '+')
+                        tree.insert(key, handle);
+                    else
+                        tree.del(key, handle);
+                    if (is_log)
+                        log_count++;
+                }
+                delete dbt;
+            }
+            delete record_ids;
+            delete block;
+        }
+    }
+    closed = false;
+}
+
+// Closes the index, checkpointing it first if anything has changed. Disables: lookup, range, prefix, insert, delete.
+void ArtIndex::close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (closed)
+        return;
+    if (log_count > 0)
+        write_checkpoint();
+    file.close();
+    tree.clear();
+    closed = true;
+}
+
+Handles *ArtIndex::lookup(ValueDict *key_values) const {
+    KeyBytes key = normalized_key(key_values);
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<ArtIndex *>(this)->open_locked();
+    const Handles *found = tree.find(key);
+    return found == nullptr ? new Handles() : new Handles(*found);
+}
+
+// Find all the rows whose key is between min_key and max_key, inclusive, in key order. Either one can be null for
+// no limit on that end, and either one can have just the leading key columns.
+Handles *ArtIndex::range(ValueDict *min_key, ValueDict *max_key) const {
+    KeyBytes min_bytes = min_key == nullptr ? KeyBytes() : normalized_key(min_key);
+    KeyBytes max_bytes = max_key == nullptr ? KeyBytes() : normalized_key(max_key);
+    Handles *handles = new Handles();
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<ArtIndex *>(this)->open_locked();
+    tree.scan(min_bytes, max_key == nullptr ? nullptr : &max_bytes, *handles);
+    return handles;
+}
+
+// The normalized bytes of a TEXT value end with a two-byte terminator, so without it they are the prefix of the
+// bytes of every value that starts with it.
+Handles *ArtIndex::prefix(ValueDict *key_values) const {
+    KeyBytes prefix = normalized_key(key_values);
+    uint given = 0;
+    while (given < key_columns.size() && key_values->find(key_columns[given]) != key_values->end())
+        given++;
+    if (given > 0 && key_profile[given - 1] == ColumnAttribute::TEXT)
+        prefix.resize(prefix.size() - 2);
+    Handles *handles = new Handles();
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<ArtIndex *>(this)->open_locked();
+    tree.scan(prefix, &prefix, *handles);
+    return handles;
+}
+
+void ArtIndex::insert(Handle handle) {
+    ValueDict *row = relation.project(handle, &key_columns);
+    insert(handle, row);
+    delete row;
+}
+
+void ArtIndex::insert(Handle handle, const ValueDict *row) {
+    KeyBytes key = normalized_key(row);
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+    if (unique && tree.find(key) != nullptr)
+        throw DbRelationError("Duplicate keys are not allowed in unique index");
+    tree.insert(key, handle);
+    append_log('+', handle, key);
+}
+
+void ArtIndex::del(Handle handle) {
+    ValueDict *row = relation.project(handle, &key_columns);
+    KeyBytes key = normalized_key(row);
+    delete row;
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+    if (tree.del(key, handle))
+        append_log('-', handle, key);
+}
+
+void ArtIndex::checkpoint() {
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+    write_checkpoint();
+}
+
+void ArtIndex::node_counts(uint counts[5]) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<ArtIndex *>(this)->open_locked();
+    tree.node_counts(counts);
+}
+
+// The key columns present in key (all of them, or the leading ones for a range or prefix), normalized.
+KeyBytes ArtIndex::normalized_key(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns) {
+        auto value = key->find(column_name);
+        if (value == key->end())
+            break;
+        key_value.push_back(value->second);
+    }
+    return NormalizedKey::encode(&key_value, key_profile);
+}
+
+void ArtIndex::write_header() {
+    SlottedPage *header = file.get(HEADER);
+    BlockID heads[] = {checkpoint_head, log_head, log_tail, free_head};
+    for (RecordID record_id = CHECKPOINT; record_id <= FREE; record_id++) {
+        Dbt dbt(&heads[record_id - CHECKPOINT], sizeof(BlockID));
+        header->put(record_id, dbt);
+    }
+    file.put(header);
+    delete header;
+}
+
+// An empty block for a chain, from the free chain if it has one, with its next-block record already in it.
+SlottedPage *ArtIndex::take_block() {
+    SlottedPage *block;
+    if (free_head != 0) {
+        block = file.get(free_head);
+        Dbt *dbt = block->get(NEXT);
+        free_head = *(BlockID *) dbt->get_data();
+        delete dbt;
+        block->clear();
+    } else {
+        block = file.get_new();
+    }
+    BlockID next = 0;
+    Dbt dbt(&next, sizeof(BlockID));
+    block->add(&dbt);
+    return block;
+}
+
+// Put every block of the chain starting at head onto the free chain.
+void ArtIndex::free_chain(BlockID head) {
+    for (BlockID block_id = head; block_id != 0;) {
+        SlottedPage *block = file.get(block_id);
+        Dbt *dbt = block->get(NEXT);
+        BlockID next = *(BlockID *) dbt->get_data();
+        delete dbt;
+        block->clear();
+        Dbt free_dbt(&free_head, sizeof(BlockID));
+        block->add(&free_dbt);
+        file.put(block);
+        delete block;
+        free_head = block_id;
+        block_id = next;
+    }
+}
+
+// Write the whole tree into blocks that aren't part of the current checkpoint or log, switch the header over to it,
+// and only then free the old ones, so there is always a whole checkpoint to open.
+void ArtIndex::write_checkpoint() {
+    BlockID old_checkpoint = checkpoint_head, old_log = log_head;
+    SlottedPage *block = take_block();
+    BlockID new_checkpoint = block->get_block_id();
+    tree.for_each([&](const KeyBytes &key, const Handles &handles) {
+        for (auto const &handle: handles) {
+            string entry((const char *) &handle.first, sizeof(BlockID));
+            entry.append((const char *) &handle.second, sizeof(RecordID));
+            entry += key;
+            if (block->unused_bytes() < entry.size() + 4) {
+                SlottedPage *next = take_block();
+                BlockID next_id = next->get_block_id();
+                Dbt next_dbt(&next_id, sizeof(BlockID));
+                block->put(NEXT, next_dbt);
+                file.put(block);
+                delete block;
+                block = next;
+            }
+            Dbt dbt((void *) entry.data(), (u_int32_t) entry.size());
+            block->add(&dbt);
+        }
+    });
+    file.put(block);
+    delete block;
+    checkpoint_head = new_checkpoint;
+    log_head = log_tail = 0;
+    log_count = 0;
+    write_header();
+    free_chain(old_checkpoint);
+    free_chain(old_log);
+    write_header();
+}
+
+// Add an entry to the end of the log, and checkpoint instead once the log has caught up with the tree.
+void ArtIndex::append_log(char op, Handle handle, const KeyBytes &key) {
+    if (log_count + 1 >= max((uint64_t) MIN_CHECKPOINT_LOG, tree.size())) {
+        write_checkpoint();  // the tree already has this change in it
+        return;
+    }
+    string entry(1, op);
+    entry.append((const char *) &handle.first, sizeof(BlockID));
+    entry.append((const char *) &handle.second, sizeof(RecordID));
+    entry += key;
+    Dbt dbt((void *) entry.data(), (u_int32_t) entry.size());
+    SlottedPage *block = log_tail == 0 ? nullptr : file.get(log_tail);
+    if (block != nullptr && block->unused_bytes() >= entry.size() + 4) {
+        block->add(&dbt);
+        file.put(block);
+        delete block;
+    } else {
+        SlottedPage *next = take_block();
+        BlockID next_id = next->get_block_id();
+        next->add(&dbt);
+        file.put(next);
+        delete next;
+        if (block == nullptr) {
+            log_head = next_id;
+        } else {
+            Dbt next_dbt(&next_id, sizeof(BlockID));
+            block->put(NEXT, next_dbt);
+            file.put(block);
+            delete block;
+        }
+        log_tail = next_id;
+        write_header();
+    }
+    log_count++;
+}
+
+static KeyBytes path_key(const string &path) {
+    KeyValue key_value;
+    key_value.push_back(Value(path));
+    KeyProfile key_profile;
+    key_profile.push_back(ColumnAttribute::TEXT);
+    return NormalizedKey::encode(&key_value, key_profile);
+}
+
+static string random_path(mt19937 &random) {
+    const char *tops[] = {"/usr/local/lib/", "/usr/local/share/", "/usr/lib/", "/home/"};
+    string path = tops[random() % 4];
+    for (uint depth = 1 + random() % 3; depth > 0; depth--)
+        path += "dir" + to_string(random() % 20) + "/";
+    return path + "file" + to_string(random() % 100);
+}
+
+static bool same_handles(const Handles &found, const multimap<KeyBytes, Handle> &model, const KeyBytes &min_key,
+                         const KeyBytes *max_key) {
+    multiset<Handle> expected, got(found.begin(), found.end());
+    for (auto const &entry: model)
+        if (entry.first >= min_key && (max_key == nullptr || entry.first <= *max_key ||
+                                       entry.first.compare(0, max_key->size(), *max_key) == 0))
+            expected.insert(entry.second);
+    return expected == got;
+}
+
+// ArtTree against a multimap with path keys and INT keys (to get every kind of node), then ArtIndex across a reopen
+// that replays its log and one that loads a checkpoint.
+bool test_art_index() {
+    mt19937 random(5300);
+    ArtTree paths;
+    multimap<KeyBytes, Handle> model;
+    for (uint i = 0; i < 5000; i++) {
+        KeyBytes key = path_key(random_path(random));
+        Handle handle(i / 100 + 1, (RecordID) (i % 100 + 1));
+        paths.insert(key, handle);
+        model.insert(make_pair(key, handle));
+    }
+    for (auto entry = model.begin(); entry != model.end();) {
+        if (random() % 2 == 0) {
+            if (!paths.del(entry->first, entry->second))
+                return assertion_failure("art del", entry->second.first, entry->second.second);
+            entry = model.erase(entry);
+        } else {
+            entry++;
+        }
+    }
+    if (paths.del(path_key("/nowhere"), Handle(1, 1)) || paths.size() != model.size())
+        return assertion_failure("art size", (double) paths.size(), (double) model.size());
+    for (auto const &entry: model) {
+        const Handles *handles = paths.find(entry.first);
+        if (handles == nullptr || find(handles->begin(), handles->end(), entry.second) == handles->end())
+            return assertion_failure("art find", entry.second.first, entry.second.second);
+    }
+    if (paths.find(path_key("/usr/local/lib/dir1")) != nullptr)
+        return assertion_failure("art find missing");
+    KeyBytes previous;
+    bool in_order = true;
+    paths.for_each([&](const KeyBytes &key, const Handles &handles) {
+        in_order = in_order && previous < key;
+        previous = key;
+    });
+    if (!in_order)
+        return assertion_failure("art order");
+    for (uint i = 0; i < 50; i++) {
+        KeyBytes min_key = path_key(random_path(random)), max_key = path_key(random_path(random));
+        if (max_key < min_key)
+            swap(min_key, max_key);
+        Handles handles;
+        paths.scan(min_key, &max_key, handles);
+        if (!same_handles(handles, model, min_key, &max_key))
+            return assertion_failure("art range", i);
+    }
+    const char *prefixes[] = {"/usr/", "/usr/local/", "/usr/local/lib/dir1", "/home/dir3/dir1", "/x", ""};
+    for (auto const &prefix: prefixes) {
+        KeyBytes prefix_key = path_key(prefix);
+        prefix_key.resize(prefix_key.size() - 2);  // just the characters
+        Handles handles;
+        paths.scan(prefix_key, &prefix_key, handles);
+        if (!same_handles(handles, model, prefix_key, &prefix_key))
+            return assertion_failure(string("art prefix ") + prefix, (double) handles.size());
+    }
+
+    ArtTree numbers;  // dense INT keys fan out to all 256 children in the last byte
+    KeyProfile int_profile;
+    int_profile.push_back(ColumnAttribute::INT);
+    for (int i = -300; i < 3000; i++) {
+        KeyValue key_value;
+        key_value.push_back(Value(i));
+        numbers.insert(NormalizedKey::encode(&key_value, int_profile), Handle(1, 1));
+    }
+    uint counts[5];
+    numbers.node_counts(counts);
+    if (counts[0] == 0 || counts[3] == 0 || counts[4] != 3300)
+        return assertion_failure("art node kinds", counts[0], counts[3]);
+    for (int i = -300; i < 3000; i++) {
+        if (i % 64 == 0)
+            continue;  // keep a few
+        KeyValue key_value;
+        key_value.push_back(Value(i));
+        numbers.del(NormalizedKey::encode(&key_value, int_profile), Handle(1, 1));
+    }
+    numbers.node_counts(counts);
+    if (counts[2] + counts[3] != 0 || counts[4] != 51 || numbers.size() != 51)
+        return assertion_failure("art shrink", counts[4], (double) numbers.size());
+
+    ColumnNames column_names;
+    column_names.push_back("path");
+    column_names.push_back("size");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_art", column_names, column_attributes);
+    table.create();
+    const int n = 1500;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["path"] = Value(random_path(random));
+        row["size"] = Value(i);
+        table.insert(&row);
+    }
+    ColumnNames key_columns;
+    key_columns.push_back("path");
+    ArtIndex index(table, "artindex", key_columns, false);
+    index.create();
+    for (int i = n; i < 2 * n; i++) {  // a checkpoint part way through, so its old blocks get reused by the log
+        if (i == n + n / 2)
+            index.checkpoint();
+        ValueDict row;
+        row["path"] = Value(random_path(random));
+        row["size"] = Value(i);
+        index.insert(table.insert(&row), &row);
+    }
+    ValueDict where;
+    where["size"] = Value(7);
+    Handles *handles = table.select(&where);
+    index.del(handles->at(0));
+    table.del(handles->at(0));
+    delete handles;
+
+    for (int reopen = 0; reopen < 2; reopen++) {
+        if (reopen == 1)
+            index.close();  // writes a checkpoint
+        ArtIndex reopened(table, "artindex", key_columns, false);  // the first time, just replays the log
+        for (auto const &prefix: {"/usr/local/", "/home/dir1", "/usr/lib/dir2/dir3/file4"}) {
+            ValueDict key;
+            key["path"] = Value(prefix);
+            Handles *found = reopened.prefix(&key);
+            Handles *scanned = table.select();
+            size_t expected = 0;
+            for (auto const &handle: *scanned) {
+                ValueDict *row = table.project(handle);
+                if (row->at("path").s.compare(0, strlen(prefix), prefix) == 0)
+                    expected++;
+                delete row;
+            }
+            bool ok = found->size() == expected;
+            delete found;
+            delete scanned;
+            if (!ok)
+                return assertion_failure(string("art index prefix ") + prefix, reopen, (double) expected);
+        }
+        where.clear();
+        where["path"] = Value("/home/dir1/file1");
+        Handles *scanned = table.select(&where);
+        Handles *found = reopened.lookup(&where);
+        sort(found->begin(), found->end());
+        bool ok = *scanned == *found;
+        delete scanned;
+        delete found;
+        if (!ok)
+            return assertion_failure("art index lookup", reopen);
+        if (reopen == 1)
+            reopened.drop();
+    }
+
+    ArtIndex unique_paths(table, "artunique", key_columns, true);  // the random paths repeat
+    bool threw = false;
+    try {
+        unique_paths.create();
+    } catch (DbRelationError &e) {
+        threw = true;
+    }
+    unique_paths.drop();
+    if (!threw)
+        return assertion_failure("art unique create");
+    key_columns[0] = "size";
+    ArtIndex unique_sizes(table, "artunique", key_columns, true);
+    unique_sizes.create();
+    ValueDict row;
+    row["path"] = Value("/again");
+    row["size"] = Value(8);
+    Handle duplicate = table.insert(&row);
+    try {
+        unique_sizes.insert(duplicate, &row);
+        return assertion_failure("art unique insert");
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    table.del(duplicate);
+    where.clear();
+    where["size"] = Value(8);
+    handles = unique_sizes.lookup(&where);
+    bool ok = handles->size() == 1 && handles->front() != duplicate;
+    delete handles;
+    if (!ok)
+        return assertion_failure("art unique lookup");
+    unique_sizes.drop();
+    table.drop();
+    return true;
+}
+
+// Point lookups and prefix scans of long paths with shared prefixes, in the ART and in a B-tree.
+void benchmark_art_index() {
+    ColumnNames column_names;
+    column_names.push_back("path");
+    column_names.push_back("size");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__benchmark_art", column_names, column_attributes);
+    table.create();
+    const int n = 50 * 1000;
+    vector<string> paths;
+    for (int i = 0; i < n; i++) {
+        paths.push_back("/srv/warehouse/catalog/sku-" + to_string(10000 + i % 500) + "/variant-" + to_string(i / 500) +
+                        "/images/front.jpg");
+        ValueDict row;
+        row["path"] = Value(paths.back());
+        row["size"] = Value(i);
+        table.insert(&row);
+    }
+    ColumnNames key_columns;
+    key_columns.push_back("path");
+    ArtIndex art(table, "artindex", key_columns, false);
+    art.create();
+    BTreeIndex btree(table, "btreeindex", key_columns, false);
+    btree.create();
+    shuffle(paths.begin(), paths.end(), mt19937(5300));
+
+    double times[2];
+    DbIndex *indices[] = {&art, &btree};
+    for (int i = 0; i < 2; i++) {
+        auto start = chrono::steady_clock::now();
+        for (auto const &path: paths) {
+            ValueDict key;
+            key["path"] = Value(path);
+            delete indices[i]->lookup(&key);
+        }
+        times[i] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    const int scans = 500;
+    size_t rows = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < scans; i++) {
+        ValueDict key;
+        key["path"] = Value("/srv/warehouse/catalog/sku-" + to_string(10000 + i) + "/");
+        Handles *handles = art.prefix(&key);
+        rows += handles->size();
+        delete handles;
+    }
+    double scan_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint counts[5];
+    art.node_counts(counts);
+    std::cout << "art index on " << n << " paths: " << (long) (n / times[0]) << " lookups/sec (btree: "
+              << (long) (n / times[1]) << "/sec), " << (long) (scans / scan_time) << " prefix scans/sec of "
+              << rows / scans << " rows, nodes 4/16/48/256: " << counts[0] << "/" << counts[1] << "/" << counts[2]
+              << "/" << counts[3] << std::endl;
+    art.drop();
+    btree.drop();
+    table.drop();
+}
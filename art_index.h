@@ -0,0 +1,181 @@
+/**
+ * @file art_index.h - ArtTree, an adaptive radix tree of normalized keys, and the ArtIndex that checkpoints one
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include "heap_storage.h"
+#include "NormalizedKey.h"
+
+struct ArtNode;
+
+/**
+ * @class ArtTree - an in-memory adaptive radix tree (Leis et al.) from normalized keys to the handles of their rows
+ *
+ * Each level of the tree looks at one byte of the key, so a search does one small node lookup per byte instead of
+ * comparing whole keys, and keys with a long common prefix (paths, SKUs) share the nodes for it. Inner nodes come in
+ * four sizes and grow and shrink between them as children come and go:
+ *      Node4, Node16:  up to 4 or 16 sorted key bytes next to the child pointers (Node16 is searched with SSE2)
+ *      Node48:         a 256-entry byte-indexed table of slots into 48 child pointers
+ *      Node256:        a child pointer for every byte
+ * A run of bytes with only one way down is compressed into the node below it (path compression). Only the first
+ * MAX_PREFIX bytes of a compressed path are kept in the node; searches skip the rest and check the whole key at the
+ * leaf. Normalized keys are never a prefix of each other (see NormalizedKey), so every key ends at its own leaf.
+ *
+ * Not thread-safe.
+ */
+class ArtTree {
+public:
+    static const uint MAX_PREFIX = 8;
+
+    ArtTree() : root(nullptr), handle_count(0) {}
+
+    virtual ~ArtTree();
+
+    ArtTree(const ArtTree &other) = delete;
+
+    ArtTree &operator=(const ArtTree &other) = delete;
+
+    /**
+     * The handles for key.
+     * @returns  null if key isn't in the tree
+     */
+    const Handles *find(const KeyBytes &key) const;
+
+    void insert(const KeyBytes &key, Handle handle);
+
+    /**
+     * Take handle out of key's handles (and the key out of the tree if that was its last one).
+     * @returns  false if it wasn't there
+     */
+    bool del(const KeyBytes &key, Handle handle);
+
+    /**
+     * Append the handles of the keys from min_key up to max_key, inclusive, in key order. A key that starts with
+     * max_key counts as no greater than it, so scan(p, &p, handles) gets every key starting with p.
+     * @param max_key  null for no upper limit
+     */
+    void scan(const KeyBytes &min_key, const KeyBytes *max_key, Handles &handles) const;
+
+    /**
+     * Call visit for every key and its handles, in key order.
+     */
+    void for_each(const std::function<void(const KeyBytes &, const Handles &)> &visit) const;
+
+    void clear();
+
+    /**
+     * Number of handles in the tree.
+     */
+    uint64_t size() const { return this->handle_count; }
+
+    /**
+     * Number of nodes of each kind: Node4, Node16, Node48, Node256, and leaves.
+     */
+    void node_counts(uint counts[5]) const;
+
+protected:
+    ArtNode *root;
+    uint64_t handle_count;
+};
+
+/**
+ * @class ArtIndex - an adaptive radix tree index (CREATE INDEX ... USING ART)
+ *
+ * The tree itself lives in memory; the index file holds a checkpoint of it plus a log of the inserts and deletes since
+ * then, and opening the index loads the one and replays the other. A new checkpoint is written on close, and whenever
+ * the log gets as long as the tree (so replaying it never costs more than loading the checkpoint did). Each
+ * operation runs under mutex, so the index can be used from several threads.
+ *
+ * Besides lookups and ranges, prefix finds the keys starting with a given one, where the last key column given can
+ * be a TEXT prefix, e.g., every path under "/usr/local/".
+ *
+ * Index file layout:
+ *      block 1:    first checkpoint block, first and last log blocks, first free block (one record each, 0 for none)
+ *      and then the checkpoint, log, and free blocks are each a chain of blocks: record 1: next block (0 at the end)
+ *          checkpoint records: handle (block id, record id), normalized key -- in key order
+ *          log records:        '+' or '-' for an insert or delete, handle, normalized key
+ * The blocks of an old checkpoint and log go on the free chain for the next ones to use.
+ */
+class ArtIndex : public DbIndex {
+public:
+    ArtIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~ArtIndex() {}
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key_values) const;
+
+    virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
+
+    virtual bool supports_range() const { return true; }
+
+    /**
+     * Find all the rows whose key starts with key_values: the leading key columns given have to match and, if the
+     * last of them is TEXT, its value only has to start with the one given.
+     * @returns  list of handles, in key order (freed by caller)
+     */
+    Handles *prefix(ValueDict *key_values) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    virtual void del(Handle handle);
+
+    /**
+     * Write a new checkpoint of the tree now and empty the log.
+     */
+    void checkpoint();
+
+    /**
+     * Number of nodes of each kind (see ArtTree::node_counts).
+     */
+    void node_counts(uint counts[5]) const;
+
+protected:
+    static const BlockID HEADER = 1;
+    static const RecordID CHECKPOINT = 1;  // where we store the first checkpoint block in the header block
+    static const RecordID LOG = CHECKPOINT + 1;  // where we store the first log block in the header block
+    static const RecordID TAIL = LOG + 1;  // where we store the last log block in the header block
+    static const RecordID FREE = TAIL + 1;  // where we store the first free block in the header block
+    static const RecordID NEXT = 1;  // where a chained block stores the next block
+    static const uint ENTRY_HEADER_SZ = sizeof(BlockID) + sizeof(RecordID);  // bytes in front of each entry's key
+    static const uint MIN_CHECKPOINT_LOG = 1000;  // log entries we let build up before a checkpoint, however small
+    bool closed;
+    HeapFile file;
+    KeyProfile key_profile;
+    ArtTree tree;
+    BlockID checkpoint_head, log_head, log_tail, free_head;
+    uint64_t log_count;  // entries in the log
+    mutable std::mutex mutex;  // held for the whole of each operation
+
+    void open_locked();
+
+    KeyBytes normalized_key(const ValueDict *key) const;
+
+    void write_header();
+
+    SlottedPage *take_block();
+
+    void free_chain(BlockID head);
+
+    void write_checkpoint();
+
+    void append_log(char op, Handle handle, const KeyBytes &key);
+};
+
+bool test_art_index();
+
+void benchmark_art_index();
@@ -0,0 +1,677 @@
+/**
+ * @file bitmap_index.cpp - implementation of WahBitmap and BitmapIndex
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <set>
+#include "bitmap_index.h"
+
+using namespace std;
+
+/*************
+ * WahBitmap *
+ *************/
+
+static const uint32_t FILL = 0x80000000U;  // high bit of a fill word
+static const uint32_t FILL_BIT = 0x40000000U;  // the bit a fill word is filled with
+static const uint32_t RUN = 0x3FFFFFFFU;  // a fill word's count of groups (and the most one word can hold)
+static const uint32_t ALL_ONES = 0x7FFFFFFFU;  // a literal of a whole group of ones
+
+static bool is_fill(uint32_t word) {
+    return (word & FILL) != 0;
+}
+
+static uint64_t groups_in(uint32_t word) {
+    return is_fill(word) ? word & RUN : 1;
+}
+
+/**
+ * @class WahCursor - reads a bitmap's words a group at a time, or the whole rest of a fill at once
+ */
+class WahCursor {
+public:
+    uint64_t left;  // groups still to read in the current word
+
+    explicit WahCursor(const vector<uint32_t> &words) : left(words.empty() ? 0 : groups_in(words[0])), words(words),
+                                                         i(0) {}
+
+    bool done() const { return i >= words.size(); }
+
+    bool fill() const { return is_fill(words[i]); }
+
+    bool fill_bit() const { return (words[i] & FILL_BIT) != 0; }
+
+    uint32_t bits() const { return fill() ? (fill_bit() ? ALL_ONES : 0) : words[i]; }
+
+    void skip(uint64_t groups) {
+        while (groups > 0 && !done()) {
+            uint64_t n = min(groups, left);
+            left -= n;
+            groups -= n;
+            if (left == 0 && ++i < words.size())
+                left = groups_in(words[i]);
+        }
+    }
+
+protected:
+    const vector<uint32_t> &words;
+    size_t i;
+};
+
+WahBitmap::WahBitmap(const vector<uint32_t> &words) : words(words), groups(0) {
+    for (auto const &word: words)
+        this->groups += groups_in(word);
+}
+
+bool WahBitmap::set(uint64_t ordinal, uint *first_changed) {
+    return change(ordinal, true, first_changed);
+}
+
+bool WahBitmap::clear(uint64_t ordinal, uint *first_changed) {
+    return change(ordinal, false, first_changed);
+}
+
+// Past the end we can just append. Otherwise the word holding ordinal's group is rewritten (a fill can turn into
+// fill, literal, fill) and the words after it are appended again, since they might now merge with it.
+bool WahBitmap::change(uint64_t ordinal, bool bit, uint *first_changed) {
+    uint64_t group = ordinal / GROUP_BITS;
+    uint32_t mask = 1U << (ordinal % GROUP_BITS);
+    if (group >= this->groups) {
+        if (!bit)
+            return false;
+        if (first_changed != nullptr)
+            *first_changed = (uint) this->words.size();
+        append_fill(false, group - this->groups);
+        append_literal(mask);
+        return true;
+    }
+
+    uint64_t start = 0;
+    size_t i = 0;
+    while (start + groups_in(this->words[i]) <= group)
+        start += groups_in(this->words[i++]);
+    uint32_t word = this->words[i];
+    if (is_fill(word) ? ((word & FILL_BIT) != 0) == bit : ((word & mask) != 0) == bit)
+        return false;
+
+    vector<uint32_t> rest(this->words.begin() + i + 1, this->words.end());
+    this->words.resize(i);
+    this->groups = start;
+    if (is_fill(word)) {
+        append_fill(!bit, group - start);
+        append_literal(bit ? mask : ALL_ONES & ~mask);
+        append_fill(!bit, start + groups_in(word) - group - 1);
+    } else {
+        append_literal(bit ? word | mask : word & ~mask);
+    }
+    for (auto const &w: rest)
+        append_word(w);
+    trim();
+    if (first_changed != nullptr)
+        *first_changed = i > 0 ? (uint) i - 1 : 0;  // the word before might have merged with it
+    return true;
+}
+
+bool WahBitmap::get(uint64_t ordinal) const {
+    uint64_t group = ordinal / GROUP_BITS, start = 0;
+    for (auto const &word: this->words) {
+        if (start + groups_in(word) > group)
+            return is_fill(word) ? (word & FILL_BIT) != 0 : (word & (1U << (ordinal % GROUP_BITS))) != 0;
+        start += groups_in(word);
+    }
+    return false;
+}
+
+WahBitmap WahBitmap::operator&(const WahBitmap &other) const {
+    return combine(other, true);
+}
+
+WahBitmap WahBitmap::operator|(const WahBitmap &other) const {
+    return combine(other, false);
+}
+
+uint64_t WahBitmap::count() const {
+    uint64_t n = 0;
+    for (auto const &word: this->words) {
+        if (!is_fill(word))
+            n += (uint64_t) __builtin_popcount(word);
+        else if ((word & FILL_BIT) != 0)
+            n += GROUP_BITS * groups_in(word);
+    }
+    return n;
+}
+
+void WahBitmap::get_ordinals(vector<uint64_t> &ordinals) const {
+    uint64_t base = 0;
+    for (auto const &word: this->words) {
+        if (!is_fill(word)) {
+            for (uint32_t bits = word; bits != 0; bits &= bits - 1)
+                ordinals.push_back(base + (uint64_t) __builtin_ctz(bits));
+        } else if ((word & FILL_BIT) != 0) {
+            for (uint64_t ordinal = base; ordinal < base + GROUP_BITS * groups_in(word); ordinal++)
+                ordinals.push_back(ordinal);
+        }
+        base += GROUP_BITS * groups_in(word);
+    }
+}
+
+void WahBitmap::append_word(uint32_t word) {
+    if (is_fill(word))
+        append_fill((word & FILL_BIT) != 0, groups_in(word));
+    else
+        append_literal(word);
+}
+
+void WahBitmap::append_literal(uint32_t bits) {
+    if (bits == 0 || bits == ALL_ONES) {
+        append_fill(bits != 0, 1);
+    } else {
+        this->words.push_back(bits);
+        this->groups++;
+    }
+}
+
+// Lengthen the last word if it is a fill of the same bit, then add as many fill words as the rest needs.
+void WahBitmap::append_fill(bool bit, uint64_t count) {
+    if (count == 0)
+        return;
+    this->groups += count;
+    if (!this->words.empty()) {
+        uint32_t &last = this->words.back();
+        if (is_fill(last) && ((last & FILL_BIT) != 0) == bit) {
+            uint64_t n = min((uint64_t) (RUN - (last & RUN)), count);
+            last += (uint32_t) n;
+            count -= n;
+        }
+    }
+    while (count > 0) {
+        uint64_t n = min((uint64_t) RUN, count);
+        this->words.push_back(FILL | (bit ? FILL_BIT : 0) | (uint32_t) n);
+        count -= n;
+    }
+}
+
+// Zeros at the end are the same as no words at all, so we drop them to keep the one encoding.
+void WahBitmap::trim() {
+    while (!this->words.empty() && is_fill(this->words.back()) && (this->words.back() & FILL_BIT) == 0) {
+        this->groups -= groups_in(this->words.back());
+        this->words.pop_back();
+    }
+}
+
+WahBitmap WahBitmap::combine(const WahBitmap &other, bool is_and) const {
+    WahBitmap result;
+    WahCursor a(this->words), b(other.words);
+    while (!a.done() && !b.done()) {
+        if (a.fill() && b.fill()) {
+            uint64_t n = min(a.left, b.left);
+            result.append_fill(is_and ? a.fill_bit() && b.fill_bit() : a.fill_bit() || b.fill_bit(), n);
+            a.skip(n);
+            b.skip(n);
+        } else if (a.fill() || b.fill()) {
+            WahCursor &filled = a.fill() ? a : b, &literal = a.fill() ? b : a;
+            if (filled.fill_bit() != is_and) {
+                // zeros for AND or ones for OR: the fill is the answer, whatever the other bitmap has
+                uint64_t n = filled.left;
+                result.append_fill(filled.fill_bit(), n);
+                filled.skip(n);
+                literal.skip(n);
+            } else {
+                result.append_literal(literal.bits());
+                filled.skip(1);
+                literal.skip(1);
+            }
+        } else {
+            result.append_literal(is_and ? a.bits() & b.bits() : a.bits() | b.bits());
+            a.skip(1);
+            b.skip(1);
+        }
+    }
+    if (!is_and) {
+        for (WahCursor *rest: {&a, &b}) {
+            while (!rest->done()) {
+                uint64_t n = rest->left;
+                if (rest->fill())
+                    result.append_fill(rest->fill_bit(), n);
+                else
+                    result.append_literal(rest->bits());
+                rest->skip(n);
+            }
+        }
+    }
+    result.trim();
+    return result;
+}
+
+
+/***************
+ * BitmapIndex *
+ ***************/
+
+BitmapIndex::BitmapIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique),
+          closed(true),
+          file(relation.get_table_name() + "-" + name),
+          key_profile(),
+          bitmaps(),
+          mutex() {
+    std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+// Create the index from the rows already in the table. They come in table order, so every set is an append.
+void BitmapIndex::create() {
+    std::lock_guard<std::mutex> guard(mutex);
+    file.create();
+    closed = false;
+    Handles *table_rows = relation.select();
+    for (auto const &handle: *table_rows) {
+        ValueDict *row = relation.project(handle, &key_columns);
+        get_key_bitmap(normalized_key(row)).bitmap.set(ordinal(handle));
+        delete row;
+    }
+    delete table_rows;
+    for (auto &key_bitmap: bitmaps)
+        save(key_bitmap.second, 0);
+}
+
+// Drop the index.
+void BitmapIndex::drop() {
+    std::lock_guard<std::mutex> guard(mutex);
+    file.drop();
+    bitmaps.clear();
+    closed = true;
+}
+
+// Open existing index. Enables: lookup, insert, delete.
+void BitmapIndex::open() {
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+}
+
+// Open the index unless it already is (mutex held), as the first lookup or change does.
+void BitmapIndex::open_locked() {
+    if (!closed)
+        return;
+    file.open();
+    SlottedPage *header = file.get(HEADER);
+    RecordIDs *record_ids = header->ids();
+    for (auto const &record_id: *record_ids) {
+        Dbt *dbt = header->get(record_id);
+        const char *data = (const char *) dbt->get_data();
+        KeyBitmap key_bitmap;
+        vector<uint32_t> words;
+        for (BlockID block_id = *(BlockID *) data; block_id != 0;) {
+            SlottedPage *block = file.get(block_id);
+            key_bitmap.blocks.push_back(block_id);
+            Dbt *next = block->get(NEXT);
+            block_id = *(BlockID *) next->get_data();
+            delete next;
+            Dbt *block_words = block->get(WORDS);
+            const uint32_t *first = (const uint32_t *) block_words->get_data();
+            words.insert(words.end(), first, first + block_words->get_size() / sizeof(uint32_t));
+            delete block_words;
+            delete block;
+        }
+        key_bitmap.bitmap = WahBitmap(words);
+        bitmaps[KeyBytes(data + sizeof(BlockID), dbt->get_size() - sizeof(BlockID))] = key_bitmap;
+        delete dbt;
+    }
+    delete record_ids;
+    delete header;
+    closed = false;
+}
+
+// Closes the index. Disables: lookup, insert, delete.
+void BitmapIndex::close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!closed) {
+        file.close();
+        bitmaps.clear();
+        closed = true;
+    }
+}
+
+Handles *BitmapIndex::lookup(ValueDict *key_values) const {
+    return get_handles(get_bitmap(key_values));
+}
+
+void BitmapIndex::insert(Handle handle) {
+    ValueDict *row = relation.project(handle, &key_columns);
+    insert(handle, row);
+    delete row;
+}
+
+void BitmapIndex::insert(Handle handle, const ValueDict *row) {
+    KeyBytes key = normalized_key(row);
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+    KeyBitmap &key_bitmap = get_key_bitmap(key);
+    uint first_changed;
+    if (key_bitmap.bitmap.set(ordinal(handle), &first_changed))
+        save(key_bitmap, first_changed);
+}
+
+void BitmapIndex::del(Handle handle) {
+    ValueDict *row = relation.project(handle, &key_columns);
+    KeyBytes key = normalized_key(row);
+    delete row;
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+    auto found = bitmaps.find(key);
+    uint first_changed;
+    if (found != bitmaps.end() && found->second.bitmap.clear(ordinal(handle), &first_changed))
+        save(found->second, first_changed);
+}
+
+WahBitmap BitmapIndex::get_bitmap(const ValueDict *key_values) const {
+    KeyBytes key = normalized_key(key_values);
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<BitmapIndex *>(this)->open_locked();
+    auto found = bitmaps.find(key);
+    if (found == bitmaps.end())
+        return WahBitmap();
+    return found->second.bitmap;
+}
+
+WahBitmap BitmapIndex::get_bitmap(const ValueDicts &keys) const {
+    WahBitmap rows;
+    for (auto const &key_values: keys)
+        rows = rows | get_bitmap(key_values);
+    return rows;
+}
+
+Handles *BitmapIndex::get_handles(const WahBitmap &bitmap) {
+    vector<uint64_t> ordinals;
+    bitmap.get_ordinals(ordinals);
+    Handles *handles = new Handles();
+    handles->reserve(ordinals.size());
+    for (auto const &ordinal: ordinals)
+        handles->push_back(Handle((BlockID) (ordinal / ROWS_PER_BLOCK + 1), (RecordID) (ordinal % ROWS_PER_BLOCK + 1)));
+    return handles;
+}
+
+uint BitmapIndex::get_key_count(uint &words) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<BitmapIndex *>(this)->open_locked();
+    words = 0;
+    for (auto const &key_bitmap: bitmaps)
+        words += (uint) key_bitmap.second.bitmap.get_words().size();
+    return (uint) bitmaps.size();
+}
+
+KeyBytes BitmapIndex::normalized_key(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns)
+        key_value.push_back(key->at(column_name));
+    return NormalizedKey::encode(&key_value, key_profile);
+}
+
+// The bitmap for key, starting an empty one (with its first block and its record in the header) if it's a new key.
+BitmapIndex::KeyBitmap &BitmapIndex::get_key_bitmap(const KeyBytes &key) {
+    auto found = bitmaps.find(key);
+    if (found != bitmaps.end())
+        return found->second;
+    SlottedPage *block = file.get_new();
+    BlockID block_id = block->get_block_id();
+    delete block;
+    string record((const char *) &block_id, sizeof(BlockID));
+    record += key;
+    Dbt dbt((void *) record.data(), (u_int32_t) record.size());
+    SlottedPage *header = file.get(HEADER);
+    try {
+        header->add(&dbt);
+    } catch (DbBlockNoRoomError &e) {
+        delete header;
+        throw DbRelationError("too many distinct keys for a bitmap index");
+    }
+    file.put(header);
+    delete header;
+    KeyBitmap &key_bitmap = bitmaps[key];
+    key_bitmap.blocks.push_back(block_id);
+    save(key_bitmap, 0);
+    return key_bitmap;
+}
+
+// Write out the blocks from the one holding first_word on, adding blocks to the chain if the bitmap has grown. If it
+// has shrunk, the blocks past its end are kept in the chain, empty.
+void BitmapIndex::save(KeyBitmap &key_bitmap, uint first_word) {
+    const vector<uint32_t> &words = key_bitmap.bitmap.get_words();
+    BlockIDs &blocks = key_bitmap.blocks;
+    uint first = min(first_word / BLOCK_WORDS, (uint) blocks.size() - 1);  // the old last block needs a new next
+    while (blocks.size() * BLOCK_WORDS < words.size()) {
+        SlottedPage *block = file.get_new();
+        blocks.push_back(block->get_block_id());
+        delete block;
+    }
+    for (uint i = first; i < blocks.size(); i++) {
+        SlottedPage *block = file.get(blocks[i]);
+        BlockID next = i + 1 < blocks.size() ? blocks[i + 1] : 0;
+        size_t begin = min((size_t) i * BLOCK_WORDS, words.size());
+        size_t count = min((size_t) BLOCK_WORDS, words.size() - begin);
+        Dbt next_dbt(&next, sizeof(BlockID));
+        Dbt words_dbt((void *) (words.data() + begin), (u_int32_t) (count * sizeof(uint32_t)));
+        if (block->size() == 0) {
+            block->add(&next_dbt);
+            block->add(&words_dbt);
+        } else {
+            block->put(NEXT, next_dbt);
+            block->put(WORDS, words_dbt);
+        }
+        file.put(block);
+        delete block;
+    }
+}
+
+static bool same_ordinals(const WahBitmap &bitmap, const set<uint64_t> &expected) {
+    vector<uint64_t> ordinals;
+    bitmap.get_ordinals(ordinals);
+    return bitmap.count() == expected.size() && ordinals == vector<uint64_t>(expected.begin(), expected.end());
+}
+
+static Value boolean(bool b) {
+    Value value(b ? 1 : 0);
+    value.data_type = ColumnAttribute::BOOLEAN;
+    return value;
+}
+
+// WahBitmap against a std::set, then a BOOLEAN and a TEXT bitmap index against table scans, alone, ANDed, and ORed.
+bool test_bitmap_index() {
+    mt19937 random(5300);
+    set<uint64_t> expected[2];
+    WahBitmap bitmaps[2];
+    for (int i = 0; i < 4000; i++) {
+        uint j = i % 2;
+        uint64_t ordinal = random() % 3 == 0 ? random() % 100000 : random() % 2000;  // long fills and busy literals
+        if (random() % 4 == 0) {
+            if (bitmaps[j].clear(ordinal) != (expected[j].erase(ordinal) == 1))
+                return assertion_failure("wah clear", ordinal);
+        } else {
+            if (bitmaps[j].set(ordinal) != expected[j].insert(ordinal).second)
+                return assertion_failure("wah set", ordinal);
+        }
+    }
+    for (uint64_t ordinal = 500; ordinal < 1500; ordinal++) {  // a run of ones
+        bitmaps[0].set(ordinal);
+        expected[0].insert(ordinal);
+    }
+    if (!same_ordinals(bitmaps[0], expected[0]) || !same_ordinals(bitmaps[1], expected[1]))
+        return assertion_failure("wah ordinals", (double) bitmaps[0].count(), (double) expected[0].size());
+    if (!same_ordinals(WahBitmap(bitmaps[0].get_words()), expected[0]) || !bitmaps[0].get(1000) || bitmaps[0].get(1u << 30))
+        return assertion_failure("wah from words");
+    set<uint64_t> both, either;
+    set_intersection(expected[0].begin(), expected[0].end(), expected[1].begin(), expected[1].end(),
+                     inserter(both, both.begin()));
+    set_union(expected[0].begin(), expected[0].end(), expected[1].begin(), expected[1].end(),
+              inserter(either, either.begin()));
+    if (!same_ordinals(bitmaps[0] & bitmaps[1], both) || !same_ordinals(bitmaps[1] | bitmaps[0], either))
+        return assertion_failure("wah and/or", (double) both.size(), (double) either.size());
+    for (auto const &ordinal: expected[0])
+        bitmaps[0].clear(ordinal);
+    if (!bitmaps[0].empty())
+        return assertion_failure("wah cleared", (double) bitmaps[0].get_words().size());
+
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("flag");
+    column_names.push_back("color");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_bitmap", column_names, column_attributes);
+    table.create();
+    const char *colors[] = {"red", "green", "blue"};
+    const int n = 3000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["flag"] = boolean(i % 2 == 0);
+        row["color"] = Value(colors[i % 3]);
+        table.insert(&row);
+    }
+    ColumnNames flag_column, color_column;
+    flag_column.push_back("flag");
+    color_column.push_back("color");
+    BitmapIndex flag_index(table, "flagindex", flag_column, false);
+    flag_index.create();
+    BitmapIndex color_index(table, "colorindex", color_column, false);
+    color_index.create();
+    Handle last;
+    for (int i = n; i < 2 * n; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["flag"] = boolean(i % 2 == 0);
+        row["color"] = Value(colors[i % 3]);
+        last = table.insert(&row);
+        flag_index.insert(last, &row);
+        color_index.insert(last, &row);
+    }
+    ValueDict where;
+    where["a"] = Value(17);
+    Handles *handles = table.select(&where);
+    for (auto const &handle: *handles) {  // a row from the middle
+        flag_index.del(handle);
+        color_index.del(handle);
+        table.del(handle);
+    }
+    delete handles;
+    flag_index.close();
+    color_index.close();
+
+    BitmapIndex flags(table, "flagindex", flag_column, false), reopened_colors(table, "colorindex", color_column, false);
+    for (int f = 0; f < 2; f++) {
+        for (int c = 0; c < 3; c++) {
+            where.clear();
+            where["flag"] = boolean(f == 1);
+            where["color"] = Value(colors[c]);
+            Handles *scanned = table.select(&where);
+            Handles *found = BitmapIndex::get_handles(flags.get_bitmap(&where) & reopened_colors.get_bitmap(&where));
+            bool ok = *scanned == *found && scanned->size() >= n / 6 - 1;
+            delete scanned;
+            delete found;
+            if (!ok)
+                return assertion_failure("bitmap and", f, c);
+        }
+    }
+    ValueDicts keys;
+    ValueDict red, blue;
+    red["color"] = Value("red");
+    blue["color"] = Value("blue");
+    keys.push_back(&red);
+    keys.push_back(&blue);
+    WahBitmap red_or_blue = reopened_colors.get_bitmap(keys);
+    where.clear();
+    where["color"] = Value("green");
+    handles = reopened_colors.lookup(&where);
+    if (red_or_blue.count() + handles->size() != 2 * n - 1 || (red_or_blue & reopened_colors.get_bitmap(&where)).count() != 0)
+        return assertion_failure("bitmap or", (double) red_or_blue.count(), (double) handles->size());
+    delete handles;
+    where["color"] = Value("purple");
+    handles = reopened_colors.lookup(&where);
+    bool ok = handles->empty();
+    delete handles;
+    if (!ok)
+        return assertion_failure("bitmap missing key");
+    uint words;  // alternating flags are as bad as it gets for WAH, but the ends of the blocks should still be fills
+    if (flags.get_key_count(words) != 2 || words >= 2 * (BitmapIndex::ordinal(last) / WahBitmap::GROUP_BITS))
+        return assertion_failure("bitmap compression", words);
+    flags.drop();
+    reopened_colors.drop();
+    table.drop();
+    return true;
+}
+
+// An AND of two low-cardinality columns, with the bitmaps and with a table scan.
+void benchmark_bitmap_index() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("flag");
+    column_names.push_back("color");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__benchmark_bitmap", column_names, column_attributes);
+    table.create();
+    const int n = 100 * 1000;
+    const int colors = 8;
+    mt19937 random(5300);
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["flag"] = boolean(random() % 2 == 0);
+        row["color"] = Value("color " + to_string(random() % colors));
+        table.insert(&row);
+    }
+    ColumnNames flag_column, color_column;
+    flag_column.push_back("flag");
+    color_column.push_back("color");
+    BitmapIndex flag_index(table, "flagindex", flag_column, false);
+    flag_index.create();
+    BitmapIndex color_index(table, "colorindex", color_column, false);
+    color_index.create();
+
+    const int queries = 2 * colors;
+    ValueDict where;
+    size_t scanned = 0, found = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++) {
+        where["flag"] = boolean(i % 2 == 0);
+        where["color"] = Value("color " + to_string(i / 2));
+        Handles *handles = table.select(&where);
+        scanned += handles->size();
+        delete handles;
+    }
+    auto middle = chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++) {
+        where["flag"] = boolean(i % 2 == 0);
+        where["color"] = Value("color " + to_string(i / 2));
+        Handles *handles = BitmapIndex::get_handles(flag_index.get_bitmap(&where) & color_index.get_bitmap(&where));
+        found += handles->size();
+        delete handles;
+    }
+    auto end = chrono::steady_clock::now();
+    double scan_time = chrono::duration<double>(middle - start).count();
+    double bitmap_time = chrono::duration<double>(end - middle).count();
+    uint flag_words, color_words;
+    flag_index.get_key_count(flag_words);
+    color_index.get_key_count(color_words);
+    std::cout << "bitmap index on " << n << " rows: " << (long) (queries / bitmap_time)
+              << " flag AND color selects/sec (scan: " << (long) (queries / scan_time) << "/sec"
+              << (scanned == found ? "" : ", DIFFERENT ROWS") << "), bitmap words: flag " << flag_words << ", color "
+              << color_words << std::endl;
+    flag_index.drop();
+    color_index.drop();
+    table.drop();
+}
@@ -0,0 +1,180 @@
+/**
+ * @file bitmap_index.h - WahBitmap and the BitmapIndex that keeps one for each distinct key of a table
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <mutex>
+#include "heap_storage.h"
+#include "NormalizedKey.h"
+
+/**
+ * @class WahBitmap - a set of row ordinals as a Word-Aligned Hybrid compressed bitmap
+ *
+ * The bits are taken 31 at a time (a group) and each 32-bit word is either:
+ *      literal: high bit 0, then the group's 31 bits as they are (bit i is ordinal 31 * group + i)
+ *      fill:    high bit 1, then the bit every ordinal has, then how many groups in a row are all that bit (30 bits)
+ * A literal is never all zeros or all ones (that's a fill of one group) and there are never two fills of the same bit
+ * next to each other, so each set has just the one encoding. Ordinals past the last word aren't in the set.
+ *
+ * AND and OR work a word at a time on the compressed words, jumping over the whole of a fill that decides the answer
+ * (zeros for AND, ones for OR) however long it is.
+ */
+class WahBitmap {
+public:
+    static const uint GROUP_BITS = 31;
+
+    WahBitmap() : words(), groups(0) {}
+
+    /**
+     * A bitmap with the given words (as saved from get_words()).
+     */
+    explicit WahBitmap(const std::vector<uint32_t> &words);
+
+    /**
+     * Add ordinal to the set. Adding past the end of the bitmap just appends, without looking at the rest of it.
+     * @param first_changed  if not null, set to the index of the first word that changed
+     * @returns              false if ordinal was already in the set
+     */
+    bool set(uint64_t ordinal, uint *first_changed = nullptr);
+
+    /**
+     * Take ordinal out of the set.
+     * @param first_changed  if not null, set to the index of the first word that changed
+     * @returns              false if ordinal wasn't in the set
+     */
+    bool clear(uint64_t ordinal, uint *first_changed = nullptr);
+
+    bool get(uint64_t ordinal) const;
+
+    WahBitmap operator&(const WahBitmap &other) const;
+
+    WahBitmap operator|(const WahBitmap &other) const;
+
+    /**
+     * Number of ordinals in the set.
+     */
+    uint64_t count() const;
+
+    /**
+     * Append every ordinal in the set to ordinals, in order.
+     */
+    void get_ordinals(std::vector<uint64_t> &ordinals) const;
+
+    const std::vector<uint32_t> &get_words() const { return this->words; }
+
+    bool empty() const { return this->words.empty(); }
+
+protected:
+    std::vector<uint32_t> words;
+    uint64_t groups;  // number of groups the words cover
+
+    bool change(uint64_t ordinal, bool bit, uint *first_changed);
+
+    void append_word(uint32_t word);
+
+    void append_literal(uint32_t bits);
+
+    void append_fill(bool bit, uint64_t count);
+
+    void trim();
+
+    WahBitmap combine(const WahBitmap &other, bool is_and) const;
+};
+
+/**
+ * @class BitmapIndex - a bitmap of rows for each distinct key of a table (CREATE INDEX ... USING BITMAP)
+ *
+ * Meant for columns with only a few values, like a BOOLEAN or a TEXT code, where a B-tree has a long run of
+ * duplicates for every key. Each row is numbered by its handle, ordinal = (block id - 1) * ROWS_PER_BLOCK +
+ * (record id - 1), which is dense apart from the unused record ids at the end of each block (and those come out as
+ * short fills). A lookup is a walk over one bitmap, and the query planner ANDs together the bitmaps of every bitmap
+ * index whose columns are in a select before it reads any rows. Bitmaps for several keys can be ORed together, too
+ * (see get_bitmap).
+ *
+ * Index file layout:
+ *      block 1:    record for each distinct key: first block of its bitmap, normalized key
+ *      and then each bitmap is a chain of blocks: record 1: next block (0 at the end), record 2: BLOCK_WORDS words
+ * Only block 1 holds keys, so a bitmap index can have as many distinct keys as fit there (a couple hundred INTs).
+ */
+class BitmapIndex : public DbIndex {
+public:
+    static const uint ROWS_PER_BLOCK = DbBlock::BLOCK_SZ / 4;  // every record in a block has a 4-byte header
+
+    BitmapIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~BitmapIndex() {}
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key_values) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    virtual void del(Handle handle);
+
+    /**
+     * The rows with the key in key_values (empty if there aren't any).
+     */
+    WahBitmap get_bitmap(const ValueDict *key_values) const;
+
+    /**
+     * The rows with any of the keys (the OR of their bitmaps).
+     */
+    WahBitmap get_bitmap(const ValueDicts &keys) const;
+
+    /**
+     * Handles for the rows in bitmap.
+     * @returns  list of handles, in table order (freed by caller)
+     */
+    static Handles *get_handles(const WahBitmap &bitmap);
+
+    static uint64_t ordinal(Handle handle) {
+        return (uint64_t) (handle.first - 1) * ROWS_PER_BLOCK + (handle.second - 1);
+    }
+
+    /**
+     * Number of distinct keys and the total number of words in their bitmaps.
+     */
+    uint get_key_count(uint &words) const;
+
+protected:
+    static const BlockID HEADER = 1;
+    static const RecordID NEXT = 1;  // where a bitmap block stores the next block in the chain
+    static const RecordID WORDS = NEXT + 1;  // where a bitmap block stores its words
+    // words per bitmap block (leaving the 4 bytes SlottedPage::put wants to spare when they grow)
+    static const uint BLOCK_WORDS = (DbBlock::BLOCK_SZ - 1 - 4 * 4 - sizeof(BlockID)) / sizeof(uint32_t);
+
+    struct KeyBitmap {
+        BlockIDs blocks;  // the chain the bitmap is saved in
+        WahBitmap bitmap;
+    };
+
+    bool closed;
+    HeapFile file;
+    KeyProfile key_profile;
+    std::map<KeyBytes, KeyBitmap> bitmaps;
+    mutable std::mutex mutex;  // held for the whole of each operation
+
+    void open_locked();
+
+    KeyBytes normalized_key(const ValueDict *key) const;
+
+    KeyBitmap &get_key_bitmap(const KeyBytes &key);
+
+    void save(KeyBitmap &key_bitmap, uint first_word);
+};
+
+bool test_bitmap_index();
+
+void benchmark_bitmap_index();
@@ -0,0 +1,418 @@
+/**
+ * @file bloom_index.cpp - implementation of BloomFilter and BloomIndex
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <chrono>
+#include <cmath>
+#include <map>
+#include "bloom_index.h"
+
+using namespace std;
+
+/***************
+ * BloomFilter *
+ ***************/
+
+BloomFilter::BloomFilter(uint capacity) : words((capacity * BITS_PER_KEY + 63) / 64, 0), hashes(HASHES), count(0) {
+    if (this->words.empty())
+        this->words.push_back(0);
+}
+
+BloomFilter::BloomFilter(const vector<uint64_t> &words, uint hashes, uint count) : words(words), hashes(hashes),
+                                                                                   count(count) {
+}
+
+void BloomFilter::add(const KeyBytes &key, set<uint> *changed) {
+    vector<uint64_t> bits;
+    positions(key, bits);
+    for (auto const &bit: bits) {
+        uint64_t &word = this->words[bit / 64];
+        uint64_t mask = 1ULL << (bit % 64);
+        if ((word & mask) == 0 && changed != nullptr)
+            changed->insert((uint) (bit / 64));
+        word |= mask;
+    }
+    this->count++;
+}
+
+bool BloomFilter::might_contain(const KeyBytes &key) const {
+    vector<uint64_t> bits;
+    positions(key, bits);
+    for (auto const &bit: bits)
+        if ((this->words[bit / 64] & (1ULL << (bit % 64))) == 0)
+            return false;
+    return true;
+}
+
+// A key that was never added gets through only if all of its bits happen to be set.
+double BloomFilter::false_positive_rate() const {
+    uint64_t set_bits = 0;
+    for (auto const &word: this->words)
+        set_bits += (uint64_t) __builtin_popcountll(word);
+    return pow((double) set_bits / (this->words.size() * 64), this->hashes);
+}
+
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Double hashing: bit i is h1 + i * h2, from two hashes of the key (FNV-1a, mixed two ways). These are kept in the
+// index file, so they mustn't change from one build to the next.
+void BloomFilter::positions(const KeyBytes &key, vector<uint64_t> &bits) const {
+    uint64_t h = 14695981039346656037ULL;
+    for (auto const &c: key) {
+        h ^= (unsigned char) c;
+        h *= 1099511628211ULL;
+    }
+    uint64_t h1 = mix(h), h2 = mix(h ^ 0x9e3779b97f4a7c15ULL) | 1;
+    uint64_t size = this->words.size() * 64;
+    for (uint i = 0; i < this->hashes; i++)
+        bits.push_back((h1 + i * h2) % size);
+}
+
+
+/**************
+ * BloomIndex *
+ **************/
+
+const uint BloomIndex::BLOCK_WORDS;
+
+BloomIndex::BloomIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique),
+          closed(true),
+          file(relation.get_table_name() + "-" + name),
+          key_profile(),
+          filter(nullptr),
+          mutex(),
+          misses(0),
+          false_positives(0) {
+    std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+BloomIndex::~BloomIndex() {
+    delete filter;
+}
+
+// Create the index, with room for the table to double before the filter has to be rebuilt.
+void BloomIndex::create() {
+    file.create();
+    closed = false;
+    Handles *table_rows = relation.select();
+    uint rows = (uint) table_rows->size();
+    delete table_rows;
+    build(max(2 * rows, 1024U));
+}
+
+// Drop the index.
+void BloomIndex::drop() {
+    file.drop();
+    delete filter;
+    filter = nullptr;
+    closed = true;
+}
+
+// Open existing index. Enables: lookup, insert, delete.
+void BloomIndex::open() {
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+}
+
+// Open the index unless it already is (mutex held), as the first lookup or insert does.
+void BloomIndex::open_locked() {
+    if (closed) {
+        file.open();
+        SlottedPage *header = file.get(HEADER);
+        uint32_t values[3];
+        for (RecordID record_id = WORDS; record_id <= COUNT; record_id++) {
+            Dbt *dbt = header->get(record_id);
+            values[record_id - WORDS] = *(uint32_t *) dbt->get_data();
+            delete dbt;
+        }
+        delete header;
+        vector<uint64_t> words;
+        for (BlockID block_id = HEADER + 1; words.size() < values[0]; block_id++) {
+            SlottedPage *block = file.get(block_id);
+            Dbt *dbt = block->get(1);
+            const uint64_t *block_words = (const uint64_t *) dbt->get_data();
+            words.insert(words.end(), block_words, block_words + dbt->get_size() / sizeof(uint64_t));
+            delete dbt;
+            delete block;
+        }
+        filter = new BloomFilter(words, values[1], values[2]);
+        closed = false;
+    }
+}
+
+// Closes the index. Disables: lookup, insert, delete.
+void BloomIndex::close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!closed) {
+        file.close();
+        delete filter;
+        filter = nullptr;
+        closed = true;
+    }
+}
+
+// A key the filter rules out comes back empty right away. Otherwise we have to look in the table.
+Handles *BloomIndex::lookup(ValueDict *key_values) const {
+    if (!might_contain(key_values)) {
+        misses++;
+        return new Handles();
+    }
+    Handles *handles = relation.select(key_values);
+    if (handles->empty()) {
+        misses++;
+        false_positives++;
+    }
+    return handles;
+}
+
+void BloomIndex::insert(Handle handle) {
+    ValueDict *row = relation.project(handle, &key_columns);
+    insert(handle, row);
+    delete row;
+}
+
+// Add the row's key, rebuilding the filter twice as big (which picks up this row from the table) if it is full.
+void BloomIndex::insert(Handle handle, const ValueDict *row) {
+    KeyBytes key = normalized_key(row);
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+    if (filter->get_count() >= filter->get_capacity()) {
+        build(2 * filter->get_capacity());
+        return;
+    }
+    set<uint> changed;
+    filter->add(key, &changed);
+    save(&changed);
+}
+
+// Bloom filters can't forget a key, so the row's bits stay set (until the next rebuild).
+void BloomIndex::del(Handle handle) {
+}
+
+bool BloomIndex::might_contain(const ValueDict *key_values) const {
+    for (auto const &column_name: key_columns)
+        if (key_values->find(column_name) == key_values->end())
+            return true;  // a filter of whole keys can't rule out part of one
+    KeyBytes key = normalized_key(key_values);
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<BloomIndex *>(this)->open_locked();
+    return filter->might_contain(key);
+}
+
+double BloomIndex::false_positive_rate() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<BloomIndex *>(this)->open_locked();
+    return filter->false_positive_rate();
+}
+
+double BloomIndex::observed_false_positive_rate(uint &misses) const {
+    misses = this->misses;
+    return misses == 0 ? 0.0 : (double) this->false_positives / misses;
+}
+
+KeyBytes BloomIndex::normalized_key(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns)
+        key_value.push_back(key->at(column_name));
+    return NormalizedKey::encode(&key_value, key_profile);
+}
+
+// Make a filter with room for capacity keys from every row in the table and write all of it out.
+void BloomIndex::build(uint capacity) {
+    BloomFilter *built = new BloomFilter(capacity);
+    Handles *table_rows = relation.select();
+    for (auto const &handle: *table_rows) {
+        ValueDict *row = relation.project(handle, &key_columns);
+        built->add(normalized_key(row));
+        delete row;
+    }
+    delete table_rows;
+    delete filter;
+    filter = built;
+    save(nullptr);  // a bigger filter just goes on into new blocks
+}
+
+// Write out the header and the blocks holding the changed words (all of them if changed is null).
+void BloomIndex::save(const set<uint> *changed) {
+    const vector<uint64_t> &words = filter->get_words();
+    uint32_t values[] = {(uint32_t) words.size(), filter->get_hashes(), filter->get_count()};
+    SlottedPage *header = file.get(HEADER);
+    bool is_new = header->size() == 0;
+    for (RecordID record_id = WORDS; record_id <= COUNT; record_id++) {
+        Dbt dbt(&values[record_id - WORDS], sizeof(uint32_t));
+        if (is_new)
+            header->add(&dbt);
+        else
+            header->put(record_id, dbt);
+    }
+    file.put(header);
+    delete header;
+
+    set<uint> blocks;
+    if (changed != nullptr) {
+        for (auto const &word: *changed)
+            blocks.insert(word / BLOCK_WORDS);
+    } else {
+        for (uint i = 0; i * BLOCK_WORDS < words.size(); i++)
+            blocks.insert(i);
+    }
+    for (auto const &i: blocks) {
+        BlockID block_id = HEADER + 1 + i;
+        SlottedPage *block = block_id > file.get_last_block_id() ? file.get_new() : file.get(block_id);
+        uint first = i * BLOCK_WORDS;
+        uint n = min(BLOCK_WORDS, (uint) words.size() - first);
+        Dbt dbt((void *) &words[first], n * sizeof(uint64_t));
+        if (block->size() == 0)
+            block->add(&dbt);
+        else
+            block->put(1, dbt);
+        file.put(block);
+        delete block;
+    }
+}
+
+// No false negatives, before and after inserts force a rebuild and across a reopen, and a low false positive rate.
+bool test_bloom_index() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_bloom", column_names, column_attributes);
+    table.create();
+    const int n = 2000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(2 * i);  // only even keys
+        row["b"] = Value("row " + to_string(i));
+        table.insert(&row);
+    }
+    ColumnNames key_columns;
+    key_columns.push_back("a");
+    BloomIndex index(table, "bloomindex", key_columns, false);
+    index.create();
+    for (int i = n; i < 4 * n; i++) {  // past the capacity it was built with, so it has to rebuild
+        ValueDict row;
+        row["a"] = Value(2 * i);
+        row["b"] = Value("row " + to_string(i));
+        index.insert(table.insert(&row), &row);
+    }
+    index.close();
+
+    BloomIndex reopened(table, "bloomindex", key_columns, false);
+    ValueDict lookup;
+    uint passed = 0;
+    for (int i = 0; i < 8 * n; i++) {
+        lookup["a"] = Value(i);
+        bool maybe = reopened.might_contain(&lookup);
+        if (i % 2 == 0 && !maybe)
+            return assertion_failure("bloom false negative", i);
+        if (i % 2 == 1 && maybe)
+            passed++;
+    }
+    double rate = (double) passed / (4 * n), estimate = reopened.false_positive_rate();
+    if (rate > 0.03 || estimate > 0.03)
+        return assertion_failure("bloom false positive rate", rate * 100, estimate * 100);
+
+    lookup["a"] = Value(2 * 123);
+    Handles *handles = reopened.lookup(&lookup);
+    bool ok = handles->size() == 1;
+    delete handles;
+    lookup["a"] = Value(-1);
+    handles = reopened.lookup(&lookup);
+    ok = ok && handles->empty();
+    delete handles;
+    uint misses;
+    reopened.observed_false_positive_rate(misses);
+    if (!ok || misses != 1)
+        return assertion_failure("bloom lookup", misses);
+    lookup.clear();
+    lookup["b"] = Value("row 1");
+    if (!reopened.might_contain(&lookup))
+        return assertion_failure("bloom without the key column");
+
+    // a composite key with TEXT in it
+    key_columns.push_back("b");
+    BloomIndex both(table, "bothindex", key_columns, false);
+    both.create();
+    lookup["a"] = Value(2);
+    lookup["b"] = Value("row 1");
+    ok = both.might_contain(&lookup);
+    lookup["b"] = Value("row 2");
+    uint wrong = both.might_contain(&lookup) ? 1 : 0;
+    for (int i = 0; i < 100; i++) {
+        lookup["a"] = Value(2 * i);
+        lookup["b"] = Value("row " + to_string(i + 1));
+        wrong += both.might_contain(&lookup) ? 1 : 0;
+    }
+    if (!ok || wrong > 5)
+        return assertion_failure("bloom composite key", wrong);
+    both.drop();
+    reopened.drop();
+    table.drop();
+    return true;
+}
+
+// Lookups of keys that aren't there, with and without the filter in front of the table scan.
+void benchmark_bloom_index() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__benchmark_bloom", column_names, column_attributes);
+    table.create();
+    const int n = 50 * 1000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(2 * i);
+        row["b"] = Value(i);
+        table.insert(&row);
+    }
+    ColumnNames key_columns;
+    key_columns.push_back("a");
+    BloomIndex index(table, "benchindex", key_columns, false);
+    index.create();
+
+    const int scans = 20;
+    ValueDict lookup;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < scans; i++) {
+        lookup["a"] = Value(2 * i + 1);
+        delete table.select(&lookup);
+    }
+    auto middle = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        lookup["a"] = Value(2 * i + 1);
+        delete index.lookup(&lookup);
+    }
+    auto end = chrono::steady_clock::now();
+    double scan_time = chrono::duration<double>(middle - start).count();
+    double bloom_time = chrono::duration<double>(end - middle).count();
+    uint misses;
+    double observed = index.observed_false_positive_rate(misses);
+    std::cout << "bloom index on " << n << " rows: " << (long) (n / bloom_time) << " missing-key lookups/sec (scan: "
+              << (long) (scans / scan_time) << "/sec), false positive rate " << observed * 100 << "% of " << misses
+              << " (estimated " << index.false_positive_rate() * 100 << "%)" << std::endl;
+    index.drop();
+    table.drop();
+}
@@ -0,0 +1,144 @@
+/**
+ * @file bloom_index.h - BloomFilter and the BloomIndex that keeps one on disk for some columns of a table
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include "heap_storage.h"
+#include "NormalizedKey.h"
+
+/**
+ * @class BloomFilter - a set of keys that can say for sure a key isn't in it, but only probably that it is
+ *
+ * Each key sets `hashes` bits of the bit array, picked by double hashing of its normalized bytes. A key whose bits
+ * aren't all set was never added. Keys can't be taken out again.
+ */
+class BloomFilter {
+public:
+    static const uint BITS_PER_KEY = 10;  // with 7 hashes, about 1% false positives when full
+    static const uint HASHES = 7;
+
+    /**
+     * An empty filter sized for capacity keys.
+     */
+    explicit BloomFilter(uint capacity);
+
+    /**
+     * A filter with the given bits (as saved from words()).
+     */
+    BloomFilter(const std::vector<uint64_t> &words, uint hashes, uint count);
+
+    /**
+     * Add a key.
+     * @param changed  if not null, the index of each word whose bits changed is added to it
+     */
+    void add(const KeyBytes &key, std::set<uint> *changed = nullptr);
+
+    bool might_contain(const KeyBytes &key) const;
+
+    /**
+     * The chance that might_contain is true for a key that was never added, estimated from how many bits are set.
+     */
+    double false_positive_rate() const;
+
+    uint get_count() const { return this->count; }
+
+    uint get_capacity() const { return (uint) (this->words.size() * 64 / BITS_PER_KEY); }
+
+    uint get_hashes() const { return this->hashes; }
+
+    const std::vector<uint64_t> &get_words() const { return this->words; }
+
+protected:
+    std::vector<uint64_t> words;
+    uint hashes;
+    uint count;  // keys added
+
+    void positions(const KeyBytes &key, std::vector<uint64_t> &bits) const;
+};
+
+/**
+ * @class BloomIndex - a Bloom filter over the key columns of a table (CREATE INDEX ... USING BLOOM)
+ *
+ * The filter doesn't know where any rows are, so a lookup it can't rule out is answered by scanning the table. What it
+ * is for is keys that usually aren't there: those come back empty without reading the table at all. The query
+ * planner asks every index on a table (with might_contain) before it scans, so a Bloom index next to a B-tree or
+ * hash index on the same columns saves their lookups too.
+ *
+ * The filter is sized on create for twice the rows in the table and rebuilt, twice as big, once inserts have filled
+ * it. Deleted rows leave their bits set, which only costs false positives until the next rebuild.
+ *
+ * Index file layout:
+ *      block 1:    number of words in the bit array, number of hashes, number of keys added (one record each)
+ *      block i+2:  words i * BLOCK_WORDS up to (i + 1) * BLOCK_WORDS of the bit array
+ */
+class BloomIndex : public DbIndex {
+public:
+    BloomIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~BloomIndex();
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key_values) const;
+
+    virtual bool supports_lookup() const { return false; }  // lookup is a table scan
+
+    virtual void insert(Handle handle);
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    virtual void del(Handle handle);
+
+    virtual bool might_contain(const ValueDict *key_values) const;
+
+    /**
+     * The filter's current false positive rate (see BloomFilter::false_positive_rate).
+     */
+    double false_positive_rate() const;
+
+    /**
+     * The false positive rate seen by lookup so far: of the lookups that found nothing, how many the filter let
+     * through to a scan.
+     * @param misses  set to the number of lookups that found nothing
+     */
+    double observed_false_positive_rate(uint &misses) const;
+
+protected:
+    static const BlockID HEADER = 1;
+    static const RecordID WORDS = 1;  // where we store the size of the bit array in the header block
+    static const RecordID HASHES = WORDS + 1;  // where we store the number of hashes in the header block
+    static const RecordID COUNT = HASHES + 1;  // where we store the number of keys added in the header block
+    // words per block (leaving the 4 bytes SlottedPage::put wants to spare when a rebuild grows the last block)
+    static const uint BLOCK_WORDS = (DbBlock::BLOCK_SZ - 1 - 4 * 3) / sizeof(uint64_t);
+    bool closed;
+    HeapFile file;
+    KeyProfile key_profile;
+    BloomFilter *filter;
+    mutable std::mutex mutex;  // guards filter, and opening it
+    mutable std::atomic<uint> misses;  // lookups that found nothing
+    mutable std::atomic<uint> false_positives;  // lookups that found nothing after the filter let them through
+
+    void open_locked();
+
+    KeyBytes normalized_key(const ValueDict *key) const;
+
+    void build(uint capacity);
+
+    void save(const std::set<uint> *changed);
+};
+
+bool test_bloom_index();
+
+void benchmark_bloom_index();
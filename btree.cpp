@@ -3,38 +3,49 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <thread>
 #include "btree.h"
 
-BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
-                                                                                                              name,
-                                                                                                              key_columns,
-                                                                                                              unique),
-                                                                                                      closed(true),
-                                                                                                      stat(nullptr),
-                                                                                                      root(nullptr),
-                                                                                                      file(relation.get_table_name() +
-                                                                                                           "-" + name),
-                                                                                                      key_profile() {
-    if (!unique)
-        throw DbRelationError("BTree index must have unique key");
+// Any include_columns are stored after the key columns in each leaf entry, making a covering index. (The
+// separators pushed up into the interior nodes are suffix truncated, so they rarely carry any of them.)
+BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+                       ColumnNames include_columns, bool buffered)
+        : DbIndex(relation, name, key_columns, unique, include_columns),
+                                                      closed(true),
+                                                      stat(nullptr),
+                                                      top(0),
+                                                      file(relation.get_table_name() + "-" + name),
+                                                      key_profile(),
+                                                      latches_mutex(),
+                                                      latches(),
+                                                      rightmost_mutex(),
+                                                      rightmost(0),
+                                                      rightmost_low(),
+                                                      buffered(buffered),
+                                                      tree_mutex() {
     build_key_profile();
 }
 
 BTreeIndex::~BTreeIndex() {
     delete stat;
-    delete root;
 }
 
 // Create the index.
 void BTreeIndex::create() {
     file.create();
     stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
-    root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
+    BTreeLeaf root(file, stat->get_root_id(), key_profile, true);
+    root.save();
+    set_top(root.get_id(), 1);
+    set_rightmost(root.get_id(), KeyBytes());
     closed = false;
-    Handles *table_rows = relation.select();
+    std::unique_ptr<Handles> table_rows(relation.select());  // (still freed if a duplicate key throws)
     for (auto const &row: *table_rows)
         insert(row);
-    delete table_rows;
 }
 
 // Drop the index.
@@ -47,11 +58,10 @@ void BTreeIndex::open() {
     if (closed) {
         file.open();
         stat = new BTreeStat(file, STAT, key_profile);
+        set_top(stat->get_root_id(), stat->get_height());
         if (stat->get_height() == 1)
-            root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
-        else
-            root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-        closed = true;
+            set_rightmost(stat->get_root_id(), KeyBytes());  // otherwise we'll find out when it next splits
+        closed = false;
     }
 }
 
@@ -61,8 +71,8 @@ void BTreeIndex::close() {
         file.close();
         delete stat;
         stat = nullptr;
-        delete root;
-        root = nullptr;
+        rightmost = 0;
+        rightmost_low.clear();
         closed = true;
     }
 }
@@ -70,63 +80,733 @@ void BTreeIndex::close() {
 // Find all the rows whose columns are equal to key. Assumes key is a dictionary whose keys are the column
 // names in the index. Returns a list of row handles.
 Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
-    // FIXME
-    return nullptr;
+    const_cast<BTreeIndex *>(this)->open();
+    KeyBytes key = normalized_key(key_dict);
+    if (buffered) {
+        std::lock_guard<std::mutex> guard(tree_mutex);
+        return buffered_lookup(key);
+    }
+    if (include_columns.empty()) {
+        BTreeLeaf *leaf = find_leaf(key);
+        Handles *handles = find_eq(leaf, key);
+        delete leaf;
+        return handles;
+    }
+
+    // entries are (key, include columns), so every one that starts with key is a match
+    Handles *handles = new Handles();
+    scan(key, &key, handles, nullptr);
+    return handles;
+}
+
+// Find the rows for each of several keys, in key order, so that keys in the same leaf share one descent to it: the
+// leaf we have stays put until a key is past its high key. Buffered indexes and ones with include columns (where a
+// key's entries can run on into the next leaf) just look up each key.
+std::vector<Handles *> *BTreeIndex::lookup_batch(const ValueDicts &keys) const {
+    if (buffered || !include_columns.empty())
+        return DbIndex::lookup_batch(keys);
+    const_cast<BTreeIndex *>(this)->open();
+    std::vector<KeyBytes> normalized;
+    std::vector<uint> order;
+    for (auto const &key: keys) {
+        order.push_back((uint) normalized.size());
+        normalized.push_back(normalized_key(key));
+    }
+    std::sort(order.begin(), order.end(), [&normalized](uint a, uint b) {
+        return NormalizedKey::compare(normalized[a], normalized[b]) < 0;
+    });
+    std::vector<Handles *> *found = new std::vector<Handles *>(keys.size(), nullptr);
+    BTreeLeaf *leaf = nullptr;
+    for (auto i: order) {
+        if (leaf == nullptr || leaf->is_past(normalized[i])) {
+            delete leaf;
+            leaf = find_leaf(normalized[i]);
+        }
+        (*found)[i] = find_eq(leaf, normalized[i]);
+    }
+    delete leaf;
+    return found;
+}
+
+// Find all the rows whose columns are equal to key and return their key and include columns from the index.
+ValueDicts *BTreeIndex::lookup_values(ValueDict *key_dict) const {
+    const_cast<BTreeIndex *>(this)->open();
+    KeyBytes key = normalized_key(key_dict);
+    std::unique_lock<std::mutex> guard(tree_mutex, std::defer_lock);
+    if (buffered) {
+        guard.lock();
+        const_cast<BTreeIndex *>(this)->flush_all();  // scans only read the leaves
+    }
+    Handles handles;
+    ValueDicts *values = new ValueDicts();
+    scan(key, &key, &handles, values);
+    return values;
+}
+
+// Are all of column_names stored in the index?
+bool BTreeIndex::covers(const ColumnNames &column_names) const {
+    for (auto const &column_name: column_names)
+        if (std::find(key_columns.begin(), key_columns.end(), column_name) == key_columns.end() &&
+            std::find(include_columns.begin(), include_columns.end(), column_name) == include_columns.end())
+            return false;
+    return true;
+}
+
+// Wait for exclusive use of a block.
+void BTreeIndex::latch(BlockID block_id) const {
+    std::mutex *block_latch;
+    {
+        std::lock_guard<std::mutex> guard(latches_mutex);
+        std::unique_ptr<std::mutex> &entry = latches[block_id];
+        if (!entry)
+            entry.reset(new std::mutex());
+        block_latch = entry.get();
+    }
+    block_latch->lock();
+}
+
+void BTreeIndex::unlatch(BlockID block_id) const {
+    std::mutex *block_latch;
+    {
+        std::lock_guard<std::mutex> guard(latches_mutex);
+        block_latch = latches.at(block_id).get();
+    }
+    block_latch->unlock();
 }
 
+// Walk down from the root to the node at level (1 is the leaf level) where key belongs, without latching anything.
+// If path isn't null, the interior node we went through on each level above is pushed onto it (root first).
+BlockID BTreeIndex::descend(const KeyBytes &key, uint level, BlockPointers *path) const {
+    uint64_t root = top;
+    BlockID block_id = (BlockID) (root >> 32);
+    for (uint height = (uint) (root & 0xFFFFFFFF); height > level; height--) {
+        BTreeNode *node = get_node(key, block_id, false, false);
+        if (path != nullptr)
+            path->push_back(node->get_id());
+        block_id = dynamic_cast<BTreeInterior *>(node)->find(key);
+        delete node;
+    }
+    return block_id;
+}
+
+// Get the node where key belongs, starting at block_id and moving right past any splits that happened since the
+// pointer to block_id was read (freed by caller). If latched, the node returned is latched (unlatched by caller)
+// and the move right latches each node before letting go of the one to its left.
+BTreeNode *BTreeIndex::get_node(const KeyBytes &key, BlockID block_id, bool leaf, bool latched) const {
+    HeapFile &index_file = const_cast<HeapFile &>(file);
+    if (latched)
+        latch(block_id);
+    BTreeNode *node;
+    while (true) {
+        if (leaf)
+            node = new BTreeLeaf(index_file, block_id, key_profile, false);
+        else
+            node = new BTreeInterior(index_file, block_id, key_profile, false);
+        if (!node->is_past(key))
+            return node;
+        BlockID next = node->get_next();
+        delete node;
+        if (latched) {
+            latch(next);
+            unlatch(block_id);
+        }
+        block_id = next;
+    }
+}
+
+// Get the leaf where key is or would be (freed by caller).
+BTreeLeaf *BTreeIndex::find_leaf(const KeyBytes &key) const {
+    return dynamic_cast<BTreeLeaf *>(get_node(key, descend(key, 1, nullptr), true, false));
+}
+
+// Find the handles for key in leaf (freed by caller), empty if it isn't there.
+Handles *BTreeIndex::find_eq(const BTreeLeaf *leaf, const KeyBytes &key) const {
+    Handles *handles = new Handles();
+    bool found;
+    uint entry = leaf->lower_bound(key, &found);
+    if (found)
+        get_entry_handles(leaf, entry, key, *handles);
+    return handles;
+}
+
+// Append the handles of leaf's entry for key. An inline posting list came with our (unlatched) copy of the leaf, but
+// one that has overflowed is a chain of blocks that writers change in place and hand back to be reused by other
+// keys, so we latch the leaf, read it again (moving right if key has been split off), and follow the chain it has
+// now. Writers only touch a chain while holding its leaf's latch.
+void BTreeIndex::get_entry_handles(const BTreeLeaf *leaf, uint entry, const KeyBytes &key, Handles &handles) const {
+    if (!leaf->is_chained(entry)) {
+        leaf->get_entry_handles(entry, handles);
+        return;
+    }
+    BTreeLeaf *latched = dynamic_cast<BTreeLeaf *>(get_node(key, leaf->get_id(), true, true));
+    try {
+        bool found;
+        entry = latched->lower_bound(key, &found);
+        if (found)
+            latched->get_entry_handles(entry, handles);
+    } catch (...) {
+        unlatch(latched->get_id());
+        delete latched;
+        throw;
+    }
+    unlatch(latched->get_id());
+    delete latched;
+}
+
+// Collect the entries from min_key up to and including max_key (or to the end if max_key is null), in order: the
+// handles of each and, if values isn't null, its key and include columns (one row for each handle). Entries that
+// start with max_key count as equal to it, so a shorter key (just the leading columns) still gets all its matches.
+// We start in the leaf where min_key would be and follow the leaves' next pointers as needed.
+void BTreeIndex::scan(const KeyBytes &min_key, const KeyBytes *max_key, Handles *handles, ValueDicts *values) const {
+    BTreeLeaf *leaf = find_leaf(min_key);
+    uint entry = leaf->lower_bound(min_key);
+    while (leaf != nullptr) {
+        if (entry == leaf->size()) {
+            BlockID next_leaf = leaf->get_next_leaf();
+            delete leaf;
+            leaf = next_leaf == 0 ? nullptr : new BTreeLeaf(const_cast<HeapFile &>(file), next_leaf, key_profile,
+                                                              false);
+            entry = 0;
+            continue;
+        }
+        KeyBytes key = leaf->get_entry_key(entry);
+        if (max_key != nullptr && NormalizedKey::compare(key, *max_key) > 0 &&
+            key.compare(0, max_key->size(), *max_key) != 0)
+            break;
+        u_long first = handles->size();
+        get_entry_handles(leaf, entry, key, *handles);
+        if (values != nullptr) {
+            KeyValue *key_value = NormalizedKey::decode(key.data(), (uint) key.size(), key_profile);
+            ValueDict row;
+            uint col_num = 0;
+            for (auto const &column_name: key_columns)
+                row[column_name] = (*key_value)[col_num++];
+            for (auto const &column_name: include_columns)
+                row[column_name] = (*key_value)[col_num++];
+            delete key_value;
+            for (u_long i = first; i < handles->size(); i++)
+                values->push_back(new ValueDict(row));
+        }
+        entry++;
+    }
+    delete leaf;
+}
+
+// Find all the rows whose key is between min_key and max_key, inclusive, in key order. Either one can be null for
+// no limit on that end, and either one can have just the leading key columns.
 Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key) const {
-    throw DbRelationError("Don't know how to do a range query on Btree index yet");
-    // FIXME
+    const_cast<BTreeIndex *>(this)->open();
+    std::unique_lock<std::mutex> guard(tree_mutex, std::defer_lock);
+    if (buffered) {
+        guard.lock();
+        const_cast<BTreeIndex *>(this)->flush_all();  // scans only read the leaves
+    }
+    Handles *handles = new Handles();
+    KeyBytes min_bytes = min_key == nullptr ? KeyBytes() : normalized_key(min_key);
+    if (max_key == nullptr) {
+        scan(min_bytes, nullptr, handles, nullptr);
+    } else {
+        KeyBytes max_bytes = normalized_key(max_key);
+        scan(min_bytes, &max_bytes, handles, nullptr);
+    }
+    return handles;
 }
 
 // Insert a row with the given handle. Row must exist in relation already.
 void BTreeIndex::insert(Handle handle) {
+    ColumnNames column_names = key_columns;
+    column_names.insert(column_names.end(), include_columns.begin(), include_columns.end());
+    ValueDict *row = relation.project(handle, &column_names);
+    try {
+        insert(handle, row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+}
+
+// Insert a row with the given handle and values. Row must exist in relation already.
+// A key that belongs in the rightmost leaf (the usual case for increasing keys) goes straight there, otherwise we
+// descend from the root. Only the leaf is latched while it's changed. If it splits, the parent is latched (before
+// the leaf is let go) to post the new sibling to it, and so on up the tree.
+void BTreeIndex::insert(Handle handle, const ValueDict *row) {
     open();
-    ValueDict *key = relation.project(handle);
-    KeyValue *tkey = this->tkey(key);
-    Insertion insertion = _insert(root, stat->get_height(), tkey, handle);
-    if (!BTreeNode::insertion_is_none(insertion)) {
-        auto *new_root = new BTreeInterior(file, 0, key_profile, true);
-        new_root->set_first(root->get_id());
-        new_root->insert(&insertion.second, insertion.first);
-        new_root->save();
-        stat->set_root_id(new_root->get_id());
-        stat->set_height(stat->get_height() + 1);
-        stat->save();
-        delete root;
-        root = new_root;
-        std::cout << "new root: " << *new_root << std::endl;
+    if (buffered) {
+        std::lock_guard<std::mutex> guard(tree_mutex);
+        if (unique) {
+            Handles *handles = buffered_lookup(normalized_key(row));
+            bool duplicate = !handles->empty();
+            delete handles;
+            if (duplicate)
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+        }
+        buffered_write(BTreeBuffer::INSERT, normalized_entry(row), handle);
+        return;
+    }
+    KeyBytes key = normalized_entry(row);
+    KeyBytes unique_key;  // with INCLUDE columns, just the key columns of the entry
+    if (unique)
+        unique_key = include_columns.empty() ? key : normalized_key(row);
+    const KeyBytes &first = unique ? unique_key : key;  // where to start looking
+    BlockID leaf_id;
+    {
+        std::lock_guard<std::mutex> guard(rightmost_mutex);
+        leaf_id = rightmost != 0 && NormalizedKey::compare(first, rightmost_low) >= 0 ? rightmost : 0;
     }
-    delete key;
-    delete tkey;
+    BlockPointers path;  // stays empty if we skip the descent, in which case a split has to look up the parent
+    if (leaf_id == 0)
+        leaf_id = descend(first, 1, &path);
+    BTreeNode *node = get_node(first, leaf_id, true, true);
+    if (unique && !include_columns.empty())
+        node = check_unique(node, unique_key, key);
+    bool was_rightmost = node->get_next() == 0;
+    Insertion insertion;
+    try {
+        insertion = dynamic_cast<BTreeLeaf *>(node)->insert(key, handle, unique ? &unique_key : nullptr, *this);
+    } catch (...) {
+        unlatch(node->get_id());
+        delete node;
+        throw;
+    }
+    if (was_rightmost && !BTreeNode::insertion_is_none(insertion))
+        set_rightmost(insertion.first, insertion.second);  // the new sibling is the rightmost leaf now
+
+    for (uint level = 2; !BTreeNode::insertion_is_none(insertion); level++) {
+        BlockID child_id = node->get_id();
+        BlockID parent_id;
+        if (!path.empty()) {
+            parent_id = path.back();
+            path.pop_back();
+        } else {
+            // we split the root, unless somebody else has already given it a parent (or we skipped the descent)
+            latch(STAT);
+            if (stat->get_root_id() == child_id) {
+                grow(child_id, level, insertion);
+                unlatch(STAT);
+                break;
+            }
+            unlatch(STAT);
+            // the root was split too, so wait for whoever did it to give the tree its new level
+            while ((uint) (top & 0xFFFFFFFF) < level)
+                std::this_thread::yield();
+            parent_id = descend(insertion.second, level, nullptr);
+        }
+        BTreeNode *parent = get_node(insertion.second, parent_id, false, true);
+        unlatch(child_id);
+        delete node;
+        node = parent;
+        insertion = dynamic_cast<BTreeInterior *>(node)->insert(insertion.second, insertion.first);
+    }
+    unlatch(node->get_id());
+    delete node;
 }
 
-// Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
-Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle) {
-    if (height == 1) {
-        auto *leaf = dynamic_cast<BTreeLeaf *>(node);
-        return leaf->insert(key, handle);
-    } else {
-        auto *interior = dynamic_cast<BTreeInterior *>(node);
-        Insertion insertion = _insert(interior->find(key, height), height - 1, key, handle);
-        if (!BTreeNode::insertion_is_none(insertion))
-            insertion = interior->insert(&insertion.second, insertion.first);
-        return insertion;
+// With INCLUDE columns, entries with the same key columns can be spread over several leaves, starting with the given
+// one (latched) where unique_key would go. Latch each of them in turn, left to right, holding on to the ones before,
+// so that no other insert of the same key can get by, and check that none has an entry starting with unique_key.
+// Returns the one of them the whole key goes in, still latched; the others are let go.
+BTreeNode *BTreeIndex::check_unique(BTreeNode *leaf, const KeyBytes &unique_key, const KeyBytes &key) {
+    std::vector<BTreeNode *> held(1, leaf);
+    try {
+        while (true) {
+            BTreeLeaf *last = dynamic_cast<BTreeLeaf *>(held.back());
+            if (last->has_prefix(unique_key))
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+            if (!last->continues(unique_key))
+                break;
+            latch(last->get_next_leaf());
+            held.push_back(new BTreeLeaf(this->file, last->get_next_leaf(), this->key_profile, false));
+        }
+    } catch (...) {
+        for (auto node: held) {
+            unlatch(node->get_id());
+            delete node;
+        }
+        throw;
     }
+    BTreeNode *target = nullptr;
+    for (auto node: held) {
+        if (target == nullptr && !node->is_past(key)) {
+            target = node;
+        } else {
+            unlatch(node->get_id());
+            delete node;
+        }
+    }
+    return target;
 }
 
+// Delete the index entry for the row with the given handle. Row must still be in relation.
+// Nodes are never merged, so only the leaf is latched.
 void BTreeIndex::del(Handle handle) {
-    throw DbRelationError("Don't know how to delete from a BTree index yet");
-    // FIXME
+    open();
+    KeyBytes key = normalized_entry(handle);
+    if (buffered) {
+        std::lock_guard<std::mutex> guard(tree_mutex);
+        buffered_write(BTreeBuffer::DELETE, key, handle);
+        return;
+    }
+    BTreeNode *node = get_node(key, descend(key, 1, nullptr), true, true);
+    try {
+        dynamic_cast<BTreeLeaf *>(node)->del(key, handle, *this);
+    } catch (...) {
+        unlatch(node->get_id());
+        delete node;
+        throw;
+    }
+    unlatch(node->get_id());
+    delete node;
+}
+
+// Put a new root above old_root_id with the split of old_root_id in it, making the tree height levels tall. Called
+// with the STAT block latched (or, if buffered, tree_mutex held).
+void BTreeIndex::grow(BlockID old_root_id, uint height, const Insertion &split) {
+    BTreeInterior new_root(file, 0, key_profile, true);
+    new_root.set_first(old_root_id);
+    new_root.insert(split.second, split.first);
+    new_root.save();
+    stat->set_root_id(new_root.get_id());
+    stat->set_height(height);
+    stat->save();
+    set_top(new_root.get_id(), height);
+    std::cout << "new root: " << new_root << std::endl;
+}
+
+// An empty overflow block, off the front of the free chain if there is one.
+BTreeOverflow *BTreeIndex::take_overflow() {
+    latch(STAT);
+    BTreeOverflow *node = nullptr;
+    try {
+        BlockID free_id = stat->get_free_head();
+        if (free_id != 0) {
+            node = new BTreeOverflow(file, free_id, key_profile, false);
+            stat->set_free_head(node->get_next());
+            stat->save();
+            node->set_next(0);
+            node->set_chunk(std::string());
+        } else {
+            node = new BTreeOverflow(file, 0, key_profile, true);
+        }
+    } catch (...) {
+        unlatch(STAT);
+        delete node;
+        throw;
+    }
+    unlatch(STAT);
+    return node;
+}
+
+// Put an overflow block on the front of the free chain.
+void BTreeIndex::give_overflow(BlockID block_id) {
+    latch(STAT);
+    try {
+        BTreeOverflow node(file, block_id, key_profile, false);
+        node.set_next(stat->get_free_head());
+        node.set_chunk(std::string());
+        node.save();
+        stat->set_free_head(block_id);
+        stat->save();
+    } catch (...) {
+        unlatch(STAT);
+        throw;
+    }
+    unlatch(STAT);
+}
+
+// Find key's handles in a buffered index: the key and include columns if there are any, otherwise just the key.
+Handles *BTreeIndex::buffered_lookup(const KeyBytes &key) const {
+    if (include_columns.empty())
+        return buffered_find(key);
+    const_cast<BTreeIndex *>(this)->flush_all();  // the entries that start with key could be in any of the buffers
+    Handles *handles = new Handles();
+    scan(key, &key, handles, nullptr);
+    return handles;
+}
+
+// Find the handles for entry key: whatever its leaf has, changed by any messages for key in the buffers on the way
+// down. A message further down is older, so they're applied from the bottom up.
+Handles *BTreeIndex::buffered_find(const KeyBytes &key) const {
+    HeapFile &index_file = const_cast<HeapFile &>(file);
+    uint64_t root = top;
+    BlockID block_id = (BlockID) (root >> 32);
+    std::vector<BTreeBuffer::Messages> found;  // for key, one list for each level, top first
+    for (uint height = (uint) (root & 0xFFFFFFFF); height > 1; height--) {
+        BTreeInterior node(index_file, block_id, key_profile, false);
+        found.push_back(BTreeBuffer::Messages());
+        if (node.get_buffer() != 0) {
+            BTreeBuffer buffer(index_file, node.get_buffer(), key_profile, false);
+            buffer.find(key, found.back());
+        }
+        block_id = node.find(key);
+    }
+    BTreeLeaf leaf(index_file, block_id, key_profile, false);
+    Handles *handles = leaf.find_eq(key);
+    for (auto level = found.rbegin(); level != found.rend(); level++)
+        for (auto const &message: *level) {
+            auto at = std::find(handles->begin(), handles->end(), message.handle);
+            if (message.op == BTreeBuffer::INSERT && at == handles->end())
+                handles->push_back(message.handle);
+            else if (message.op == BTreeBuffer::DELETE && at != handles->end())
+                handles->erase(at);
+        }
+    std::sort(handles->begin(), handles->end());  // posting list order
+    return handles;
+}
+
+// Queue an insert or delete in the root's buffer, or just do it if the root is the only leaf.
+void BTreeIndex::buffered_write(BTreeBuffer::Op op, const KeyBytes &key, Handle handle) {
+    BTreeBuffer::Message message;
+    message.op = op;
+    message.handle = handle;
+    message.key = key;
+    BTreeBuffer::Messages messages(1, message);
+    uint64_t root = top;
+    uint height = (uint) (root & 0xFFFFFFFF);
+    if (height == 1)
+        post(apply((BlockID) (root >> 32), messages), 1);
+    else
+        push((BlockID) (root >> 32), height, messages);
+}
+
+// Get node's message buffer, giving the node one if it doesn't have one yet (freed by caller).
+BTreeBuffer *BTreeIndex::get_buffer(BTreeInterior &node) {
+    if (node.get_buffer() != 0)
+        return new BTreeBuffer(file, node.get_buffer(), key_profile, false);
+    BTreeBuffer *buffer = new BTreeBuffer(file, 0, key_profile, true);
+    buffer->save();
+    node.set_buffer(buffer->get_id());
+    node.save();
+    return buffer;
+}
+
+static bool message_less(const BTreeBuffer::Message &a, const BTreeBuffer::Message &b) {
+    return NormalizedKey::compare(a.key, b.key) < 0;
 }
 
+// Add messages to the buffers of the nodes at level, starting with node_id and moving right as the keys require.
+// A buffer that fills up is flushed to make room.
+void BTreeIndex::push(BlockID node_id, uint level, BTreeBuffer::Messages &messages) {
+    std::stable_sort(messages.begin(), messages.end(), message_less);  // stable keeps each key's messages in order
+    BTreeInterior *node = nullptr;
+    BTreeBuffer *buffer = nullptr;
+    for (auto const &message: messages) {
+        while (true) {
+            if (node == nullptr || node->is_past(message.key)) {
+                if (node != nullptr) {
+                    node_id = node->get_id();
+                    buffer->save();
+                    delete buffer;
+                    delete node;
+                }
+                node = dynamic_cast<BTreeInterior *>(get_node(message.key, node_id, false, false));
+                buffer = get_buffer(*node);
+            }
+            if (buffer->add(message))
+                break;
+            node_id = node->get_id();
+            buffer->save();
+            delete buffer;
+            delete node;
+            node = nullptr;
+            flush(node_id, level);
+        }
+    }
+    if (node != nullptr) {
+        buffer->save();
+        delete buffer;
+        delete node;
+    }
+}
+
+// Move the messages for node_id's busiest child out of its buffer and down a level, into the child's buffer or,
+// if the child is a leaf, into the leaf itself.
+void BTreeIndex::flush(BlockID node_id, uint level) {
+    BTreeInterior node(file, node_id, key_profile, false);
+    BTreeBuffer buffer(file, node.get_buffer(), key_profile, false);
+    const BTreeBuffer::Messages &messages = buffer.get_messages();
+    BlockPointers children;
+    std::map<BlockID, uint> counts;
+    for (auto const &message: messages) {
+        children.push_back(node.find(message.key));
+        counts[children.back()]++;
+    }
+    BlockID busiest = 0;
+    for (auto const &count: counts)
+        if (busiest == 0 || count.second > counts[busiest])
+            busiest = count.first;
+
+    BTreeBuffer::Messages down, rest;
+    for (u_long i = 0; i < messages.size(); i++)
+        (children[i] == busiest ? down : rest).push_back(messages[i]);
+    buffer.set_messages(rest);
+    buffer.save();
+    if (level == 2)
+        post(apply(busiest, down), 1);
+    else
+        push(busiest, level - 1, down);
+}
+
+// Flush every buffer, top level first, so the leaves have everything.
+void BTreeIndex::flush_all() {
+    for (uint level = (uint) (top & 0xFFFFFFFF); level > 1; level--) {
+        BlockID node_id = descend(KeyBytes(), level, nullptr);  // leftmost node on the level
+        while (node_id != 0) {
+            BTreeInterior node(file, node_id, key_profile, false);
+            if (node.get_buffer() != 0 &&
+                !BTreeBuffer(file, node.get_buffer(), key_profile, false).get_messages().empty())
+                flush(node_id, level);  // and look at the same node again
+            else
+                node_id = node.get_next();
+        }
+    }
+}
+
+// Carry out messages on the leaves, starting at leaf_id and moving right as the keys require.
+// Returns the leaves' splits, which the caller has to post.
+BTreeIndex::Insertions BTreeIndex::apply(BlockID leaf_id, BTreeBuffer::Messages &messages) {
+    std::stable_sort(messages.begin(), messages.end(), message_less);
+    Insertions splits;
+    BTreeLeaf *leaf = nullptr;
+    for (auto const &message: messages) {
+        if (leaf == nullptr || leaf->is_past(message.key)) {
+            if (leaf != nullptr) {
+                leaf_id = leaf->get_id();
+                delete leaf;
+            }
+            leaf = dynamic_cast<BTreeLeaf *>(get_node(message.key, leaf_id, true, false));
+        }
+        if (message.op == BTreeBuffer::INSERT) {
+            Insertion insertion = leaf->insert(message.key, message.handle, nullptr, *this);  // unique was checked already
+            if (!BTreeNode::insertion_is_none(insertion)) {
+                splits.push_back(insertion);
+                leaf_id = leaf->get_id();
+                delete leaf;
+                leaf = nullptr;
+            }
+        } else {
+            try {
+                leaf->del(message.key, message.handle, *this);
+            } catch (DbRelationError &e) {
+                // it was never in the index, so there's nothing to delete
+            }
+        }
+    }
+    delete leaf;
+    return splits;
+}
+
+// Post splits of nodes at level to their parents, and so on up the tree. When a parent with a buffer splits, the
+// messages for its new sibling go with it.
+// Interior nodes are kept to BUFFERED_FANOUT children: with hundreds of them, as a full block of short keys would
+// have, a full buffer has only a few messages for each and a flush moves hardly anything down.
+void BTreeIndex::post(const Insertions &splits, uint level) {
+    for (auto const &split: splits) {
+        uint64_t root = top;
+        if ((uint) (root & 0xFFFFFFFF) == level) {
+            grow((BlockID) (root >> 32), level + 1, split);
+            continue;
+        }
+        BTreeInterior *parent = dynamic_cast<BTreeInterior *>(
+                get_node(split.second, descend(split.second, level + 1, nullptr), false, false));
+        Insertion insertion = parent->insert(split.second, split.first, BUFFERED_FANOUT);
+        BlockID buffer_id = parent->get_buffer();
+        delete parent;
+        if (!BTreeNode::insertion_is_none(insertion)) {
+            if (buffer_id != 0)
+                split_buffer(buffer_id, insertion);
+            post(Insertions(1, insertion), level + 1);
+        }
+    }
+}
+
+// Move the messages at or past split's boundary out of the split node's buffer into one for its new sibling.
+void BTreeIndex::split_buffer(BlockID buffer_id, const Insertion &split) {
+    BTreeBuffer buffer(file, buffer_id, key_profile, false);
+    BTreeBuffer::Messages left, right;
+    for (auto const &message: buffer.get_messages())
+        (NormalizedKey::compare(message.key, split.second) < 0 ? left : right).push_back(message);
+    buffer.set_messages(left);
+    buffer.save();
+    BTreeInterior sibling(file, split.first, key_profile, false);
+    BTreeBuffer *sibling_buffer = get_buffer(sibling);
+    sibling_buffer->set_messages(right);
+    sibling_buffer->save();
+    delete sibling_buffer;
+}
+
+// Walk the leaves from left to right adding up how much of each block is used.
+double BTreeIndex::leaf_fill(uint &leaves) const {
+    const_cast<BTreeIndex *>(this)->open();
+    std::unique_lock<std::mutex> guard(tree_mutex, std::defer_lock);
+    if (buffered) {
+        guard.lock();
+        const_cast<BTreeIndex *>(this)->flush_all();
+    }
+    leaves = 0;
+    double used = 0.0;
+    BTreeLeaf *leaf = find_leaf(KeyBytes());  // nothing is less than the empty key, so this is the leftmost leaf
+    while (leaf != nullptr) {
+        leaves++;
+        used += 1.0 - (double) leaf->get_unused_bytes() / DbBlock::BLOCK_SZ;
+        BlockID next_leaf = leaf->get_next_leaf();
+        delete leaf;
+        leaf = next_leaf == 0 ? nullptr : new BTreeLeaf(const_cast<HeapFile &>(file), next_leaf, key_profile, false);
+    }
+    return used / leaves;
+}
+
+// Pull out the key values in order, stopping at the first key column that isn't in the dictionary.
 KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
     KeyValue *key_value = new KeyValue();
-    for (auto const &column_name: key_columns)
-        key_value->push_back(key->find(column_name)->second);
+    for (auto const &column_name: key_columns) {
+        auto value = key->find(column_name);
+        if (value == key->end())
+            break;
+        key_value->push_back(value->second);
+    }
     return key_value;
 }
 
+// Encode the search key once so the nodes can compare it directly against their stored bytes.
+KeyBytes BTreeIndex::normalized_key(const ValueDict *key) const {
+    KeyValue *key_value = tkey(key);
+    KeyBytes key_bytes = NormalizedKey::encode(key_value, key_profile);
+    delete key_value;
+    return key_bytes;
+}
+
+// Encode the key and include columns of the row in the relation.
+KeyBytes BTreeIndex::normalized_entry(Handle handle) const {
+    ColumnNames column_names = key_columns;
+    column_names.insert(column_names.end(), include_columns.begin(), include_columns.end());
+    ValueDict *row = relation.project(handle, &column_names);
+    KeyBytes entry = normalized_entry(row);
+    delete row;
+    return entry;
+}
+
+// Encode the key and include columns of row.
+KeyBytes BTreeIndex::normalized_entry(const ValueDict *row) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns)
+        key_value.push_back(row->at(column_name));
+    for (auto const &column_name: include_columns)
+        key_value.push_back(row->at(column_name));
+    return NormalizedKey::encode(&key_value, key_profile);
+}
+
+// Remember the rightmost leaf and the lowest key that goes in it. Leaves never merge and a split only moves a
+// leaf's upper end, so a leaf's lowest key stays good even once the leaf isn't rightmost anymore (the insert just
+// moves right from it). Since splits can finish out of order, keep whichever leaf is furthest right.
+void BTreeIndex::set_rightmost(BlockID leaf_id, const KeyBytes &low) {
+    std::lock_guard<std::mutex> guard(rightmost_mutex);
+    if (rightmost == 0 || NormalizedKey::compare(low, rightmost_low) > 0) {
+        rightmost = leaf_id;
+        rightmost_low = low;
+    }
+}
+
 // Figure out the data types of each key component and encode them in key_profile, a list of int/str classes.
 void BTreeIndex::build_key_profile() {
     std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
@@ -138,9 +818,689 @@ void BTreeIndex::build_key_profile() {
     }
     for (auto const &column_name: key_columns)
         key_profile.push_back(types_by_colname[column_name]);
+    for (auto const &column_name: include_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+// Long TEXT keys with a long common prefix exercise the prefix compression and suffix truncation in the nodes.
+bool test_btree_text() {
+    ColumnNames column_names;
+    column_names.push_back("path");
+    column_names.push_back("n");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_text", column_names, column_attributes);
+    table.create();
+    const std::string base = "https://www.example.com/catalog/products/item-";
+    for (int i = 0; i < 10 * 1000; i++) {
+        ValueDict row;
+        int j = (i * 7919) % (10 * 1000);  // not in order
+        row["path"] = Value(base + std::to_string(j) + ".html");
+        row["n"] = Value(j);
+        table.insert(&row);
+    }
+    column_names.clear();
+    column_names.push_back("path");
+    BTreeIndex index(table, "pathindex", column_names, true);
+    index.create();
+    ValueDict lookup;
+    for (int i = 0; i < 10 * 1000; i += 7) {
+        lookup["path"] = Value(base + std::to_string(i) + ".html");
+        Handles *handles = index.lookup(&lookup);
+        if (handles->size() != 1) {
+            std::cout << "text lookup failed " << i << std::endl;
+            return false;
+        }
+        ValueDict *result = table.project(handles->back());
+        bool ok = result->at("n") == Value(i);
+        delete handles;
+        delete result;
+        if (!ok) {
+            std::cout << "text lookup wrong row " << i << std::endl;
+            return false;
+        }
+    }
+    lookup["path"] = Value(base);  // a prefix of every key, but not a key
+    Handles *handles = index.lookup(&lookup);
+    bool found = !handles->empty();
+    delete handles;
+    if (found) {
+        std::cout << "text prefix lookup failed" << std::endl;
+        return false;
+    }
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// A non-unique index on a column with few distinct values: posting lists, overflow chains, and delete.
+bool test_btree_non_unique() {
+    ColumnNames column_names;
+    column_names.push_back("status");
+    column_names.push_back("id");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_multi", column_names, column_attributes);
+    table.create();
+    const int n = 20 * 1000, statuses = 3;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["status"] = Value(i % statuses);  // hot keys, each needs an overflow chain
+        row["id"] = Value(i);
+        table.insert(&row);
+    }
+    ValueDict row;
+    row["status"] = Value(99);  // a rare key that stays inline
+    row["id"] = Value(n);
+    Handle rare = table.insert(&row);
+    column_names.clear();
+    column_names.push_back("status");
+    BTreeIndex index(table, "statusindex", column_names, false);
+    index.create();
+    row["status"] = Value(99);
+    row["id"] = Value(n + 1);
+    Handle rare2 = table.insert(&row);  // goes in after the index is built
+    index.insert(rare2);
+
+    ValueDict lookup;
+    for (int status = 0; status < statuses; status++) {
+        lookup["status"] = Value(status);
+        Handles *handles = index.lookup(&lookup);
+        ValueDicts *results = table.project(handles);
+        bool ok = handles->size() == (u_long) (n + statuses - 1 - status) / statuses;
+        int expected = status;
+        for (auto const &result: *results) {
+            ok = ok && result->at("status") == Value(status) && result->at("id") == Value(expected);
+            expected += statuses;  // posting lists are in heap order, which is insert order here
+            delete result;
+        }
+        delete results;
+        delete handles;
+        if (!ok)
+            return assertion_failure("non-unique lookup", status);
+    }
+    lookup["status"] = Value(99);
+    Handles *handles = index.lookup(&lookup);
+    bool ok = handles->size() == 2 && handles->front() == rare && handles->back() == rare2;
+    delete handles;
+    if (!ok)
+        return assertion_failure("non-unique rare lookup");
+
+    // delete every other row with status 1, then all but a few, so the chain shrinks back inline
+    lookup["status"] = Value(1);
+    handles = index.lookup(&lookup);
+    for (u_long i = 0; i < handles->size(); i += 2)
+        index.del((*handles)[i]);
+    Handles *remaining = index.lookup(&lookup);
+    ok = remaining->size() == handles->size() / 2;
+    for (u_long i = 0; ok && i < remaining->size(); i++)
+        ok = (*remaining)[i] == (*handles)[2 * i + 1];
+    for (u_long i = 0; ok && i + 3 < remaining->size(); i++)
+        index.del((*remaining)[i]);
+    delete remaining;
+    delete handles;
+    if (!ok)
+        return assertion_failure("non-unique delete");
+    handles = index.lookup(&lookup);
+    ok = handles->size() == 3;
+    delete handles;
+    if (!ok)
+        return assertion_failure("non-unique delete back to inline");
+
+    index.del(rare);
+    index.del(rare2);
+    lookup["status"] = Value(99);
+    handles = index.lookup(&lookup);
+    ok = handles->empty();
+    delete handles;
+    if (!ok)
+        return assertion_failure("non-unique delete last handle");
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// For looking at how big an index's file has gotten.
+class BTreeFileSize : public BTreeIndex {
+public:
+    BTreeFileSize(DbRelation &relation, Identifier name, ColumnNames key_columns)
+            : BTreeIndex(relation, name, key_columns, false) {}
+
+    uint32_t get_block_count() { return file.get_last_block_id(); }
+};
+
+// A hot key in a packed leaf, its rows each on a block of their own so that its handles take more room inline than
+// its overflow chain's record does: deleting it down to a few handles has to keep the chain until the leaf has room,
+// and inserting and deleting them over and over has to reuse the chain's blocks instead of growing the file.
+bool test_btree_hot_key() {
+    ColumnNames column_names;
+    column_names.push_back("k");
+    column_names.push_back("pad");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_btree_hot", column_names, column_attributes);
+    table.create();
+    const int hot = 300, keys = 5000;
+    const Value no_pad(""), pad(std::string(DbBlock::BLOCK_SZ * 3 / 4, 'x'));
+    Handles hot_rows;
+    ValueDict hot_row, row;
+    hot_row["k"] = Value(0);
+    hot_row["pad"] = no_pad;
+    for (int i = 0; i < hot; i++) {
+        hot_rows.push_back(table.insert(&hot_row));
+        row["k"] = Value(i + 1);
+        row["pad"] = pad;  // so the next hot row is on another block
+        table.insert(&row);
+    }
+    row["pad"] = no_pad;
+    for (int i = hot + 1; i <= keys; i++) {
+        row["k"] = Value(i);  // increasing, so the hot key's leaf is left packed when it splits
+        table.insert(&row);
+    }
+    column_names.clear();
+    column_names.push_back("k");
+    BTreeFileSize index(table, "hotindex", column_names);
+    index.create();
+
+    // delete all but every 60th, and churn the rest
+    Handles kept, churned;
+    for (int i = 0; i < hot; i++)
+        (i % 60 == 0 ? kept : churned).push_back(hot_rows[i]);
+    ValueDict lookup;
+    lookup["k"] = Value(0);
+    uint32_t blocks = 0;
+    for (int round = 0; round < 10; round++) {
+        try {
+            if (round > 0)
+                for (auto const &handle: churned)
+                    index.insert(handle);
+            for (auto const &handle: churned)
+                index.del(handle);
+        } catch (DbBlockNoRoomError &e) {
+            return assertion_failure(std::string("hot key churn: ") + e.what(), round);
+        }
+        Handles *handles = index.lookup(&lookup);
+        bool ok = *handles == kept;
+        delete handles;
+        if (!ok)
+            return assertion_failure("hot key lookup", round);
+        if (round == 1)
+            blocks = index.get_block_count();
+        else if (round > 1 && index.get_block_count() != blocks)
+            return assertion_failure("hot key churn grew the index file", index.get_block_count(), blocks);
+    }
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// A covering index: key (a) with b included, answering lookups from the index alone.
+bool test_btree_covering() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_cover", column_names, column_attributes);
+    table.create();
+    const int n = 5 * 1000, keys = 50;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i % keys);
+        row["b"] = Value("name-" + std::to_string(n - i));
+        row["c"] = Value(i);
+        table.insert(&row);
+    }
+    ColumnNames key_columns, include_columns;
+    key_columns.push_back("a");
+    include_columns.push_back("b");
+    BTreeIndex index(table, "coverindex", key_columns, false, include_columns);
+    index.create();
+
+    ColumnNames needed;
+    needed.push_back("b");
+    needed.push_back("a");
+    if (!index.covers(needed))
+        return assertion_failure("covers key and include columns");
+    needed.push_back("c");
+    if (index.covers(needed))
+        return assertion_failure("covers a column it doesn't have");
+
+    ValueDict lookup;
+    for (int a = 0; a < keys; a += 7) {
+        lookup["a"] = Value(a);
+        ValueDicts *values = index.lookup_values(&lookup);
+        Handles *handles = index.lookup(&lookup);
+        bool ok = values->size() == (u_long) (n / keys) && handles->size() == values->size();
+        for (u_long i = 0; ok && i < values->size(); i++) {
+            ValueDict *row = table.project((*handles)[i]);
+            ok = (*values)[i]->size() == 2 && (*values)[i]->at("a") == row->at("a") &&
+                 (*values)[i]->at("b") == row->at("b");
+            delete row;
+        }
+        for (auto const &row: *values)
+            delete row;
+        delete values;
+        delete handles;
+        if (!ok)
+            return assertion_failure("covering lookup", a);
+    }
+
+    // a unique covering index still only looks at the key columns for duplicates
+    BTreeIndex unique_index(table, "uniquecoverindex", key_columns, true, include_columns);
+    bool threw = false;
+    try {
+        unique_index.create();
+    } catch (DbRelationError &e) {
+        threw = true;
+    }
+    unique_index.close();
+    unique_index.drop();
+    if (!threw)
+        return assertion_failure("unique covering index allowed a duplicate key");
+
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// Run work(t) for t = 0 .. threads-1, each on its own thread, and return how many seconds they took all together.
+static double run_threads(int threads, const std::function<void(int)> &work) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(std::thread(work, t));
+    for (auto &worker: workers)
+        worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Fill a two-column table with n rows whose a values are 0..n-1, not in order, and return their handles.
+static Handles fill_mt_table(HeapTable &table, int n) {
+    Handles rows;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value((int) ((i * 7919LL) % n));
+        row["b"] = Value(i);
+        rows.push_back(table.insert(&row));
+    }
+    return rows;
+}
+
+// Several threads inserting into and looking up in the same index at once. However their splits interleave, every
+// row has to end up in the tree exactly once.
+bool test_btree_concurrent() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_mt", column_names, column_attributes);
+    table.create();
+    column_names.clear();
+    column_names.push_back("a");
+    BTreeIndex index(table, "mtindex", column_names, true);
+    index.create();  // empty, the threads fill it
+    const int n = 20 * 1000, threads = 4;
+    Handles rows = fill_mt_table(table, n);
+
+    std::atomic<int> failures(0);
+    run_threads(threads, [&](int t) {
+        try {
+            ValueDict lookup;
+            for (int i = t; i < n; i += threads) {
+                index.insert(rows[i]);
+                lookup["a"] = Value((int) ((i * 7919LL) % n));
+                Handles *handles = index.lookup(&lookup);
+                if (handles->size() != 1 || handles->back() != rows[i])
+                    failures++;
+                delete handles;
+            }
+        } catch (DbRelationError &e) {
+            failures++;
+        }
+    });
+    if (failures > 0)
+        return assertion_failure("concurrent insert/lookup", failures);
+
+    Handles *handles = index.range(nullptr, nullptr);
+    bool ok = handles->size() == (u_long) n;
+    for (int i = 0; ok && i < n; i++) {
+        ValueDict *row = table.project((*handles)[i]);
+        ok = row->at("a") == Value(i);
+        delete row;
+    }
+    delete handles;
+    if (!ok)
+        return assertion_failure("concurrent inserts out of order or missing");
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// Several threads inserting the same keys, with different include values, into a unique covering index at once.
+// For each key exactly one of them has to get in.
+bool test_btree_concurrent_unique() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_btree_mt_unique", column_names, column_attributes);
+    table.create();
+    ColumnNames key_columns, include_columns;
+    key_columns.push_back("a");
+    include_columns.push_back("b");
+    BTreeIndex index(table, "mtuniqueindex", key_columns, true, include_columns);
+    index.create();
+    const int threads = 4, n = 2 * 1000;
+    std::vector<Handles> rows(threads);
+    for (int i = 0; i < n; i++) {
+        for (int t = 0; t < threads; t++) {
+            ValueDict row;
+            row["a"] = Value((int) ((i * 7919LL) % n));
+            row["b"] = Value(std::to_string(t) + std::string(100, 'x'));  // a few entries to a leaf
+            rows[t].push_back(table.insert(&row));
+        }
+    }
+
+    std::vector<std::atomic<int>> inserted(n);
+    std::atomic<int> failures(0);
+    run_threads(threads, [&](int t) {
+        for (int i = 0; i < n; i++) {
+            try {
+                index.insert(rows[t][i]);
+                inserted[i]++;
+            } catch (DbRelationError &e) {
+                // somebody else got there first
+            } catch (...) {
+                failures++;
+            }
+        }
+    });
+    if (failures > 0)
+        return assertion_failure("concurrent unique insert", failures);
+    for (int i = 0; i < n; i++)
+        if (inserted[i] != 1)
+            return assertion_failure("concurrent unique insert of a key", i, inserted[i]);
+
+    Handles *handles = index.range(nullptr, nullptr);
+    bool ok = handles->size() == (u_long) n;
+    delete handles;
+    if (!ok)
+        return assertion_failure("concurrent unique inserts missing or doubled");
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// Readers looking up a key whose posting list has overflowed while one writer keeps deleting and putting back its
+// rows (rewriting its chain) and another churns a second overflowed key (freeing blocks the first can reuse). A
+// reader must always get the list as it was at some moment: only rows with that key, at most one of them missing.
+bool test_btree_concurrent_overflow() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_mt_chain", column_names, column_attributes);
+    table.create();
+    const int n = 2000, rounds = 300;
+    std::vector<Handles> rows(2);
+    for (int i = 0; i < n; i++) {
+        for (int a = 0; a < 2; a++) {
+            ValueDict row;
+            row["a"] = Value(a);
+            row["b"] = Value(i);
+            rows[a].push_back(table.insert(&row));
+        }
+    }
+    column_names.clear();
+    column_names.push_back("a");
+    BTreeIndex index(table, "mtchainindex", column_names, false);
+    index.create();
+
+    std::atomic<int> failures(0), torn(0);
+    std::atomic<bool> writing(true);
+    run_threads(4, [&](int t) {
+        try {
+            if (t < 2) {
+                for (int r = 0; r < rounds; r++) {
+                    Handle handle = rows[t][(r * 7919LL) % n];
+                    index.del(handle);
+                    index.insert(handle);
+                }
+                if (t == 0)
+                    writing = false;
+                return;
+            }
+            ValueDict lookup;
+            lookup["a"] = Value(0);
+            std::vector<Handle> hot(rows[0]);
+            std::sort(hot.begin(), hot.end());
+            do {
+                Handles *handles = index.lookup(&lookup);
+                bool ok = handles->size() + 1 >= (u_long) n && handles->size() <= (u_long) n &&
+                          std::is_sorted(handles->begin(), handles->end()) &&
+                          std::adjacent_find(handles->begin(), handles->end()) == handles->end() &&
+                          std::includes(hot.begin(), hot.end(), handles->begin(), handles->end());
+                delete handles;
+                if (!ok)
+                    torn++;
+            } while (writing);
+        } catch (...) {
+            failures++;
+        }
+    });
+    if (failures > 0)
+        return assertion_failure("concurrent overflow lookup", failures);
+    if (torn > 0)
+        return assertion_failure("concurrent overflow lookup saw a torn list", torn);
+    ValueDict lookup;
+    for (int a = 0; a < 2; a++) {
+        lookup["a"] = Value(a);
+        Handles *handles = index.lookup(&lookup);
+        bool ok = handles->size() == (u_long) n;
+        delete handles;
+        if (!ok)
+            return assertion_failure("overflowed key after concurrent churn", a);
+    }
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// A buffered index: most of the inserts and deletes are still sitting in buffers when the lookups happen, and the
+// buffers have to survive closing and reopening the index.
+bool test_btree_buffered() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_buf", column_names, column_attributes);
+    table.create();
+    const int n = 20 * 1000;
+    Handles rows = fill_mt_table(table, n);
+    column_names.clear();
+    column_names.push_back("a");
+    BTreeIndex index(table, "bufindex", column_names, true, ColumnNames(), true);
+    index.create();
+
+    for (int i = 0; i < n; i += 3)
+        index.del(rows[i]);
+    index.close();
+    ValueDict lookup;
+    for (int i = 0; i < n; i++) {
+        lookup["a"] = Value((int) ((i * 7919LL) % n));
+        Handles *handles = index.lookup(&lookup);
+        bool ok = i % 3 == 0 ? handles->empty() : handles->size() == 1 && handles->back() == rows[i];
+        delete handles;
+        if (!ok)
+            return assertion_failure("buffered lookup", i);
+    }
+
+    bool threw = false;
+    try {
+        index.insert(rows[1]);
+    } catch (DbRelationError &e) {
+        threw = true;
+    }
+    if (!threw)
+        return assertion_failure("buffered index allowed a duplicate key");
+    index.insert(rows[0]);  // deleted above, so it can go back in
+
+    Handles *handles = index.range(nullptr, nullptr);
+    bool ok = handles->size() == (u_long) (n - (n - 1) / 3);
+    int last = -1;
+    for (u_long i = 0; ok && i < handles->size(); i++) {
+        ValueDict *row = table.project((*handles)[i]);
+        ok = row->at("a").n > last && ((row->at("b").n % 3) != 0 || row->at("b").n == 0);
+        last = row->at("a").n;
+        delete row;
+    }
+    delete handles;
+    if (!ok)
+        return assertion_failure("buffered range");
+    index.drop();
+    table.drop();
+    return true;
+}
+
+/**
+ * Measure the KeySearch kernels on a node's worth of keys, leaf fill for increasing and for random keys, random
+ * insert throughput with and without buffering, then index insert and lookup throughput with 1, 2, 4, and 8 threads
+ * sharing the index.
+ */
+void benchmark_btree() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    ColumnNames key_columns;
+    key_columns.push_back("a");
+    const int n = 50 * 1000;
+
+    std::vector<int32_t> node_keys;
+    for (int32_t i = 0; i < 300; i++)  // about as many as a leaf holds
+        node_keys.push_back(i * 16);
+    const char *kernel_names[] = {"scalar", "sse2", "avx2"};
+    KeySearch::Kernel kernels[] = {KeySearch::lower_bound_scalar, KeySearch::lower_bound_sse2,
+                                   KeySearch::lower_bound_avx2};
+    for (int k = 0; k < 3; k++) {
+        if (k == 2 && std::string(KeySearch::kernel_name()) != "avx2")
+            continue;  // this CPU can't run it
+        double search_time = run_threads(1, [&](int t) {
+            for (int i = 0; i < 100 * n; i++)
+                kernels[k]((const char *) node_keys.data(), (uint) node_keys.size(), (int32_t) ((i * 7919LL) % 4800));
+        });
+        std::cout << kernel_names[k] << " key search: " << (long) (100 * n / search_time) << " searches/sec"
+                  << std::endl;
+    }
+
+    std::vector<int> keys;
+    for (int i = 0; i < n; i++)
+        keys.push_back(i);
+    for (int shuffled = 0; shuffled < 2; shuffled++) {
+        if (shuffled)
+            std::shuffle(keys.begin(), keys.end(), std::mt19937(5300));
+        HeapTable table("__benchmark_btree", column_names, column_attributes);
+        table.create();
+        BTreeIndex index(table, "benchindex", key_columns, true);
+        index.create();
+        Handles rows;
+        double append_time = run_threads(1, [&](int t) {
+            for (int i = 0; i < n; i++) {
+                ValueDict row;
+                row["a"] = Value(keys[i]);
+                row["b"] = Value(i);
+                rows.push_back(table.insert(&row));
+            }
+        });
+        double insert_time = run_threads(1, [&](int t) {
+            for (int i = 0; i < n; i++) {
+                ValueDict row;
+                row["a"] = Value(keys[i]);
+                index.insert(rows[i], &row);
+            }
+        });
+        uint leaves;
+        double fill = index.leaf_fill(leaves);
+        std::cout << "btree with " << (shuffled ? "random" : "increasing") << " keys: " << leaves << " leaves, "
+                  << (int) (fill * 100 + 0.5) << "% full, " << (long) (n / insert_time) << " inserts/sec (heap: "
+                  << (long) (n / append_time) << " appends/sec)" << std::endl;
+        index.drop();
+        table.drop();
+    }
+
+    for (int buffered = 0; buffered < 2; buffered++) {
+        HeapTable table("__benchmark_btree", column_names, column_attributes);
+        table.create();
+        BTreeIndex index(table, "benchindex", key_columns, true, ColumnNames(), buffered != 0);
+        index.create();
+        Handles rows = fill_mt_table(table, n);
+        double insert_time = run_threads(1, [&](int t) {
+            for (int i = 0; i < n; i++)
+                index.insert(rows[i]);
+        });
+        double lookup_time = run_threads(1, [&](int t) {
+            ValueDict lookup;
+            for (int i = 0; i < n; i++) {
+                lookup["a"] = Value(i);
+                delete index.lookup(&lookup);
+            }
+        });
+        std::cout << (buffered ? "buffered" : "plain") << " btree with random keys: " << (long) (n / insert_time)
+                  << " inserts/sec, " << (long) (n / lookup_time) << " lookups/sec" << std::endl;
+        index.drop();
+        table.drop();
+    }
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        HeapTable table("__benchmark_btree", column_names, column_attributes);
+        table.create();
+        BTreeIndex index(table, "benchindex", key_columns, true);
+        index.create();
+        Handles rows = fill_mt_table(table, n);
+        double insert_time = run_threads(threads, [&](int t) {
+            for (int i = t; i < n; i += threads)
+                index.insert(rows[i]);
+        });
+        double lookup_time = run_threads(threads, [&](int t) {
+            ValueDict lookup;
+            for (int i = t; i < n; i += threads) {
+                lookup["a"] = Value(i);
+                delete index.lookup(&lookup);
+            }
+        });
+        std::cout << "btree with " << threads << " thread(s): " << (long) (n / insert_time) << " inserts/sec, "
+                  << (long) (n / lookup_time) << " lookups/sec" << std::endl;
+        index.drop();
+        table.drop();
+    }
 }
 
 bool test_btree() {
+    if (!test_normalized_key())
+        return assertion_failure("normalized key tests failed");
+    std::cout << "normalized key tests ok" << std::endl;
+    if (!test_key_search())
+        return assertion_failure("key search tests failed");
+    std::cout << "key search tests ok (using " << KeySearch::kernel_name() << ")" << std::endl;
+
     ColumnNames column_names;
     column_names.push_back("a");
     column_names.push_back("b");
@@ -166,8 +1526,10 @@ bool test_btree() {
     column_names.push_back("a");
     BTreeIndex index(table, "fooindex", column_names, true);
     index.create();
-    return true;  // FIXME
-
+    uint leaves;
+    double fill = index.leaf_fill(leaves);
+    if (fill < 0.85)  // the keys are increasing, so the leaves should be packed (they'd only be half full otherwise)
+        return assertion_failure("sequential leaf fill", fill * 100, leaves);
 
     ValueDict lookup;
     lookup["a"] = 12;
@@ -277,6 +1639,22 @@ bool test_btree() {
     }
     index.drop();
     table.drop();
+    if (!test_btree_text())
+        return false;
+    if (!test_btree_non_unique())
+        return false;
+    if (!test_btree_hot_key())
+        return false;
+    if (!test_btree_covering())
+        return false;
+    if (!test_btree_concurrent())
+        return false;
+    if (!test_btree_concurrent_unique())
+        return false;
+    if (!test_btree_concurrent_overflow())
+        return false;
+    if (!test_btree_buffered())
+        return false;
     return true;
 }
 
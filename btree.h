@@ -6,11 +6,34 @@
  */
 #pragma once
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "BTreeNode.h"
 
-class BTreeIndex : public DbIndex {
+/**
+ * @class BTreeIndex - a B-link tree: every node has a high key and a link to its right sibling
+ *
+ * Once the index is open, lookup, range, insert, and del can be called from several threads at once.
+ * Searches never latch: a node that has been split since its parent was read is detected by its high key and the
+ * search just moves right. Writers latch only the node they are changing, plus the parent while a split is posted
+ * to it (always child before parent and left before right, so they can't deadlock).
+ * Create, open, close, and drop are not thread-safe.
+ *
+ * A buffered index (a B-epsilon tree) queues inserts and deletes as messages in a buffer block under each interior
+ * node. When a buffer fills up, the messages for its busiest child are moved down a level in one batch, so a leaf is
+ * rewritten once for a whole batch of changes instead of once for each. A lookup picks up the messages for its key
+ * on the way down; a range scan flushes every buffer first. Buffered indexes do one operation at a time (under
+ * tree_mutex) instead of latching.
+ *
+ * Overflow blocks that posting lists no longer need go on a free chain (its head kept in the STAT block) for the
+ * next ones to use.
+ */
+class BTreeIndex : public DbIndex, protected OverflowBlocks {
 public:
-    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+               ColumnNames include_columns = ColumnNames(), bool buffered = false);
 
     virtual ~BTreeIndex();
 
@@ -24,28 +47,108 @@ public:
 
     virtual Handles *lookup(ValueDict *key) const;
 
+    virtual std::vector<Handles *> *lookup_batch(const ValueDicts &keys) const;
+
     virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
 
+    virtual bool supports_range() const { return true; }
+
     virtual void insert(Handle handle);
 
+    virtual void insert(Handle handle, const ValueDict *row);
+
     virtual void del(Handle handle);
 
+    virtual bool covers(const ColumnNames &column_names) const;
+
+    virtual ValueDicts *lookup_values(ValueDict *key_values) const;
+
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
 
+    /**
+     * How full the leaves are.
+     * @param leaves  set to the number of leaves
+     * @returns       average fraction of a leaf's block that is in use
+     */
+    double leaf_fill(uint &leaves) const;
+
 protected:
     static const BlockID STAT = 1;
+    static const uint BUFFERED_FANOUT = 16;  // buffered only: most boundaries in an interior node (see post)
     bool closed;
-    BTreeStat *stat;
-    BTreeNode *root;
+    BTreeStat *stat;  // only used with the STAT block latched
+    std::atomic<uint64_t> top;  // root block id and height, packed so searches can read them together
     HeapFile file;
-    KeyProfile key_profile;
+    KeyProfile key_profile;  // data types of the key columns followed by the include columns
+    mutable std::mutex latches_mutex;  // guards latches
+    mutable std::map<BlockID, std::unique_ptr<std::mutex>> latches;  // one per block, created on first use
+    std::mutex rightmost_mutex;  // guards rightmost and rightmost_low
+    BlockID rightmost;  // the rightmost leaf, where increasing keys go (0 if we don't know which it is)
+    KeyBytes rightmost_low;  // every key from this one up belongs in the rightmost leaf
+    bool buffered;  // writes go through the interior nodes' message buffers
+    mutable std::mutex tree_mutex;  // buffered only: held for the whole of each operation
+
+    typedef std::vector<Insertion> Insertions;
 
     void build_key_profile();
 
-    Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key) const;
+    KeyBytes normalized_key(const ValueDict *key) const; // tkey in its normalized byte form
+
+    KeyBytes normalized_entry(Handle handle) const; // key and include columns of a row, as stored in the leaves
+
+    KeyBytes normalized_entry(const ValueDict *row) const;
+
+    void set_rightmost(BlockID leaf_id, const KeyBytes &low);
+
+    void set_top(BlockID root_id, uint height) { top = ((uint64_t) root_id << 32) | height; }
+
+    void latch(BlockID block_id) const;
+
+    void unlatch(BlockID block_id) const;
+
+    BlockID descend(const KeyBytes &key, uint level, BlockPointers *path) const;
 
-    Insertion _insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle);
+    BTreeNode *get_node(const KeyBytes &key, BlockID block_id, bool leaf, bool latched) const;
+
+    BTreeNode *check_unique(BTreeNode *leaf, const KeyBytes &unique_key, const KeyBytes &key);
+
+    BTreeLeaf *find_leaf(const KeyBytes &key) const;
+
+    Handles *find_eq(const BTreeLeaf *leaf, const KeyBytes &key) const;
+
+    void get_entry_handles(const BTreeLeaf *leaf, uint entry, const KeyBytes &key, Handles &handles) const;
+
+    void scan(const KeyBytes &min_key, const KeyBytes *max_key, Handles *handles, ValueDicts *values) const;
+
+    void grow(BlockID old_root_id, uint height, const Insertion &split);
+
+    virtual BTreeOverflow *take_overflow();
+
+    virtual void give_overflow(BlockID block_id);
+
+    // buffered mode, all called with tree_mutex held
+    Handles *buffered_lookup(const KeyBytes &key) const;
+
+    Handles *buffered_find(const KeyBytes &key) const;
+
+    void buffered_write(BTreeBuffer::Op op, const KeyBytes &key, Handle handle);
+
+    BTreeBuffer *get_buffer(BTreeInterior &node);
+
+    void push(BlockID node_id, uint level, BTreeBuffer::Messages &messages);
+
+    void flush(BlockID node_id, uint level);
+
+    void flush_all();
+
+    Insertions apply(BlockID leaf_id, BTreeBuffer::Messages &messages);
+
+    void post(const Insertions &splits, uint level);
+
+    void split_buffer(BlockID buffer_id, const Insertion &split);
 };
 
 bool test_btree();
 
+void benchmark_btree();
+
@@ -0,0 +1,896 @@
+/**
+ * @file hash_index.cpp - implementation of HashIndex and HashBucket
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <random>
+#include <set>
+#include "hash_index.h"
+#include "btree.h"
+
+using namespace std;
+
+/**************
+ * HashBucket *
+ **************/
+
+HashBucket::HashBucket(HeapFile &file, BlockID block_id, bool create) : file(file), block(nullptr), id(block_id),
+                                                                        depth(0), next(0), count(0) {
+    if (create) {
+        this->block = file.get_new();
+        this->id = this->block->get_block_id();
+        clear();
+    } else {
+        this->block = file.get(block_id);
+        Dbt *dbt = this->block->get(DEPTH);
+        this->depth = *(uint32_t *) dbt->get_data();
+        delete dbt;
+        dbt = this->block->get(NEXT);
+        this->next = *(BlockID *) dbt->get_data();
+        delete dbt;
+        dbt = this->block->get(HASHES);
+        this->count = dbt->get_size() / sizeof(HashCode);
+        delete dbt;
+    }
+}
+
+HashBucket::~HashBucket() {
+    delete this->block;
+    this->block = nullptr;
+}
+
+// Only fetch the entries whose hash code matches.
+void HashBucket::find(HashCode hash, const KeyBytes &key, Handles &handles) const {
+    Dbt *hashes = this->block->get(HASHES);
+    const char *codes = (const char *) hashes->get_data();
+    for (uint i = 0; i < this->count; i++) {
+        HashCode code;
+        memcpy(&code, codes + i * sizeof(HashCode), sizeof(HashCode));
+        if (code != hash)
+            continue;
+        Dbt *dbt = this->block->get((RecordID) (FIRST + i));
+        bool match = dbt->get_size() - ENTRY_HEADER_SZ == key.size() &&
+                     memcmp((const char *) dbt->get_data() + ENTRY_HEADER_SZ, key.data(), key.size()) == 0;
+        delete dbt;
+        if (match)
+            handles.push_back(get_handle((RecordID) (FIRST + i)));
+    }
+    delete hashes;
+}
+
+void HashBucket::get_entries(Entries &entries) const {
+    Dbt *hashes = this->block->get(HASHES);
+    const char *codes = (const char *) hashes->get_data();
+    for (uint i = 0; i < this->count; i++) {
+        Entry entry;
+        memcpy(&entry.hash, codes + i * sizeof(HashCode), sizeof(HashCode));
+        entry.handle = get_handle((RecordID) (FIRST + i));
+        Dbt *dbt = this->block->get((RecordID) (FIRST + i));
+        entry.key = KeyBytes((const char *) dbt->get_data() + ENTRY_HEADER_SZ, dbt->get_size() - ENTRY_HEADER_SZ);
+        delete dbt;
+        entries.push_back(entry);
+    }
+    delete hashes;
+}
+
+// Room for the record and its header, plus the hash code and the slack SlottedPage::put wants for growing HASHES.
+bool HashBucket::add(const Entry &entry) {
+    uint size = ENTRY_HEADER_SZ + (uint) entry.key.size();
+    if (size + 4 + sizeof(HashCode) + 4 > this->block->unused_bytes())
+        return false;
+    Dbt *dbt = this->block->get(HASHES);
+    string hashes((const char *) dbt->get_data(), dbt->get_size());
+    delete dbt;
+    hashes.append((const char *) &entry.hash, sizeof(HashCode));
+    put_hashes(hashes);
+
+    string bytes(ENTRY_HEADER_SZ, '\0');
+    memcpy(&bytes[0], &entry.handle.first, sizeof(BlockID));
+    memcpy(&bytes[sizeof(BlockID)], &entry.handle.second, sizeof(RecordID));
+    bytes += entry.key;
+    Dbt entry_dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+    this->block->add(&entry_dbt);
+    this->count++;
+    return true;
+}
+
+// Entries are in no order, so we can remove the record and let the ones after it be renumbered.
+bool HashBucket::del(HashCode hash, Handle handle) {
+    Dbt *dbt = this->block->get(HASHES);
+    string hashes((const char *) dbt->get_data(), dbt->get_size());
+    delete dbt;
+    for (uint i = 0; i < this->count; i++) {
+        HashCode code;
+        memcpy(&code, hashes.data() + i * sizeof(HashCode), sizeof(HashCode));
+        if (code != hash || get_handle((RecordID) (FIRST + i)) != handle)
+            continue;
+        this->block->remove((RecordID) (FIRST + i));
+        hashes.erase(i * sizeof(HashCode), sizeof(HashCode));
+        put_hashes(hashes);
+        this->count--;
+        return true;
+    }
+    return false;
+}
+
+// Start the block over with just the depth and next records (their values get filled in by save) and no hashes.
+void HashBucket::clear() {
+    this->block->clear();
+    uint32_t zero = 0;
+    Dbt dbt(&zero, sizeof(zero));
+    this->block->add(&dbt);
+    this->block->add(&dbt);
+    Dbt empty(&zero, 0);
+    this->block->add(&empty);
+    this->count = 0;
+}
+
+void HashBucket::save() {
+    uint32_t depth = this->depth;
+    Dbt dbt(&depth, sizeof(depth));
+    this->block->put(DEPTH, dbt);
+    BlockID next = this->next;
+    Dbt next_dbt(&next, sizeof(next));
+    this->block->put(NEXT, next_dbt);
+    this->file.put(this->block);
+}
+
+Handle HashBucket::get_handle(RecordID record_id) const {
+    Dbt *dbt = this->block->get(record_id);
+    const char *bytes = (const char *) dbt->get_data();
+    Handle handle;
+    memcpy(&handle.first, bytes, sizeof(BlockID));
+    memcpy(&handle.second, bytes + sizeof(BlockID), sizeof(RecordID));
+    delete dbt;
+    return handle;
+}
+
+void HashBucket::put_hashes(const string &hashes) {
+    Dbt dbt((void *) hashes.data(), (u_int32_t) hashes.size());
+    this->block->put(HASHES, dbt);
+}
+
+
+/*************
+ * HashIndex *
+ *************/
+
+const uint HashIndex::PAGE_SLOTS;
+
+HashIndex::HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique),
+          closed(true),
+          file(relation.get_table_name() + "-" + name),
+          key_profile(),
+          global_depth(0),
+          directory(),
+          pages(),
+          free_head(0),
+          mutex() {
+    std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+// Create the index, sizing the directory up front so the rows already in the relation go straight into their
+// buckets without any splits.
+void HashIndex::create() {
+    file.create();  // makes the HEADER block
+    closed = false;
+    HashBucket::Entries entries;
+    u_long key_bytes = 0;
+    Handles *table_rows = relation.select();
+    for (auto const &row: *table_rows) {
+        ValueDict *values = relation.project(row, &key_columns);
+        HashBucket::Entry entry;
+        entry.key = normalized_key(values);
+        entry.hash = hash(entry.key);
+        entry.handle = row;
+        key_bytes += entry.key.size();
+        entries.push_back(entry);
+        delete values;
+    }
+    delete table_rows;
+
+    u_long bytes = key_bytes + entries.size() * (HashBucket::ENTRY_HEADER_SZ + 4 + sizeof(HashCode));
+    u_long room = DbBlock::BLOCK_SZ - 1 - 4 * (HashBucket::FIRST) - 2 * sizeof(uint32_t);
+    global_depth = 0;
+    while (global_depth < max_depth() && bytes * 100 > (room << global_depth) * BULK_FILL)
+        global_depth++;
+    vector<HashBucket::Entries> buckets(1U << global_depth);
+    for (auto const &entry: entries)
+        buckets[slot(entry.hash)].push_back(entry);
+    if (unique) {
+        for (auto const &bucket: buckets) {
+            set<KeyBytes> keys;
+            for (auto const &entry: bucket)
+                if (!keys.insert(entry.key).second)
+                    throw DbRelationError("Duplicate keys are not allowed in unique index");
+        }
+    }
+
+    BucketPointers spares;
+    directory.clear();
+    for (auto const &bucket: buckets)
+        directory.push_back(write_chain(0, bucket, global_depth, spares));
+    save_directory(set<uint>());
+}
+
+// Drop the index.
+void HashIndex::drop() {
+    file.drop();
+}
+
+// Open existing index. Enables: lookup, insert, delete.
+void HashIndex::open() {
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+}
+
+// Open the index unless it already is (mutex held). Lookups and changes open it on first use this way, so that two
+// of them at once can't both load the directory.
+void HashIndex::open_locked() {
+    if (closed) {
+        file.open();
+        load_directory();
+        closed = false;
+    }
+}
+
+// Closes the index. Disables: lookup, insert, delete.
+void HashIndex::close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!closed) {
+        file.close();
+        directory.clear();
+        pages.clear();
+        closed = true;
+    }
+}
+
+// Find all the rows whose key columns are equal to key_values, which must have every key column.
+Handles *HashIndex::lookup(ValueDict *key_values) const {
+    KeyBytes key = normalized_key(key_values);
+    Handles *handles = new Handles();
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<HashIndex *>(this)->open_locked();
+    find(hash(key), key, *handles);
+    return handles;
+}
+
+// Sort the keys by the bucket they hash to, so that each bucket's chain is read just once for all of its keys.
+std::vector<Handles *> *HashIndex::lookup_batch(const ValueDicts &keys) const {
+    std::vector<KeyBytes> normalized;
+    std::vector<HashCode> hashes;
+    std::vector<uint> order;
+    std::vector<Handles *> *found = new std::vector<Handles *>();
+    for (auto const &key: keys) {
+        order.push_back((uint) normalized.size());
+        normalized.push_back(normalized_key(key));
+        hashes.push_back(hash(normalized.back()));
+        found->push_back(new Handles());
+    }
+    HeapFile &index_file = const_cast<HeapFile &>(file);
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<HashIndex *>(this)->open_locked();
+    std::sort(order.begin(), order.end(), [this, &hashes](uint a, uint b) {
+        return directory[slot(hashes[a])] < directory[slot(hashes[b])];
+    });
+    for (size_t first = 0, last; first < order.size(); first = last) {
+        BlockID head_id = directory[slot(hashes[order[first]])];
+        last = first + 1;
+        while (last < order.size() && directory[slot(hashes[order[last]])] == head_id)
+            last++;
+        for (BlockID block_id = head_id; block_id != 0;) {
+            HashBucket bucket(index_file, block_id, false);
+            for (size_t i = first; i < last; i++)
+                bucket.find(hashes[order[i]], normalized[order[i]], *(*found)[order[i]]);
+            block_id = bucket.get_next();
+        }
+    }
+    return found;
+}
+
+void HashIndex::insert(Handle handle) {
+    ValueDict *row = relation.project(handle, &key_columns);
+    try {
+        insert(handle, row);
+    } catch (...) {
+        delete row;  // the insert broke the unique constraint
+        throw;
+    }
+    delete row;
+}
+
+void HashIndex::insert(Handle handle, const ValueDict *row) {
+    HashBucket::Entry entry;
+    entry.key = normalized_key(row);
+    entry.hash = hash(entry.key);
+    entry.handle = handle;
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+    if (unique) {
+        Handles existing;
+        find(entry.hash, entry.key, existing);
+        if (!existing.empty())
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+    }
+    add(entry);
+}
+
+void HashIndex::del(Handle handle) {
+    ValueDict *row = relation.project(handle, &key_columns);
+    KeyBytes key = normalized_key(row);
+    delete row;
+    HashCode key_hash = hash(key);
+    std::lock_guard<std::mutex> guard(mutex);
+    open_locked();
+    for (BlockID block_id = directory[slot(key_hash)]; block_id != 0;) {
+        HashBucket bucket(file, block_id, false);
+        if (bucket.del(key_hash, handle)) {
+            bucket.save();
+            return;
+        }
+        block_id = bucket.get_next();
+    }
+}
+
+// FNV-1a, then a final mix so the low bits (the ones the directory uses) depend on every byte of the key.
+HashCode HashIndex::hash(const KeyBytes &key) {
+    uint64_t h = 14695981039346656037ULL;
+    for (auto const &c: key) {
+        h ^= (unsigned char) c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (HashCode) h;
+}
+
+// Visit each bucket once (several slots can point to the same one) and walk its chain.
+double HashIndex::bucket_fill(uint &buckets, uint &overflows) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    const_cast<HashIndex *>(this)->open_locked();
+    set<BlockID> heads(directory.begin(), directory.end());
+    buckets = (uint) heads.size();
+    overflows = 0;
+    double used = 0.0;
+    for (auto const &head_id: heads) {
+        HashBucket head(const_cast<HeapFile &>(file), head_id, false);
+        used += 1.0 - (double) head.get_unused_bytes() / DbBlock::BLOCK_SZ;
+        for (BlockID block_id = head.get_next(); block_id != 0; overflows++) {
+            HashBucket overflow(const_cast<HeapFile &>(file), block_id, false);
+            block_id = overflow.get_next();
+        }
+    }
+    return used / buckets;
+}
+
+// The deepest directory whose page list still fits in the header block (next to the global depth, with the 4 bytes
+// SlottedPage::put wants to spare for growing it).
+uint HashIndex::max_depth() {
+    uint64_t max_pages = (DbBlock::BLOCK_SZ - 1 - 4 * 4 - sizeof(uint32_t)) / sizeof(BlockID);
+    uint depth = 0;
+    while ((2ULL << depth) <= PAGE_SLOTS * max_pages)
+        depth++;
+    return depth;
+}
+
+// Encode the search key, which has to be the whole key: a hash of part of it wouldn't find anything.
+KeyBytes HashIndex::normalized_key(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns) {
+        auto value = key->find(column_name);
+        if (value == key->end())
+            throw DbRelationError("hash index " + name + " needs a value for " + column_name);
+        key_value.push_back(value->second);
+    }
+    return NormalizedKey::encode(&key_value, key_profile);
+}
+
+void HashIndex::load_directory() {
+    SlottedPage *header = file.get(HEADER);
+    Dbt *dbt = header->get(GLOBAL_DEPTH);
+    global_depth = *(uint32_t *) dbt->get_data();
+    delete dbt;
+    dbt = header->get(PAGES);
+    const BlockID *page_ids = (const BlockID *) dbt->get_data();
+    pages.assign(page_ids, page_ids + dbt->get_size() / sizeof(BlockID));
+    delete dbt;
+    free_head = 0;
+    if (header->size() >= FREE) {  // (older index files don't have one)
+        dbt = header->get(FREE);
+        free_head = *(BlockID *) dbt->get_data();
+        delete dbt;
+    }
+    delete header;
+
+    directory.clear();
+    for (auto const &page_id: pages) {
+        SlottedPage *page = file.get(page_id);
+        dbt = page->get(1);
+        const BlockID *slots = (const BlockID *) dbt->get_data();
+        directory.insert(directory.end(), slots, slots + dbt->get_size() / sizeof(BlockID));
+        delete dbt;
+        delete page;
+    }
+}
+
+// Write out the directory pages holding slots that have changed (the numbers in dirty are page indexes), plus any
+// new ones the directory has grown into. The header is rewritten whenever that happens.
+void HashIndex::save_directory(const set<uint> &dirty) {
+    uint page_count = (uint) ((directory.size() + PAGE_SLOTS - 1) / PAGE_SLOTS);
+    bool grown = pages.size() < page_count;
+    for (uint i = 0; i < page_count; i++) {
+        bool is_new = i >= pages.size();
+        if (!is_new && dirty.find(i) == dirty.end())
+            continue;
+        SlottedPage *page = is_new ? file.get_new() : file.get(pages[i]);
+        uint first = i * PAGE_SLOTS;
+        uint count = min(PAGE_SLOTS, (uint) directory.size() - first);
+        Dbt dbt(&directory[first], count * sizeof(BlockID));
+        if (is_new) {
+            page->add(&dbt);
+            pages.push_back(page->get_block_id());
+        } else {
+            page->put(1, dbt);
+        }
+        file.put(page);
+        delete page;
+    }
+
+    SlottedPage *header = file.get(HEADER);
+    bool is_new = header->size() == 0;
+    if (grown || is_new) {
+        uint32_t depth = global_depth;
+        Dbt depth_dbt(&depth, sizeof(depth));
+        Dbt pages_dbt(pages.data(), (u_int32_t) (pages.size() * sizeof(BlockID)));
+        if (is_new) {
+            BlockID none = 0;
+            Dbt free_dbt(&none, sizeof(BlockID));
+            header->add(&depth_dbt);
+            header->add(&pages_dbt);
+            header->add(&free_dbt);
+        } else {
+            header->put(GLOBAL_DEPTH, depth_dbt);
+            header->put(PAGES, pages_dbt);
+        }
+        file.put(header);
+    } else {
+        Dbt *dbt = header->get(GLOBAL_DEPTH);
+        bool changed = *(uint32_t *) dbt->get_data() != global_depth;
+        delete dbt;
+        if (changed) {
+            uint32_t depth = global_depth;
+            Dbt depth_dbt(&depth, sizeof(depth));
+            header->put(GLOBAL_DEPTH, depth_dbt);
+            file.put(header);
+        }
+    }
+    delete header;
+}
+
+// Append the handles of every row with key to handles (mutex held).
+void HashIndex::find(HashCode hash, const KeyBytes &key, Handles &handles) const {
+    HeapFile &index_file = const_cast<HeapFile &>(file);
+    for (BlockID block_id = directory[slot(hash)]; block_id != 0;) {
+        HashBucket bucket(index_file, block_id, false);
+        bucket.find(hash, key, handles);
+        block_id = bucket.get_next();
+    }
+}
+
+// Put the entry in the first block of its bucket's chain with room for it. If they're all full, split the bucket
+// and try again, unless every entry in it has the same hash code as this one (at least as far as we could ever
+// split), in which case splitting wouldn't separate any of them, so add another block to the chain instead.
+void HashIndex::add(const HashBucket::Entry &entry) {
+    HashCode mask = (HashCode) ((1ULL << max_depth()) - 1);
+    while (true) {
+        BlockID head_id = directory[slot(entry.hash)];
+        BlockID block_id = head_id, last_id = 0;
+        uint depth = 0;
+        bool splittable = false;
+        while (block_id != 0) {
+            HashBucket bucket(file, block_id, false);
+            if (bucket.add(entry)) {
+                bucket.save();
+                return;
+            }
+            if (block_id == head_id)
+                depth = bucket.get_depth();
+            HashBucket::Entries entries;
+            bucket.get_entries(entries);
+            for (auto const &other: entries)
+                splittable = splittable || ((other.hash ^ entry.hash) & mask) != 0;
+            last_id = block_id;
+            block_id = bucket.get_next();
+        }
+
+        if (splittable && depth < max_depth()) {
+            split(head_id);
+            continue;
+        }
+        HashBucket *overflow = new_bucket();
+        overflow->set_depth(depth);
+        if (!overflow->add(entry)) {
+            free_blocks(BucketPointers(1, overflow->get_id()));
+            delete overflow;
+            throw DbRelationError("key too big for hash index " + name);
+        }
+        overflow->save();
+        HashBucket last(file, last_id, false);
+        last.set_next(overflow->get_id());
+        last.save();
+        delete overflow;
+        return;
+    }
+}
+
+// Split the bucket on the next bit of the hash code, doubling the directory first if the bucket already uses all
+// of its bits. The entries with that bit set move to a new bucket (mutex held).
+void HashIndex::split(BlockID bucket_id) {
+    HashBucket::Entries entries;
+    BucketPointers spares;  // the bucket's overflow blocks, for either half to reuse
+    uint depth = 0;
+    for (BlockID block_id = bucket_id; block_id != 0;) {
+        HashBucket bucket(file, block_id, false);
+        bucket.get_entries(entries);
+        if (block_id == bucket_id)
+            depth = bucket.get_depth();
+        else
+            spares.push_back(block_id);
+        block_id = bucket.get_next();
+    }
+
+    set<uint> dirty;
+    if (depth == global_depth) {
+        uint size = (uint) directory.size();
+        directory.reserve(2 * size);
+        for (uint i = 0; i < size; i++)
+            directory.push_back(directory[i]);  // the new upper half points where the lower half does
+        global_depth++;
+    }
+    HashBucket::Entries stay, move;
+    for (auto const &entry: entries)
+        ((entry.hash >> depth) & 1 ? move : stay).push_back(entry);
+    write_chain(bucket_id, stay, depth + 1, spares);
+    BlockID sibling_id = write_chain(0, move, depth + 1, spares);
+    free_blocks(spares);  // whatever overflow blocks the two halves didn't need
+    for (uint i = 0; i < directory.size(); i++) {
+        if (directory[i] == bucket_id && (i >> depth) & 1) {
+            directory[i] = sibling_id;
+            dirty.insert(i / PAGE_SLOTS);
+        }
+    }
+    save_directory(dirty);
+}
+
+// Write entries into the chain starting at head_id (or a new block if head_id is 0), replacing what was there.
+// Overflow blocks come from spares while there are any. Returns the head's block id.
+BlockID HashIndex::write_chain(BlockID head_id, const HashBucket::Entries &entries, uint depth,
+                               BucketPointers &spares) {
+    HashBucket *bucket = head_id == 0 ? new_bucket() : new HashBucket(file, head_id, false);
+    BlockID chain_id = bucket->get_id();
+    bucket->clear();
+    bucket->set_depth(depth);
+    for (auto const &entry: entries) {
+        if (bucket->add(entry))
+            continue;
+        HashBucket *overflow;
+        if (spares.empty()) {
+            overflow = new_bucket();
+        } else {
+            overflow = new HashBucket(file, spares.back(), false);
+            spares.pop_back();
+            overflow->clear();
+        }
+        overflow->set_depth(depth);
+        bucket->set_next(overflow->get_id());
+        bucket->save();
+        delete bucket;
+        bucket = overflow;
+        if (!bucket->add(entry)) {
+            delete bucket;
+            throw DbRelationError("key too big for hash index " + name);
+        }
+    }
+    bucket->set_next(0);
+    bucket->save();
+    delete bucket;
+    return chain_id;
+}
+
+// An empty block for a bucket or an overflow block: the first free one if there is one, otherwise a new one at the
+// end of the file (mutex held, freed by caller).
+HashBucket *HashIndex::new_bucket() {
+    if (free_head == 0)
+        return new HashBucket(file, 0, true);
+    HashBucket *bucket = new HashBucket(file, free_head, false);
+    free_head = bucket->get_next();
+    save_free_head();
+    bucket->set_next(0);
+    return bucket;  // (emptied when it was freed)
+}
+
+// Put blocks no chain uses anymore on the free chain (mutex held).
+void HashIndex::free_blocks(const BucketPointers &block_ids) {
+    if (block_ids.empty())
+        return;
+    for (auto const &block_id: block_ids) {
+        HashBucket bucket(file, block_id, false);
+        bucket.clear();
+        bucket.set_depth(0);
+        bucket.set_next(free_head);
+        bucket.save();
+        free_head = block_id;
+    }
+    save_free_head();
+}
+
+// Record free_head in the header block (mutex held).
+void HashIndex::save_free_head() {
+    SlottedPage *header = file.get(HEADER);
+    BlockID head = free_head;
+    Dbt dbt(&head, sizeof(BlockID));
+    if (header->size() < FREE)
+        header->add(&dbt);
+    else
+        header->put(FREE, dbt);
+    file.put(header);
+    delete header;
+}
+
+// For getting at the index file's size and splitting a bucket on demand.
+class HashFileSize : public HashIndex {
+public:
+    HashFileSize(DbRelation &relation, Identifier name, ColumnNames key_columns)
+            : HashIndex(relation, name, key_columns, false) {}
+
+    uint32_t get_block_count() { return file.get_last_block_id(); }
+
+    void split_first() {
+        std::lock_guard<std::mutex> guard(mutex);
+        split(directory[0]);
+    }
+};
+
+// A long overflow chain that loses most of its rows and is then split gives back the blocks it doesn't need
+// anymore, and the chain growing again takes them instead of growing the file.
+static bool test_hash_free_blocks() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_hash_free", column_names, column_attributes);
+    table.create();
+    ColumnNames key_columns;
+    key_columns.push_back("b");
+    HashFileSize index(table, "hashfree", key_columns);
+    index.create();
+    const int n = 3000;
+    Handles rows;
+    ValueDict row;
+    row["b"] = Value(0);
+    for (int i = 0; i < n; i++) {
+        row["a"] = Value(i);
+        rows.push_back(table.insert(&row));
+        index.insert(rows.back(), &row);
+    }
+    uint32_t full = index.get_block_count();
+    for (int i = 5; i < n; i++)
+        index.del(rows[i]);
+    index.split_first();
+    for (int i = 5; i < n; i++)
+        index.insert(rows[i], &row);  // (a isn't in the key)
+    if (index.get_block_count() > full + 1)  // just the split's new bucket
+        return assertion_failure("hash split lost its spare blocks", full, index.get_block_count());
+    index.close();
+    HashIndex reopened(table, "hashfree", key_columns, false);
+    ValueDict lookup;
+    lookup["b"] = Value(0);
+    Handles *handles = reopened.lookup(&lookup);
+    bool ok = handles->size() == (u_long) n;
+    delete handles;
+    if (!ok)
+        return assertion_failure("hash lookup after reusing blocks");
+    reopened.drop();
+    table.drop();
+    return true;
+}
+
+// Lookups of every key, before and after splits, a reopen, and deletes. Duplicate keys make overflow chains.
+bool test_hash_index() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("s");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_hash", column_names, column_attributes);
+    table.create();
+    const int n = 10 * 1000, statuses = 3;
+    Handles rows;
+    for (int i = 0; i < 2 * n; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(i % statuses);
+        row["s"] = Value("row " + to_string(i));
+        rows.push_back(table.insert(&row));
+        if (i == n - 1) {
+            ColumnNames key_columns;
+            key_columns.push_back("a");
+            HashIndex index(table, "hashindex", key_columns, true);
+            index.create();  // bulk load the first half
+            index.close();
+        }
+    }
+
+    ColumnNames key_columns;
+    key_columns.push_back("a");
+    HashIndex index(table, "hashindex", key_columns, true);
+    index.open();
+    uint start_depth = index.get_global_depth();
+    for (int i = n; i < 2 * n; i++)
+        index.insert(rows[i]);  // these have to split buckets
+    if (index.get_global_depth() <= start_depth)
+        return assertion_failure("hash directory didn't grow", start_depth, index.get_global_depth());
+    uint buckets, overflows;
+    double fill = index.bucket_fill(buckets, overflows);
+    if (overflows != 0 || fill < 0.4)
+        return assertion_failure("hash bucket fill", fill * 100, overflows);
+    index.close();
+
+    HashIndex reopened(table, "hashindex", key_columns, true);
+    ValueDict lookup;
+    for (int i = -1; i <= 2 * n; i++) {
+        lookup["a"] = Value(i);
+        Handles *handles = reopened.lookup(&lookup);
+        bool ok = (i < 0 || i == 2 * n) ? handles->empty() : handles->size() == 1 && handles->front() == rows[i];
+        delete handles;
+        if (!ok)
+            return assertion_failure("hash lookup", i);
+    }
+    ValueDict row;
+    row["a"] = Value(7);
+    row["b"] = Value(0);
+    row["s"] = Value("again");
+    Handle duplicate = table.insert(&row);
+    try {
+        reopened.insert(duplicate);
+        return assertion_failure("hash unique insert");
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    table.del(duplicate);
+    for (int i = 0; i < 2 * n; i += 2)
+        reopened.del(rows[i]);
+    for (int i = 0; i < 2 * n; i++) {
+        lookup["a"] = Value(i);
+        Handles *handles = reopened.lookup(&lookup);
+        bool ok = handles->size() == (u_long) (i % 2);
+        delete handles;
+        if (!ok)
+            return assertion_failure("hash delete", i);
+    }
+    reopened.drop();
+
+    // a few keys with lots of rows each, over a composite key with TEXT in it
+    key_columns.clear();
+    key_columns.push_back("b");
+    key_columns.push_back("s");
+    for (int i = 0; i < 2 * n; i++) {
+        ValueDict same;
+        same["a"] = Value(i);
+        same["b"] = Value(i % statuses);
+        same["s"] = Value("same");
+        rows.push_back(table.insert(&same));
+    }
+    HashIndex multi(table, "multiindex", key_columns, false);
+    multi.create();
+    multi.bucket_fill(buckets, overflows);
+    if (overflows == 0)
+        return assertion_failure("hash overflow chains");
+    lookup.clear();
+    lookup["s"] = Value("same");
+    for (int status = 0; status < statuses; status++) {
+        lookup["b"] = Value(status);
+        Handles *handles = multi.lookup(&lookup);
+        bool ok = handles->size() == (u_long) (2 * n + statuses - 1 - status) / statuses;
+        delete handles;
+        if (!ok)
+            return assertion_failure("hash duplicate lookup", status);
+    }
+    lookup["b"] = Value(1);
+    Handles *handles = multi.lookup(&lookup);
+    for (u_long i = 0; i + 5 < handles->size(); i++)
+        multi.del((*handles)[i]);
+    delete handles;
+    handles = multi.lookup(&lookup);
+    bool ok = handles->size() == 5;
+    delete handles;
+    if (!ok)
+        return assertion_failure("hash duplicate delete");
+    lookup["s"] = Value("row 4");
+    handles = multi.lookup(&lookup);
+    ok = handles->size() == 1 && handles->front() == rows[4];
+    delete handles;
+    if (!ok)
+        return assertion_failure("hash composite lookup");
+    lookup.erase("s");
+    try {
+        delete multi.lookup(&lookup);
+        return assertion_failure("hash lookup without the whole key");
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    multi.drop();
+    table.drop();
+    return test_hash_free_blocks();
+}
+
+// Random inserts and lookups, against the same in a B-tree.
+void benchmark_hash_index() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    ColumnNames key_columns;
+    key_columns.push_back("a");
+    const int n = 50 * 1000;
+    std::vector<int> keys;
+    for (int i = 0; i < n; i++)
+        keys.push_back(i);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(5300));
+
+    for (int hashed = 0; hashed < 2; hashed++) {
+        HeapTable table("__benchmark_hash", column_names, column_attributes);
+        table.create();
+        DbIndex *index;
+        if (hashed)
+            index = new HashIndex(table, "benchindex", key_columns, true);
+        else
+            index = new BTreeIndex(table, "benchindex", key_columns, true);
+        index->create();
+        Handles rows;
+        for (int i = 0; i < n; i++) {
+            ValueDict row;
+            row["a"] = Value(keys[i]);
+            row["b"] = Value(i);
+            rows.push_back(table.insert(&row));
+        }
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < n; i++)
+            index->insert(rows[i]);
+        auto middle = chrono::steady_clock::now();
+        ValueDict lookup;
+        for (int i = 0; i < n; i++) {
+            lookup["a"] = Value(i);
+            delete index->lookup(&lookup);
+        }
+        auto end = chrono::steady_clock::now();
+        double insert_time = chrono::duration<double>(middle - start).count();
+        double lookup_time = chrono::duration<double>(end - middle).count();
+        std::cout << (hashed ? "hash index" : "btree index") << " with random keys: " << (long) (n / insert_time)
+                  << " inserts/sec, " << (long) (n / lookup_time) << " lookups/sec" << std::endl;
+        index->drop();
+        delete index;
+        table.drop();
+    }
+}
@@ -0,0 +1,199 @@
+/**
+ * @file hash_index.h - HashIndex class and the HashBucket blocks it keeps its entries in
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <mutex>
+#include <set>
+#include "heap_storage.h"
+#include "NormalizedKey.h"
+
+typedef uint32_t HashCode;
+typedef std::vector<BlockID> BucketPointers;
+
+/**
+ * @class HashBucket - one block of a hash bucket: the bucket's head block or one of its overflow blocks
+ *
+ * Block layout:
+ *      record 1:   local depth: every key in the bucket has the same low this-many bits of hash code
+ *      record 2:   next overflow block in the chain (0 at the end)
+ *      record 3:   hash code of every entry, in order, as a contiguous array
+ *      record i+4: entry i: handle (block id, record id), normalized key
+ * There is an entry for each row, so a key with several rows has several entries. Entries are in no order. A search
+ * runs down the hash code array and only looks at the entries whose code matches.
+ */
+class HashBucket {
+public:
+    static const RecordID DEPTH = 1;  // where we store the local depth
+    static const RecordID NEXT = DEPTH + 1;  // where we store the next block in the overflow chain
+    static const RecordID HASHES = NEXT + 1;  // where we store the entries' hash codes
+    static const RecordID FIRST = HASHES + 1;  // where we store the first entry
+    static const uint ENTRY_HEADER_SZ = sizeof(BlockID) + sizeof(RecordID);  // bytes in front of each entry's key
+
+    struct Entry {
+        HashCode hash;
+        Handle handle;
+        KeyBytes key;
+    };
+    typedef std::vector<Entry> Entries;
+
+    HashBucket(HeapFile &file, BlockID block_id, bool create);
+
+    virtual ~HashBucket();
+
+    BlockID get_id() const { return this->id; }
+
+    uint get_depth() const { return this->depth; }
+
+    void set_depth(uint depth) { this->depth = depth; }
+
+    BlockID get_next() const { return this->next; }
+
+    void set_next(BlockID next) { this->next = next; }
+
+    uint get_unused_bytes() const { return this->block->unused_bytes(); }
+
+    /**
+     * Append the handle of every entry for key in this block to handles.
+     */
+    void find(HashCode hash, const KeyBytes &key, Handles &handles) const;
+
+    /**
+     * Append every entry in this block to entries.
+     */
+    void get_entries(Entries &entries) const;
+
+    /**
+     * Add an entry (the caller still has to save).
+     * @returns  false, without adding it, if the block is full
+     */
+    bool add(const Entry &entry);
+
+    /**
+     * Remove the entry for handle (the caller still has to save).
+     * @returns  false if it isn't in this block
+     */
+    bool del(HashCode hash, Handle handle);
+
+    /**
+     * Remove every entry (the caller still has to save).
+     */
+    void clear();
+
+    void save();
+
+protected:
+    HeapFile &file;
+    SlottedPage *block;
+    BlockID id;
+    uint depth;
+    BlockID next;
+    uint count;  // number of entries
+
+    Handle get_handle(RecordID record_id) const;
+
+    void put_hashes(const std::string &hashes);
+};
+
+/**
+ * @class HashIndex - an extendible hash index: O(1) lookups by the whole key, no ranges
+ *
+ * The directory has 2^global_depth slots, each pointing to a bucket, and the low global_depth bits of a key's hash
+ * code pick the slot. A bucket with local depth d is pointed to by every slot that agrees with it in the low d bits.
+ * When a bucket fills up it splits in two on bit d (doubling the directory first if d is already the global depth),
+ * so only that one bucket's entries are moved. Entries that all have the same hash code, like the rows of a common
+ * key, can't be split apart, so those go into a chain of overflow blocks instead. Buckets never merge.
+ *
+ * Block 1 of the index file holds the global depth and a list of the blocks holding the directory, which is kept in
+ * memory while the index is open, and the head of a chain of the overflow blocks splits have emptied, to be used
+ * again before the file grows. Each operation runs under mutex, so the index can be used from several threads.
+ */
+class HashIndex : public DbIndex {
+public:
+    HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~HashIndex() {}
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key_values) const;
+
+    virtual std::vector<Handles *> *lookup_batch(const ValueDicts &keys) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    virtual void del(Handle handle);
+
+    /**
+     * The hash code of a normalized key. Kept in the index file, so it mustn't change from one build to the next.
+     */
+    static HashCode hash(const KeyBytes &key);
+
+    /**
+     * How full the buckets are.
+     * @param buckets    set to the number of distinct buckets
+     * @param overflows  set to the number of overflow blocks in their chains
+     * @returns          average fraction of a bucket's head block that is in use
+     */
+    double bucket_fill(uint &buckets, uint &overflows) const;
+
+    uint get_global_depth() const { return this->global_depth; }
+
+protected:
+    static const BlockID HEADER = 1;
+    static const RecordID GLOBAL_DEPTH = 1;  // where we store the global depth in the header block
+    static const RecordID PAGES = GLOBAL_DEPTH + 1;  // where we store the directory's block ids in the header block
+    static const RecordID FREE = PAGES + 1;  // where we store the first free block in the header block
+    // directory slots per block (leaving the 4 bytes SlottedPage::put wants to spare when the last page grows)
+    static const uint PAGE_SLOTS = (DbBlock::BLOCK_SZ - 1 - 4 * 3) / sizeof(BlockID);
+    static const uint BULK_FILL = 70;  // percent of a bucket create fills, leaving room for inserts
+    bool closed;
+    HeapFile file;
+    KeyProfile key_profile;
+    uint global_depth;
+    BucketPointers directory;  // bucket for each slot
+    BucketPointers pages;  // blocks the directory is saved in, PAGE_SLOTS slots each
+    BlockID free_head;  // first of the free blocks, chained through their next links (0 if none)
+    mutable std::mutex mutex;  // held for the whole of each operation
+
+    static uint max_depth();
+
+    void open_locked();
+
+    uint slot(HashCode hash) const { return hash & ((1U << this->global_depth) - 1); }
+
+    KeyBytes normalized_key(const ValueDict *key) const;
+
+    void load_directory();
+
+    void save_directory(const std::set<uint> &dirty);
+
+    void find(HashCode hash, const KeyBytes &key, Handles &handles) const;
+
+    void add(const HashBucket::Entry &entry);
+
+    void split(BlockID bucket_id);
+
+    HashBucket *new_bucket();
+
+    void free_blocks(const BucketPointers &block_ids);
+
+    void save_free_head();
+
+    BlockID write_chain(BlockID head_id, const HashBucket::Entries &entries, uint depth, BucketPointers &spares);
+};
+
+bool test_hash_index();
+
+void benchmark_hash_index();
@@ -0,0 +1,871 @@
+/**
+ * @file joins.cpp - implementation of the join iterators
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include "joins.h"
+#include "btree.h"
+#include "hash_index.h"
+
+using namespace std;
+
+bool join_key(const ValueDict &row, const ColumnNames &key_columns, string &key) {
+    key.clear();
+    for (auto const &column_name: key_columns) {
+        ValueDict::const_iterator column = row.find(column_name);
+        if (column == row.end())
+            return false;
+        key.push_back((char) column->second.data_type);
+        if (column->second.data_type == ColumnAttribute::TEXT) {
+            uint32_t size = (uint32_t) column->second.s.size();
+            key.append((const char *) &size, sizeof(size));
+            key.append(column->second.s);
+        } else {
+            key.append((const char *) &column->second.n, sizeof(int32_t));
+        }
+    }
+    return true;
+}
+
+bool order_key(const ValueDict &row, const ColumnNames &key_columns, KeyBytes &key) {
+    key.clear();
+    KeyValue value(1);
+    KeyProfile profile(1);
+    for (auto const &column_name: key_columns) {
+        ValueDict::const_iterator column = row.find(column_name);
+        if (column == row.end())
+            return false;
+        value[0] = column->second;
+        profile[0] = column->second.data_type;
+        key.push_back((char) column->second.data_type);  // every encoding ends where it should, so this can follow
+        key.append(NormalizedKey::encode(&value, profile));
+    }
+    return true;
+}
+
+ValueDict *join_rows(const ValueDict &left, const ValueDict *right, const JoinSpec &join) {
+    ValueDict *row = new ValueDict();
+    for (auto const &column: left) {
+        auto renamed = join.left_renames.find(column.first);
+        (*row)[renamed == join.left_renames.end() ? column.first : renamed->second] = column.second;
+    }
+    if (right != nullptr) {
+        for (auto const &column: *right) {
+            auto renamed = join.right_renames.find(column.first);
+            (*row)[renamed == join.right_renames.end() ? column.first : renamed->second] = column.second;
+        }
+    }
+    return row;
+}
+
+bool satisfies(const ValueDict &row, const ValueDict *where) {
+    if (where == nullptr)
+        return true;
+    for (auto const &column: *where) {
+        ValueDict::const_iterator value = row.find(column.first);
+        if (value == row.end() || value->second != column.second)
+            return false;
+    }
+    return true;
+}
+
+// The map's node for each column (with its name and value) and any text.
+size_t row_bytes(const ValueDict &row) {
+    size_t bytes = sizeof(ValueDict);
+    for (auto const &column: row)
+        bytes += 48 + sizeof(ValueDict::value_type) + column.first.size() + column.second.s.size();
+    return bytes;
+}
+
+HashJoinIterator::HashJoinIterator(EvalIterator *left, EvalIterator *right, const JoinSpec &join,
+                                   const ValueDict *where, size_t memory_budget)
+        : left(left), right(right), join(join), where(where), memory_budget(memory_budget), table(), table_bytes(0),
+          partitions(), probing_left(false), probe_file(nullptr), probe_row(nullptr), matches(nullptr), match_at(0),
+          partition_count(0), done(true) {
+}
+
+HashJoinIterator::~HashJoinIterator() {
+    close();
+    delete this->left;
+    delete this->right;
+}
+
+// Build the hash table from the right side, and if it doesn't fit, partition both sides to disk instead.
+void HashJoinIterator::open() {
+    close();
+    this->partition_count = 0;
+    this->done = false;
+    vector<SpillFile *> build_files;  // once the table doesn't fit
+    string key;
+    this->right->open();
+    for (ValueDict *row = this->right->next(); row != nullptr; row = this->right->next()) {
+        if (!join_key(*row, this->join.right_keys, key)) {
+            delete row;  // matches nothing
+        } else if (build_files.empty()) {
+            add_build_row(key, row);
+            if (this->table_bytes > this->memory_budget) {
+                build_files = new_partition_files();
+                spill_table(build_files, 0);
+            }
+        } else {
+            build_files[partition_of(key, 0)]->append(*row);
+            delete row;
+        }
+    }
+    this->right->close();
+
+    this->left->open();
+    if (build_files.empty()) {
+        this->probing_left = true;
+        return;
+    }
+    vector<SpillFile *> probe_files = new_partition_files();
+    for (ValueDict *row = this->left->next(); row != nullptr; row = this->left->next()) {
+        probe_files[join_key(*row, this->join.left_keys, key) ? partition_of(key, 0) : 0]->append(*row);
+        delete row;
+    }
+    this->left->close();
+    for (uint i = FANOUT; i-- > 0;)
+        this->partitions.push_back(Partition{build_files[i], probe_files[i], 0});
+}
+
+ValueDict *HashJoinIterator::next() {
+    while (true) {
+        ValueDict *row = next_joined();
+        if (row == nullptr || satisfies(*row, this->where))
+            return row;
+        delete row;
+    }
+}
+
+void HashJoinIterator::close() {
+    this->left->close();
+    this->right->close();
+    clear_table();
+    for (auto const &partition: this->partitions) {
+        delete partition.build;
+        delete partition.probe;
+    }
+    this->partitions.clear();
+    delete this->probe_file;
+    this->probe_file = nullptr;
+    delete this->probe_row;
+    this->probe_row = nullptr;
+    this->matches = nullptr;
+    this->probing_left = false;
+    this->done = true;
+}
+
+// Each match of the current probe row in turn, then (for a left outer join, if there were none) the probe row on its
+// own, and then on to the next probe row, and the next partition.
+ValueDict *HashJoinIterator::next_joined() {
+    string key;
+    while (!this->done) {
+        if (this->probe_row != nullptr) {
+            if (this->matches != nullptr && this->match_at < this->matches->size())
+                return join_rows(*this->probe_row, (*this->matches)[this->match_at++], this->join);
+            ValueDict *unmatched = nullptr;
+            if (this->matches == nullptr && this->join.left_outer)
+                unmatched = join_rows(*this->probe_row, nullptr, this->join);
+            delete this->probe_row;
+            this->probe_row = nullptr;
+            if (unmatched != nullptr)
+                return unmatched;
+        }
+        if (this->probing_left)
+            this->probe_row = this->left->next();
+        else if (this->probe_file != nullptr)
+            this->probe_row = this->probe_file->next();
+        if (this->probe_row == nullptr) {
+            if (this->probing_left || !next_partition())
+                this->done = true;
+            continue;
+        }
+        auto found = join_key(*this->probe_row, this->join.left_keys, key) ? this->table.find(key) : this->table.end();
+        this->matches = found == this->table.end() ? nullptr : &found->second;
+        this->match_at = 0;
+    }
+    return nullptr;
+}
+
+// Load the next pair of partitions' build rows into the table (splitting them further if there are too many).
+bool HashJoinIterator::next_partition() {
+    clear_table();
+    delete this->probe_file;
+    this->probe_file = nullptr;
+    string key;
+    while (!this->partitions.empty()) {
+        Partition partition = this->partitions.back();
+        this->partitions.pop_back();
+        if (partition.probe->size() == 0 || (partition.build->size() == 0 && !this->join.left_outer)) {
+            delete partition.build;  // nothing would come of it
+            delete partition.probe;
+            continue;
+        }
+        bool too_big = false;
+        while (!too_big) {
+            ValueDict *row = partition.build->next();
+            if (row == nullptr)
+                break;
+            join_key(*row, this->join.right_keys, key);
+            add_build_row(key, row);
+            too_big = this->table_bytes > this->memory_budget && this->table.size() > 1 &&
+                      partition.depth + 1 < MAX_DEPTH;
+        }
+        if (!too_big) {
+            delete partition.build;
+            this->probe_file = partition.probe;
+            this->partition_count++;
+            return true;
+        }
+
+        uint depth = partition.depth + 1;
+        vector<SpillFile *> build_files = new_partition_files(), probe_files = new_partition_files();
+        spill_table(build_files, depth);
+        for (ValueDict *row = partition.build->next(); row != nullptr; row = partition.build->next()) {
+            join_key(*row, this->join.right_keys, key);
+            build_files[partition_of(key, depth)]->append(*row);
+            delete row;
+        }
+        for (ValueDict *row = partition.probe->next(); row != nullptr; row = partition.probe->next()) {
+            probe_files[join_key(*row, this->join.left_keys, key) ? partition_of(key, depth) : 0]->append(*row);
+            delete row;
+        }
+        delete partition.build;
+        delete partition.probe;
+        for (uint i = FANOUT; i-- > 0;)
+            this->partitions.push_back(Partition{build_files[i], probe_files[i], depth});
+    }
+    return false;
+}
+
+void HashJoinIterator::add_build_row(const string &key, ValueDict *row) {
+    this->table_bytes += row_bytes(*row) + (this->table.find(key) == this->table.end() ? 64 + key.size() : 0);
+    this->table[key].push_back(row);
+}
+
+void HashJoinIterator::clear_table() {
+    for (auto const &entry: this->table)
+        for (auto row: entry.second)
+            delete row;
+    this->table.clear();
+    this->table_bytes = 0;
+}
+
+// Move the rows in the table out to the partitions they belong in at depth.
+void HashJoinIterator::spill_table(vector<SpillFile *> &files, uint depth) {
+    for (auto const &entry: this->table) {
+        SpillFile *file = files[partition_of(entry.first, depth)];
+        for (auto row: entry.second)
+            file->append(*row);
+    }
+    clear_table();
+}
+
+vector<SpillFile *> HashJoinIterator::new_partition_files() {
+    vector<SpillFile *> files;
+    for (uint i = 0; i < FANOUT; i++)
+        files.push_back(new SpillFile());
+    return files;
+}
+
+// Which partition a key goes in at each depth; each depth mixes the hash differently, so that the keys of one
+// partition spread out again over the partitions it's split into.
+uint HashJoinIterator::partition_of(const string &key, uint depth) {
+    uint64_t h = hash<string>()(key) + (depth + 1) * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return (uint) ((h ^ (h >> 31)) % FANOUT);
+}
+
+IndexNestedLoopJoinIterator::IndexNestedLoopJoinIterator(EvalIterator *left, DbRelation &table, const DbIndex &index,
+                                                         const ValueDict *table_where, const JoinSpec &join,
+                                                         const ValueDict *where)
+        : left(left), table(table), index(index), table_where(table_where), join(join), where(where), probe_columns(),
+          key_types(), batch(), batch_matches(), found(), at(0), match_at(0), probe_count(0), left_done(true),
+          done(true) {
+    for (auto const &column_name: index.get_key_columns()) {
+        auto right_key = find(join.right_keys.begin(), join.right_keys.end(), column_name);
+        if (right_key == join.right_keys.end()) {
+            delete left;
+            throw DbRelationError("index key " + column_name + " isn't one of the join's keys");
+        }
+        this->probe_columns.push_back(join.left_keys[right_key - join.right_keys.begin()]);
+    }
+    ColumnAttributes *key_attributes = table.get_column_attributes(index.get_key_columns());
+    for (auto attribute: *key_attributes)
+        this->key_types.push_back(attribute.get_data_type());
+    delete key_attributes;
+}
+
+IndexNestedLoopJoinIterator::~IndexNestedLoopJoinIterator() {
+    close();
+    delete this->left;
+}
+
+void IndexNestedLoopJoinIterator::open() {
+    close();
+    this->probe_count = 0;
+    this->left_done = false;
+    this->done = false;
+    this->left->open();
+}
+
+ValueDict *IndexNestedLoopJoinIterator::next() {
+    while (true) {
+        ValueDict *row = next_joined();
+        if (row == nullptr || satisfies(*row, this->where))
+            return row;
+        delete row;
+    }
+}
+
+void IndexNestedLoopJoinIterator::close() {
+    this->left->close();
+    clear_batch();
+    this->done = true;
+}
+
+// Each match of the current left row in turn, then (for a left outer join, if there were none) the left row on its
+// own, and then on to the next left row, and the next batch.
+ValueDict *IndexNestedLoopJoinIterator::next_joined() {
+    while (!this->done) {
+        if (this->at == this->batch.size()) {
+            if (!next_batch())
+                this->done = true;
+            continue;
+        }
+        const ValueDicts *matches = this->batch_matches[this->at];
+        if (matches != nullptr && this->match_at < matches->size())
+            return join_rows(*this->batch[this->at], (*matches)[this->match_at++], this->join);
+        const ValueDict *unmatched = matches == nullptr && this->join.left_outer ? this->batch[this->at] : nullptr;
+        this->at++;
+        this->match_at = 0;
+        if (unmatched != nullptr)
+            return join_rows(*unmatched, nullptr, this->join);
+    }
+    return nullptr;
+}
+
+// Read the next batch of left rows and look up their distinct keys all at once.
+bool IndexNestedLoopJoinIterator::next_batch() {
+    clear_batch();
+    while (!this->left_done && this->batch.size() < BATCH) {
+        ValueDict *row = this->left->next();
+        if (row == nullptr)
+            this->left_done = true;
+        else
+            this->batch.push_back(row);
+    }
+    if (this->batch.empty())
+        return false;
+
+    vector<string> keys(this->batch.size());
+    vector<bool> keyed(this->batch.size(), false);  // a NULL or a value of the wrong type matches nothing
+    vector<string> probe_keys;
+    ValueDicts probes;
+    for (size_t i = 0; i < this->batch.size(); i++) {
+        const ValueDict &row = *this->batch[i];
+        if (!join_key(row, this->join.left_keys, keys[i]))
+            continue;
+        keyed[i] = true;
+        for (uint j = 0; j < this->probe_columns.size() && keyed[i]; j++)
+            keyed[i] = row.at(this->probe_columns[j]).data_type == this->key_types[j];
+        if (!keyed[i] || this->found.find(keys[i]) != this->found.end())
+            continue;
+        this->found[keys[i]];
+        ValueDict *probe = new ValueDict();
+        for (uint j = 0; j < this->probe_columns.size(); j++)
+            (*probe)[this->index.get_key_columns()[j]] = row.at(this->probe_columns[j]);
+        probes.push_back(probe);
+        probe_keys.push_back(keys[i]);
+    }
+
+    vector<Handles *> *handles = this->index.lookup_batch(probes);
+    this->probe_count += probes.size();
+    string key;
+    for (size_t i = 0; i < probes.size(); i++) {
+        ValueDicts &matches = this->found[probe_keys[i]];
+        for (auto const &handle: *(*handles)[i]) {
+            ValueDict *row = this->table.project(handle);
+            if (satisfies(*row, this->table_where) && join_key(*row, this->join.right_keys, key) &&
+                key == probe_keys[i])
+                matches.push_back(row);
+            else
+                delete row;  // the index only has some of the keys, or the select rules it out
+        }
+        delete (*handles)[i];
+        delete probes[i];
+    }
+    delete handles;
+    for (size_t i = 0; i < this->batch.size(); i++) {
+        const ValueDicts *matches = keyed[i] ? &this->found[keys[i]] : nullptr;
+        this->batch_matches.push_back(matches == nullptr || matches->empty() ? nullptr : matches);
+    }
+    return true;
+}
+
+void IndexNestedLoopJoinIterator::clear_batch() {
+    for (auto row: this->batch)
+        delete row;
+    this->batch.clear();
+    this->batch_matches.clear();
+    for (auto const &entry: this->found)
+        for (auto row: entry.second)
+            delete row;
+    this->found.clear();
+    this->at = 0;
+    this->match_at = 0;
+}
+
+MergeJoinIterator::MergeJoinIterator(EvalIterator *left, EvalIterator *right, const JoinSpec &join,
+                                     const ValueDict *where)
+        : left(left), right(right), join(join), where(where), left_row(nullptr), left_key(), left_keyed(false),
+          matches(nullptr), match_at(0), group(), group_key(), grouped(false), right_row(nullptr), right_key(),
+          right_keyed(false), right_done(true), done(true) {
+}
+
+MergeJoinIterator::~MergeJoinIterator() {
+    close();
+    delete this->left;
+    delete this->right;
+}
+
+void MergeJoinIterator::open() {
+    close();
+    this->left_keyed = false;
+    this->right_keyed = false;
+    this->right_done = false;
+    this->done = false;
+    this->left->open();
+    this->right->open();
+    this->right_row = next_right();
+}
+
+ValueDict *MergeJoinIterator::next() {
+    while (true) {
+        ValueDict *row = next_joined();
+        if (row == nullptr || satisfies(*row, this->where))
+            return row;
+        delete row;
+    }
+}
+
+void MergeJoinIterator::close() {
+    this->left->close();
+    this->right->close();
+    delete this->left_row;
+    this->left_row = nullptr;
+    delete this->right_row;
+    this->right_row = nullptr;
+    clear_group();
+    this->matches = nullptr;
+    this->right_done = true;
+    this->done = true;
+}
+
+// Each match of the current left row in turn, then (for a left outer join, if there were none) the left row on its
+// own, and then on to the next left row, moving the right side up to the group with its key.
+ValueDict *MergeJoinIterator::next_joined() {
+    KeyBytes key;
+    while (!this->done) {
+        if (this->left_row != nullptr) {
+            if (this->matches != nullptr && this->match_at < this->matches->size())
+                return join_rows(*this->left_row, (*this->matches)[this->match_at++], this->join);
+            ValueDict *unmatched = nullptr;
+            if (this->matches == nullptr && this->join.left_outer)
+                unmatched = join_rows(*this->left_row, nullptr, this->join);
+            delete this->left_row;
+            this->left_row = nullptr;
+            if (unmatched != nullptr)
+                return unmatched;
+        }
+        this->left_row = this->left->next();
+        if (this->left_row == nullptr) {
+            this->done = true;
+            continue;
+        }
+        this->matches = nullptr;
+        this->match_at = 0;
+        if (!order_key(*this->left_row, this->join.left_keys, key))
+            continue;
+        if (this->left_keyed && NormalizedKey::compare(key, this->left_key) < 0)
+            throw DbRelationError("the left side of a merge join isn't in order");
+        this->left_key = key;
+        this->left_keyed = true;
+        while ((!this->grouped || NormalizedKey::compare(this->group_key, key) < 0) && this->right_row != nullptr)
+            next_group();
+        if (this->grouped && this->group_key == key)
+            this->matches = &this->group;
+    }
+    return nullptr;
+}
+
+// The next right row with a key, its key in right_key (null at the end).
+ValueDict *MergeJoinIterator::next_right() {
+    KeyBytes key;
+    while (!this->right_done) {
+        ValueDict *row = this->right->next();
+        if (row == nullptr) {
+            this->right_done = true;
+        } else if (!order_key(*row, this->join.right_keys, key)) {
+            delete row;  // matches nothing
+        } else {
+            if (this->right_keyed && NormalizedKey::compare(key, this->right_key) < 0) {
+                delete row;
+                throw DbRelationError("the right side of a merge join isn't in order");
+            }
+            this->right_key = key;
+            this->right_keyed = true;
+            return row;
+        }
+    }
+    return nullptr;
+}
+
+// Read the right rows with the next key into the group.
+void MergeJoinIterator::next_group() {
+    clear_group();
+    this->group_key = this->right_key;
+    this->group.push_back(this->right_row);
+    this->right_row = nullptr;  // the group has it now
+    this->grouped = true;
+    ValueDict *row = next_right();
+    while (row != nullptr && this->right_key == this->group_key) {
+        this->group.push_back(row);
+        row = next_right();
+    }
+    this->right_row = row;
+}
+
+void MergeJoinIterator::clear_group() {
+    for (auto row: this->group)
+        delete row;
+    this->group.clear();
+    this->grouped = false;
+}
+
+static string test_row_string(const ValueDict &row) {
+    string s;
+    for (auto const &column: row)
+        s += column.first + "=" + (column.second.data_type == ColumnAttribute::TEXT ? column.second.s
+                                                                                   : to_string(column.second.n)) + ";";
+    return s;
+}
+
+// Evaluate plan with memory_budget and check its rows are expected (in any order), and whether it spilled.
+static bool test_join(EvalPlan &plan, size_t memory_budget, vector<string> expected, bool spills,
+                      const string &name) {
+    size_t saved = EvalPlan::get_join_memory();
+    EvalPlan::set_join_memory(memory_budget);
+    EvalIterator *rows = plan.row_iterator();
+    HashJoinIterator *hash_join = dynamic_cast<HashJoinIterator *>(rows);
+    EvalPlan::set_join_memory(saved);
+    vector<string> got;
+    rows->open();
+    for (ValueDict *row = rows->next(); row != nullptr; row = rows->next()) {
+        got.push_back(test_row_string(*row));
+        delete row;
+    }
+    bool spilled = hash_join != nullptr && hash_join->get_partition_count() > 0;
+    rows->close();
+    delete rows;
+    sort(got.begin(), got.end());
+    sort(expected.begin(), expected.end());
+    if (got.size() != expected.size())
+        return assertion_failure("join " + name + " rows", (double) got.size(), (double) expected.size());
+    if (got != expected)
+        return assertion_failure("join " + name + " values");
+    if (spilled != spills)
+        return assertion_failure("join " + name + " spilled", spilled, spills);
+    return true;
+}
+
+// An index's lookup_batch finds the same rows as a lookup of each key, for keys in any order, repeated or not there.
+static bool test_lookup_batch(const DbIndex &index, int rows, const string &name) {
+    ValueDicts keys;
+    for (int i = 0; i < rows; i++) {
+        ValueDict *key = new ValueDict();
+        (*key)["id"] = Value((i * 7919) % 1000);  // 700..999 aren't in the index
+        keys.push_back(key);
+    }
+    vector<Handles *> *found = index.lookup_batch(keys);
+    bool ok = found->size() == keys.size();
+    for (size_t i = 0; i < found->size() && ok; i++) {
+        Handles *expected = index.lookup(keys[i]);
+        Handles got = *(*found)[i];
+        sort(got.begin(), got.end());
+        sort(expected->begin(), expected->end());
+        ok = got == *expected;
+        delete expected;
+    }
+    for (auto handles: *found)
+        delete handles;
+    delete found;
+    for (auto key: keys)
+        delete key;
+    if (!ok)
+        return assertion_failure("lookup_batch" + name);
+    return true;
+}
+
+// Inner and left outer hash joins, in memory and spilled to partitions (and partitions of partitions), index
+// nested-loop joins, and merge joins, checked against a nested-loop join of the same rows.
+bool test_joins() {
+    if (!test_spill_file())
+        return false;
+    ColumnNames left_names, right_names;
+    ColumnAttributes left_attributes, right_attributes;
+    left_names.push_back("id");
+    left_names.push_back("name");
+    left_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    left_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    right_names.push_back("id");
+    right_names.push_back("v");
+    right_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    right_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable left("__test_join_left", left_names, left_attributes);
+    HeapTable right("__test_join_right", right_names, right_attributes);
+    left.create();
+    right.create();
+    const int n = 1000;
+    vector<ValueDict> left_rows, right_rows;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["id"] = Value(i);
+        row["name"] = Value("name " + to_string(i));
+        left.insert(&row);
+        left_rows.push_back(row);
+    }
+    for (int i = 0; i < 3 * n / 2; i++) {  // ids 0..699, most twice, and none for 700..999
+        ValueDict row;
+        row["id"] = Value(i % 700);
+        row["v"] = Value("v" + to_string(i % 4));
+        right.insert(&row);
+        right_rows.push_back(row);
+    }
+
+    JoinSpec inner;
+    inner.left_outer = false;
+    inner.left_keys.push_back("id");
+    inner.right_keys.push_back("id");
+    inner.left_renames["id"] = "l.id";
+    inner.right_renames["id"] = "r.id";
+    JoinSpec outer = inner;
+    outer.left_outer = true;
+    ValueDict where;
+    where["v"] = Value("v1");
+
+    vector<string> expected_inner, expected_outer, expected_where;
+    for (auto const &left_row: left_rows) {
+        bool matched = false;
+        for (auto const &right_row: right_rows) {
+            if (left_row.at("id") != right_row.at("id"))
+                continue;
+            ValueDict joined;
+            joined["l.id"] = left_row.at("id");
+            joined["name"] = left_row.at("name");
+            joined["r.id"] = right_row.at("id");
+            joined["v"] = right_row.at("v");
+            expected_inner.push_back(test_row_string(joined));
+            if (joined["v"] == where["v"])
+                expected_where.push_back(test_row_string(joined));
+            matched = true;
+        }
+        if (!matched) {
+            ValueDict joined;
+            joined["l.id"] = left_row.at("id");
+            joined["name"] = left_row.at("name");
+            expected_outer.push_back(test_row_string(joined));
+        }
+    }
+    expected_outer.insert(expected_outer.end(), expected_inner.begin(), expected_inner.end());
+
+    EvalPlan inner_plan(EvalPlan::HashJoin, new JoinSpec(inner), nullptr, new EvalPlan(EvalPlan::ProjectAll,
+                        new EvalPlan(left)), new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(right)));
+    EvalPlan outer_plan(EvalPlan::HashJoin, new JoinSpec(outer), nullptr, new EvalPlan(EvalPlan::ProjectAll,
+                        new EvalPlan(left)), new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(right)));
+    EvalPlan where_plan(EvalPlan::HashJoin, new JoinSpec(outer), new ValueDict(where),
+                        new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(left)),
+                        new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(right)));
+    const size_t plenty = 64 << 20, some = 16 << 10, hardly_any = 256;
+    bool ok = test_join(inner_plan, plenty, expected_inner, false, "inner") &&
+              test_join(inner_plan, some, expected_inner, true, "inner spilled") &&
+              test_join(inner_plan, hardly_any, expected_inner, true, "inner spilled twice") &&
+              test_join(outer_plan, plenty, expected_outer, false, "left outer") &&
+              test_join(outer_plan, some, expected_outer, true, "left outer spilled") &&
+              test_join(outer_plan, hardly_any, expected_outer, true, "left outer spilled twice") &&
+              test_join(where_plan, plenty, expected_where, false, "left outer with where") &&
+              test_join(where_plan, some, expected_where, true, "left outer with where spilled");
+
+    // the same joins probing an index of the right table instead (a B-tree and a hash index), and one with a select
+    // on the right table
+    ColumnNames id_column(1, "id");
+    BTreeIndex btree(right, "__test_join_btree", id_column, false);
+    HashIndex hash_index(right, "__test_join_hash", id_column, false);
+    btree.create();
+    hash_index.create();
+    DbIndex *indices[] = {&btree, &hash_index};
+    for (uint i = 0; i < 2 && ok; i++) {
+        DbIndex &index = *indices[i];
+        string name = i == 0 ? " (B-tree)" : " (hash)";
+        ok = test_lookup_batch(index, 3 * n / 2, name);
+        EvalPlan index_inner(index, new JoinSpec(inner), nullptr, new EvalPlan(EvalPlan::ProjectAll,
+                             new EvalPlan(left)), new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(right)));
+        EvalPlan index_outer(index, new JoinSpec(outer), nullptr, new EvalPlan(EvalPlan::ProjectAll,
+                             new EvalPlan(left)), new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(right)));
+        EvalPlan index_where(index, new JoinSpec(outer), new ValueDict(where),
+                             new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(left)),
+                             new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(right)));
+        EvalPlan index_select(index, new JoinSpec(inner), nullptr,
+                              new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(left)),
+                              new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(new ValueDict(where),
+                                                                              new EvalPlan(right))));
+        ok = ok && test_join(index_inner, plenty, expected_inner, false, "index inner" + name) &&
+             test_join(index_outer, plenty, expected_outer, false, "index left outer" + name) &&
+             test_join(index_where, plenty, expected_where, false, "index left outer with where" + name) &&
+             test_join(index_select, plenty, expected_where, false, "index inner with select" + name);
+    }
+
+    // merge joins of the two tables' rows in the order of B-trees on their ids, and of rows that aren't in order
+    BTreeIndex left_btree(left, "__test_join_left_btree", id_column, true);
+    left_btree.create();
+    auto ordered = [](DbIndex &index, DbRelation &table) {
+        return new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(index, nullptr, nullptr, new EvalPlan(table)));
+    };
+    EvalPlan merge_inner(EvalPlan::MergeJoin, new JoinSpec(inner), nullptr, ordered(left_btree, left),
+                         ordered(btree, right));
+    EvalPlan merge_outer(EvalPlan::MergeJoin, new JoinSpec(outer), nullptr, ordered(left_btree, left),
+                         ordered(btree, right));
+    EvalPlan merge_where(EvalPlan::MergeJoin, new JoinSpec(outer), new ValueDict(where), ordered(left_btree, left),
+                         ordered(btree, right));
+    EvalPlan merge_select(EvalPlan::MergeJoin, new JoinSpec(inner), nullptr, ordered(left_btree, left),
+                          new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(new ValueDict(where),
+                                       new EvalPlan(btree, nullptr, nullptr, new EvalPlan(right)))));
+    ok = ok && test_join(merge_inner, plenty, expected_inner, false, "merge inner") &&
+         test_join(merge_outer, plenty, expected_outer, false, "merge left outer") &&
+         test_join(merge_where, plenty, expected_where, false, "merge left outer with where") &&
+         test_join(merge_select, plenty, expected_where, false, "merge inner with select");
+    EvalPlan merge_unordered(EvalPlan::MergeJoin, new JoinSpec(inner), nullptr, ordered(left_btree, left),
+                             new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(right)));
+    EvalIterator *rows = merge_unordered.row_iterator();
+    bool threw = false;
+    try {
+        rows->open();
+        for (ValueDict *row = rows->next(); row != nullptr; row = rows->next())
+            delete row;
+    } catch (DbRelationError &e) {
+        threw = true;
+    }
+    delete rows;
+    if (ok && !threw)
+        ok = assertion_failure("merge join of rows out of order");
+
+    left_btree.drop();
+    btree.drop();
+    hash_index.drop();
+    left.drop();
+    right.drop();
+    return ok;
+}
+
+// A join of a 200k-row table with a 50k-row one, in memory and with the build side partitioned to disk, and of 1000
+// rows with the 50k-row one, by hash join and by index join.
+void benchmark_joins() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("v");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable big("__benchmark_join_big", column_names, column_attributes);
+    HeapTable small("__benchmark_join_small", column_names, column_attributes);
+    big.create();
+    small.create();
+    const int n = 200 * 1000, m = 50 * 1000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["id"] = Value(i % m);
+        row["v"] = Value("big " + to_string(i));
+        big.insert(&row);
+    }
+    for (int i = 0; i < m; i++) {
+        ValueDict row;
+        row["id"] = Value(i);
+        row["v"] = Value("small " + to_string(i));
+        small.insert(&row);
+    }
+    JoinSpec join;
+    join.left_outer = false;
+    join.left_keys.push_back("id");
+    join.right_keys.push_back("id");
+    join.left_renames["id"] = "big.id";
+    join.left_renames["v"] = "big.v";
+    EvalPlan plan(EvalPlan::HashJoin, new JoinSpec(join), nullptr,
+                  new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(big)),
+                  new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(small)));
+
+    size_t saved = EvalPlan::get_join_memory();
+    const size_t budgets[] = {saved, 1 << 20};
+    cout << "hash join of " << n << " rows with " << m << " rows:";
+    for (auto budget: budgets) {
+        EvalPlan::set_join_memory(budget);
+        auto start = chrono::steady_clock::now();
+        EvalIterator *rows = plan.row_iterator();
+        size_t count = 0;
+        rows->open();
+        for (ValueDict *row = rows->next(); row != nullptr; row = rows->next(), count++)
+            delete row;
+        uint partitions = dynamic_cast<HashJoinIterator *>(rows)->get_partition_count();
+        rows->close();
+        delete rows;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << " budget " << budget / 1024 << "KB: " << count << " rows in " << seconds << "s ("
+             << (partitions == 0 ? string("in memory") : to_string(partitions) + " partitions") << ");";
+    }
+    cout << endl;
+    EvalPlan::set_join_memory(saved);
+
+    // a few rows joined with the 50k-row table, hashing all of it or probing its index
+    HeapTable few("__benchmark_join_few", column_names, column_attributes);
+    few.create();
+    const int k = 1000;
+    for (int i = 0; i < k; i++) {
+        ValueDict row;
+        row["id"] = Value((i * 7919) % m);
+        row["v"] = Value("few " + to_string(i));
+        few.insert(&row);
+    }
+    BTreeIndex index(small, "__benchmark_join_index", ColumnNames(1, "id"), true);
+    index.create();
+    join.left_renames["id"] = "few.id";
+    join.left_renames["v"] = "few.v";
+    EvalPlan hash_plan(EvalPlan::HashJoin, new JoinSpec(join), nullptr,
+                       new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(few)),
+                       new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(small)));
+    EvalPlan index_plan(index, new JoinSpec(join), nullptr, new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(few)),
+                        new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(small)));
+    EvalPlan *plans[] = {&hash_plan, &index_plan};
+    cout << "join of " << k << " rows with " << m << " rows:";
+    for (uint i = 0; i < 2; i++) {
+        auto start = chrono::steady_clock::now();
+        EvalIterator *rows = plans[i]->row_iterator();
+        size_t count = 0;
+        rows->open();
+        for (ValueDict *row = rows->next(); row != nullptr; row = rows->next(), count++)
+            delete row;
+        rows->close();
+        delete rows;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << (i == 0 ? " hash join " : " index join ") << count << " rows in " << seconds << "s;";
+    }
+    cout << endl;
+    index.drop();
+    few.drop();
+    big.drop();
+    small.drop();
+}
@@ -0,0 +1,242 @@
+/**
+ * @file joins.h - the iterators that evaluate join plans, and the pieces they share
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <unordered_map>
+#include "EvalPlan.h"
+#include "SpillFile.h"
+#include "NormalizedKey.h"
+
+/**
+ * Get the values of a row's key columns as one string of bytes, so that rows match exactly when their strings are
+ * equal (values of different types never do).
+ * @returns  false if the row doesn't have one of them (a NULL, which matches nothing)
+ */
+bool join_key(const ValueDict &row, const ColumnNames &key_columns, std::string &key);
+
+/**
+ * The joined row for a left row and a right row (or none, for a left outer join), its columns renamed as in join.
+ * @returns  the joined row (freed by caller)
+ */
+ValueDict *join_rows(const ValueDict &left, const ValueDict *right, const JoinSpec &join);
+
+/**
+ * Get the values of a row's key columns as one string of bytes whose memcmp order is the order of the rows by those
+ * columns, each column's values in NormalizedKey order (and values of different types by type).
+ * @returns  false if the row doesn't have one of them (a NULL)
+ */
+bool order_key(const ValueDict &row, const ColumnNames &key_columns, KeyBytes &key);
+
+/**
+ * About how many bytes of memory a row takes, for operators that have to keep to a memory budget.
+ */
+size_t row_bytes(const ValueDict &row);
+
+/**
+ * Whether row has every value in where (a column it doesn't have, a NULL, doesn't equal anything).
+ */
+bool satisfies(const ValueDict &row, const ValueDict *where);
+
+/**
+ * @class HashJoinIterator - an equi-join (inner or left outer) by hashing the right side's rows on their keys and
+ * looking up each left row's key
+ *
+ * If the right side's rows (the build side) all fit within the memory budget, they are kept in a hash table and the
+ * left side (the probe side) is streamed past it. Otherwise the join switches to Grace hash partitioning: both sides
+ * are split into FANOUT partitions by a hash of their keys, each written to its own SpillFile, and then the
+ * partitions are joined one pair at a time, the build partition in memory. A partition that is still too big is split
+ * again (with a different hash) up to MAX_DEPTH levels deep; after that, or if all its rows have the same key, it is
+ * joined in memory anyway.
+ *
+ * The joined rows come out in left-side order when the build side fits, partition by partition when it doesn't.
+ */
+class HashJoinIterator : public EvalIterator {
+public:
+    static const uint FANOUT = 32;
+    static const uint MAX_DEPTH = 3;
+
+    /**
+     * @param left           the probe side's rows (freed by this iterator)
+     * @param right          the build side's rows (freed by this iterator)
+     * @param join           what to join on and what to call the columns (has to outlive the iterator)
+     * @param where          only give the joined rows that satisfy it (null for all; has to outlive the iterator)
+     * @param memory_budget  about how many bytes of build rows to hold in memory at once
+     */
+    HashJoinIterator(EvalIterator *left, EvalIterator *right, const JoinSpec &join, const ValueDict *where,
+                     size_t memory_budget);
+
+    virtual ~HashJoinIterator();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    /**
+     * Number of partitions joined from disk so far (0 if the build side fit in memory).
+     */
+    uint get_partition_count() const { return this->partition_count; }
+
+protected:
+    // A pair of partitions, still to be joined.
+    struct Partition {
+        SpillFile *build, *probe;
+        uint depth;  // how many times their rows have been partitioned
+    };
+
+    EvalIterator *left, *right;
+    const JoinSpec &join;
+    const ValueDict *where;
+    size_t memory_budget;
+    std::unordered_map<std::string, ValueDicts> table;  // build rows by key
+    size_t table_bytes;  // about how much memory they take
+    std::vector<Partition> partitions;  // still to be joined, the next one at the back
+    bool probing_left;  // the build side fit, so the probe rows come straight from left
+    SpillFile *probe_file;  // otherwise, from the partition being joined
+    ValueDict *probe_row;
+    const ValueDicts *matches;  // build rows matching probe_row (null for none)
+    size_t match_at;
+    uint partition_count;
+    bool done;
+
+    ValueDict *next_joined();
+
+    bool next_partition();
+
+    void add_build_row(const std::string &key, ValueDict *row);
+
+    void clear_table();
+
+    void spill_table(std::vector<SpillFile *> &files, uint depth);
+
+    static std::vector<SpillFile *> new_partition_files();
+
+    static uint partition_of(const std::string &key, uint depth);
+};
+
+/**
+ * @class IndexNestedLoopJoinIterator - an equi-join (inner or left outer) that finds the right rows matching each left
+ * row with an index of the right side's table instead of reading all of them
+ *
+ * The index's key columns have to be among the join's right keys. Left rows are probed BATCH at a time: each distinct
+ * key in the batch is looked up once, all of them in one DbIndex::lookup_batch (so a B-tree can sort them and
+ * find the keys that are in the same leaf with one descent). The rows found are checked against the rest of the keys
+ * and table_where, the select on the table the join replaced. The joined rows come out in left-side order.
+ */
+class IndexNestedLoopJoinIterator : public EvalIterator {
+public:
+    static const uint BATCH = 512;
+
+    /**
+     * @param left         the outer side's rows (freed by this iterator)
+     * @param table        the inner side's table
+     * @param index        an index of table on some or all of join's right keys
+     * @param table_where  only join the rows of table that satisfy it (null for all; has to outlive the iterator)
+     * @param join         what to join on and what to call the columns (has to outlive the iterator)
+     * @param where        only give the joined rows that satisfy it (null for all; has to outlive the iterator)
+     */
+    IndexNestedLoopJoinIterator(EvalIterator *left, DbRelation &table, const DbIndex &index,
+                                const ValueDict *table_where, const JoinSpec &join, const ValueDict *where);
+
+    virtual ~IndexNestedLoopJoinIterator();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    /**
+     * Number of keys looked up in the index so far (each distinct key of a batch once).
+     */
+    uint64_t get_probe_count() const { return this->probe_count; }
+
+protected:
+    EvalIterator *left;
+    DbRelation &table;
+    const DbIndex &index;
+    const ValueDict *table_where;
+    const JoinSpec &join;
+    const ValueDict *where;
+    ColumnNames probe_columns;  // the left side's column for each of the index's key columns
+    std::vector<ColumnAttribute::DataType> key_types;  // and the index's key columns' types
+    ValueDicts batch;  // left rows
+    std::vector<const ValueDicts *> batch_matches;  // table rows matching each (null for none)
+    std::unordered_map<std::string, ValueDicts> found;  // table rows by key, for this batch
+    size_t at, match_at;
+    uint64_t probe_count;
+    bool left_done;  // left has no more rows
+    bool done;
+
+    ValueDict *next_joined();
+
+    bool next_batch();
+
+    void clear_batch();
+};
+
+/**
+ * @class MergeJoinIterator - an equi-join (inner or left outer) of two sides that both come in order of their keys, by
+ * stepping through them together
+ *
+ * Each side has to be in ascending order_key order of its join keys, as a B-tree range scan gives them (the keys in
+ * the index's order) or a sort. Only the right rows with the current key (its group) are held in memory, to be joined
+ * with each of the left rows with that key. A row with a NULL key matches nothing and can be anywhere. The joined rows
+ * come out in left-side order.
+ */
+class MergeJoinIterator : public EvalIterator {
+public:
+    /**
+     * @param left   the left side's rows, in order (freed by this iterator)
+     * @param right  the right side's rows, in order (freed by this iterator)
+     * @param join   what to join on and what to call the columns (has to outlive the iterator)
+     * @param where  only give the joined rows that satisfy it (null for all; has to outlive the iterator)
+     */
+    MergeJoinIterator(EvalIterator *left, EvalIterator *right, const JoinSpec &join, const ValueDict *where);
+
+    virtual ~MergeJoinIterator();
+
+    virtual void open();
+
+    /**
+     * @throws DbRelationError if either side turns out not to be in order
+     */
+    virtual ValueDict *next();
+
+    virtual void close();
+
+protected:
+    EvalIterator *left, *right;
+    const JoinSpec &join;
+    const ValueDict *where;
+    ValueDict *left_row;
+    KeyBytes left_key;  // of the last left row with a key
+    bool left_keyed;  // there has been one
+    const ValueDicts *matches;  // right rows matching left_row (null for none)
+    size_t match_at;
+    ValueDicts group;  // right rows with group_key
+    KeyBytes group_key;
+    bool grouped;  // group has been read
+    ValueDict *right_row;  // the first right row after the group (null at the end)
+    KeyBytes right_key;  // its key
+    bool right_keyed;  // right_key has been set
+    bool right_done;  // right has no more rows
+    bool done;
+
+    ValueDict *next_joined();
+
+    ValueDict *next_right();
+
+    void next_group();
+
+    void clear_group();
+};
+
+bool test_joins();
+
+void benchmark_joins();
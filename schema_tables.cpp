@@ -6,6 +6,10 @@
 #include "schema_tables.h"
 #include "ParseTreeToString.h"
 #include "btree.h"
+#include "hash_index.h"
+#include "bloom_index.h"
+#include "bitmap_index.h"
+#include "art_index.h"
 
 
 void initialize_schema_tables() {
@@ -313,7 +317,7 @@ Handle Indices::insert(const ValueDict *row) {
     ValueDict where;
     where["table_name"] = row->at("table_name");
     where["index_name"] = row->at("index_name");
-    if (row->at("seq_in_index").n > 1)
+    if (row->at("seq_in_index").n != 1)
         where["column_name"] = row->at("column_name");  // check for duplicate columns on the same index
     Handles *handles = select(&where);
     bool unique = handles->empty();
@@ -341,8 +345,9 @@ void Indices::del(Handle handle) {
 }
 
 // Return a list of column names and column attributes for given table.
-void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
-                          bool &is_unique) {
+// Included (non-key) columns of a covering index are stored with seq_in_index -1, -2, etc.
+void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names,
+                          Identifier &index_type, bool &is_unique, ColumnNames &include_columns) {
     // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     ValueDict where;
     where["table_name"] = table_name;
@@ -350,45 +355,35 @@ void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNa
     Handles *handles = select(&where);
 
     Identifier colnames[DbIndex::MAX_COMPOSITE];
-    uint size = 0;
+    Identifier include_colnames[DbIndex::MAX_COMPOSITE];
+    uint size = 0, include_size = 0;
     for (auto const &handle: *handles) {
         ValueDict *row = project(handle);
 
         Identifier column_name = (*row)["column_name"].s;
-        uint which = (uint) (*row)["seq_in_index"].n;
-        colnames[which - 1] = column_name;  // seq_in_index is 1-based
-        if (which > size)
-            size = which;
+        int seq = (*row)["seq_in_index"].n;
+        if (seq > 0) {
+            uint which = (uint) seq;
+            colnames[which - 1] = column_name;  // seq_in_index is 1-based
+            if (which > size)
+                size = which;
+        } else {
+            uint which = (uint) -seq;
+            include_colnames[which - 1] = column_name;
+            if (which > include_size)
+                include_size = which;
+        }
         is_unique = (*row)["is_unique"].n != 0;
-        is_hash = (*row)["index_type"].s == "HASH";
+        index_type = (*row)["index_type"].s;
         delete row;
     }
     for (uint i = 0; i < size; i++)
         column_names.push_back(colnames[i]);
+    for (uint i = 0; i < include_size; i++)
+        include_columns.push_back(include_colnames[i]);
     delete handles;
 }
 
-// FIXME - use this for now until we have BTreeIndex and HashIndex
-class DummyIndex : public DbIndex {
-public:
-    DummyIndex(DbRelation &rel, Identifier idx, ColumnNames key, bool unq) : DbIndex(rel, idx, key, unq) {}
-
-    void create() {}
-
-    void drop() {}
-
-    void open() {}
-
-    void close() {}
-
-    Handles *lookup(ValueDict *key_values) const { return nullptr; }
-
-    void insert(Handle handle) {}
-
-    void del(Handle handle) {}
-};
-
-
 // Return a table for given table_name.
 DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     // if they are asking about an index we've once constructed, then just return that one
@@ -396,16 +391,23 @@ DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
         return *Indices::index_cache[cache_key];
 
-    // otherwise assume it is a DummyIndex (for now)
-    ColumnNames column_names;
-    bool is_hash, is_unique;
-    get_columns(table_name, index_name, column_names, is_hash, is_unique);
+    // otherwise construct it from its rows in _indices
+    ColumnNames column_names, include_columns;
+    Identifier index_type;
+    bool is_unique;
+    get_columns(table_name, index_name, column_names, index_type, is_unique, include_columns);
     DbRelation &table = Tables::get_table(table_name);
     DbIndex *index;
-    if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
+    if (index_type == "HASH") {
+        index = new HashIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "BLOOM") {
+        index = new BloomIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "BITMAP") {
+        index = new BitmapIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "ART") {
+        index = new ArtIndex(table, index_name, column_names, is_unique);
     } else {
-        index = new BTreeIndex(table, index_name, column_names, is_unique);
+        index = new BTreeIndex(table, index_name, column_names, is_unique, include_columns, index_type == "BETREE");
     }
     Indices::index_cache[cache_key] = index;
     return *index;
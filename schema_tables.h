@@ -122,12 +122,14 @@ public:
      * @param index_name      name of index (unique by table)
      * @param column_names    returned by reference: list of column names
      *                        in search key in order
-     * @param is_hash         returned by reference: set to False if the
-     *                        requested index is a btree index
+     * @param index_type      returned by reference: BTREE, BETREE (a buffered B-tree), HASH, BLOOM, BITMAP,
+     *                        or ART
      * @param is_unique       search key for this index is a key for the relation
+     * @param include_columns returned by reference: list of non-key columns
+     *                        also stored in the index, in order
      */
-    virtual void get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
-                             bool &is_unique);
+    virtual void get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names,
+                             Identifier &index_type, bool &is_unique, ColumnNames &include_columns);
 
     /**
      * Get the instantiated DbIndex for the given index.
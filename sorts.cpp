@@ -0,0 +1,700 @@
+/**
+ * @file sorts.cpp - implementation of the external merge sort, top-N, and limit
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include "sorts.h"
+
+using namespace std;
+
+void sort_key(const ValueDict &row, const SortSpec &sort, KeyBytes &key) {
+    key.clear();
+    KeyValue value(1);
+    KeyProfile profile(1);
+    for (size_t i = 0; i < sort.columns.size(); i++) {
+        size_t start = key.size();
+        ValueDict::const_iterator column = row.find(sort.columns[i]);
+        if (column == row.end()) {
+            key.push_back('\0');
+        } else {
+            value[0] = column->second;
+            profile[0] = column->second.data_type;
+            key.push_back('\1');
+            key.push_back((char) column->second.data_type);
+            key.append(NormalizedKey::encode(&value, profile));
+        }
+        if (sort.descending[i])
+            for (size_t j = start; j < key.size(); j++)
+                key[j] = (char) ~key[j];
+    }
+}
+
+LoserTree::LoserTree(const vector<const KeyBytes *> &keys) : keys(keys), losers(keys.size(), 0) {
+    this->losers[0] = build(1);
+}
+
+void LoserTree::replace(const KeyBytes *key) {
+    uint k = (uint) this->keys.size();
+    uint winner = this->losers[0];
+    this->keys[winner] = key;
+    for (uint node = (winner + k) / 2; node > 0; node /= 2)
+        if (beats(this->losers[node], winner))
+            swap(this->losers[node], winner);
+    this->losers[0] = winner;
+}
+
+bool LoserTree::beats(uint a, uint b) const {
+    if (this->keys[a] == nullptr)
+        return false;
+    if (this->keys[b] == nullptr)
+        return true;
+    int cmp = NormalizedKey::compare(*this->keys[a], *this->keys[b]);
+    return cmp < 0 || (cmp == 0 && a < b);
+}
+
+// Play the matches below node, keeping each one's loser, and return the winner.
+uint LoserTree::build(uint node) {
+    uint k = (uint) this->keys.size();
+    if (node >= k)
+        return node - k;
+    uint a = build(2 * node), b = build(2 * node + 1);
+    if (beats(a, b)) {
+        this->losers[node] = b;
+        return a;
+    }
+    this->losers[node] = a;
+    return b;
+}
+
+/**
+ * @class RunMerge - the rows of some sorted runs, merged (and the runs, which it frees)
+ */
+class RunMerge {
+public:
+    RunMerge(const vector<SpillFile *> &runs, const SortSpec &sort)
+            : runs(runs), sort(sort), rows(runs.size(), nullptr), keys(runs.size()), tree(nullptr) {
+        vector<const KeyBytes *> heads;
+        for (size_t i = 0; i < runs.size(); i++)
+            heads.push_back(read(i));
+        this->tree = new LoserTree(heads);
+    }
+
+    ~RunMerge() {
+        delete this->tree;
+        for (auto row: this->rows)
+            delete row;
+        for (auto run: this->runs)
+            delete run;
+    }
+
+    ValueDict *next() {
+        uint i = this->tree->winner();
+        ValueDict *row = this->rows[i];
+        if (row != nullptr)
+            this->tree->replace(read(i));
+        return row;
+    }
+
+protected:
+    vector<SpillFile *> runs;
+    const SortSpec &sort;
+    ValueDicts rows;  // each run's next row
+    vector<KeyBytes> keys;  // and its sort key
+    LoserTree *tree;
+
+    // Read run i's next row, returning its key (null if the run is out).
+    const KeyBytes *read(size_t i) {
+        this->rows[i] = this->runs[i]->next();
+        if (this->rows[i] == nullptr)
+            return nullptr;
+        sort_key(*this->rows[i], this->sort, this->keys[i]);
+        return &this->keys[i];
+    }
+};
+
+SortIterator::SortIterator(EvalIterator *input, const SortSpec &sort, size_t memory_budget)
+        : input(input), sort(sort), memory_budget(memory_budget), rows(), at(0), merge(nullptr), run_count(0) {
+}
+
+SortIterator::~SortIterator() {
+    close();
+    delete this->input;
+}
+
+void SortIterator::open() {
+    close();
+    this->run_count = 0;
+    vector<SpillFile *> runs;
+    try {
+        size_t bytes = 0;
+        this->input->open();
+        for (ValueDict *row = this->input->next(); row != nullptr; row = this->input->next()) {
+            this->rows.push_back(make_pair(KeyBytes(), row));
+            KeyBytes &key = this->rows.back().first;
+            sort_key(*row, this->sort, key);
+            bytes += row_bytes(*row) + sizeof(this->rows.back()) + key.size();
+            if (bytes > this->memory_budget && this->rows.size() > 1) {
+                runs.push_back(spill_rows());
+                bytes = 0;
+            }
+        }
+        this->input->close();
+        if (runs.empty()) {
+            sort_rows();
+            return;
+        }
+        if (!this->rows.empty())
+            runs.push_back(spill_rows());
+        this->run_count = (uint) runs.size();
+        while (runs.size() > MAX_FAN_IN)
+            runs = merge_pass(runs);
+    } catch (...) {
+        for (auto run: runs)
+            delete run;
+        close();
+        throw;
+    }
+    this->merge = new RunMerge(runs, this->sort);
+}
+
+ValueDict *SortIterator::next() {
+    if (this->merge != nullptr)
+        return this->merge->next();
+    if (this->at == this->rows.size())
+        return nullptr;
+    ValueDict *row = this->rows[this->at].second;
+    this->rows[this->at++].second = nullptr;
+    return row;
+}
+
+void SortIterator::close() {
+    this->input->close();
+    clear_rows();
+    delete this->merge;
+    this->merge = nullptr;
+}
+
+// Stable, so rows with the same key keep their input order.
+void SortIterator::sort_rows() {
+    stable_sort(this->rows.begin(), this->rows.end(),
+                [](const pair<KeyBytes, ValueDict *> &a, const pair<KeyBytes, ValueDict *> &b) {
+                    return NormalizedKey::compare(a.first, b.first) < 0;
+                });
+    this->at = 0;
+}
+
+// Sort the rows in memory and write them out as a run.
+SpillFile *SortIterator::spill_rows() {
+    sort_rows();
+    SpillFile *run = new SpillFile();
+    try {
+        for (auto const &row: this->rows)
+            run->append(*row.second);
+    } catch (...) {
+        delete run;
+        throw;
+    }
+    clear_rows();
+    return run;
+}
+
+// Merge each MAX_FAN_IN runs into one, keeping them in input order so the sort stays stable.
+vector<SpillFile *> SortIterator::merge_pass(const vector<SpillFile *> &runs) {
+    vector<SpillFile *> merged;
+    for (size_t first = 0; first < runs.size(); first += MAX_FAN_IN) {
+        vector<SpillFile *> group(runs.begin() + first, runs.begin() + min(runs.size(), first + MAX_FAN_IN));
+        if (group.size() == 1) {
+            merged.push_back(group[0]);
+            continue;
+        }
+        SpillFile *run = new SpillFile();
+        RunMerge merge(group, this->sort);
+        for (ValueDict *row = merge.next(); row != nullptr; row = merge.next()) {
+            run->append(*row);
+            delete row;
+        }
+        merged.push_back(run);
+    }
+    return merged;
+}
+
+void SortIterator::clear_rows() {
+    for (auto const &row: this->rows)
+        delete row.second;
+    this->rows.clear();
+    this->at = 0;
+}
+
+TopNIterator::TopNIterator(EvalIterator *input, const SortSpec &sort, const LimitSpec &limit)
+        : input(input), sort(sort), limit(limit), heap(), at(0) {
+}
+
+TopNIterator::~TopNIterator() {
+    close();
+    delete this->input;
+}
+
+void TopNIterator::open() {
+    close();
+    if (this->limit.limit == 0)
+        return;  // no need to read any of them
+    size_t keep = this->limit.limit > SIZE_MAX - this->limit.offset ? SIZE_MAX
+                                                                     : this->limit.limit + this->limit.offset;
+    try {
+        uint64_t sequence = 0;
+        KeyBytes key;
+        this->input->open();
+        for (ValueDict *row = this->input->next(); row != nullptr; row = this->input->next()) {
+            if (this->heap.size() < keep) {
+                this->heap.push_back(Entry{KeyBytes(), sequence++, row});
+                sort_key(*row, this->sort, this->heap.back().key);
+                push_heap(this->heap.begin(), this->heap.end(), less);
+                continue;
+            }
+            // the top is the last of the rows kept so far: a row has to sort before it to take its place (one that
+            // sorts the same comes after it in the input, so it goes after it too)
+            sort_key(*row, this->sort, key);
+            if (NormalizedKey::compare(key, this->heap.front().key) < 0) {
+                pop_heap(this->heap.begin(), this->heap.end(), less);
+                Entry &last = this->heap.back();
+                delete last.row;
+                last.key.swap(key);
+                last.sequence = sequence;
+                last.row = row;
+                push_heap(this->heap.begin(), this->heap.end(), less);
+            } else {
+                delete row;
+            }
+            sequence++;
+        }
+        this->input->close();
+    } catch (...) {
+        close();
+        throw;
+    }
+    sort_heap(this->heap.begin(), this->heap.end(), less);
+    this->at = min(this->limit.offset, this->heap.size());
+}
+
+ValueDict *TopNIterator::next() {
+    if (this->at == this->heap.size())
+        return nullptr;
+    ValueDict *row = this->heap[this->at].row;
+    this->heap[this->at++].row = nullptr;
+    return row;
+}
+
+void TopNIterator::close() {
+    this->input->close();
+    clear_rows();
+}
+
+// By sort key, then by input order.
+bool TopNIterator::less(const Entry &a, const Entry &b) {
+    int cmp = NormalizedKey::compare(a.key, b.key);
+    return cmp < 0 || (cmp == 0 && a.sequence < b.sequence);
+}
+
+void TopNIterator::clear_rows() {
+    for (auto const &entry: this->heap)
+        delete entry.row;
+    this->heap.clear();
+    this->at = 0;
+}
+
+LimitIterator::LimitIterator(EvalIterator *input, const LimitSpec &limit)
+        : input(input), limit(limit), count(0), done(true) {
+}
+
+LimitIterator::~LimitIterator() {
+    close();
+    delete this->input;
+}
+
+void LimitIterator::open() {
+    close();
+    this->count = 0;
+    this->done = this->limit.limit == 0;
+    if (this->done)
+        return;  // no need to read any of them
+    this->input->open();
+    for (size_t i = 0; i < this->limit.offset; i++) {
+        ValueDict *row = this->input->next();
+        if (row == nullptr) {
+            close();
+            return;
+        }
+        delete row;
+    }
+}
+
+ValueDict *LimitIterator::next() {
+    if (this->done)
+        return nullptr;
+    ValueDict *row = this->input->next();
+    if (row == nullptr || ++this->count == this->limit.limit)
+        close();  // stop the input here, without reading (or scanning) any more of it
+    return row;
+}
+
+void LimitIterator::close() {
+    this->input->close();
+    this->done = true;
+}
+
+/**
+ * @class TestRows - rows from a vector, for testing the sort with rows a table wouldn't have (with NULLs)
+ */
+class TestRows : public EvalIterator {
+public:
+    explicit TestRows(const vector<ValueDict> &rows) : rows(rows), at(0) {}
+
+    virtual void open() { this->at = 0; }
+
+    virtual ValueDict *next() { return this->at < this->rows.size() ? new ValueDict(this->rows[this->at++]) : nullptr; }
+
+    virtual void close() {}
+
+    // Rows given since opened.
+    size_t get_count() const { return this->at; }
+
+protected:
+    const vector<ValueDict> &rows;
+    size_t at;
+};
+
+// The order a SortSpec says, compared a value at a time (the way sort_key should agree with).
+static bool test_sort_less(const ValueDict &a, const ValueDict &b, const SortSpec &sort) {
+    for (size_t i = 0; i < sort.columns.size(); i++) {
+        ValueDict::const_iterator x = a.find(sort.columns[i]), y = b.find(sort.columns[i]);
+        int cmp;
+        if (x == a.end() || y == b.end())
+            cmp = (x == a.end() ? 0 : 1) - (y == b.end() ? 0 : 1);
+        else if (x->second.data_type == ColumnAttribute::TEXT)
+            cmp = x->second.s.compare(y->second.s);
+        else
+            cmp = x->second.n < y->second.n ? -1 : x->second.n > y->second.n ? 1 : 0;
+        if (cmp != 0)
+            return sort.descending[i] ? cmp > 0 : cmp < 0;
+    }
+    return false;
+}
+
+// Sort rows by sort with memory_budget and check they come out as a stable sort of them would, and how many runs
+// were spilled.
+static bool test_sort(const vector<ValueDict> &rows, const SortSpec &sort, size_t memory_budget, uint min_runs,
+                      uint max_runs, const string &name) {
+    vector<ValueDict> expected(rows);
+    stable_sort(expected.begin(), expected.end(),
+                [&sort](const ValueDict &a, const ValueDict &b) { return test_sort_less(a, b, sort); });
+    SortIterator sorted(new TestRows(rows), sort, memory_budget);
+    for (int pass = 0; pass < 2; pass++) {  // again, to see it can be reopened
+        sorted.open();
+        size_t count = 0;
+        bool ok = true;
+        for (ValueDict *row = sorted.next(); row != nullptr; row = sorted.next(), count++) {
+            ok = ok && count < expected.size() && *row == expected[count];
+            delete row;
+        }
+        if (sorted.next() != nullptr)
+            return assertion_failure("sort " + name + " past the end");
+        sorted.close();
+        if (count != expected.size())
+            return assertion_failure("sort " + name + " rows", (double) count, (double) expected.size());
+        if (!ok)
+            return assertion_failure("sort " + name + " order");
+        if (sorted.get_run_count() < min_runs || sorted.get_run_count() > max_runs)
+            return assertion_failure("sort " + name + " runs", sorted.get_run_count(), min_runs);
+    }
+    return true;
+}
+
+// Take limit rows after offset of rows in order by sort, and check they're the ones a stable sort of them would give
+// there.
+static bool test_top_n(const vector<ValueDict> &rows, const SortSpec &sort, size_t limit, size_t offset) {
+    string name = "top-n limit " + to_string(limit) + " offset " + to_string(offset);
+    vector<ValueDict> expected(rows);
+    stable_sort(expected.begin(), expected.end(),
+                [&sort](const ValueDict &a, const ValueDict &b) { return test_sort_less(a, b, sort); });
+    expected.erase(expected.begin(), expected.begin() + min(offset, expected.size()));
+    expected.resize(min(limit, expected.size()));
+    LimitSpec spec = {limit, offset};
+    TopNIterator top(new TestRows(rows), sort, spec);
+    for (int pass = 0; pass < 2; pass++) {  // again, to see it can be reopened
+        top.open();
+        size_t count = 0;
+        bool ok = true;
+        for (ValueDict *row = top.next(); row != nullptr; row = top.next(), count++) {
+            ok = ok && count < expected.size() && *row == expected[count];
+            delete row;
+        }
+        if (top.next() != nullptr)
+            return assertion_failure(name + " past the end");
+        top.close();
+        if (count != expected.size())
+            return assertion_failure(name + " rows", (double) count, (double) expected.size());
+        if (!ok)
+            return assertion_failure(name + " order");
+    }
+    return true;
+}
+
+// Take limit rows after offset of rows and check they're the right ones, and that no more rows were read than that.
+static bool test_limit(const vector<ValueDict> &rows, size_t limit, size_t offset) {
+    string name = "limit " + to_string(limit) + " offset " + to_string(offset);
+    size_t first = min(offset, rows.size()), last = min(rows.size(), first + min(limit, rows.size()));
+    LimitSpec spec = {limit, offset};
+    TestRows *input = new TestRows(rows);
+    LimitIterator limited(input, spec);
+    limited.open();
+    size_t count = 0;
+    bool ok = true;
+    for (ValueDict *row = limited.next(); row != nullptr; row = limited.next(), count++) {
+        ok = ok && first + count < last && *row == rows[first + count];
+        delete row;
+    }
+    if (limited.next() != nullptr)
+        return assertion_failure(name + " past the end");
+    size_t read = input->get_count();
+    limited.close();
+    if (count != last - first)
+        return assertion_failure(name + " rows", (double) count, (double) (last - first));
+    if (!ok)
+        return assertion_failure(name + " order");
+    size_t expected_read = limit == 0 ? 0 : min(rows.size(), offset + limit);
+    if (read != expected_read)
+        return assertion_failure(name + " rows read", (double) read, (double) expected_read);
+    return true;
+}
+
+// Merging sorted lists with a loser tree, lists of different lengths, some empty, with ties among them.
+static bool test_loser_tree() {
+    for (uint k = 1; k <= 9; k++) {
+        vector<vector<KeyBytes>> lists(k);
+        vector<pair<KeyBytes, uint>> expected;
+        for (uint i = 0; i < k; i++) {
+            for (uint j = 0; j < (i * 5) % 7; j++) {
+                lists[i].push_back(KeyBytes(1, (char) ('a' + (j * 3 + i) % 11)));
+                expected.push_back(make_pair(lists[i].back(), i));
+            }
+            sort(lists[i].begin(), lists[i].end());
+        }
+        stable_sort(expected.begin(), expected.end());  // by key, then by list
+        vector<size_t> at(k, 0);
+        vector<const KeyBytes *> heads;
+        for (uint i = 0; i < k; i++)
+            heads.push_back(lists[i].empty() ? nullptr : &lists[i][0]);
+        LoserTree tree(heads);
+        for (auto const &want: expected) {
+            uint i = tree.winner();
+            if (at[i] == lists[i].size() || lists[i][at[i]] != want.first || i != want.second)
+                return assertion_failure("loser tree of " + to_string(k) + " lists");
+            at[i]++;
+            tree.replace(at[i] < lists[i].size() ? &lists[i][at[i]] : nullptr);
+        }
+        if (at[tree.winner()] != lists[tree.winner()].size())
+            return assertion_failure("loser tree of " + to_string(k) + " lists left over");
+    }
+    return true;
+}
+
+// Sorts ascending and descending, by several columns, with NULLs, in memory, spilled to runs merged in one pass,
+// and spilled to so many runs they take more than one, and a sort plan over a table.
+bool test_sorts() {
+    if (!test_loser_tree())
+        return false;
+    vector<ValueDict> rows;
+    const int n = 5000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value((i * 7919) % 300 - 150);
+        if (i % 17 != 0)
+            row["b"] = Value("b" + to_string((i * 31) % 13));  // otherwise NULL
+        row["c"] = Value(i);
+        rows.push_back(row);
+    }
+    SortSpec by_a, by_a_desc, by_b_a, by_b_desc_a;
+    by_a.columns.push_back("a");
+    by_a.descending.push_back(false);
+    by_a_desc.columns.push_back("a");
+    by_a_desc.descending.push_back(true);
+    by_b_a.columns.push_back("b");
+    by_b_a.descending.push_back(false);
+    by_b_a.columns.push_back("a");
+    by_b_a.descending.push_back(false);
+    by_b_desc_a = by_b_a;
+    by_b_desc_a.descending[0] = true;
+    struct {
+        const SortSpec &sort;
+        string name;
+    } sorts[] = {{by_a, "a"}, {by_a_desc, "a desc"}, {by_b_a, "b, a"}, {by_b_desc_a, "b desc, a"}};
+    for (auto const &sort: sorts) {
+        if (!test_sort(rows, sort.sort, 64 << 20, 0, 0, sort.name + " in memory") ||
+            !test_sort(rows, sort.sort, 64 << 10, 2, SortIterator::MAX_FAN_IN, sort.name + " spilled") ||
+            !test_sort(rows, sort.sort, 4 << 10, SortIterator::MAX_FAN_IN + 1, n, sort.name + " multi-pass"))
+            return false;
+    }
+    vector<ValueDict> none;
+    if (!test_sort(none, by_a, 64 << 20, 0, 0, "of nothing"))
+        return false;
+
+    // top-n, with lots of ties on b, and limits
+    const size_t limits[] = {0, 1, 10, 100, (size_t) n, (size_t) n + 1};
+    const size_t offsets[] = {0, 1, 50, (size_t) n};
+    for (auto limit: limits) {
+        for (auto offset: offsets) {
+            if (!test_top_n(rows, by_b_a, limit, offset) || !test_top_n(rows, by_b_desc_a, limit, offset) ||
+                !test_limit(rows, limit, offset))
+                return false;
+        }
+    }
+    if (!test_top_n(none, by_a, 10, 0) || !test_limit(none, 10, 0))
+        return false;
+
+    // a sort plan over a table, spilled
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_sort", column_names, column_attributes);
+    table.create();
+    vector<ValueDict> table_rows;
+    for (auto const &row: rows) {
+        if (row.find("b") == row.end())
+            continue;
+        table.insert(&row);
+        table_rows.push_back(row);
+    }
+    stable_sort(table_rows.begin(), table_rows.end(),
+                [&by_b_desc_a](const ValueDict &a, const ValueDict &b) { return test_sort_less(a, b, by_b_desc_a); });
+    EvalPlan plan(new SortSpec(by_b_desc_a), new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table)));
+    size_t saved = EvalPlan::get_sort_memory();
+    EvalPlan::set_sort_memory(64 << 10);
+    EvalIterator *sorted = plan.row_iterator();
+    EvalPlan::set_sort_memory(saved);
+    sorted->open();
+    size_t count = 0;
+    bool ok = dynamic_cast<SortIterator *>(sorted) != nullptr;
+    for (ValueDict *row = sorted->next(); row != nullptr; row = sorted->next(), count++) {
+        ok = ok && count < table_rows.size() && (*row)["c"] == table_rows[count]["c"];
+        delete row;
+    }
+    ok = ok && count == table_rows.size() && dynamic_cast<SortIterator *>(sorted)->get_run_count() > 1;
+    sorted->close();
+    delete sorted;
+    if (!ok) {
+        table.drop();
+        return assertion_failure("sort plan");
+    }
+
+    // top-n and limit plans over it
+    EvalPlan top_plan(new SortSpec(by_b_desc_a), new LimitSpec{10, 5},
+                      new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table)));
+    EvalPlan limit_plan(new LimitSpec{10, 5}, new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table)));
+    EvalIterator *top = top_plan.row_iterator();
+    EvalIterator *limited = limit_plan.row_iterator();
+    ok = dynamic_cast<TopNIterator *>(top) != nullptr && dynamic_cast<LimitIterator *>(limited) != nullptr;
+    top->open();
+    limited->open();
+    count = 0;
+    for (ValueDict *row = top->next(); row != nullptr; row = top->next(), count++) {
+        ok = ok && count < 10 && (*row)["c"] == table_rows[5 + count]["c"];
+        delete row;
+    }
+    ok = ok && count == 10;
+    count = 0;
+    for (ValueDict *row = limited->next(); row != nullptr; row = limited->next(), count++)
+        delete row;
+    ok = ok && count == 10;
+    top->close();
+    limited->close();
+    delete top;
+    delete limited;
+    table.drop();
+    if (!ok)
+        return assertion_failure("top-n and limit plans");
+    return true;
+}
+
+// A sort of 200k rows by a text column, in memory and spilled to runs of about 1MB, and the first few of them by a
+// whole sort and by a top-n, and with no order.
+void benchmark_sorts() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("v");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__benchmark_sort", column_names, column_attributes);
+    table.create();
+    const int n = 200 * 1000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["id"] = Value(i);
+        row["v"] = Value("v " + to_string((i * 7919L) % n));
+        table.insert(&row);
+    }
+    SortSpec by_v;
+    by_v.columns.push_back("v");
+    by_v.descending.push_back(false);
+    EvalPlan plan(new SortSpec(by_v), new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table)));
+
+    size_t saved = EvalPlan::get_sort_memory();
+    const size_t budgets[] = {saved, 1 << 20};
+    cout << "sort of " << n << " rows:";
+    for (auto budget: budgets) {
+        EvalPlan::set_sort_memory(budget);
+        auto start = chrono::steady_clock::now();
+        EvalIterator *rows = plan.row_iterator();
+        size_t count = 0;
+        rows->open();
+        for (ValueDict *row = rows->next(); row != nullptr; row = rows->next(), count++)
+            delete row;
+        uint runs = dynamic_cast<SortIterator *>(rows)->get_run_count();
+        rows->close();
+        delete rows;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << " budget " << budget / 1024 << "KB: " << count << " rows in " << seconds << "s ("
+             << (runs == 0 ? string("in memory") : to_string(runs) + " runs") << ");";
+    }
+    cout << endl;
+    EvalPlan::set_sort_memory(saved);
+
+    // the first 50 by v descending, from a whole sort and from a top-n, and the first 10 of any order
+    SortSpec by_v_desc = by_v;
+    by_v_desc.descending[0] = true;
+    EvalPlan sorted_plan(new LimitSpec{50, 0}, new EvalPlan(new SortSpec(by_v_desc),
+                                                            new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table))));
+    EvalPlan top_plan(new SortSpec(by_v_desc), new LimitSpec{50, 0},
+                      new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table)));
+    EvalPlan scan_plan(EvalPlan::ProjectAll, new EvalPlan(table));
+    EvalPlan limit_plan(new LimitSpec{10, 0}, new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table)));
+    struct {
+        EvalPlan &plan;
+        string name;
+    } plans[] = {{sorted_plan, "order by v desc limit 50, sorted"}, {top_plan, "top-n"},
+                 {scan_plan, "no order, all rows"}, {limit_plan, "limit 10"}};
+    for (auto const &plan: plans) {
+        auto start = chrono::steady_clock::now();
+        EvalIterator *rows = plan.plan.row_iterator();
+        size_t count = 0;
+        rows->open();
+        for (ValueDict *row = rows->next(); row != nullptr; row = rows->next(), count++)
+            delete row;
+        rows->close();
+        delete rows;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << (&plan == plans ? "" : "; ") << plan.name << ": " << count << " rows in " << seconds << "s";
+    }
+    cout << endl;
+    table.drop();
+}
@@ -0,0 +1,195 @@
+/**
+ * @file sorts.h - the iterators that evaluate sort plans (an external merge sort), top-N plans, and limit plans, and
+ * the pieces they use
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include "joins.h"
+
+/**
+ * Get a row's sort key: bytes whose memcmp order is the order sort puts the rows in. For each column there is a byte
+ * for whether the row has it (0 for a NULL, 1 if it has), and then its data type and its NormalizedKey encoding, all
+ * of the column's bytes flipped if it's descending.
+ */
+void sort_key(const ValueDict &row, const SortSpec &sort, KeyBytes &key);
+
+/**
+ * @class LoserTree - picks the smallest of k keys over and over, with about log2(k) comparisons each time the smallest
+ * one is replaced
+ *
+ * Each internal node of the tree holds the loser of the match played there and the overall winner is kept apart, so
+ * replacing the winner's key just replays the matches on the path from its leaf up to the root. On a tie, the key with
+ * the lower number wins (so a merge of runs in input order is stable), and a null key (a run that has run out) loses
+ * to any other.
+ */
+class LoserTree {
+public:
+    /**
+     * @param keys  the k keys (k at least 1): the tree keeps the pointers, so they have to stay put
+     */
+    explicit LoserTree(const std::vector<const KeyBytes *> &keys);
+
+    /**
+     * Which key is smallest (its key is null if they all are).
+     */
+    uint winner() const { return this->losers[0]; }
+
+    /**
+     * Give the winner a new key and replay its matches.
+     * @param key  the new key, no smaller than the old one (null if there isn't one)
+     */
+    void replace(const KeyBytes *key);
+
+protected:
+    std::vector<const KeyBytes *> keys;
+    std::vector<uint> losers;  // losers[1..k-1] are the internal nodes (node n's children are 2n and 2n + 1, leaf i
+                               // is node k + i), and losers[0] is the winner
+
+    bool beats(uint a, uint b) const;
+
+    uint build(uint node);
+};
+
+class RunMerge;
+
+/**
+ * @class SortIterator - an external merge sort: all of its input's rows, in sort order
+ *
+ * Rows are collected in memory up to the memory budget, and then sorted by sort_key into a run that is written out to
+ * a SpillFile, and so on. If no run had to be spilled, the rows are given straight from memory. Otherwise the last
+ * run is spilled too, and the runs are merged MAX_FAN_IN at a time with a LoserTree (in passes that merge groups of
+ * runs into longer ones, until there are few enough left to merge as the rows are read). Rows that sort the same keep
+ * their input order.
+ */
+class SortIterator : public EvalIterator {
+public:
+    static const uint MAX_FAN_IN = 64;
+
+    /**
+     * @param input          the rows to sort (freed by this iterator)
+     * @param sort           what to sort them by (has to outlive the iterator)
+     * @param memory_budget  about how many bytes of rows to hold in memory at once
+     */
+    SortIterator(EvalIterator *input, const SortSpec &sort, size_t memory_budget);
+
+    virtual ~SortIterator();
+
+    /**
+     * Reads and sorts all of the input's rows.
+     */
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    /**
+     * Number of runs spilled to disk by open (0 if the rows all fit in memory).
+     */
+    uint get_run_count() const { return this->run_count; }
+
+protected:
+    EvalIterator *input;
+    const SortSpec &sort;
+    size_t memory_budget;
+    std::vector<std::pair<KeyBytes, ValueDict *>> rows;  // held in memory, with their sort keys
+    size_t at;  // the next one to give, once they're sorted
+    RunMerge *merge;  // of the spilled runs (null if there are none)
+    uint run_count;
+
+    void sort_rows();
+
+    SpillFile *spill_rows();
+
+    std::vector<SpillFile *> merge_pass(const std::vector<SpillFile *> &runs);
+
+    void clear_rows();
+};
+
+/**
+ * @class TopNIterator - the first few rows of its input in sort order (an ORDER BY with a LIMIT), without sorting the
+ * rest of them
+ *
+ * Only the limit + offset rows that sort first so far are held, in a max-heap by sort_key (and then by input order,
+ * so rows that sort the same keep it, the way SortIterator does): each new row just has to be compared with the
+ * heap's top, and if it's smaller it takes the top's place. That's at most MAX_ROWS of them, beyond which a full sort
+ * (that can spill to disk) is the better plan.
+ */
+class TopNIterator : public EvalIterator {
+public:
+    static const size_t MAX_ROWS = 64 * 1024;
+
+    /**
+     * @param input  the rows to pick from (freed by this iterator)
+     * @param sort   what to sort them by (has to outlive the iterator)
+     * @param limit  which of the sorted rows to give (has to outlive the iterator)
+     */
+    TopNIterator(EvalIterator *input, const SortSpec &sort, const LimitSpec &limit);
+
+    virtual ~TopNIterator();
+
+    /**
+     * Reads all of the input's rows, keeping the first limit + offset of them in sort order.
+     */
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+protected:
+    struct Entry {
+        KeyBytes key;
+        uint64_t sequence;  // in the input
+        ValueDict *row;
+    };
+
+    EvalIterator *input;
+    const SortSpec &sort;
+    const LimitSpec &limit;
+    std::vector<Entry> heap;  // then, once they're all read, the rows in sort order
+    size_t at;  // the next one to give
+
+    static bool less(const Entry &a, const Entry &b);
+
+    void clear_rows();
+};
+
+/**
+ * @class LimitIterator - limit of its input's rows, after skipping the first offset of them
+ *
+ * The input is closed as soon as the last row is given, so a scan under it (or the workers of a vectorized one) stops
+ * there rather than reading the rest of the table.
+ */
+class LimitIterator : public EvalIterator {
+public:
+    /**
+     * @param input  the rows to limit (freed by this iterator)
+     * @param limit  which of them to give (has to outlive the iterator)
+     */
+    LimitIterator(EvalIterator *input, const LimitSpec &limit);
+
+    virtual ~LimitIterator();
+
+    /**
+     * Opens the input and skips its first offset rows.
+     */
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+protected:
+    EvalIterator *input;
+    const LimitSpec &limit;
+    size_t count;  // rows given so far
+    bool done;  // once the input is closed (or ran out)
+};
+
+bool test_sorts();
+
+void benchmark_sorts();
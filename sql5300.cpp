@@ -11,6 +11,14 @@
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
 #include "btree.h"
+#include "hash_index.h"
+#include "bloom_index.h"
+#include "bitmap_index.h"
+#include "art_index.h"
+#include "EvalPlan.h"
+#include "joins.h"
+#include "sorts.h"
+#include "aggregates.h"
 
 using namespace std;
 using namespace hsql;
@@ -46,10 +54,36 @@ int main(int argc, char *argv[]) {
         if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
             cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+            cout << "test_hash_index: " << (test_hash_index() ? "ok" : "failed") << endl;
+            cout << "test_bloom_index: " << (test_bloom_index() ? "ok" : "failed") << endl;
+            cout << "test_bitmap_index: " << (test_bitmap_index() ? "ok" : "failed") << endl;
+            cout << "test_art_index: " << (test_art_index() ? "ok" : "failed") << endl;
+            cout << "test_eval_plan: " << (test_eval_plan() ? "ok" : "failed") << endl;
+            cout << "test_joins: " << (test_joins() ? "ok" : "failed") << endl;
+            cout << "test_sorts: " << (test_sorts() ? "ok" : "failed") << endl;
+            cout << "test_aggregates: " << (test_aggregates() ? "ok" : "failed") << endl;
+            continue;
+        }
+        if (query.compare(0, 8, "workers ") == 0) {  // most threads to run one query on
+            EvalPlan::set_max_workers((uint) atoi(query.c_str() + 8));
+            cout << "max workers: " << EvalPlan::get_max_workers() << endl;
+            continue;
+        }
+        if (query == "benchmark") {
+            benchmark_btree();
+            benchmark_hash_index();
+            benchmark_bloom_index();
+            benchmark_bitmap_index();
+            benchmark_art_index();
+            benchmark_eval_plan();
+            benchmark_joins();
+            benchmark_sorts();
+            benchmark_aggregates();
             continue;
         }
 
         // parse and execute
+        vector<ColumnNames *> includes = SQLExec::extract_include(query);  // our extension to CREATE INDEX
         SQLParserResult *parse = SQLParser::parseSQLString(query);
         if (!parse->isValid()) {
             cout << "invalid SQL: " << query << endl;
@@ -59,8 +93,13 @@ int main(int argc, char *argv[]) {
                 const SQLStatement *statement = parse->getStatement(i);
                 try {
                     cout << ParseTreeToString::statement(statement) << endl;
-                    QueryResult *result = SQLExec::execute(statement);
-                    cout << *result << endl;
+                    QueryResult *result = SQLExec::execute(statement, i < includes.size() ? includes[i] : nullptr);
+                    try {
+                        cout << *result << endl;  // a select's rows are only read now
+                    } catch (DbRelationError &e) {
+                        delete result;
+                        throw SQLExecError(string("DbRelationError: ") + e.what());
+                    }
                     delete result;
                 } catch (SQLExecError &e) {
                     cout << "Error: " << e.what() << endl;
@@ -68,6 +107,8 @@ int main(int argc, char *argv[]) {
             }
         }
         delete parse;
+        for (auto const &include: includes)
+            delete include;
     }
     return EXIT_SUCCESS;
 }
@@ -81,7 +122,7 @@ void initialize_environment(char *envHome) {
     env->set_message_stream(&cout);
     env->set_error_stream(&cerr);
     try {
-        env->open(envHome, DB_CREATE | DB_INIT_MPOOL, 0);
+        env->open(envHome, DB_CREATE | DB_INIT_MPOOL | DB_THREAD, 0);
     } catch (DbException &exc) {
         cerr << "(sql5300: " << exc.what() << ")" << endl;
         exit(1);
@@ -5,13 +5,14 @@
  */
 #include <algorithm>
 #include "storage_engine.h"
+#include "ColumnBatch.h"
 
 bool Value::operator==(const Value &other) const {
     if (this->data_type != other.data_type)
         return false;
-    if (this->data_type == ColumnAttribute::INT)
-        return this->n == other.n;
-    return this->s == other.s;
+    if (this->data_type == ColumnAttribute::TEXT)
+        return this->s == other.s;
+    return this->n == other.n;  // INT or BOOLEAN
 }
 
 bool Value::operator!=(const Value &other) const {
@@ -88,6 +89,20 @@ ValueDicts *DbRelation::project(Handles *handles, const ColumnNames *column_name
     return ret;
 }
 
+// Add a page's rows to a batch by projecting them one at a time
+bool DbRelation::select_page(uint page, ColumnBatch &batch) {
+    Handles *handles = select_page(page);
+    if (handles == nullptr)
+        return false;
+    for (auto const &handle: *handles) {
+        ValueDict *row = project(handle, &batch.get_column_names());
+        batch.append(handle, *row);
+        delete row;
+    }
+    delete handles;
+    return true;
+}
+
 // Do a projection for each of a list of handles
 ValueDicts *DbRelation::project(Handles *handles, const ValueDict *where) {
     ColumnNames t;
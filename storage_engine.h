@@ -263,6 +263,8 @@ typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict *> ValueDicts;
 
 
+class ColumnBatch;
+
 /**
  * @class DbRelationError - generic exception class for DbRelation
  */
@@ -374,6 +376,30 @@ public:
      */
     virtual Handles *select(Handles *current_selection, const ValueDict *where) = 0;
 
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE 1, but just one page of the relation at a time,
+     * so that a scan only has to hold that page's handles.
+     * @param page  which page, counting from 1 (some pages may have no rows)
+     * @returns     a pointer to a list of handles for the rows on page (freed by caller), or nullptr past the end
+     */
+    virtual Handles *select_page(uint page) {
+        return page == 1 ? select() : nullptr;  // by default, just the one page
+    }
+
+    /**
+     * Add the rows of one page to the end of batch, the way a vectorized scan reads them: just the batch's columns,
+     * straight into its column vectors.
+     * @param page   which page, counting from 1
+     * @param batch  where to put them (with room for ColumnBatch::MAX_PAGE_ROWS more)
+     * @returns      false past the end
+     */
+    virtual bool select_page(uint page, ColumnBatch &batch);
+
+    /**
+     * Number of pages select_page has (now), so that a parallel scan can split them up ahead of time.
+     */
+    virtual uint get_page_count() { return 1; }
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -454,10 +480,9 @@ public:
     static const uint MAX_COMPOSITE = 32U;
 
     // ctor/dtor
-    DbIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : relation(relation),
-                                                                                           name(name),
-                                                                                           key_columns(key_columns),
-                                                                                           unique(unique) {}
+    DbIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+            ColumnNames include_columns = ColumnNames()) : relation(relation), name(name), key_columns(key_columns),
+                                                          unique(unique), include_columns(include_columns) {}
 
     virtual ~DbIndex() {}
 
@@ -488,6 +513,19 @@ public:
      */
     virtual Handles *lookup(ValueDict *key_values) const = 0;
 
+    /**
+     * Lookup several search keys at once, e.g., for the probes of a join. An index that can find nearby keys
+     * together (a B-tree's keys in the same leaf, say) does less work than with a lookup for each.
+     * @param keys  dictionaries of values for the search keys
+     * @returns     list of handles for each of keys, in the same order (all freed by caller)
+     */
+    virtual std::vector<Handles *> *lookup_batch(const ValueDicts &keys) const {
+        std::vector<Handles *> *found = new std::vector<Handles *>();
+        for (auto const &key: keys)
+            found->push_back(lookup(key));
+        return found;
+    }
+
     /**
      * Lookup a range of search keys.
      * @param min_key  dictionary of min (inclusive) search key
@@ -498,6 +536,25 @@ public:
         throw DbRelationError("range index query not supported");
     }
 
+    /**
+     * Check if lookup finds rows faster than scanning the relation for them (not so for an index that can only rule
+     * rows out, like a Bloom filter), so the query planner can use it to find the rows of a select.
+     * @returns  true if lookup is worth calling instead of a table scan
+     */
+    virtual bool supports_lookup() const {
+        return true;
+    }
+
+    /**
+     * Check if range is implemented, with the semantics of an ordered index: either end can give just the leading
+     * key columns, and a key starting with max_key counts as within it (so range(k, k) finds every key starting
+     * with k).
+     * @returns  true if range can be called
+     */
+    virtual bool supports_range() const {
+        return false;
+    }
+
     /**
      * Insert the index entry for the given record.
      * @param record  handle (into relation) to the record to insert
@@ -505,6 +562,17 @@ public:
      */
     virtual void insert(Handle record) = 0;
 
+    /**
+     * Insert the index entry for the given record when the caller already has its values, so the index doesn't
+     * have to read them back from the relation.
+     * @param record  handle (into relation) to the record to insert
+     *                (must be in the relation at time of insertion)
+     * @param row     the record's values (at least the ones the index stores)
+     */
+    virtual void insert(Handle record, const ValueDict *row) {
+        insert(record);
+    }
+
     /**
      * Delete the index entry for the given record.
      * @param record  handle (into relation) to the record to remove
@@ -512,11 +580,56 @@ public:
      */
     virtual void del(Handle record) = 0;
 
+    /**
+     * Check if every one of column_names is stored in the index (as a key or included column), so that a query
+     * using only those columns can be answered by lookup_values without going to the relation.
+     * @param column_names  columns the query needs
+     * @returns             true if lookup_values has them all
+     */
+    virtual bool covers(const ColumnNames &column_names) const {
+        return false;
+    }
+
+    /**
+     * Lookup a specific search key, getting the values straight from the index instead of the relation.
+     * @param key_values  dictionary of values for the search key
+     * @returns           the key and included columns of each record with key_values (freed by caller)
+     */
+    virtual ValueDicts *lookup_values(ValueDict *key_values) const {
+        throw DbRelationError("index-only lookup not supported");
+    }
+
+    /**
+     * Check whether any record could have key_values without looking for it, e.g., with a Bloom filter.
+     * @param key_values  dictionary of values for the whole search key
+     * @returns           false only if there definitely isn't one
+     */
+    virtual bool might_contain(const ValueDict *key_values) const {
+        return true;
+    }
+
+    /**
+     * Accessor for key_columns.
+     * @returns  list of the columns in the search key, in order
+     */
+    virtual const ColumnNames &get_key_columns() const {
+        return key_columns;
+    }
+
+    /**
+     * Accessor for include_columns.
+     * @returns  list of the non-key columns also stored in the index, in order
+     */
+    virtual const ColumnNames &get_include_columns() const {
+        return include_columns;
+    }
+
 protected:
     DbRelation &relation;
     Identifier name;
     ColumnNames key_columns;
     bool unique;
+    ColumnNames include_columns;  // non-key columns also stored in the index (for a covering index)
 };
 
 